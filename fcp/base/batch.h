@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FCP_BASE_BATCH_H_
+#define FCP_BASE_BATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace fcp {
+
+/**
+ * Reads a batch of elements by calling next (a callable returning
+ * absl::StatusOr<std::string>) repeatedly, until the batch holds max_count
+ * elements, or at least max_bytes bytes (but always at least one element).
+ *
+ * Reaching the end of the data (OUT_OF_RANGE) ends the batch early, and is
+ * only returned if the batch is empty, so that the caller sees it on the next
+ * call. Any other error is returned right away, dropping the elements read so
+ * far.
+ */
+template <typename NextFn>
+absl::StatusOr<std::vector<std::string>> ReadBatch(NextFn&& next,
+                                                   int max_count,
+                                                   int64_t max_bytes) {
+  std::vector<std::string> batch;
+  int64_t batch_bytes = 0;
+  while (static_cast<int>(batch.size()) < max_count &&
+         (batch.empty() || batch_bytes < max_bytes)) {
+    absl::StatusOr<std::string> element = next();
+    if (!element.ok()) {
+      if (element.status().code() == absl::StatusCode::kOutOfRange &&
+          !batch.empty()) {
+        break;
+      }
+      return element.status();
+    }
+    batch_bytes += element->size();
+    batch.push_back(std::move(element).value());
+  }
+  return batch;
+}
+
+/**
+ * Writes each element of the batch, in order, to a buffer of the element's
+ * size obtained from allocate. This is the default way for iterators to
+ * implement a batched "Into" read on top of one returning a batch of strings.
+ */
+inline void WriteBatchInto(const std::vector<std::string>& batch,
+                           const std::function<char*(size_t size)>& allocate) {
+  for (const std::string& element : batch) {
+    char* buffer = allocate(element.size());
+    if (!element.empty()) {
+      std::memcpy(buffer, element.data(), element.size());
+    }
+  }
+}
+
+}  // namespace fcp
+
+#endif  // FCP_BASE_BATCH_H_
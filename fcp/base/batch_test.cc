@@ -0,0 +1,72 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fcp/base/batch.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace fcp {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Returns a callable producing the given elements, followed by `end`.
+auto ElementsThen(std::vector<std::string> elements, absl::Status end) {
+  return [elements = std::move(elements), end, i = size_t{0}]() mutable
+         -> absl::StatusOr<std::string> {
+    if (i < elements.size()) return elements[i++];
+    return end;
+  };
+}
+
+TEST(ReadBatchTest, StopsAtMaxCount) {
+  auto next = ElementsThen({"a", "b", "c"}, absl::OutOfRangeError(""));
+  absl::StatusOr<std::vector<std::string>> batch =
+      ReadBatch(next, /*max_count=*/2, /*max_bytes=*/100);
+  ASSERT_TRUE(batch.ok());
+  EXPECT_THAT(*batch, ElementsAre("a", "b"));
+  batch = ReadBatch(next, /*max_count=*/2, /*max_bytes=*/100);
+  ASSERT_TRUE(batch.ok());
+  EXPECT_THAT(*batch, ElementsAre("c"));
+  EXPECT_EQ(ReadBatch(next, /*max_count=*/2, /*max_bytes=*/100).status().code(),
+            absl::StatusCode::kOutOfRange);
+}
+
+TEST(ReadBatchTest, StopsAtMaxBytesButReturnsAtLeastOneElement) {
+  auto next = ElementsThen({"aa", "bb", "cccc"}, absl::OutOfRangeError(""));
+  absl::StatusOr<std::vector<std::string>> batch =
+      ReadBatch(next, /*max_count=*/10, /*max_bytes=*/3);
+  ASSERT_TRUE(batch.ok());
+  EXPECT_THAT(*batch, ElementsAre("aa", "bb"));
+  batch = ReadBatch(next, /*max_count=*/10, /*max_bytes=*/1);
+  ASSERT_TRUE(batch.ok());
+  EXPECT_THAT(*batch, ElementsAre("cccc"));
+}
+
+TEST(ReadBatchTest, ReturnsOtherErrorsRightAway) {
+  auto next = ElementsThen({"a"}, absl::InternalError("failed"));
+  EXPECT_EQ(ReadBatch(next, /*max_count=*/2, /*max_bytes=*/100).status().code(),
+            absl::StatusCode::kInternal);
+}
+
+}  // namespace
+}  // namespace fcp
@@ -23,11 +23,16 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <utility>
 
 #include "absl/status/status.h"
 
 #ifdef _WIN32
 #include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include "absl/strings/str_cat.h"
@@ -83,6 +88,55 @@ absl::StatusOr<absl::Cord> ReadFileToCord(absl::string_view file_name) {
   return internal::ReadFile<absl::Cord>(file_name);
 }
 
+absl::StatusOr<absl::Cord> MapFileToCord(absl::string_view file_name) {
+#ifdef _WIN32
+  return ReadFileToCord(file_name);
+#else
+  auto file_name_str = std::string(file_name);
+  int fd = open(file_name_str.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("cannot read file ", file_name_str));
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return absl::InternalError(
+        absl::StrCat("error reading file ", file_name_str));
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  // Mapping (and unmapping) a small file costs more than copying it, and
+  // empty files can't be mapped at all.
+  constexpr size_t kMinMappedFileSize = 64 * 1024;
+  if (size < kMinMappedFileSize) {
+    std::string contents(size, '\0');
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+      ssize_t result = pread(fd, contents.data() + bytes_read,
+                             size - bytes_read, bytes_read);
+      if (result <= 0) break;
+      bytes_read += result;
+    }
+    close(fd);
+    if (bytes_read < size) {
+      return absl::InternalError(
+          absl::StrCat("error reading file ", file_name_str));
+    }
+    return absl::Cord(std::move(contents));
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping remains valid after the file is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return absl::InternalError(
+        absl::StrCat("cannot map file ", file_name_str));
+  }
+  return absl::MakeCordFromExternal(
+      absl::string_view(static_cast<const char*>(data), size),
+      [data, size](absl::string_view) { munmap(data, size); });
+#endif
+}
+
 absl::Status WriteStringToFile(absl::string_view file_name,
                                absl::string_view content) {
   auto file_name_str = std::string(file_name);
@@ -49,6 +49,16 @@ absl::StatusOr<std::string> ReadFileToString(absl::string_view file_name);
  */
 absl::StatusOr<absl::Cord> ReadFileToCord(absl::string_view file_name);
 
+/**
+ * Maps file content read-only into memory, and returns it as an absl::Cord
+ * referencing the mapping (which is released along with the last copy of the
+ * Cord). The content is paged in lazily and shared with the page cache, rather
+ * than copied onto the heap. The file must not be modified in place while the
+ * Cord is alive (replacing or deleting it is fine). Small files are simply
+ * read instead. Falls back to ReadFileToCord on platforms without mmap.
+ */
+absl::StatusOr<absl::Cord> MapFileToCord(absl::string_view file_name);
+
 /**
  * Reads file content into message.
  */
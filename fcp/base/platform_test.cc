@@ -16,6 +16,9 @@
 
 #include "fcp/base/platform.h"
 
+#include <cstdio>
+#include <string>
+
 #include "gtest/gtest.h"
 #include "absl/strings/cord.h"
 #include "fcp/base/monitoring.h"
@@ -63,6 +66,35 @@ TEST(PlatformTest, ReadWriteCord) {
   ASSERT_EQ(status_or_cord.value(), "Ein Text");
 }
 
+TEST(PlatformTest, MapFileToCord) {
+  auto file = TemporaryTestFile(".dat");
+  ASSERT_EQ(WriteStringToFile(file, "Ein Text").code(), OK);
+  auto status_or_cord = MapFileToCord(file);
+  ASSERT_TRUE(status_or_cord.ok()) << status_or_cord.status();
+  // The mapping outlives the file.
+  ASSERT_EQ(std::remove(file.c_str()), 0);
+  ASSERT_EQ(status_or_cord.value(), "Ein Text");
+}
+
+TEST(PlatformTest, MapLargeFileToCord) {
+  auto file = TemporaryTestFile(".dat");
+  std::string content(1024 * 1024, 'x');
+  content.back() = 'y';
+  ASSERT_EQ(WriteStringToFile(file, content).code(), OK);
+  auto status_or_cord = MapFileToCord(file);
+  ASSERT_TRUE(status_or_cord.ok()) << status_or_cord.status();
+  ASSERT_EQ(std::remove(file.c_str()), 0);
+  ASSERT_EQ(status_or_cord.value(), content);
+}
+
+TEST(PlatformTest, MapEmptyFileToCord) {
+  auto file = TemporaryTestFile(".dat");
+  ASSERT_EQ(WriteStringToFile(file, "").code(), OK);
+  auto status_or_cord = MapFileToCord(file);
+  ASSERT_TRUE(status_or_cord.ok()) << status_or_cord.status();
+  ASSERT_TRUE(status_or_cord.value().empty());
+}
+
 TEST(PlatformTest, ReadStringFails) {
   ASSERT_FALSE(ReadFileToString("foobarbaz").ok());
 }
@@ -71,6 +103,10 @@ TEST(PlatformTest, ReadCordFails) {
   ASSERT_FALSE(ReadFileToCord("foobarbaz").ok());
 }
 
+TEST(PlatformTest, MapFileToCordFails) {
+  ASSERT_FALSE(MapFileToCord("foobarbaz").ok());
+}
+
 TEST(PlatformTest, BaseName) {
   ASSERT_EQ(BaseName(ConcatPath("foo", "bar.x")), "bar.x");
 }
@@ -42,6 +42,10 @@ class TimeUtil {
   // will lead to undefined behavior.
   static google::protobuf::Duration ConvertAbslToProtoDuration(
       absl::Duration absl_duration);
+
+  // Converts a google::protobuf::Duration to an absl::Duration.
+  static absl::Duration ConvertProtoToAbslDuration(
+      google::protobuf::Duration proto);
 };
 
 }  // namespace fcp
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/abort_signal.h"
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace fcp {
+namespace client {
+
+void AbortSignal::Abort() {
+  absl::MutexLock lock(&mutex_);
+  if (aborted_) return;
+  aborted_ = true;
+  for (const auto& [id, listener] : listeners_) {
+    listener();
+  }
+}
+
+void AbortSignal::Reset() {
+  absl::MutexLock lock(&mutex_);
+  aborted_ = false;
+}
+
+bool AbortSignal::IsAborted() const {
+  absl::MutexLock lock(&mutex_);
+  return aborted_;
+}
+
+int64_t AbortSignal::AddListener(std::function<void()> listener) {
+  absl::MutexLock lock(&mutex_);
+  if (aborted_) {
+    listener();
+  }
+  int64_t id = next_listener_id_++;
+  listeners_.emplace(id, std::move(listener));
+  return id;
+}
+
+void AbortSignal::RemoveListener(int64_t listener_id) {
+  absl::MutexLock lock(&mutex_);
+  listeners_.erase(listener_id);
+}
+
+}  // namespace client
+}  // namespace fcp
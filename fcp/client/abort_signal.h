@@ -0,0 +1,72 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_ABORT_SIGNAL_H_
+#define FCP_CLIENT_ABORT_SIGNAL_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace fcp {
+namespace client {
+
+// A channel through which an environment pushes the news that ongoing
+// operations should be aborted (e.g. because the device is no longer idle), as
+// an alternative to having the environment's conditions polled periodically.
+//
+// Once aborted, the signal stays aborted until it is reset, so that operations
+// started afterwards are aborted right away as well. The environment should
+// reset it once the conditions are satisfied again.
+//
+// This class is thread-safe.
+class AbortSignal {
+ public:
+  AbortSignal() = default;
+
+  AbortSignal(const AbortSignal&) = delete;
+  AbortSignal& operator=(const AbortSignal&) = delete;
+
+  // Marks the signal as aborted, and calls all listeners if it wasn't already.
+  void Abort();
+
+  // Marks the signal as no longer aborted.
+  void Reset();
+
+  // Whether `Abort` was called since the signal was last reset.
+  bool IsAborted() const;
+
+  // Has `listener` called whenever the signal gets aborted, or right away if
+  // it already is, until `RemoveListener` is called with the returned id. The
+  // listener is called on the aborting thread while the signal is locked, so
+  // it must return quickly and must not use the signal. Once `RemoveListener`
+  // returns, the listener is guaranteed to not be running anymore.
+  int64_t AddListener(std::function<void()> listener);
+  void RemoveListener(int64_t listener_id);
+
+ private:
+  mutable absl::Mutex mutex_;
+  bool aborted_ ABSL_GUARDED_BY(mutex_) = false;
+  int64_t next_listener_id_ ABSL_GUARDED_BY(mutex_) = 0;
+  std::map<int64_t, std::function<void()>> listeners_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_ABORT_SIGNAL_H_
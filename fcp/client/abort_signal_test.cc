@@ -0,0 +1,66 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/abort_signal.h"
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+namespace fcp {
+namespace client {
+namespace {
+
+TEST(AbortSignalTest, AbortAndReset) {
+  AbortSignal abort_signal;
+  EXPECT_FALSE(abort_signal.IsAborted());
+  abort_signal.Abort();
+  EXPECT_TRUE(abort_signal.IsAborted());
+  abort_signal.Reset();
+  EXPECT_FALSE(abort_signal.IsAborted());
+}
+
+TEST(AbortSignalTest, CallsListenersOncePerAbort) {
+  AbortSignal abort_signal;
+  int first_calls = 0;
+  int second_calls = 0;
+  int64_t first_id =
+      abort_signal.AddListener([&first_calls]() { first_calls++; });
+  abort_signal.AddListener([&second_calls]() { second_calls++; });
+
+  abort_signal.Abort();
+  abort_signal.Abort();
+  EXPECT_EQ(first_calls, 1);
+  EXPECT_EQ(second_calls, 1);
+
+  // Removed listeners aren't called anymore.
+  abort_signal.RemoveListener(first_id);
+  abort_signal.Reset();
+  abort_signal.Abort();
+  EXPECT_EQ(first_calls, 1);
+  EXPECT_EQ(second_calls, 2);
+}
+
+TEST(AbortSignalTest, CallsListenerAddedAfterAbort) {
+  AbortSignal abort_signal;
+  abort_signal.Abort();
+  int calls = 0;
+  abort_signal.AddListener([&calls]() { calls++; });
+  EXPECT_EQ(calls, 1);
+}
+
+}  // namespace
+}  // namespace client
+}  // namespace fcp
@@ -16,6 +16,9 @@
 
 #include "fcp/client/cache/file_backed_resource_cache.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cstdint>
 #include <filesystem>
@@ -32,16 +35,23 @@
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/timestamp.pb.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/platform.h"
 #include "fcp/base/time_util.h"
 #include "fcp/client/cache/cache_manifest.pb.h"
+#include "fcp/client/cord_utils.h"
 #include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/histogram_counters.pb.h"
+#include "fcp/client/journal_file.h"
 #include "protostore/file-storage.h"
 #include "protostore/proto-data-store.h"
 
@@ -50,9 +60,129 @@ namespace client {
 namespace cache {
 
 constexpr absl::string_view kCacheManifestFileName = "cache_manifest.pb";
+constexpr absl::string_view kCacheManifestJournalFileName =
+    "cache_manifest.journal";
 constexpr absl::string_view kParentDir = "fcp";
 // Cached files will be saved in <cache directory>/fcp/cache.
 constexpr absl::string_view kCacheDir = "cache";
+// The kind of the journal records, whose payload is a serialized
+// CacheManifestUpdate. The journal header is the fingerprint of the manifest
+// the journal applies to.
+constexpr char kJournalManifestUpdate = 2;
+// The maximum number of changes that are buffered before they are appended to
+// the journal.
+constexpr int kMaxPendingUpdates = 32;
+// The journal is only compacted into the manifest once it is larger than both
+// this and the manifest itself.
+constexpr int64_t kMinJournalSizeForCompaction = 64 * 1024;
+// Resource files are written under a temporary name (the final name plus this
+// suffix), and only renamed once they are durable.
+constexpr absl::string_view kTempFileSuffix = ".tmp";
+// Resource files are written in blocks of at least this size (unless the
+// resource is smaller), coalescing the chunks of the resource Cord.
+constexpr size_t kWriteBlockSize = 1024 * 1024;
+// The cost of re-fetching a resource beyond downloading its bytes (i.e. of the
+// request round trip), expressed in bytes, used to weigh evictions.
+constexpr double kRefetchOverheadBytes = 64 * 1024;
+
+namespace {
+
+// Returns the name of the file holding a resource with the given contents.
+std::string GetResourceFileName(const absl::Cord& resource) {
+  return absl::BytesToHexString(ComputeSHA256FromStringOrCord(resource));
+}
+
+// Writes all of `data` to the file descriptor.
+absl::Status WriteFully(int fd, absl::string_view data) {
+  while (!data.empty()) {
+    ssize_t result = write(fd, data.data(), data.size());
+    if (result <= 0) {
+      return absl::InternalError("Failed to write resource file.");
+    }
+    data.remove_prefix(result);
+  }
+  return absl::OkStatus();
+}
+
+// Writes `contents` to `temp_path` using large sequential writes, syncs it to
+// disk, and then atomically renames it to `path`, so that a file at `path` is
+// always complete.
+absl::Status WriteFileDurably(const std::filesystem::path& temp_path,
+                              const std::filesystem::path& path,
+                              const absl::Cord& contents) {
+  int fd = open(temp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("Failed to create file: ", temp_path.string()));
+  }
+  absl::Status status = absl::OkStatus();
+  std::string buffer;
+  for (absl::string_view chunk : contents.Chunks()) {
+    if (!status.ok()) break;
+    if (buffer.size() + chunk.size() <= kWriteBlockSize) {
+      buffer.append(chunk.data(), chunk.size());
+      continue;
+    }
+    status = WriteFully(fd, buffer);
+    buffer.clear();
+    if (status.ok() && chunk.size() >= kWriteBlockSize) {
+      status = WriteFully(fd, chunk);
+    } else {
+      buffer.append(chunk.data(), chunk.size());
+    }
+  }
+  if (status.ok()) status = WriteFully(fd, buffer);
+  if (status.ok() && fsync(fd) != 0) {
+    status = absl::InternalError("Failed to sync resource file.");
+  }
+  close(fd);
+  if (status.ok() && rename(temp_path.c_str(), path.c_str()) != 0) {
+    status = absl::InternalError(
+        absl::StrCat("Failed to rename file: ", temp_path.string()));
+  }
+  if (!status.ok()) {
+    std::error_code remove_error;
+    std::filesystem::remove(temp_path, remove_error);
+    return status;
+  }
+  // Make the rename itself durable.
+  int dir_fd = open(path.parent_path().c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return absl::OkStatus();
+}
+
+// Returns how valuable it is to keep a cached file, per byte it takes up: how
+// often its resources are expected to be needed again, times the cost of
+// re-fetching them, divided by the size of the file. The former is estimated
+// by the number of times the resources were accessed, divided by the time
+// since they were last accessed (plus a minute, so that entries accessed at
+// the same time are still ranked by frequency). The files with the lowest
+// value are evicted first.
+double GetRetentionValue(int64_t access_count, absl::Duration since_last_access,
+                         uintmax_t size) {
+  double minutes_since_last_access = absl::ToDoubleMinutes(
+      std::max(since_last_access, absl::ZeroDuration()));
+  double expected_accesses =
+      static_cast<double>(std::max<int64_t>(access_count, 1)) /
+      (minutes_since_last_access + 1);
+  double size_bytes = static_cast<double>(std::max<uintmax_t>(size, 1));
+  return expected_accesses * (kRefetchOverheadBytes + size_bytes) / size_bytes;
+}
+
+// Returns true if any entry in the manifest refers to the given file.
+bool IsFileReferenced(const CacheManifest& manifest,
+                      const std::string& file_name) {
+  for (const auto& [id, resource] : manifest.cache()) {
+    if (resource.file_name() == file_name) return true;
+  }
+  return false;
+}
+
+}  // anonymous namespace
 
 absl::StatusOr<CacheManifest> FileBackedResourceCache::ReadInternal() {
   absl::StatusOr<const CacheManifest*> data = pds_->Read();
@@ -74,6 +204,63 @@ absl::Status FileBackedResourceCache::WriteInternal(
   return status;
 }
 
+absl::Status FileBackedResourceCache::WriteManifestLocked() {
+  auto manifest = std::make_unique<CacheManifest>(manifest_);
+  // Entries whose file is still being written are only persisted once the file
+  // is durable (see `WritePendingFile`).
+  if (!pending_files_.empty()) {
+    for (auto it = manifest->mutable_cache()->begin();
+         it != manifest->mutable_cache()->end();) {
+      if (pending_files_.contains(it->second.file_name())) {
+        it = manifest->mutable_cache()->erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  manifest_size_bytes_ = manifest->ByteSizeLong();
+  FCP_RETURN_IF_ERROR(WriteInternal(std::move(manifest)));
+  // The buffered changes are part of the manifest that was just written.
+  pending_updates_.clear();
+  num_pending_updates_ = 0;
+  absl::StatusOr<std::string> fingerprint =
+      GetFileFingerprint(manifest_path_.string());
+  absl::Status status =
+      fingerprint.ok() ? journal_.Reset(*fingerprint) : fingerprint.status();
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MANIFEST_WRITE_FAILED);
+  }
+  return status;
+}
+
+void FileBackedResourceCache::RecordUpdateLocked(
+    const std::string& cache_id, const CachedResource* resource) {
+  CacheManifestUpdate update;
+  update.set_cache_id(cache_id);
+  if (resource != nullptr) *update.mutable_resource() = *resource;
+  pending_updates_.append(JournalFile::EncodeRecord(
+      kJournalManifestUpdate, update.SerializeAsString()));
+  num_pending_updates_++;
+}
+
+absl::Status FileBackedResourceCache::FlushUpdatesLocked() {
+  if (num_pending_updates_ == 0) return absl::OkStatus();
+  absl::Status status = journal_.AppendEncoded(pending_updates_);
+  pending_updates_.clear();
+  num_pending_updates_ = 0;
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MANIFEST_WRITE_FAILED);
+    // The changes are still applied to the in-memory manifest, so persist them
+    // by rewriting the whole manifest instead.
+    return WriteManifestLocked();
+  }
+  if (journal_.size_bytes() >
+      std::max(kMinJournalSizeForCompaction, manifest_size_bytes_)) {
+    return WriteManifestLocked();
+  }
+  return absl::OkStatus();
+}
+
 absl::StatusOr<std::unique_ptr<FileBackedResourceCache>>
 FileBackedResourceCache::Create(absl::string_view base_dir,
                                 absl::string_view cache_dir,
@@ -108,6 +295,8 @@ FileBackedResourceCache::Create(absl::string_view base_dir,
     return absl::InternalError(
         absl::StrCat("Failed to create directory ", manifest_path.string()));
   }
+  std::filesystem::path journal_path =
+      manifest_path / kCacheManifestJournalFileName;
   manifest_path /= kCacheManifestFileName;
 
   auto file_storage = std::make_unique<protostore::FileStorage>();
@@ -116,81 +305,167 @@ FileBackedResourceCache::Create(absl::string_view base_dir,
   std::unique_ptr<FileBackedResourceCache> resource_cache =
       absl::WrapUnique(new FileBackedResourceCache(
           std::move(pds), std::move(file_storage), cache_dir_path,
-          manifest_path, log_manager, clock, max_cache_size_bytes));
+          manifest_path, journal_path, log_manager, clock,
+          max_cache_size_bytes));
 
   FCP_RETURN_IF_ERROR(resource_cache->Initialize());
 
   return resource_cache;
 }
 
+FileBackedResourceCache::~FileBackedResourceCache() {
+  WaitForPendingWrites();
+  absl::MutexLock lock(&mutex_);
+  // Any failure has already been logged, and can't be acted upon anymore.
+  FlushUpdatesLocked().IgnoreError();
+}
+
 absl::Status FileBackedResourceCache::Put(absl::string_view cache_id,
                                           const absl::Cord& resource,
                                           const google::protobuf::Any& metadata,
                                           absl::Duration max_age) {
-  absl::MutexLock lock(&mutex_);
-
   if (resource.size() > max_cache_size_bytes_ / 2) {
     return absl::ResourceExhaustedError(absl::StrCat(cache_id, " too large"));
   }
 
-  FCP_ASSIGN_OR_RETURN(CacheManifest manifest, ReadInternal());
+  // Hashing a large resource takes a while, so do it before taking the lock to
+  // avoid blocking concurrent `Get` calls.
+  const std::string file_name = GetResourceFileName(resource);
+
+  absl::MutexLock lock(&mutex_);
 
-  FCP_RETURN_IF_ERROR(CleanUp(resource.size(), manifest));
+  // If the same contents are already cached (under another cache ID), the file
+  // is shared and no space needs to be reserved for it, unless all the entries
+  // referring to it turn out to have expired.
+  const int num_entries_before_clean_up = manifest_.cache_size();
+  const bool file_referenced = IsFileReferenced(manifest_, file_name);
+  FCP_RETURN_IF_ERROR(
+      CleanUp(file_referenced ? 0 : resource.size(), manifest_));
+  if (file_referenced && !IsFileReferenced(manifest_, file_name)) {
+    FCP_RETURN_IF_ERROR(CleanUp(resource.size(), manifest_));
+  }
+  const bool entries_removed =
+      manifest_.cache_size() < num_entries_before_clean_up;
 
-  std::filesystem::path cached_file_path = cache_dir_path_ / cache_id;
+  std::filesystem::path cached_file_path = cache_dir_path_ / file_name;
   absl::Time now = clock_.Now();
   absl::Time expiry = now + max_age;
   CachedResource cached_resource;
-  cached_resource.set_file_name(std::string(cache_id));
+  cached_resource.set_file_name(file_name);
   *cached_resource.mutable_metadata() = metadata;
   *cached_resource.mutable_expiry_time() =
       TimeUtil::ConvertAbslToProtoTimestamp(expiry);
   *cached_resource.mutable_last_accessed_time() =
       TimeUtil::ConvertAbslToProtoTimestamp(now);
+  cached_resource.set_access_count(1);
+
+  std::string cache_id_string(cache_id);
+  if (manifest_.mutable_cache()
+          ->insert({cache_id_string, cached_resource})
+          .second) {
+    // Write the file in the background if it doesn't exist yet. The entry is
+    // only persisted once the file is durable, but can be read from memory in
+    // the meantime. Existing files are never modified, since they may be
+    // shared with other entries, and may be mapped by `Get`.
+    const bool file_pending = pending_files_.contains(file_name);
+    if (file_pending || std::filesystem::exists(cached_file_path)) {
+      log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_DEDUPLICATED);
+      log_manager_.LogToLongHistogram(
+          HistogramCounters::RESOURCE_CACHE_DEDUPLICATED_BYTES,
+          resource.size());
+      if (!file_pending) RecordUpdateLocked(cache_id_string, &cached_resource);
+    } else {
+      pending_files_.emplace(file_name, resource);
+      if (writer_ == nullptr) {
+        writer_ = CreateThreadPoolScheduler(1);
+      }
+      writer_->Schedule([this, file_name]() { WritePendingFile(file_name); });
+    }
+  }
 
-  // Write the manifest back to disk before we write the file.
-  manifest.mutable_cache()->insert({std::string(cache_id), cached_resource});
+  // Removed entries aren't journaled, so the whole manifest is rewritten in
+  // that case.
+  return entries_removed ? WriteManifestLocked() : FlushUpdatesLocked();
+}
+
+void FileBackedResourceCache::WritePendingFile(const std::string& file_name) {
+  absl::Cord contents;
+  {
+    absl::MutexLock lock(&mutex_);
+    contents = pending_files_.at(file_name);
+  }
+  std::filesystem::path cached_file_path = cache_dir_path_ / file_name;
+  std::filesystem::path temp_file_path =
+      cache_dir_path_ / absl::StrCat(file_name, kTempFileSuffix);
   absl::Status status =
-      WriteInternal(std::make_unique<CacheManifest>(std::move(manifest)));
-
-  // Write file if it doesn't exist.
-  if (!std::filesystem::exists(cached_file_path)) {
-    auto status = WriteCordToFile(cached_file_path.string(), resource);
-    if (!status.ok()) {
-      log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_WRITE_FAILED);
-      return status;
+      WriteFileDurably(temp_file_path, cached_file_path, contents);
+
+  absl::MutexLock lock(&mutex_);
+  pending_files_.erase(file_name);
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_WRITE_FAILED);
+  }
+  // Now that the file is durable, persist the entries referring to it (or drop
+  // them if the file couldn't be written). The file itself is removed again if
+  // all of them have been removed in the meantime.
+  bool file_referenced = false;
+  for (auto it = manifest_.mutable_cache()->begin();
+       it != manifest_.mutable_cache()->end();) {
+    if (it->second.file_name() != file_name) {
+      ++it;
+    } else if (!status.ok()) {
+      it = manifest_.mutable_cache()->erase(it);
+    } else {
+      file_referenced = true;
+      RecordUpdateLocked(it->first, &it->second);
+      ++it;
     }
   }
+  if (status.ok() && !file_referenced) {
+    std::error_code remove_error;
+    std::filesystem::remove(cached_file_path, remove_error);
+  }
+  // Any failure has already been logged.
+  FlushUpdatesLocked().IgnoreError();
+}
 
-  return absl::OkStatus();
+void FileBackedResourceCache::WaitForPendingWrites() {
+  Scheduler* writer;
+  {
+    absl::MutexLock lock(&mutex_);
+    writer = writer_.get();
+  }
+  if (writer != nullptr) writer->WaitUntilIdle();
 }
 
 absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata>
 FileBackedResourceCache::Get(absl::string_view cache_id,
                              std::optional<absl::Duration> max_age) {
   absl::MutexLock lock(&mutex_);
-  FCP_ASSIGN_OR_RETURN(CacheManifest manifest, ReadInternal());
-
-  if (!manifest.cache().contains(cache_id)) {
+  std::string cache_id_string(cache_id);
+  auto it = manifest_.mutable_cache()->find(cache_id_string);
+  if (it == manifest_.mutable_cache()->end()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS);
     return absl::NotFoundError(absl::StrCat(cache_id, " not found"));
   }
-  CachedResource cached_resource = manifest.cache().at(cache_id);
-  std::filesystem::path cached_file_path = cache_dir_path_ / cache_id;
+  CachedResource& cached_resource = it->second;
+  std::filesystem::path cached_file_path =
+      cache_dir_path_ / cached_resource.file_name();
   google::protobuf::Any metadata = cached_resource.metadata();
-  absl::Time now = clock_.Now();
-  *cached_resource.mutable_last_accessed_time() =
-      TimeUtil::ConvertAbslToProtoTimestamp(now);
-  if (max_age.has_value()) {
-    absl::Time expiry = now + max_age.value();
-    *cached_resource.mutable_expiry_time() =
-        TimeUtil::ConvertAbslToProtoTimestamp(expiry);
-  }
 
+  // A file which is still being written is served from memory. Cached files
+  // are only ever created and deleted, never modified in place, so it is safe
+  // to hand out a Cord referencing a mapping of the file otherwise.
+  auto pending_file = pending_files_.find(cached_resource.file_name());
+  const bool file_pending = pending_file != pending_files_.end();
   absl::StatusOr<absl::Cord> contents =
-      ReadFileToCord(cached_file_path.string());
+      file_pending ? pending_file->second
+                   : MapFileToCord(cached_file_path.string());
   if (!contents.ok()) {
     log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_READ_FAILED);
-    manifest.mutable_cache()->erase(cache_id);
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS);
+    manifest_.mutable_cache()->erase(it);
+    RecordUpdateLocked(cache_id_string, nullptr);
     std::error_code error;
     std::filesystem::remove(cached_file_path, error);
     if (error.value() != 0) {
@@ -200,21 +475,114 @@ FileBackedResourceCache::Get(absl::string_view cache_id,
     return absl::NotFoundError(absl::StrCat(cache_id, " not found"));
   }
 
+  FCP_RETURN_IF_ERROR(RecordAccessLocked(cache_id_string, max_age,
+                                         file_pending, &cached_resource));
+  log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_HIT);
+
+  return FileBackedResourceCache::ResourceAndMetadata{*contents, metadata};
+}
+
+FileBackedResourceCache::CachedFile&
+FileBackedResourceCache::CachedFile::operator=(CachedFile&& other) noexcept {
+  if (this != &other) {
+    if (cache_ != nullptr) cache_->ReleaseFile(file_name_);
+    cache_ = std::exchange(other.cache_, nullptr);
+    file_name_ = std::move(other.file_name_);
+    path_ = std::move(other.path_);
+  }
+  return *this;
+}
+
+FileBackedResourceCache::CachedFile::~CachedFile() {
+  if (cache_ != nullptr) cache_->ReleaseFile(file_name_);
+}
+
+absl::StatusOr<FileBackedResourceCache::CachedFile>
+FileBackedResourceCache::GetFile(absl::string_view cache_id,
+                                 std::optional<absl::Duration> max_age) {
+  absl::MutexLock lock(&mutex_);
   std::string cache_id_string(cache_id);
-  manifest.mutable_cache()->erase(cache_id_string);
-  manifest.mutable_cache()->insert({cache_id_string, cached_resource});
+  // Only a complete file can be handed out, so wait for the entry's file to be
+  // written if it is still pending (or for the entry to be dropped, if writing
+  // it fails).
+  auto file_written = [this, &cache_id_string]() {
+    mutex_.AssertHeld();
+    auto it = manifest_.cache().find(cache_id_string);
+    return it == manifest_.cache().end() ||
+           !pending_files_.contains(it->second.file_name());
+  };
+  mutex_.Await(absl::Condition(&file_written));
+  auto it = manifest_.mutable_cache()->find(cache_id_string);
+  if (it == manifest_.mutable_cache()->end()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS);
+    return absl::NotFoundError(absl::StrCat(cache_id, " not found"));
+  }
+  CachedResource& cached_resource = it->second;
+  std::filesystem::path cached_file_path =
+      cache_dir_path_ / cached_resource.file_name();
+  std::error_code error;
+  if (!std::filesystem::is_regular_file(cached_file_path, error)) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_READ_FAILED);
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS);
+    manifest_.mutable_cache()->erase(it);
+    RecordUpdateLocked(cache_id_string, nullptr);
+    // Treat as not found, the resource should be fetched again.
+    return absl::NotFoundError(absl::StrCat(cache_id, " not found"));
+  }
 
-  absl::Status status =
-      WriteInternal(std::make_unique<CacheManifest>(std::move(manifest)));
-  if (!status.ok()) return status;
+  FCP_RETURN_IF_ERROR(RecordAccessLocked(cache_id_string, max_age,
+                                         /*file_pending=*/false,
+                                         &cached_resource));
+  log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_HIT);
+  // The file is kept until the caller is done with it, even if its entries are
+  // evicted in the meantime.
+  ++files_in_use_[cached_resource.file_name()];
+  return CachedFile(this, cached_resource.file_name(),
+                    cached_file_path.string());
+}
 
-  return FileBackedResourceCache::ResourceAndMetadata{*contents, metadata};
+void FileBackedResourceCache::ReleaseFile(const std::string& file_name) {
+  absl::MutexLock lock(&mutex_);
+  auto it = files_in_use_.find(file_name);
+  if (--it->second > 0) return;
+  files_in_use_.erase(it);
+  // A file which was evicted while in use is deleted now, unless it has been
+  // cached again in the meantime.
+  if (!IsFileReferenced(manifest_, file_name)) {
+    std::error_code remove_error;
+    std::filesystem::remove(cache_dir_path_ / file_name, remove_error);
+  }
+}
+
+absl::Status FileBackedResourceCache::RecordAccessLocked(
+    const std::string& cache_id, std::optional<absl::Duration> max_age,
+    bool file_pending, CachedResource* cached_resource) {
+  absl::Time now = clock_.Now();
+  *cached_resource->mutable_last_accessed_time() =
+      TimeUtil::ConvertAbslToProtoTimestamp(now);
+  cached_resource->set_access_count(
+      std::max<int64_t>(cached_resource->access_count(), 1) + 1);
+  if (max_age.has_value()) {
+    absl::Time expiry = now + max_age.value();
+    *cached_resource->mutable_expiry_time() =
+        TimeUtil::ConvertAbslToProtoTimestamp(expiry);
+  }
+  // The entry of a file which is still being written is persisted along with
+  // its latest access time once the file is durable.
+  if (!file_pending) RecordUpdateLocked(cache_id, cached_resource);
+  if (num_pending_updates_ >= kMaxPendingUpdates) {
+    return FlushUpdatesLocked();
+  }
+  return absl::OkStatus();
 }
 
 absl::Status FileBackedResourceCache::Initialize() {
   absl::MutexLock lock(&mutex_);
   std::string pds_path = manifest_path_.string();
-  if (!std::filesystem::exists(pds_path)) {
+  // A journal left behind by a manifest which no longer exists must not be
+  // replayed onto the new, empty one (whose fingerprint may well match).
+  const bool manifest_existed = std::filesystem::exists(pds_path);
+  if (!manifest_existed) {
     std::ofstream ofs(pds_path);
   }
   FCP_ASSIGN_OR_RETURN(absl::StatusOr<int64_t> file_size,
@@ -223,12 +591,42 @@ absl::Status FileBackedResourceCache::Initialize() {
   if (file_size.value() == 0) {
     FCP_RETURN_IF_ERROR(WriteInternal(std::make_unique<CacheManifest>()));
   }
+  FCP_ASSIGN_OR_RETURN(manifest_, ReadInternal());
+  absl::StatusOr<std::string> fingerprint = GetFileFingerprint(pds_path);
+  absl::Status journal_status = fingerprint.status();
+  if (!manifest_existed && fingerprint.ok()) {
+    journal_status = journal_.Reset(*fingerprint);
+  } else if (fingerprint.ok()) {
+    journal_status = journal_.Load(
+        *fingerprint, [this](char kind, absl::string_view payload) -> bool {
+          mutex_.AssertHeld();
+          CacheManifestUpdate update;
+          if (kind != kJournalManifestUpdate ||
+              !update.ParseFromArray(payload.data(),
+                                     static_cast<int>(payload.size()))) {
+            return false;
+          }
+          if (update.has_resource()) {
+            (*manifest_.mutable_cache())[update.cache_id()] =
+                std::move(*update.mutable_resource());
+          } else {
+            manifest_.mutable_cache()->erase(update.cache_id());
+          }
+          return true;
+        });
+  }
+  if (!journal_status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::RESOURCE_CACHE_MANIFEST_READ_FAILED);
+    return absl::InternalError(
+        absl::StrCat(
+            "Failed to read the manifest journal, with error message: ",
+            journal_status.message()));
+  }
   // Then run CleanUp. Even if our manifest was empty we still might have
   // stranded cache files to delete, i.e. in the case that the manifest was
   // deleted but the cache dir was not deleted.
-  FCP_ASSIGN_OR_RETURN(CacheManifest manifest, ReadInternal());
-  FCP_RETURN_IF_ERROR(CleanUp(std::nullopt, manifest));
-  FCP_RETURN_IF_ERROR(pds_->Write(std::make_unique<CacheManifest>(manifest)));
+  FCP_RETURN_IF_ERROR(CleanUp(std::nullopt, manifest_));
+  FCP_RETURN_IF_ERROR(WriteManifestLocked());
 
   return absl::OkStatus();
 }
@@ -257,6 +655,17 @@ absl::Status FileBackedResourceCache::CleanUp(
                                             directory_error.message()));
   }
 
+  // Files which are still being written are not stranded, and neither are
+  // files which are still in use.
+  for (const auto& [file_name, contents] : pending_files_) {
+    files_to_delete.erase(cache_dir_path_ /
+                          absl::StrCat(file_name, kTempFileSuffix));
+    files_to_delete.erase(cache_dir_path_ / file_name);
+  }
+  for (const auto& [file_name, num_users] : files_in_use_) {
+    files_to_delete.erase(cache_dir_path_ / file_name);
+  }
+
   int64_t max_allowed_size_bytes = max_cache_size_bytes_;
   max_allowed_size_bytes -= reserved_space_bytes.value_or(0);
 
@@ -296,23 +705,40 @@ absl::Status FileBackedResourceCache::CleanUp(
   FCP_RETURN_IF_ERROR(filesystem_status);
 
   // If we still exceed the allowed size of the cache, delete entries until
-  // we're under the allowed size, sorted by least recently used.
-
-  // Build up a list of (cache_id, least recently used timestamp) and compute
-  // the total size of the cache.
-  std::vector<std::pair<std::string, absl::Time>> cache_id_lru;
-  cache_id_lru.reserve(manifest.cache().size());
+  // we're under the allowed size, sorted by retention value.
+
+  // Build up a list of the files in the cache with their size, the time they
+  // were last used and how often, and compute the total size of the cache.
+  struct CachedFile {
+    absl::Time last_accessed_time = absl::InfinitePast();
+    int64_t access_count = 0;
+    uintmax_t size = 0;
+  };
+  absl::flat_hash_map<std::string, CachedFile> cached_files;
+  cached_files.reserve(manifest.cache().size());
   uintmax_t cache_dir_size = 0;
 
   for (auto& [id, resource] : manifest.cache()) {
+    auto [it, inserted] = cached_files.try_emplace(resource.file_name());
+    CachedFile& cached_file = it->second;
+    cached_file.last_accessed_time = std::max(
+        cached_file.last_accessed_time,
+        TimeUtil::ConvertProtoToAbslTime(resource.last_accessed_time()));
+    cached_file.access_count += std::max<int64_t>(resource.access_count(), 1);
+    if (!inserted) continue;
+    auto pending_file = pending_files_.find(resource.file_name());
+    if (pending_file != pending_files_.end()) {
+      cached_file.size = pending_file->second.size();
+      cache_dir_size += cached_file.size;
+      continue;
+    }
     std::error_code file_size_error;
-    cache_id_lru.emplace_back(std::make_pair(
-        id, TimeUtil::ConvertProtoToAbslTime(resource.last_accessed_time())));
     // We calculate the sum of tracked files instead of taking the file_size()
     // of the cache directory, because the latter generally does not reflect the
     // the total size of all of the files inside a directory.
-    cache_dir_size += std::filesystem::file_size(
+    cached_file.size = std::filesystem::file_size(
         cache_dir_path_ / resource.file_name(), file_size_error);
+    cache_dir_size += cached_file.size;
     // Loop through as many as we can and if there's an error, return the most
     // recent one.
     if (file_size_error.value() != 0) {
@@ -323,31 +749,43 @@ absl::Status FileBackedResourceCache::CleanUp(
 
   FCP_RETURN_IF_ERROR(filesystem_status);
 
-  // Then, if the cache is bigger than the allowed size, delete entries ordered
-  // by least recently used until we're below the threshold.
+  // Then, if the cache is bigger than the allowed size, delete files (and all
+  // the entries referring to them) ordered by increasing retention value until
+  // we're below the threshold.
   if (cache_dir_size > max_allowed_size_bytes) {
-    std::sort(cache_id_lru.begin(), cache_id_lru.end(),
-              [](std::pair<std::string, absl::Time> first,
-                 std::pair<std::string, absl::Time> second) -> bool {
-                // Sort by least recently used timestamp.
-                return first.second < second.second;
-              });
-    for (auto const& entry : cache_id_lru) {
-      std::string id_to_remove = entry.first;
-      std::filesystem::path file_to_remove =
-          cache_dir_path_ / manifest.cache().at(id_to_remove).file_name();
-      manifest.mutable_cache()->erase(id_to_remove);
+    std::vector<std::pair<double, std::string>> files_by_value;
+    files_by_value.reserve(cached_files.size());
+    for (const auto& [file_name, cached_file] : cached_files) {
+      files_by_value.emplace_back(
+          GetRetentionValue(cached_file.access_count,
+                            now - cached_file.last_accessed_time,
+                            cached_file.size),
+          file_name);
+    }
+    std::sort(files_by_value.begin(), files_by_value.end());
+    absl::flat_hash_set<std::string> files_to_evict;
+    for (const auto& [value, file_name] : files_by_value) {
+      files_to_evict.insert(file_name);
+      // A file which is still in use is deleted once it is released.
       std::error_code remove_error;
-      uintmax_t file_size =
-          std::filesystem::file_size(file_to_remove, remove_error);
-      std::filesystem::remove(file_to_remove, remove_error);
+      if (!files_in_use_.contains(file_name)) {
+        std::filesystem::remove(cache_dir_path_ / file_name, remove_error);
+      }
       if (remove_error.value() != 0 && filesystem_status.ok()) {
         filesystem_status = absl::InternalError(
             absl::StrCat("Failed to delete file: ", remove_error.message()));
       }
-      cache_dir_size -= file_size;
+      cache_dir_size -= cached_files[file_name].size;
       if (cache_dir_size < max_allowed_size_bytes) break;
     }
+    for (auto it = manifest.mutable_cache()->begin();
+         it != manifest.mutable_cache()->end();) {
+      if (files_to_evict.contains(it->second.file_name())) {
+        it = manifest.mutable_cache()->erase(it);
+      } else {
+        ++it;
+      }
+    }
   }
 
   FCP_RETURN_IF_ERROR(filesystem_status);
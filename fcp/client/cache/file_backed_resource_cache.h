@@ -26,10 +26,13 @@
 #include "google/protobuf/any.pb.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/cord.h"
 #include "fcp/base/clock.h"
+#include "fcp/base/scheduler.h"
 #include "fcp/client/cache/cache_manifest.pb.h"
 #include "fcp/client/cache/resource_cache.h"
+#include "fcp/client/journal_file.h"
 #include "fcp/client/log_manager.h"
 #include "protostore/file-storage.h"
 #include "protostore/proto-data-store.h"
@@ -43,12 +46,36 @@ namespace cache {
  * resource payload is stored as an individual file in a directory, along with a
  * ProtoDataStore manifest that tracks each entry.
  *
+ * Resource files are named after the SHA-256 digest of their contents, so that
+ * identical resources cached under different cache IDs share a single file. A
+ * file is deleted once no manifest entry refers to it anymore, and eviction
+ * treats all the entries sharing a file as a unit (see `CleanUp`).
+ *
+ * The manifest is kept in memory. Changes to it (i.e. new entries, and the
+ * updated access and expiry times of entries that are read) are recorded in a
+ * `JournalFile` next to the manifest, rather than rewriting the whole manifest
+ * each time. The changes made by `Get` are buffered and only appended to the
+ * journal in batches (or by the next `Put`, or when the cache is destroyed), so
+ * that a cache hit usually doesn't cause any disk writes. This means that a
+ * crash may lose the most recent access time updates, which only affects the
+ * order in which entries are evicted (or may cause an entry whose expiry was
+ * extended by `Get` to expire earlier). The manifest itself is only rewritten
+ * when entries are removed by `Put`, or once the journal has grown larger than
+ * the manifest.
+ *
+ * `Put` doesn't write the resource file itself, but hands it to a background
+ * thread, so that storing a resource doesn't block its caller on disk I/O.
+ * Until the file has been written and synced, the resource is kept (and served
+ * by `Get`) from memory, and its entries aren't persisted, so that a crash
+ * never leaves an entry behind without a complete file.
+ *
  * FileBackedResourceCache is thread safe.
  */
 class FileBackedResourceCache : public ResourceCache {
  public:
   // The CacheManifest will be created in
-  // <base directory>/fcp/cache_manifest.pb.
+  // <base directory>/fcp/cache_manifest.pb, and its journal in
+  // <base directory>/fcp/cache_manifest.journal.
 
   // Factory method to create FileBackedResourceCache. The provided cache dir is
   // the absolute path for storing cached files, and the provided base dir is
@@ -67,23 +94,75 @@ class FileBackedResourceCache : public ResourceCache {
   // Implementation of `ResourceCache::Put`.
   //
   // If storing `resource` pushes the size of the cache directory over
-  // `max_cache_size_bytes`, entries with the oldest last_accessed_time will be
-  // deleted until the directory is under `max_cache_size_bytes` Returns Ok on
-  // success. On error, returns:
+  // `max_cache_size_bytes`, the entries which are least valuable to keep (see
+  // `CleanUp`) will be deleted until the directory is under
+  // `max_cache_size_bytes` Returns Ok on success. On error, returns:
   // - INTERNAL - unexpected error.
   // - INVALID_ARGUMENT - if max_age is in the past.
   // - RESOURCE_EXHAUSTED - if resource bytes is bigger than
   //   `max_cache_size_bytes` / 2.
+  // - INTERNAL - if the changes to the manifest couldn't be persisted. The
+  //   resource is still cached, but only until the cache is recreated.
+  //
+  // The resource file is written asynchronously, so a failure to write it is
+  // only logged (and the entry dropped), rather than returned.
   absl::Status Put(absl::string_view cache_id, const absl::Cord& resource,
                    const google::protobuf::Any& metadata,
                    absl::Duration max_age) override ABSL_LOCKS_EXCLUDED(mutex_);
 
-  // Implementation of `ResourceCache::Get`.
+  // Implementation of `ResourceCache::Get`. The returned resource references a
+  // read-only memory mapping of the cached file (see `MapFileToCord`), so it
+  // doesn't take up any heap memory, and is only paged in as it is read.
   absl::StatusOr<ResourceAndMetadata> Get(absl::string_view cache_id,
                                           std::optional<absl::Duration> max_age)
       override ABSL_LOCKS_EXCLUDED(mutex_);
 
-  ~FileBackedResourceCache() override = default;
+  // A resource file handed out by `GetFile`. The file is never modified, and
+  // isn't deleted for as long as the CachedFile exists, even if its entries
+  // are evicted in the meantime. Once it is destroyed, the file may be deleted
+  // at any time, which doesn't affect files that are already open or mapped.
+  // A CachedFile must not outlive the cache it came from.
+  class CachedFile {
+   public:
+    CachedFile(CachedFile&& other) noexcept
+        : cache_(std::exchange(other.cache_, nullptr)),
+          file_name_(std::move(other.file_name_)),
+          path_(std::move(other.path_)) {}
+    CachedFile& operator=(CachedFile&& other) noexcept;
+    ~CachedFile();
+
+    const std::string& path() const { return path_; }
+
+   private:
+    friend class FileBackedResourceCache;
+    CachedFile(FileBackedResourceCache* cache, std::string file_name,
+               std::string path)
+        : cache_(cache),
+          file_name_(std::move(file_name)),
+          path_(std::move(path)) {}
+
+    FileBackedResourceCache* cache_;
+    std::string file_name_;
+    std::string path_;
+  };
+
+  // Like `Get`, but returns the file holding the resource rather than its
+  // contents, for libraries which load large resources from files themselves
+  // (e.g. by memory-mapping them, like TFLite's
+  // `FlatBufferModel::BuildFromFile`). Waits for the file to be written if it
+  // is still pending (but not for any other pending files). Returns NOT_FOUND
+  // if the resource isn't cached, or if writing its file failed.
+  absl::StatusOr<CachedFile> GetFile(absl::string_view cache_id,
+                                     std::optional<absl::Duration> max_age)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Blocks until the files of all the resources passed to `Put` so far have
+  // been written (or failed to be written).
+  void WaitForPendingWrites() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Waits for any pending resource file writes, and appends any buffered
+  // manifest changes to the journal.
+  ~FileBackedResourceCache() override;
 
   // FileBackedResourceCache is neither copyable nor movable.
   FileBackedResourceCache(const FileBackedResourceCache&) = delete;
@@ -94,11 +173,13 @@ class FileBackedResourceCache : public ResourceCache {
       std::unique_ptr<protostore::ProtoDataStore<CacheManifest>> pds,
       std::unique_ptr<protostore::FileStorage> storage,
       std::filesystem::path cache_dir_path, std::filesystem::path manifest_path,
-      LogManager* log_manager, Clock* clock, const int64_t max_cache_size_bytes)
+      std::filesystem::path journal_path, LogManager* log_manager, Clock* clock,
+      const int64_t max_cache_size_bytes)
       : storage_(std::move(storage)),
         pds_(std::move(pds)),
         cache_dir_path_(cache_dir_path),
         manifest_path_(manifest_path),
+        journal_(journal_path.string()),
         log_manager_(*log_manager),
         clock_(*clock),
         max_cache_size_bytes_(max_cache_size_bytes) {}
@@ -108,15 +189,50 @@ class FileBackedResourceCache : public ResourceCache {
   absl::Status WriteInternal(std::unique_ptr<CacheManifest> manifest)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  // Initializes the CacheManifest ProtoDataStore db if necessesary, then runs
-  // CleanUp().
+  // Writes `manifest_` to the ProtoDataStore, and starts a new, empty journal.
+  absl::Status WriteManifestLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Buffers a change to the manifest entry for `cache_id`, to be appended to
+  // the journal by `FlushUpdatesLocked`. A null `resource` means that the entry
+  // was removed.
+  void RecordUpdateLocked(const std::string& cache_id,
+                          const CachedResource* resource)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Updates the access time (and, if `max_age` is set, the expiry time) of a
+  // manifest entry that was just read, and records the change.
+  absl::Status RecordAccessLocked(const std::string& cache_id,
+                                  std::optional<absl::Duration> max_age,
+                                  bool file_pending,
+                                  CachedResource* cached_resource)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Appends the buffered changes to the journal, and rewrites the manifest
+  // instead if that fails, or if the journal has grown too large.
+  absl::Status FlushUpdatesLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Releases a file handed out by `GetFile`, deleting it if it is no longer
+  // handed out nor referred to by any entry.
+  void ReleaseFile(const std::string& file_name) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Writes the pending file with the given name to disk, and then persists the
+  // manifest entries referring to it. Runs on `writer_`.
+  void WritePendingFile(const std::string& file_name)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Initializes the CacheManifest ProtoDataStore db if necessesary, loads it
+  // and applies the journal to it, then runs CleanUp().
   absl::Status Initialize() ABSL_LOCKS_EXCLUDED(mutex_);
 
   // TTLs any cached resources stored past their expiry, then deletes any
   // stranded files without matching manifest entries, and any entries without
   // matching resource files. If `reserved_space_bytes` is set, cleans up
-  // resources sorted by least recently used until the cache size is less than
-  // `max_cache_size_bytes_ - reserved_space_bytes`.
+  // resource files until the cache size is less than
+  // `max_cache_size_bytes_ - reserved_space_bytes`, starting with the files
+  // least valuable to keep per byte: those accessed least often and least
+  // recently, and the larger ones among them, since the cost of re-fetching a
+  // resource grows more slowly than its size. A file shared by several entries
+  // counts towards the cache size once, is as recently used as the most
+  // recently used of those entries and as often as all of them together, and
+  // is only evicted along with all of them. Files handed out by `GetFile` are
+  // only deleted once they are released.
   // This modifies the passed `manifest`.
   absl::Status CleanUp(std::optional<int64_t> reserved_space_bytes,
                        CacheManifest& manifest)
@@ -128,10 +244,29 @@ class FileBackedResourceCache : public ResourceCache {
       ABSL_GUARDED_BY(mutex_);
   const std::filesystem::path cache_dir_path_;
   const std::filesystem::path manifest_path_;
+  JournalFile journal_ ABSL_GUARDED_BY(mutex_);
   LogManager& log_manager_;
   Clock& clock_;
   const int64_t max_cache_size_bytes_;
   absl::Mutex mutex_;
+
+  // The current manifest, i.e. the ProtoDataStore manifest with the journal and
+  // the buffered changes applied to it.
+  CacheManifest manifest_ ABSL_GUARDED_BY(mutex_);
+  // The serialized size of the manifest when it was last written.
+  int64_t manifest_size_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  // The encoded journal records of the changes not yet appended to the journal.
+  std::string pending_updates_ ABSL_GUARDED_BY(mutex_);
+  int num_pending_updates_ ABSL_GUARDED_BY(mutex_) = 0;
+  // The contents of the resource files which are still being written, by file
+  // name.
+  absl::flat_hash_map<std::string, absl::Cord> pending_files_
+      ABSL_GUARDED_BY(mutex_);
+  // The number of CachedFiles handed out for each file, by file name.
+  absl::flat_hash_map<std::string, int> files_in_use_ ABSL_GUARDED_BY(mutex_);
+  // Writes the pending files, one at a time. Created on first use, and declared
+  // last so that it is destroyed (and its thread joined) first.
+  std::unique_ptr<Scheduler> writer_ ABSL_GUARDED_BY(mutex_);
 };
 
 // Used by the class and in tests only.
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/any.pb.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fcp/base/clock.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/cache/file_backed_resource_cache.h"
+#include "fcp/client/log_manager.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace cache {
+namespace {
+
+constexpr int64_t kResourceSize = 1024;
+
+class NoOpLogManager : public LogManager {
+ public:
+  void LogDiag(ProdDiagCode diag_code) override {}
+  void LogDiag(DebugDiagCode diag_code) override {}
+  void LogToLongHistogram(HistogramCounters histogram_counter,
+                          int execution_index, int epoch_index,
+                          engine::DataSourceType data_source_type,
+                          int64_t value) override {}
+  void SetModelIdentifier(const std::string& model_identifier) override {}
+};
+
+google::protobuf::Any CreateMetadata() {
+  google::protobuf::Any metadata;
+  metadata.set_type_url("type.googleapis.com/fcp.client.SelectorContext");
+  metadata.set_value(std::string(64, 'm'));
+  return metadata;
+}
+
+// Returns the contents of the i-th resource. Each resource is distinct, so
+// that none of them are deduplicated.
+absl::Cord CreateResource(int64_t i) {
+  std::string resource(kResourceSize, 'r');
+  std::string prefix = absl::StrCat(i, ":");
+  resource.replace(0, prefix.size(), prefix);
+  return absl::Cord(resource);
+}
+
+// Creates a cache in a fresh directory, already containing `num_entries`
+// resources.
+class CacheWithEntries {
+ public:
+  explicit CacheWithEntries(int64_t num_entries)
+      : CacheWithEntries(num_entries, num_entries * kResourceSize * 4) {}
+
+  CacheWithEntries(int64_t num_entries, int64_t max_cache_size_bytes)
+      : base_dir_(std::filesystem::temp_directory_path() /
+                  absl::StrCat("resource_cache_bench_", getpid())) {
+    std::filesystem::remove_all(base_dir_);
+    std::filesystem::create_directories(base_dir_);
+    cache_ = FileBackedResourceCache::Create(
+                 base_dir_.generic_string(), base_dir_.generic_string(),
+                 &log_manager_, Clock::RealClock(),
+                 max_cache_size_bytes)
+                 .value();
+    for (int64_t i = 0; i < num_entries; ++i) {
+      FCP_CHECK_STATUS(cache_->Put(CacheId(i), CreateResource(i), metadata_,
+                                   absl::Hours(24)));
+    }
+  }
+
+  ~CacheWithEntries() {
+    cache_.reset();
+    std::filesystem::remove_all(base_dir_);
+  }
+
+  static std::string CacheId(int64_t i) { return absl::StrCat("resource_", i); }
+
+  FileBackedResourceCache& cache() { return *cache_; }
+  const google::protobuf::Any& metadata() const { return metadata_; }
+
+ private:
+  const std::filesystem::path base_dir_;
+  const google::protobuf::Any metadata_ = CreateMetadata();
+  NoOpLogManager log_manager_;
+  std::unique_ptr<FileBackedResourceCache> cache_;
+};
+
+// Looks up the cached resources in a round-robin fashion, i.e. each lookup is a
+// cache hit.
+void BM_Get(benchmark::State& state) {
+  const int64_t num_entries = state.range(0);
+  CacheWithEntries cache(num_entries);
+  int64_t i = 0;
+  for (auto s : state) {
+    benchmark::DoNotOptimize(
+        cache.cache().Get(CacheWithEntries::CacheId(i++ % num_entries),
+                          std::nullopt));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Stores resources which are already cached (so that their files don't have to
+// be written again) in a round-robin fashion, which isolates the cost of
+// updating the manifest.
+void BM_Put(benchmark::State& state) {
+  const int64_t num_entries = state.range(0);
+  CacheWithEntries cache(num_entries);
+  std::vector<absl::Cord> resources;
+  for (int64_t i = 0; i < num_entries; ++i) {
+    resources.push_back(CreateResource(i));
+  }
+  int64_t i = 0;
+  for (auto s : state) {
+    const int64_t index = i++ % num_entries;
+    benchmark::DoNotOptimize(cache.cache().Put(
+        CacheWithEntries::CacheId(index), resources[index], cache.metadata(),
+        absl::Hours(24)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Stores new resources of the given size, which measures the latency `Put`
+// adds for its caller. The resource files are written in the background.
+void BM_PutNewResource(benchmark::State& state) {
+  const int64_t resource_size = state.range(0);
+  CacheWithEntries cache(/*num_entries=*/0,
+                         /*max_cache_size_bytes=*/int64_t{1} << 30);
+  std::string contents(resource_size, 'r');
+  int64_t i = 0;
+  for (auto s : state) {
+    state.PauseTiming();
+    std::string prefix = absl::StrCat(i, ":");
+    contents.replace(0, prefix.size(), prefix);
+    absl::Cord resource(contents);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(
+        cache.cache().Put(CacheWithEntries::CacheId(i++), resource,
+                          cache.metadata(), absl::Hours(24)));
+  }
+  cache.cache().WaitForPendingWrites();
+  state.SetBytesProcessed(state.iterations() * resource_size);
+}
+
+BENCHMARK(BM_Get)->RangeMultiplier(4)->Range(16, 4096);
+BENCHMARK(BM_Put)->RangeMultiplier(4)->Range(16, 4096);
+BENCHMARK(BM_PutNewResource)
+    ->RangeMultiplier(8)
+    ->Range(64 << 10, 4 << 20)
+    // Keeps the number of files in the cache directory (which `Put` scans) low.
+    ->Iterations(64);
+
+}  // namespace
+}  // namespace cache
+}  // namespace client
+}  // namespace fcp
@@ -20,6 +20,7 @@
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <iterator>
 #include <optional>
 #include <string>
 #include <utility>
@@ -30,6 +31,9 @@
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/simulated_clock.h"
+#include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/engine/engine.pb.h"
+#include "fcp/client/histogram_counters.pb.h"
 #include "fcp/client/selector_context.pb.h"
 #include "fcp/client/test_helpers.h"
 #include "fcp/testing/testing.h"
@@ -39,6 +43,9 @@ namespace client {
 namespace cache {
 namespace {
 
+using ::testing::_;
+using ::testing::AnyNumber;
+
 constexpr char kKey1[] = "1";
 absl::Cord Resource1() { return absl::Cord("stream RENAISSANCE by Beyoncé"); }
 constexpr char kKey2[] = "2";
@@ -70,6 +77,19 @@ class FileBackedResourceCacheTest : public testing::Test {
     root_files_dir_ = testing::TempDir();
     std::filesystem::path root_files_dir(root_files_dir_);
     manifest_path_ = root_files_dir / "fcp" / "cache_manifest.pb";
+    EXPECT_CALL(log_manager_, LogDiag(ProdDiagCode::RESOURCE_CACHE_HIT))
+        .Times(AnyNumber());
+    EXPECT_CALL(log_manager_, LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS))
+        .Times(AnyNumber());
+  }
+
+  int NumFilesInCacheDir() {
+    int num_files_in_cache_dir = 0;
+    for ([[maybe_unused]] auto& de :
+         std::filesystem::directory_iterator(cache_dir_)) {
+      num_files_in_cache_dir++;
+    }
+    return num_files_in_cache_dir;
   }
 
   void TearDown() override {
@@ -207,6 +227,29 @@ TEST_F(FileBackedResourceCacheTest, CacheFileThenExpire) {
   }
 }
 
+TEST_F(FileBackedResourceCacheTest, CachedResourceOutlivesDeletedFile) {
+  absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata> cached_resource;
+  {
+    auto resource_cache = FileBackedResourceCache::Create(
+        root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+        kMaxCacheSizeBytes);
+    ASSERT_OK(resource_cache);
+    ASSERT_OK((*resource_cache)->Put(kKey1, Resource1(), Metadata(), kMaxAge));
+    cached_resource = (*resource_cache)->Get(kKey1, std::nullopt);
+    ASSERT_OK(cached_resource);
+  }
+
+  // Expire the resource, so that its file gets deleted when the cache is
+  // reinitialized.
+  clock_.AdvanceTime(kMaxAge + absl::Minutes(1));
+  ASSERT_OK(FileBackedResourceCache::Create(root_files_dir_, root_cache_dir_,
+                                            &log_manager_, &clock_,
+                                            kMaxCacheSizeBytes));
+  ASSERT_EQ(NumFilesInCacheDir(), 0);
+
+  ASSERT_EQ(Resource1(), (*cached_resource).resource);
+}
+
 TEST_F(FileBackedResourceCacheTest, PutTwoFilesThenOneExpires) {
   {
     auto resource_cache = FileBackedResourceCache::Create(
@@ -328,6 +371,316 @@ TEST_F(FileBackedResourceCacheTest,
   ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
 }
 
+TEST_F(FileBackedResourceCacheTest,
+       CacheExceedsMaxCacheSizeLeastFrequentlyUsedDeleted) {
+  int64_t local_max_cache_size_bytes =
+      Resource1().size() + (Resource2().size() / 2) + Resource3().size();
+
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      local_max_cache_size_bytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey1, Resource1(), Metadata(), absl::Hours(1)));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  clock_.AdvanceTime(absl::Minutes(1));
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey2, Resource2(), Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  // Even though resource1 was used less recently than resource2, it was used
+  // much more often, so resource2 gets deleted when we add resource3.
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey3, Resource3(), Metadata(), absl::Hours(1)));
+
+  ASSERT_OK((*resource_cache)->Get(kKey3, std::nullopt));
+  ASSERT_THAT((*resource_cache)->Get(kKey2, std::nullopt), IsCode(NOT_FOUND));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+}
+
+TEST_F(FileBackedResourceCacheTest,
+       CacheExceedsMaxCacheSizeLargerResourceDeleted) {
+  absl::Cord large_resource1(std::string(1024 * 1024, '1'));
+  absl::Cord large_resource2(std::string(1024 * 1024, '2'));
+  // Room for resource2 and one of the large resources, but not both.
+  int64_t local_max_cache_size_bytes = 2 * large_resource1.size();
+
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      local_max_cache_size_bytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey2, Resource2(), Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  ASSERT_OK((*resource_cache)
+                ->Put(kKey1, large_resource1, Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  // Evicting the large resource frees much more space for about the same cost
+  // of re-fetching it later, so it is deleted even though it was used more
+  // recently than resource2.
+  ASSERT_OK((*resource_cache)
+                ->Put(kKey3, large_resource2, Metadata(), absl::Hours(1)));
+
+  ASSERT_OK((*resource_cache)->Get(kKey3, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get(kKey2, std::nullopt));
+  ASSERT_THAT((*resource_cache)->Get(kKey1, std::nullopt), IsCode(NOT_FOUND));
+}
+
+TEST_F(FileBackedResourceCacheTest,
+       AccessTimesSurviveReinitializationWithoutRewritingManifest) {
+  int64_t local_max_cache_size_bytes =
+      Resource1().size() + (Resource2().size() / 2) + Resource3().size();
+  {
+    auto resource_cache = FileBackedResourceCache::Create(
+        root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+        local_max_cache_size_bytes);
+    ASSERT_OK(resource_cache);
+    ASSERT_OK(
+        (*resource_cache)->Put(kKey1, Resource1(), Metadata(), absl::Hours(1)));
+    clock_.AdvanceTime(absl::Minutes(1));
+    ASSERT_OK(
+        (*resource_cache)->Put(kKey2, Resource2(), Metadata(), absl::Hours(1)));
+    clock_.AdvanceTime(absl::Minutes(1));
+
+    // Reading resource1 should update its access time, without rewriting the
+    // manifest.
+    std::filesystem::file_time_type manifest_write_time =
+        std::filesystem::last_write_time(manifest_path_);
+    ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+    EXPECT_EQ(std::filesystem::last_write_time(manifest_path_),
+              manifest_write_time);
+  }
+  clock_.AdvanceTime(absl::Minutes(1));
+
+  // The updated access time should have been recovered from the journal, so
+  // that resource2 is deleted instead of resource1 when we add resource3.
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      local_max_cache_size_bytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey3, Resource3(), Metadata(), absl::Hours(1)));
+
+  ASSERT_OK((*resource_cache)->Get(kKey3, std::nullopt));
+  ASSERT_THAT((*resource_cache)->Get(kKey2, std::nullopt), IsCode(NOT_FOUND));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+}
+
+TEST_F(FileBackedResourceCacheTest, TornJournalRecordIsIgnored) {
+  {
+    auto resource_cache = FileBackedResourceCache::Create(
+        root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+        kMaxCacheSizeBytes);
+    ASSERT_OK(resource_cache);
+    ASSERT_OK(
+        (*resource_cache)->Put(kKey1, Resource1(), Metadata(), absl::Hours(1)));
+  }
+
+  // Simulate a crash in the middle of appending to the journal.
+  std::ofstream(manifest_path_.parent_path() / "cache_manifest.journal",
+                std::ios::binary | std::ios::app)
+      << "\x02\xff";
+
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata> cached_resource =
+      (*resource_cache)->Get(kKey1, std::nullopt);
+  ASSERT_OK(cached_resource);
+  ASSERT_EQ(Resource1(), (*cached_resource).resource);
+}
+
+TEST_F(FileBackedResourceCacheTest, GetLogsHitsAndMisses) {
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey1, Resource1(), Metadata(), absl::Hours(1)));
+
+  EXPECT_CALL(log_manager_, LogDiag(ProdDiagCode::RESOURCE_CACHE_HIT))
+      .Times(2);
+  EXPECT_CALL(log_manager_, LogDiag(ProdDiagCode::RESOURCE_CACHE_MISS));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  ASSERT_THAT((*resource_cache)->Get(kKey2, std::nullopt), IsCode(NOT_FOUND));
+}
+
+TEST_F(FileBackedResourceCacheTest, IdenticalResourcesAreStoredOnce) {
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK((*resource_cache)->Put(kKey1, Resource1(), Metadata(), kMaxAge));
+
+  EXPECT_CALL(log_manager_,
+              LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_DEDUPLICATED));
+  EXPECT_CALL(log_manager_,
+              LogToLongHistogram(
+                  HistogramCounters::RESOURCE_CACHE_DEDUPLICATED_BYTES,
+                  /*execution_index=*/0, /*epoch_index=*/0,
+                  engine::DataSourceType::DATASET, Resource1().size()));
+  ASSERT_OK((*resource_cache)->Put(kKey2, Resource1(), Metadata(),
+                                   kMaxAge + absl::Minutes(2)));
+  (*resource_cache)->WaitForPendingWrites();
+  EXPECT_EQ(NumFilesInCacheDir(), 1);
+
+  // Once the first entry expires, the file is still kept for the second one.
+  clock_.AdvanceTime(kMaxAge + absl::Minutes(1));
+  ASSERT_OK((*resource_cache)->Put(kKey3, Resource3(), Metadata(), kMaxAge));
+  (*resource_cache)->WaitForPendingWrites();
+  EXPECT_EQ(NumFilesInCacheDir(), 2);
+  ASSERT_THAT((*resource_cache)->Get(kKey1, std::nullopt), IsCode(NOT_FOUND));
+  absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata> cached_resource =
+      (*resource_cache)->Get(kKey2, std::nullopt);
+  ASSERT_OK(cached_resource);
+  ASSERT_EQ(Resource1(), (*cached_resource).resource);
+}
+
+TEST_F(FileBackedResourceCacheTest, SharedFileIsEvictedWithAllItsEntries) {
+  // Room for resource1 and resource2, but not for resource3 as well.
+  int64_t local_max_cache_size_bytes =
+      Resource1().size() + Resource2().size() + (Resource3().size() / 2);
+  EXPECT_CALL(log_manager_,
+              LogDiag(ProdDiagCode::RESOURCE_CACHE_RESOURCE_DEDUPLICATED));
+  EXPECT_CALL(log_manager_, LogToLongHistogram(_, _, _, _, _));
+
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      local_max_cache_size_bytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey1, Resource1(), Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey2, Resource2(), Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  // The same contents under another key don't take up any more space.
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey3, Resource2(), Metadata(), absl::Hours(1)));
+  clock_.AdvanceTime(absl::Minutes(1));
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+  clock_.AdvanceTime(absl::Minutes(1));
+  ASSERT_OK((*resource_cache)->Get(kKey2, std::nullopt));
+  clock_.AdvanceTime(absl::Minutes(1));
+
+  // Even though kKey3 is now the least recently used entry, its file is still
+  // in use by kKey2, so resource1 is evicted instead.
+  ASSERT_OK((*resource_cache)->Put("4", Resource3(), Metadata(),
+                                   absl::Hours(1)));
+  (*resource_cache)->WaitForPendingWrites();
+  EXPECT_EQ(NumFilesInCacheDir(), 2);
+  ASSERT_THAT((*resource_cache)->Get(kKey1, std::nullopt), IsCode(NOT_FOUND));
+  ASSERT_OK((*resource_cache)->Get(kKey2, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get(kKey3, std::nullopt));
+  ASSERT_OK((*resource_cache)->Get("4", std::nullopt));
+}
+
+TEST_F(FileBackedResourceCacheTest, ResourceIsAvailableBeforeItIsWritten) {
+  {
+    auto resource_cache = FileBackedResourceCache::Create(
+        root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+        kMaxCacheSizeBytes);
+    ASSERT_OK(resource_cache);
+    ASSERT_OK((*resource_cache)->Put(kKey1, Resource1(), Metadata(), kMaxAge));
+    // The file may still be being written, in which case the resource is
+    // served from memory.
+    absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata>
+        cached_resource = (*resource_cache)->Get(kKey1, std::nullopt);
+    ASSERT_OK(cached_resource);
+    ASSERT_EQ(Resource1(), (*cached_resource).resource);
+
+    // Once written, the file is in place under its final name.
+    (*resource_cache)->WaitForPendingWrites();
+    ASSERT_EQ(NumFilesInCacheDir(), 1);
+    ASSERT_OK((*resource_cache)->Put(kKey2, Resource2(), Metadata(), kMaxAge));
+  }
+
+  // Destroying the cache waits for the second write, and both entries are
+  // persisted.
+  ASSERT_EQ(NumFilesInCacheDir(), 2);
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  absl::StatusOr<FileBackedResourceCache::ResourceAndMetadata> cached_resource =
+      (*resource_cache)->Get(kKey2, std::nullopt);
+  ASSERT_OK(cached_resource);
+  ASSERT_EQ(Resource2(), (*cached_resource).resource);
+  ASSERT_OK((*resource_cache)->Get(kKey1, std::nullopt));
+}
+
+TEST_F(FileBackedResourceCacheTest, GetFileReturnsWrittenFile) {
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK((*resource_cache)->Put(kKey1, Resource1(), Metadata(), kMaxAge));
+
+  // The file is complete by the time it is returned, even though it was only
+  // just put.
+  absl::StatusOr<FileBackedResourceCache::CachedFile> cached_file =
+      (*resource_cache)->GetFile(kKey1, std::nullopt);
+  ASSERT_OK(cached_file);
+  std::ifstream file(cached_file->path(), std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  EXPECT_EQ(contents, std::string(Resource1()));
+
+  EXPECT_THAT((*resource_cache)->GetFile(kKey2, std::nullopt),
+              IsCode(NOT_FOUND));
+}
+
+TEST_F(FileBackedResourceCacheTest, GetFileKeepsEvictedFileUntilReleased) {
+  absl::Cord large_resource1(std::string(1024 * 1024, '1'));
+  absl::Cord large_resource2(std::string(1024 * 1024, '2'));
+  // Room for resource2 and one of the large resources, but not both.
+  int64_t local_max_cache_size_bytes = 2 * large_resource1.size();
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      local_max_cache_size_bytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK(
+      (*resource_cache)->Put(kKey2, Resource2(), Metadata(), absl::Hours(1)));
+  ASSERT_OK((*resource_cache)
+                ->Put(kKey1, large_resource1, Metadata(), absl::Hours(1)));
+  absl::StatusOr<FileBackedResourceCache::CachedFile> cached_file =
+      (*resource_cache)->GetFile(kKey1, std::nullopt);
+  ASSERT_OK(cached_file);
+
+  // Evicting the resource doesn't delete its file while it is in use.
+  ASSERT_OK((*resource_cache)
+                ->Put(kKey3, large_resource2, Metadata(), absl::Hours(1)));
+  (*resource_cache)->WaitForPendingWrites();
+  ASSERT_THAT((*resource_cache)->Get(kKey1, std::nullopt), IsCode(NOT_FOUND));
+  const std::string path = cached_file->path();
+  EXPECT_TRUE(std::filesystem::exists(path));
+  EXPECT_EQ(NumFilesInCacheDir(), 3);
+
+  // Once it's released, it is deleted.
+  cached_file = absl::NotFoundError("");
+  EXPECT_FALSE(std::filesystem::exists(path));
+  EXPECT_EQ(NumFilesInCacheDir(), 2);
+}
+
+TEST_F(FileBackedResourceCacheTest, GetFileUpdatesExpiry) {
+  auto resource_cache = FileBackedResourceCache::Create(
+      root_files_dir_, root_cache_dir_, &log_manager_, &clock_,
+      kMaxCacheSizeBytes);
+  ASSERT_OK(resource_cache);
+  ASSERT_OK((*resource_cache)->Put(kKey1, Resource1(), Metadata(), kMaxAge));
+
+  clock_.AdvanceTime(kMaxAge / 2);
+  ASSERT_OK((*resource_cache)->GetFile(kKey1, kMaxAge));
+  // Putting another resource cleans up expired entries, but the first one's
+  // expiry was extended.
+  clock_.AdvanceTime(kMaxAge * 3 / 4);
+  ASSERT_OK((*resource_cache)->Put(kKey2, Resource2(), Metadata(), kMaxAge));
+  ASSERT_OK((*resource_cache)->GetFile(kKey1, std::nullopt));
+}
+
 TEST_F(FileBackedResourceCacheTest, FileInCacheDirButNotInManifest) {
   {
     auto resource_cache = FileBackedResourceCache::Create(
@@ -342,12 +695,7 @@ TEST_F(FileBackedResourceCacheTest, FileInCacheDirButNotInManifest) {
   std::filesystem::remove(manifest_path_);
 
   // There should be the one file we cached.
-  int num_files_in_cache_dir = 0;
-  for ([[maybe_unused]] auto& de :
-       std::filesystem::directory_iterator(cache_dir_)) {
-    num_files_in_cache_dir++;
-  }
-  ASSERT_EQ(num_files_in_cache_dir, 1);
+  ASSERT_EQ(NumFilesInCacheDir(), 1);
 
   {
     auto resource_cache = FileBackedResourceCache::Create(
@@ -359,12 +707,7 @@ TEST_F(FileBackedResourceCacheTest, FileInCacheDirButNotInManifest) {
     ASSERT_THAT(cached_resource, IsCode(NOT_FOUND));
     // The cache dir should also be empty, because we reinitialized the cache
     // and there was an untracked file in it.
-    num_files_in_cache_dir = 0;
-    for ([[maybe_unused]] auto& de :
-         std::filesystem::directory_iterator(cache_dir_)) {
-      num_files_in_cache_dir++;
-    }
-    ASSERT_EQ(num_files_in_cache_dir, 0);
+    ASSERT_EQ(NumFilesInCacheDir(), 0);
   }
 }
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/cord_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <variant>
+
+#include "google/protobuf/message_lite.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "fcp/base/monitoring.h"
+#include "openssl/digest.h"
+#include "openssl/evp.h"
+
+namespace fcp {
+namespace client {
+
+CordInputStream::CordInputStream(const absl::Cord* cord)
+    : next_chunk_(cord->chunk_begin()), end_(cord->chunk_end()) {}
+
+bool CordInputStream::Next(const void** data, int* size) {
+  while (remaining_.empty()) {
+    if (next_chunk_ == end_) {
+      return false;
+    }
+    remaining_ = *next_chunk_;
+    ++next_chunk_;
+  }
+  // A single chunk could in theory be larger than what `size` can represent,
+  // in which case we return it in multiple parts.
+  int returned_size = static_cast<int>(std::min(
+      remaining_.size(), static_cast<size_t>(std::numeric_limits<int>::max())));
+  *data = remaining_.data();
+  *size = returned_size;
+  remaining_.remove_prefix(returned_size);
+  byte_count_ += returned_size;
+  return true;
+}
+
+void CordInputStream::BackUp(int count) {
+  // The backed up bytes are always the last bytes returned by `Next`, which
+  // immediately precede `remaining_` within the same chunk.
+  FCP_CHECK(count >= 0 && count <= byte_count_);
+  remaining_ = absl::string_view(remaining_.data() - count,
+                                 remaining_.size() + count);
+  byte_count_ -= count;
+}
+
+bool CordInputStream::Skip(int count) {
+  const void* data;
+  int size;
+  while (count > 0) {
+    if (!Next(&data, &size)) {
+      return false;
+    }
+    if (size > count) {
+      BackUp(size - count);
+      return true;
+    }
+    count -= size;
+  }
+  return true;
+}
+
+bool ParseFromCord(google::protobuf::MessageLite& proto,
+                   const absl::Cord& data) {
+  CordInputStream stream(&data);
+  return proto.ParseFromZeroCopyStream(&stream);
+}
+
+bool ParseFromStringOrCord(google::protobuf::MessageLite& proto,
+                           const std::variant<std::string, absl::Cord>& data) {
+  if (std::holds_alternative<std::string>(data)) {
+    return proto.ParseFromString(std::get<std::string>(data));
+  } else {
+    return ParseFromCord(proto, std::get<absl::Cord>(data));
+  }
+}
+
+std::string ComputeSHA256FromStringOrCord(
+    const std::variant<std::string, absl::Cord>& data) {
+  std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX*)> mdctx(EVP_MD_CTX_new(),
+                                                           EVP_MD_CTX_free);
+  FCP_CHECK(EVP_DigestInit_ex(mdctx.get(), EVP_sha256(), nullptr));
+
+  if (std::holds_alternative<std::string>(data)) {
+    const std::string& str = std::get<std::string>(data);
+    FCP_CHECK(EVP_DigestUpdate(mdctx.get(), str.data(), str.size()));
+  } else {
+    for (absl::string_view chunk : std::get<absl::Cord>(data).Chunks()) {
+      FCP_CHECK(EVP_DigestUpdate(mdctx.get(), chunk.data(), chunk.size()));
+    }
+  }
+
+  const int hash_len = 32;  // 32 bytes for SHA-256.
+  uint8_t digest_bytes[hash_len];
+  FCP_CHECK(EVP_DigestFinal_ex(mdctx.get(), digest_bytes, nullptr));
+
+  return std::string(reinterpret_cast<char const*>(digest_bytes), hash_len);
+}
+
+}  // namespace client
+}  // namespace fcp
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_CORD_UTILS_H_
+#define FCP_CLIENT_CORD_UTILS_H_
+
+#include <cstdint>
+#include <string>
+#include <variant>
+
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/message_lite.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+
+namespace fcp {
+namespace client {
+
+// A `ZeroCopyInputStream` which reads the data of an `absl::Cord` chunk by
+// chunk, without ever flattening (i.e. copying) it. The Cord must outlive the
+// stream.
+class CordInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  explicit CordInputStream(const absl::Cord* cord);
+
+  bool Next(const void** data, int* size) override;
+  void BackUp(int count) override;
+  bool Skip(int count) override;
+  int64_t ByteCount() const override { return byte_count_; }
+
+ private:
+  absl::Cord::ChunkIterator next_chunk_;
+  const absl::Cord::ChunkIterator end_;
+  // The part of the current chunk that hasn't been returned by `Next` yet.
+  absl::string_view remaining_;
+  int64_t byte_count_ = 0;
+};
+
+// Parses a proto from an `absl::Cord`, without flattening the Cord first.
+bool ParseFromCord(google::protobuf::MessageLite& proto,
+                   const absl::Cord& data);
+
+// Parses a proto from either an std::string or an absl::Cord. This allows the
+// proto data to be provided in either format.
+bool ParseFromStringOrCord(google::protobuf::MessageLite& proto,
+                           const std::variant<std::string, absl::Cord>& data);
+
+// Computes the SHA-256 digest of the given data (returned as 32 raw bytes),
+// hashing an absl::Cord chunk by chunk rather than flattening it first.
+std::string ComputeSHA256FromStringOrCord(
+    const std::variant<std::string, absl::Cord>& data);
+
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_CORD_UTILS_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/resource.h>
+
+#include <cstdint>
+#include <string>
+#include <variant>
+
+#include "absl/strings/cord.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/cord_utils.h"
+#include "fcp/protos/plan.pb.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp::client {
+namespace {
+
+using ::google::internal::federated::plan::ClientOnlyPlan;
+
+// The size of the blocks that a fetched resource is typically received in.
+constexpr int64_t kBlockSize = 4 * 1024 * 1024;
+
+// Returns the peak resident set size of the process so far, in MiB.
+double PeakRssMiB() {
+  struct rusage usage;
+  FCP_CHECK(getrusage(RUSAGE_SELF, &usage) == 0);
+  // ru_maxrss is reported in KiB on Linux.
+  return usage.ru_maxrss / 1024.0;
+}
+
+// Returns a serialized plan with a model of `state.range(0)` bytes, laid out
+// like a plan payload received during checkin (i.e. as a Cord consisting of
+// many large blocks).
+absl::Cord CreatePlanPayload(benchmark::State& state) {
+  ClientOnlyPlan plan;
+  plan.set_tflite_graph(std::string(state.range(0), 't'));
+  plan.mutable_phase()->mutable_tensorflow_spec()->set_dataset_token_tensor_name(
+      "dataset_token");
+  std::string serialized_plan = plan.SerializeAsString();
+  absl::Cord payload;
+  for (size_t offset = 0; offset < serialized_plan.size();
+       offset += kBlockSize) {
+    payload.Append(absl::Cord(serialized_plan.substr(offset, kBlockSize)));
+  }
+  return payload;
+}
+
+// Note: the peak RSS of a process never decreases, so to compare the
+// "peak_rss_mib" counters of the benchmarks below, each benchmark should be
+// run in a separate process (using --benchmark_filter).
+
+// Parses the plan by first flattening the Cord into a string, as was done
+// before `ParseFromCord` existed.
+static void BM_ParsePlanFromFlattenedCord(benchmark::State& state) {
+  absl::Cord payload = CreatePlanPayload(state);
+  for (auto s : state) {
+    ClientOnlyPlan plan;
+    FCP_CHECK(plan.ParseFromString(std::string(payload)));
+    benchmark::DoNotOptimize(plan);
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+  state.counters["peak_rss_mib"] = PeakRssMiB();
+}
+
+static void BM_ParsePlanFromCord(benchmark::State& state) {
+  absl::Cord payload = CreatePlanPayload(state);
+  for (auto s : state) {
+    ClientOnlyPlan plan;
+    FCP_CHECK(ParseFromCord(plan, payload));
+    benchmark::DoNotOptimize(plan);
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+  state.counters["peak_rss_mib"] = PeakRssMiB();
+}
+
+static void BM_ComputeSHA256FromCord(benchmark::State& state) {
+  std::variant<std::string, absl::Cord> payload = CreatePlanPayload(state);
+  for (auto s : state) {
+    benchmark::DoNotOptimize(ComputeSHA256FromStringOrCord(payload));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          std::get<absl::Cord>(payload).size());
+  state.counters["peak_rss_mib"] = PeakRssMiB();
+}
+
+// Plan-sized payloads, from 16 MiB up to 256 MiB.
+BENCHMARK(BM_ParsePlanFromFlattenedCord)
+    ->RangeMultiplier(4)
+    ->Range(1 << 24, 1 << 28)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ParsePlanFromCord)
+    ->RangeMultiplier(4)
+    ->Range(1 << 24, 1 << 28)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ComputeSHA256FromCord)
+    ->RangeMultiplier(4)
+    ->Range(1 << 24, 1 << 28)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace fcp::client
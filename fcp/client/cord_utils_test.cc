@@ -0,0 +1,173 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/cord_utils.h"
+
+#include <string>
+#include <variant>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/string_view.h"
+#include "fcp/protos/plan.pb.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp {
+namespace client {
+namespace {
+
+using ::google::internal::federated::plan::ClientOnlyPlan;
+
+// Creates a Cord holding the given data, split into chunks of `chunk_size`
+// bytes.
+absl::Cord MakeFragmentedCord(absl::string_view data, size_t chunk_size) {
+  absl::Cord cord;
+  for (size_t offset = 0; offset < data.size(); offset += chunk_size) {
+    // Constructing a separate Cord for each chunk (rather than appending the
+    // string_view directly) prevents small chunks from being merged.
+    cord.Append(absl::Cord(std::string(data.substr(offset, chunk_size))));
+  }
+  return cord;
+}
+
+ClientOnlyPlan CreatePlan() {
+  ClientOnlyPlan plan;
+  plan.set_graph(std::string(100000, 'g'));
+  plan.set_tflite_graph(std::string(50000, 't'));
+  plan.mutable_phase()->mutable_tensorflow_spec()->set_dataset_token_tensor_name(
+      "dataset_token");
+  return plan;
+}
+
+TEST(CordInputStreamTest, ReadsAllChunks) {
+  std::string data(10000, 'x');
+  absl::Cord cord = MakeFragmentedCord(data, 3000);
+  CordInputStream stream(&cord);
+
+  std::string result;
+  const void* chunk;
+  int size;
+  while (stream.Next(&chunk, &size)) {
+    result.append(static_cast<const char*>(chunk), size);
+  }
+  EXPECT_EQ(result, data);
+  EXPECT_EQ(stream.ByteCount(), data.size());
+}
+
+TEST(CordInputStreamTest, BackUpReturnsDataAgain) {
+  std::string first_chunk(1000, 'a');
+  std::string second_chunk(1000, 'b');
+  absl::Cord cord = MakeFragmentedCord(first_chunk + second_chunk, 1000);
+  CordInputStream stream(&cord);
+
+  const void* chunk;
+  int size;
+  ASSERT_TRUE(stream.Next(&chunk, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(chunk), size),
+            first_chunk);
+  stream.BackUp(200);
+  EXPECT_EQ(stream.ByteCount(), 800);
+  ASSERT_TRUE(stream.Next(&chunk, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(chunk), size),
+            first_chunk.substr(800));
+  ASSERT_TRUE(stream.Next(&chunk, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(chunk), size),
+            second_chunk);
+  EXPECT_FALSE(stream.Next(&chunk, &size));
+  EXPECT_EQ(stream.ByteCount(), 2000);
+}
+
+TEST(CordInputStreamTest, SkipAcrossChunks) {
+  std::string data = std::string(1000, 'a') + std::string(1000, 'b') +
+                     std::string(1000, 'c');
+  absl::Cord cord = MakeFragmentedCord(data, 1000);
+  CordInputStream stream(&cord);
+
+  ASSERT_TRUE(stream.Skip(1500));
+  EXPECT_EQ(stream.ByteCount(), 1500);
+  const void* chunk;
+  int size;
+  ASSERT_TRUE(stream.Next(&chunk, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(chunk), size),
+            data.substr(1500, 500));
+  EXPECT_FALSE(stream.Skip(1001));
+}
+
+TEST(CordInputStreamTest, EmptyCord) {
+  absl::Cord cord;
+  CordInputStream stream(&cord);
+  const void* chunk;
+  int size;
+  EXPECT_FALSE(stream.Next(&chunk, &size));
+  EXPECT_EQ(stream.ByteCount(), 0);
+}
+
+TEST(ParseFromCordTest, ParsesFragmentedCord) {
+  ClientOnlyPlan expected_plan = CreatePlan();
+  // Use a chunk size that doesn't line up with any field boundaries.
+  absl::Cord cord =
+      MakeFragmentedCord(expected_plan.SerializeAsString(), /*chunk_size=*/777);
+
+  ClientOnlyPlan plan;
+  ASSERT_TRUE(ParseFromCord(plan, cord));
+  EXPECT_THAT(plan, EqualsProto(expected_plan));
+}
+
+TEST(ParseFromCordTest, InvalidDataFails) {
+  ClientOnlyPlan plan;
+  EXPECT_FALSE(
+      ParseFromCord(plan, MakeFragmentedCord("not a valid plan proto", 5)));
+}
+
+TEST(ParseFromStringOrCordTest, ParsesStringAndCord) {
+  ClientOnlyPlan expected_plan = CreatePlan();
+  std::string serialized_plan = expected_plan.SerializeAsString();
+
+  ClientOnlyPlan plan_from_string;
+  ASSERT_TRUE(ParseFromStringOrCord(plan_from_string, serialized_plan));
+  EXPECT_THAT(plan_from_string, EqualsProto(expected_plan));
+
+  ClientOnlyPlan plan_from_cord;
+  ASSERT_TRUE(ParseFromStringOrCord(
+      plan_from_cord, MakeFragmentedCord(serialized_plan, 1000)));
+  EXPECT_THAT(plan_from_cord, EqualsProto(expected_plan));
+}
+
+TEST(ComputeSHA256FromStringOrCordTest, MatchesKnownDigest) {
+  // The SHA-256 digest of "abc", from FIPS 180-2.
+  const std::string expected_digest = absl::HexStringToBytes(
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  EXPECT_EQ(ComputeSHA256FromStringOrCord(std::string("abc")),
+            expected_digest);
+  EXPECT_EQ(ComputeSHA256FromStringOrCord(MakeFragmentedCord("abc", 1)),
+            expected_digest);
+}
+
+TEST(ComputeSHA256FromStringOrCordTest, HashesAllOfTheData) {
+  std::string data(100000, 'x');
+  std::string other_data = data;
+  other_data.back() = 'y';
+  std::string digest = ComputeSHA256FromStringOrCord(data);
+  EXPECT_EQ(digest.size(), 32);
+  EXPECT_EQ(ComputeSHA256FromStringOrCord(MakeFragmentedCord(data, 4096)),
+            digest);
+  EXPECT_NE(ComputeSHA256FromStringOrCord(other_data), digest);
+}
+
+}  // namespace
+}  // namespace client
+}  // namespace fcp
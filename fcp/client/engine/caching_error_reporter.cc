@@ -44,6 +44,11 @@ std::vector<std::string> CachingErrorReporter::error_messages() {
   return error_messages_;
 }
 
+void CachingErrorReporter::Clear() {
+  absl::MutexLock lock(&mutex_);
+  error_messages_.clear();
+}
+
 }  // namespace engine
 }  // namespace client
 }  // namespace fcp
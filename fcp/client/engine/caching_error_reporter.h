@@ -32,6 +32,8 @@ class CachingErrorReporter : public tflite::ErrorReporter {
   int Report(const char* format, va_list args) override
       ABSL_LOCKS_EXCLUDED(mutex_);
   std::vector<std::string> error_messages() ABSL_LOCKS_EXCLUDED(mutex_);
+  // Drops all stored error messages.
+  void Clear() ABSL_LOCKS_EXCLUDED(mutex_);
 
  private:
   absl::Mutex mutex_;
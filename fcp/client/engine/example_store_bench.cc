@@ -0,0 +1,451 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for the path examples take from a SimpleTaskEnvironment's example
+// store into a plan, i.e. ExampleIterator -> the ExternalDatasetProvider
+// registered by AddDatasetTokenToInputs(ForTfLite) -> the ExternalDataset op
+// -> the TensorFlow graph (or, via the Flex delegate, the TFLite model).
+//
+// Each benchmark reports examples/s (items_per_second) and bytes/s. The
+// per-example overhead of the path is the difference between the time per
+// example of a benchmark and that of BM_DrainExampleStore for the same store.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/engine/example_iterator_factory.h"
+#include "fcp/client/engine/plan_engine_helpers.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
+#include "fcp/client/engine/tflite_wrapper.h"
+#include "fcp/client/interruptible_runner.h"
+#include "fcp/client/opstats/opstats_logger.h"
+#include "fcp/client/simple_task_environment.h"
+#include "fcp/client/test_helpers.h"
+#include "fcp/protos/plan.pb.h"
+#include "fcp/tensorflow/host_object.h"
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/core/framework/function.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/string_util.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+using ::google::internal::federated::plan::ExampleSelector;
+
+constexpr char kDatasetTokenName[] = "dataset_token";
+constexpr char kExampleCountName[] = "example_count";
+constexpr char kExamplesName[] = "examples";
+constexpr char kLengthModelPath[] =
+    "fcp/client/engine/data/length_model.flatbuffer";
+
+// An example store holding `num_examples` synthetic examples of `example_size`
+// bytes each, all of which are returned for any query.
+class SyntheticExampleStore : public SimpleTaskEnvironment {
+ public:
+  SyntheticExampleStore(int64_t num_examples, int64_t example_size)
+      : num_examples_(num_examples), example_size_(example_size) {}
+
+  std::string GetBaseDir() override { return ""; }
+  absl::StatusOr<std::unique_ptr<ExampleIterator>> CreateExampleIterator(
+      const ExampleSelector& example_selector) override {
+    return std::make_unique<RepeatedExampleIterator>(example_size_,
+                                                     num_examples_);
+  }
+
+ private:
+  bool TrainingConditionsSatisfied() override { return true; }
+
+  const int64_t num_examples_;
+  const int64_t example_size_;
+};
+
+// Registers an example store's examples for a plan the way the plan engines
+// do, i.e. through the same ExampleIteratorFactory as the runners use.
+class ExampleStoreInputs {
+ public:
+  explicit ExampleStoreInputs(SimpleTaskEnvironment* example_store)
+      : example_iterator_factory_(
+            [example_store](const ExampleSelector& example_selector) {
+              return example_store->CreateExampleIterator(example_selector);
+            }) {}
+
+  HostObjectRegistration AddTo(
+      std::vector<std::pair<std::string, tensorflow::Tensor>>* inputs) {
+    return AddDatasetTokenToInputs(
+        {&example_iterator_factory_}, &opstats_logger_, &flags_, inputs,
+        kDatasetTokenName, &total_example_count_, &total_example_size_bytes_,
+        &example_iterator_status_);
+  }
+  HostObjectRegistration AddTo(
+      absl::flat_hash_map<std::string, std::string>* inputs) {
+    return AddDatasetTokenToInputsForTfLite(
+        {&example_iterator_factory_}, &opstats_logger_, &flags_, inputs,
+        kDatasetTokenName, &total_example_count_, &total_example_size_bytes_,
+        &example_iterator_status_);
+  }
+
+ private:
+  FunctionalExampleIteratorFactory example_iterator_factory_;
+  opstats::OpStatsLogger opstats_logger_{/*opstats_enabled=*/false};
+  ::testing::NiceMock<MockFlags> flags_;
+  std::atomic<int> total_example_count_ = 0;
+  std::atomic<int64_t> total_example_size_bytes_ = 0;
+  ExampleIteratorStatus example_iterator_status_;
+};
+
+// Returns a graph which counts the examples of an ExternalDataset with the
+// given batch size, i.e. which does as little as possible with each example.
+tensorflow::GraphDef CreateCountingGraph(int64_t batch_size) {
+  using ::tensorflow::DT_INT64;
+  using ::tensorflow::DT_STRING;
+  using ::tensorflow::DT_VARIANT;
+  using ::tensorflow::FunctionDefHelper;
+  using ::tensorflow::NodeDefBuilder;
+
+  tensorflow::GraphDef graph;
+  // Adds the number of examples in a dataset element (i.e. 1, or the size of
+  // the batch) to the count.
+  *graph.mutable_library()->add_function() = FunctionDefHelper::Create(
+      "CountExamples", {"count: int64", "examples: string"},
+      {"new_count: int64"}, {},
+      {{{"size"},
+        "Size",
+        {"examples"},
+        {{"T", DT_STRING}, {"out_type", DT_INT64}}},
+       {{"sum"}, "AddV2", {"count", "size:output:0"}, {{"T", DT_INT64}}}},
+      {{"new_count", "sum:z:0"}});
+  tensorflow::NameAttrList count_examples;
+  count_examples.set_name("CountExamples");
+
+  tensorflow::Tensor selector(DT_STRING, {});
+  selector.scalar<tensorflow::tstring>()() =
+      ExampleSelector().SerializeAsString();
+  TF_CHECK_OK(NodeDefBuilder(kDatasetTokenName, "Placeholder")
+                  .Attr("dtype", DT_STRING)
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(NodeDefBuilder("selector", "Const")
+                  .Attr("dtype", DT_STRING)
+                  .Attr("value", selector)
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(NodeDefBuilder("initial_count", "Const")
+                  .Attr("dtype", DT_INT64)
+                  .Attr("value", tensorflow::Tensor(int64_t{0}))
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(NodeDefBuilder("dataset", "ExternalDataset")
+                  .Input(kDatasetTokenName, 0, DT_STRING)
+                  .Input("selector", 0, DT_STRING)
+                  .Attr("batch_size", batch_size)
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(
+      NodeDefBuilder(kExampleCountName, "ReduceDataset")
+          .Input("dataset", 0, DT_VARIANT)
+          .Input(std::vector<NodeDefBuilder::NodeOut>{
+              {"initial_count", 0, DT_INT64}})
+          .Input(std::vector<NodeDefBuilder::NodeOut>{})
+          .Attr("f", count_examples)
+          .Attr("Targuments", tensorflow::DataTypeVector{})
+          .Attr("output_types", tensorflow::DataTypeVector{DT_INT64})
+          .Attr("output_shapes", std::vector<tensorflow::PartialTensorShape>{
+                                     tensorflow::PartialTensorShape({})})
+          .Finalize(graph.add_node()));
+  return graph;
+}
+
+// Returns the custom options of a TFLite op run by the Flex delegate, which
+// hold the op's name and its NodeDef.
+std::vector<uint8_t> CreateFlexOpOptions(const tensorflow::NodeDef& node_def) {
+  flexbuffers::Builder builder;
+  builder.Vector([&]() {
+    builder.String(node_def.op());
+    builder.String(node_def.SerializeAsString());
+  });
+  builder.Finish();
+  return builder.GetBuffer();
+}
+
+// Returns a TFLite model which reads all examples of an ExternalDataset into
+// a single string tensor `examples`, the way a TFLite plan reads its examples:
+// through the ExternalDataset op, run by the Flex delegate. `batch_size` must
+// be at least the number of examples.
+std::string CreateReadExamplesModel(int64_t batch_size) {
+  using ::tensorflow::DT_STRING;
+  using ::tensorflow::DT_VARIANT;
+  using ::tensorflow::NodeDefBuilder;
+
+  tensorflow::NodeDef dataset;
+  TF_CHECK_OK(NodeDefBuilder("dataset", "ExternalDataset")
+                  .Input(kDatasetTokenName, 0, DT_STRING)
+                  .Input("selector", 0, DT_STRING)
+                  .Attr("batch_size", batch_size)
+                  .Finalize(&dataset));
+  tensorflow::NodeDef examples;
+  TF_CHECK_OK(
+      NodeDefBuilder(kExamplesName, "DatasetToSingleElement")
+          .Input("dataset", 0, DT_VARIANT)
+          .Attr("output_types", tensorflow::DataTypeVector{DT_STRING})
+          .Attr("output_shapes", std::vector<tensorflow::PartialTensorShape>{
+                                     tensorflow::PartialTensorShape({-1})})
+          .Finalize(&examples));
+
+  // The selector is a constant string tensor, in TFLite's string buffer
+  // format.
+  tflite::DynamicBuffer selector_buffer;
+  std::string selector = ExampleSelector().SerializeAsString();
+  selector_buffer.AddString(selector.data(), selector.size());
+  char* selector_data = nullptr;
+  size_t selector_size = selector_buffer.WriteToBuffer(&selector_data);
+  std::vector<uint8_t> selector_bytes(selector_data,
+                                      selector_data + selector_size);
+  free(selector_data);
+
+  flatbuffers::FlatBufferBuilder builder;
+  auto int_vector = [&builder](const std::vector<int32_t>& values) {
+    return builder.CreateVector(values);
+  };
+  std::vector<flatbuffers::Offset<tflite::Buffer>> buffers = {
+      // Buffer 0 is the empty buffer of all tensors without data.
+      tflite::CreateBuffer(builder),
+      tflite::CreateBuffer(builder, builder.CreateVector(selector_bytes))};
+  std::vector<flatbuffers::Offset<tflite::Tensor>> tensors = {
+      tflite::CreateTensor(builder, int_vector({}),
+                           tflite::TensorType_STRING, /*buffer=*/0,
+                           builder.CreateString(kDatasetTokenName)),
+      tflite::CreateTensor(builder, int_vector({}),
+                           tflite::TensorType_STRING, /*buffer=*/1,
+                           builder.CreateString("selector")),
+      tflite::CreateTensor(builder, int_vector({}),
+                           tflite::TensorType_VARIANT, /*buffer=*/0,
+                           builder.CreateString("dataset")),
+      tflite::CreateTensor(
+          builder, int_vector({static_cast<int32_t>(batch_size)}),
+          tflite::TensorType_STRING, /*buffer=*/0,
+          builder.CreateString(kExamplesName), /*quantization=*/0,
+          /*is_variable=*/false, /*sparsity=*/0,
+          /*shape_signature=*/int_vector({-1}))};
+  std::vector<flatbuffers::Offset<tflite::OperatorCode>> operator_codes;
+  std::vector<flatbuffers::Offset<tflite::Operator>> operators;
+  auto add_flex_op = [&](const tensorflow::NodeDef& node_def,
+                         const std::vector<int32_t>& inputs,
+                         const std::vector<int32_t>& outputs) {
+    operator_codes.push_back(tflite::CreateOperatorCode(
+        builder, tflite::BuiltinOperator_CUSTOM,
+        builder.CreateString(absl::StrCat("Flex", node_def.op())),
+        /*version=*/1, tflite::BuiltinOperator_CUSTOM));
+    operators.push_back(tflite::CreateOperator(
+        builder, /*opcode_index=*/operator_codes.size() - 1,
+        int_vector(inputs), int_vector(outputs),
+        tflite::BuiltinOptions_NONE, /*builtin_options=*/0,
+        builder.CreateVector(CreateFlexOpOptions(node_def)),
+        tflite::CustomOptionsFormat_FLEXBUFFERS));
+  };
+  add_flex_op(dataset, /*inputs=*/{0, 1}, /*outputs=*/{2});
+  add_flex_op(examples, /*inputs=*/{2}, /*outputs=*/{3});
+  auto subgraph = tflite::CreateSubGraph(
+      builder, builder.CreateVector(tensors),
+      /*inputs=*/int_vector({0}),
+      /*outputs=*/int_vector({3}),
+      builder.CreateVector(operators));
+  std::vector<flatbuffers::Offset<tflite::SubGraph>> subgraphs = {subgraph};
+  tflite::FinishModelBuffer(
+      builder,
+      tflite::CreateModel(builder, TFLITE_SCHEMA_VERSION,
+                          builder.CreateVector(operator_codes),
+                          builder.CreateVector(subgraphs),
+                          /*description=*/0, builder.CreateVector(buffers)));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+std::unique_ptr<tensorflow::Session> CreateSession(
+    const tensorflow::GraphDef& graph) {
+  tensorflow::Session* session = nullptr;
+  TF_CHECK_OK(tensorflow::NewSession(tensorflow::SessionOptions(), &session));
+  TF_CHECK_OK(session->Create(graph));
+  return std::unique_ptr<tensorflow::Session>(session);
+}
+
+void SetProcessed(benchmark::State& state, int64_t examples_per_iteration,
+                  int64_t example_size) {
+  state.SetItemsProcessed(state.iterations() * examples_per_iteration);
+  state.SetBytesProcessed(state.iterations() * examples_per_iteration *
+                          example_size);
+}
+
+// Takes the number of examples and their size as arguments.
+void ExampleStoreArgs(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t num_examples : {1000, 10000}) {
+    for (int64_t example_size : {64, 1024, 16384}) {
+      benchmark->Args({num_examples, example_size});
+    }
+  }
+}
+
+// Additionally takes the batch size of the ExternalDataset op (0 meaning
+// unbatched) as the third argument.
+void BatchedExampleStoreArgs(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t num_examples : {1000, 10000}) {
+    for (int64_t example_size : {64, 1024, 16384}) {
+      for (int64_t batch_size : {0, 64}) {
+        benchmark->Args({num_examples, example_size, batch_size});
+      }
+    }
+  }
+}
+
+// Reads all examples from the example store itself, which is the baseline for
+// the per-example overhead of the other benchmarks.
+void BM_DrainExampleStore(benchmark::State& state) {
+  const int64_t num_examples = state.range(0);
+  SyntheticExampleStore example_store(num_examples, state.range(1));
+  for (auto s : state) {
+    std::unique_ptr<ExampleIterator> iterator =
+        example_store.CreateExampleIterator(ExampleSelector()).value();
+    while (true) {
+      absl::StatusOr<std::string> example = iterator->Next();
+      if (!example.ok()) break;
+      benchmark::DoNotOptimize(example);
+    }
+  }
+  SetProcessed(state, num_examples, state.range(1));
+}
+
+// Runs a graph counting all examples of the example store, i.e. covers the
+// whole path of the examples into a TensorFlow plan.
+void BM_TensorFlowCountExamples(benchmark::State& state) {
+  const int64_t num_examples = state.range(0);
+  SyntheticExampleStore example_store(num_examples, state.range(1));
+  ExampleStoreInputs example_store_inputs(&example_store);
+  std::unique_ptr<tensorflow::Session> session =
+      CreateSession(CreateCountingGraph(/*batch_size=*/state.range(2)));
+  for (auto s : state) {
+    std::vector<std::pair<std::string, tensorflow::Tensor>> inputs;
+    HostObjectRegistration registration = example_store_inputs.AddTo(&inputs);
+    std::vector<tensorflow::Tensor> outputs;
+    TF_CHECK_OK(session->Run(inputs, {kExampleCountName}, {}, &outputs));
+    FCP_CHECK(outputs.at(0).scalar<int64_t>()() == num_examples);
+  }
+  SetProcessed(state, num_examples, state.range(1));
+}
+
+// Runs a TFLite model reading all examples of the example store, i.e. covers
+// the whole path of the examples into a TFLite plan: the ExternalDataset op run
+// by the Flex delegate, and the copy of its output into the interpreter.
+void BM_TfLiteReadExamples(benchmark::State& state) {
+  const int64_t num_examples = state.range(0);
+  SyntheticExampleStore example_store(num_examples, state.range(1));
+  ExampleStoreInputs example_store_inputs(&example_store);
+  const std::string model = CreateReadExamplesModel(num_examples);
+  ::testing::NiceMock<MockLogManager> log_manager;
+  InterruptibleRunner::TimingConfig timing_config{
+      .polling_period = absl::InfiniteDuration(),
+      .graceful_shutdown_period = absl::Milliseconds(1000),
+      .extended_shutdown_period = absl::Milliseconds(2000)};
+  TfLiteInterpreterCache interpreter_cache(/*max_interpreters=*/1);
+  for (auto s : state) {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    HostObjectRegistration registration =
+        example_store_inputs.AddTo(inputs.get());
+    auto wrapper = TfLiteWrapper::Create(
+        model, []() { return false; }, timing_config, &log_manager,
+        std::move(inputs), {kExamplesName}, TfLiteInterpreterOptions(),
+        &interpreter_cache);
+    FCP_CHECK_STATUS(wrapper.status());
+    absl::StatusOr<OutputTensors> outputs = (*wrapper)->Run();
+    FCP_CHECK_STATUS(outputs.status());
+    FCP_CHECK(outputs->output_tensors.at(0).NumElements() == num_examples);
+  }
+  SetProcessed(state, num_examples, state.range(1));
+}
+
+// Runs the length model on each example of the example store, reusing a
+// cached interpreter, i.e. covers what running a TFLite model costs per
+// example.
+void BM_TfLiteLengthModel(benchmark::State& state) {
+  const int64_t example_size = state.range(0);
+  std::ifstream model_stream(kLengthModelPath);
+  FCP_CHECK(model_stream) << "Failed to open " << kLengthModelPath;
+  std::stringstream model_buffer;
+  model_buffer << model_stream.rdbuf();
+  const std::string model = model_buffer.str();
+  ::testing::NiceMock<MockLogManager> log_manager;
+  InterruptibleRunner::TimingConfig timing_config{
+      .polling_period = absl::InfiniteDuration(),
+      .graceful_shutdown_period = absl::Milliseconds(1000),
+      .extended_shutdown_period = absl::Milliseconds(2000)};
+  TfLiteInterpreterCache interpreter_cache(/*max_interpreters=*/1);
+  SyntheticExampleStore example_store(/*num_examples=*/1, example_size);
+  for (auto s : state) {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    std::unique_ptr<ExampleIterator> iterator =
+        example_store.CreateExampleIterator(ExampleSelector()).value();
+    (*inputs)["x"] = iterator->Next().value();
+    auto wrapper = TfLiteWrapper::Create(
+        model, []() { return false; }, timing_config, &log_manager,
+        std::move(inputs), {"Identity"}, TfLiteInterpreterOptions(),
+        &interpreter_cache);
+    FCP_CHECK_STATUS(wrapper.status());
+    absl::StatusOr<OutputTensors> outputs = (*wrapper)->Run();
+    FCP_CHECK_STATUS(outputs.status());
+    FCP_CHECK(outputs->output_tensors.at(0).scalar<int32_t>()() ==
+              example_size);
+  }
+  SetProcessed(state, /*examples_per_iteration=*/1, example_size);
+}
+
+BENCHMARK(BM_DrainExampleStore)
+    ->Apply(ExampleStoreArgs)
+    ->ArgNames({"examples", "size"});
+BENCHMARK(BM_TensorFlowCountExamples)
+    ->Apply(BatchedExampleStoreArgs)
+    ->ArgNames({"examples", "size", "batch"});
+BENCHMARK(BM_TfLiteReadExamples)
+    ->Apply(ExampleStoreArgs)
+    ->ArgNames({"examples", "size"});
+BENCHMARK(BM_TfLiteLengthModel)->RangeMultiplier(16)->Range(64, 16384);
+
+}  // namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
@@ -15,13 +15,18 @@
  */
 #include "fcp/client/engine/plan_engine_helpers.h"
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/status/statusor.h"
+#include "fcp/base/scheduler.h"
 #include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/engine/prefetching_example_iterator.h"
+#include "fcp/client/flags.h"
 #include "fcp/client/opstats/opstats_logger.h"
 #include "fcp/client/opstats/opstats_logger_impl.h"
 #include "fcp/client/opstats/pds_backed_opstats_db.h"
@@ -38,6 +43,29 @@ using ::fcp::client::opstats::OpStatsLoggerImpl;
 using ::fcp::client::opstats::PdsBackedOpStatsDb;
 using ::google::internal::federated::plan::ExampleSelector;
 
+// The number of threads that example iterators are read ahead on. A thread is
+// only taken up while it waits for the example store, so a few of them are
+// enough for all of the datasets a plan reads at once.
+constexpr int kNumExamplePrefetchThreads = 4;
+
+// Returns the scheduler that example iterators are read ahead on. It is shared
+// by all iterators, and is only created once it's first needed.
+Scheduler& GetExamplePrefetchScheduler() {
+  static Scheduler* const scheduler =
+      CreateThreadPoolScheduler(kNumExamplePrefetchThreads).release();
+  return *scheduler;
+}
+
+// Forwards examples from an ExampleIterator to TensorFlow, and records stats
+// about them.
+//
+// GetNext may be called from multiple TensorFlow threads, but it is already
+// serialized by `iterator_lock_` (since ExampleIterator isn't thread-safe), so
+// the per-dataset stats are plain counters guarded by that same lock. The
+// stats shared by all iterators are updated as the examples are read (once
+// per call, i.e. once per batch when reading batches), with relaxed atomic
+// adds, so that they are complete as soon as the plan has finished running.
+// `example_iterator_status_` is only updated when an error occurs.
 class DatasetIterator : public ExternalDatasetIterator {
  public:
   DatasetIterator(std::unique_ptr<ExampleIterator> example_iterator,
@@ -52,14 +80,13 @@ class DatasetIterator : public ExternalDatasetIterator {
         total_example_count_(total_example_count),
         total_example_size_bytes_(total_example_size_bytes),
         example_iterator_status_(example_iterator_status),
-        example_count_(0),
-        example_size_bytes_(0),
         collection_uri_(collection_uri),
         iterator_finished_(false),
         collect_stats_(collect_stats) {}
 
   ~DatasetIterator() override {
     if (collect_stats_) {
+      absl::MutexLock locked(&iterator_lock_);
       opstats_logger_->UpdateDatasetStats(collection_uri_, example_count_,
                                           example_size_bytes_);
     }
@@ -72,26 +99,125 @@ class DatasetIterator : public ExternalDatasetIterator {
       return absl::OutOfRangeError("End of iterator reached");
     }
     absl::StatusOr<std::string> example = example_iterator_->Next();
-    absl::StatusCode error_code = example.status().code();
-      example_iterator_status_->SetStatus(example.status());
-      if (error_code == absl::StatusCode::kOutOfRange) {
-        example_iterator_->Close();
-        iterator_finished_ = true;
-      }
-    // If we're not forwarding an OUT_OF_RANGE to the caller, record example
-    // stats for metrics logging.
-      if (collect_stats_ && example.ok()) {
-        // TODO(team): Consider reducing logic duplication in
-        // cross-dataset and single-dataset example stat variables.
-        *total_example_count_ += 1;
-        *total_example_size_bytes_ += example->size();
-        example_count_ += 1;
-        example_size_bytes_ += example->size();
-      }
+    if (example.ok()) {
+      // If we're not forwarding an OUT_OF_RANGE to the caller, record example
+      // stats for metrics logging.
+      RecordExamplesLocked(1, example->size());
+    } else {
+      HandleErrorLocked(example.status());
+    }
     return example;
   }
 
+  absl::Status GetNextInto(
+      const std::function<char*(size_t size)>& allocate) final {
+    absl::MutexLock locked(&iterator_lock_);
+    if (iterator_finished_) {
+      // If we've reached the end of the iterator, always return OUT_OF_RANGE.
+      return absl::OutOfRangeError("End of iterator reached");
+    }
+    size_t example_size = 0;
+    absl::Status status =
+        example_iterator_->NextInto([&allocate, &example_size](size_t size) {
+          example_size = size;
+          return allocate(size);
+        });
+    if (status.ok()) {
+      RecordExamplesLocked(1, example_size);
+    } else {
+      HandleErrorLocked(status);
+    }
+    return status;
+  }
+
+  absl::StatusOr<std::vector<std::string>> GetNextBatch(
+      int max_count, int64_t max_bytes) final {
+    absl::MutexLock locked(&iterator_lock_);
+    if (iterator_finished_) {
+      // If we've reached the end of the iterator, always return OUT_OF_RANGE.
+      return absl::OutOfRangeError("End of iterator reached");
+    }
+    absl::StatusOr<std::vector<std::string>> batch =
+        example_iterator_->NextBatch(max_count, max_bytes);
+    if (batch.ok()) {
+      if (collect_stats_) {
+        int64_t batch_size_bytes = 0;
+        for (const std::string& example : *batch) {
+          batch_size_bytes += example.size();
+        }
+        RecordExamplesLocked(static_cast<int>(batch->size()),
+                             batch_size_bytes);
+      }
+    } else {
+      HandleErrorLocked(batch.status());
+    }
+    return batch;
+  }
+
+  absl::Status GetNextBatchInto(
+      int max_count, int64_t max_bytes,
+      const std::function<char*(size_t size)>& allocate) final {
+    absl::MutexLock locked(&iterator_lock_);
+    if (iterator_finished_) {
+      // If we've reached the end of the iterator, always return OUT_OF_RANGE.
+      return absl::OutOfRangeError("End of iterator reached");
+    }
+    int batch_size = 0;
+    int64_t batch_size_bytes = 0;
+    absl::Status status = example_iterator_->NextBatchInto(
+        max_count, max_bytes,
+        [&allocate, &batch_size, &batch_size_bytes](size_t size) {
+          ++batch_size;
+          batch_size_bytes += size;
+          return allocate(size);
+        });
+    if (status.ok()) {
+      RecordExamplesLocked(batch_size, batch_size_bytes);
+    } else {
+      HandleErrorLocked(status);
+    }
+    return status;
+  }
+
+  absl::Status Skip(int64_t count) final {
+    absl::MutexLock locked(&iterator_lock_);
+    if (iterator_finished_) return absl::OkStatus();
+    // The skipped examples were already used by the run the iterator's
+    // position was saved from, so they aren't counted again.
+    absl::Status status = example_iterator_->Skip(count);
+    if (!status.ok()) {
+      HandleErrorLocked(status);
+    }
+    return status;
+  }
+
  private:
+  // Closes the iterator once its end has been reached, or records any other
+  // error.
+  void HandleErrorLocked(const absl::Status& status)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(iterator_lock_) {
+    if (status.code() == absl::StatusCode::kOutOfRange) {
+      example_iterator_->Close();
+      iterator_finished_ = true;
+    } else {
+      example_iterator_status_->SetStatus(status);
+    }
+  }
+
+  // Records the stats of examples returned by the iterator, both for this
+  // dataset and across all datasets.
+  void RecordExamplesLocked(int count, int64_t size_bytes)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(iterator_lock_) {
+    if (!collect_stats_) return;
+    // TODO(team): Consider reducing logic duplication in cross-dataset and
+    // single-dataset example stat variables.
+    total_example_count_->fetch_add(count, std::memory_order_relaxed);
+    total_example_size_bytes_->fetch_add(size_bytes,
+                                         std::memory_order_relaxed);
+    example_count_ += count;
+    example_size_bytes_ += size_bytes;
+  }
+
   std::unique_ptr<ExampleIterator> example_iterator_
       ABSL_GUARDED_BY(iterator_lock_);
   OpStatsLogger* opstats_logger_;
@@ -101,8 +227,8 @@ class DatasetIterator : public ExternalDatasetIterator {
   std::atomic<int64_t>* total_example_size_bytes_;
   ExampleIteratorStatus* example_iterator_status_;
   // Example stats only for this dataset.
-  std::atomic<int> example_count_;
-  std::atomic<int64_t> example_size_bytes_;
+  int example_count_ ABSL_GUARDED_BY(iterator_lock_) = 0;
+  int64_t example_size_bytes_ ABSL_GUARDED_BY(iterator_lock_) = 0;
   const std::string collection_uri_;
   bool iterator_finished_ ABSL_GUARDED_BY(iterator_lock_);
   const bool collect_stats_;
@@ -137,11 +263,14 @@ class TrainingDatasetProvider
  public:
   TrainingDatasetProvider(
       std::vector<ExampleIteratorFactory*> example_iterator_factories,
-      OpStatsLogger* opstats_logger, std::atomic<int>* total_example_count,
+      OpStatsLogger* opstats_logger, const Flags* flags,
+      std::atomic<int>* total_example_count,
       std::atomic<int64_t>* total_example_size_bytes,
       ExampleIteratorStatus* example_iterator_status)
       : example_iterator_factories_(example_iterator_factories),
         opstats_logger_(opstats_logger),
+        prefetch_count_(flags->example_iterator_prefetch_count()),
+        prefetch_bytes_(flags->example_iterator_prefetch_bytes()),
         total_example_count_(total_example_count),
         total_example_size_bytes_(total_example_size_bytes),
         example_iterator_status_(example_iterator_status) {}
@@ -150,7 +279,8 @@ class TrainingDatasetProvider
       ExampleSelector selector) final {
     return ExternalDataset::FromFunction(
         [example_iterator_factories = example_iterator_factories_,
-         opstats_logger = opstats_logger_, selector,
+         opstats_logger = opstats_logger_, prefetch_count = prefetch_count_,
+         prefetch_bytes = prefetch_bytes_, selector,
          total_example_count = total_example_count_,
          total_example_size_bytes = total_example_size_bytes_,
          example_iterator_status = example_iterator_status_]()
@@ -173,6 +303,13 @@ class TrainingDatasetProvider
             return std::make_unique<FailingDatasetIterator>(
                 example_iterator.status());
           }
+          if (prefetch_count > 0) {
+            // Read examples ahead of the plan, so that the example store's
+            // latency overlaps with the plan's computation.
+            *example_iterator = std::make_unique<PrefetchingExampleIterator>(
+                std::move(*example_iterator), prefetch_count, prefetch_bytes,
+                GetExamplePrefetchScheduler());
+          }
           return std::make_unique<DatasetIterator>(
               std::move(*example_iterator), opstats_logger, total_example_count,
               total_example_size_bytes, example_iterator_status,
@@ -184,6 +321,8 @@ class TrainingDatasetProvider
  private:
   std::vector<ExampleIteratorFactory*> example_iterator_factories_;
   OpStatsLogger* opstats_logger_;
+  const int prefetch_count_;
+  const int64_t prefetch_bytes_;
   std::atomic<int>* total_example_count_;
   std::atomic<int64_t>* total_example_size_bytes_;
   ExampleIteratorStatus* example_iterator_status_;
@@ -209,7 +348,7 @@ absl::Status ExampleIteratorStatus::GetStatus() {
 
 HostObjectRegistration AddDatasetTokenToInputs(
     std::vector<ExampleIteratorFactory*> example_iterator_factories,
-    OpStatsLogger* opstats_logger,
+    OpStatsLogger* opstats_logger, const Flags* flags,
     std::vector<std::pair<std::string, tensorflow::Tensor>>* inputs,
     const std::string& dataset_token_tensor_name,
     std::atomic<int>* total_example_count,
@@ -219,8 +358,9 @@ HostObjectRegistration AddDatasetTokenToInputs(
   // ExternalDatasetProviderRegistry.
   auto host_registration = fcp::ExternalDatasetProviderRegistry::Register(
       std::make_shared<TrainingDatasetProvider>(
-          example_iterator_factories, opstats_logger, total_example_count,
-          total_example_size_bytes, example_iterator_status));
+          example_iterator_factories, opstats_logger, flags,
+          total_example_count, total_example_size_bytes,
+          example_iterator_status));
   // Pack the token returned from registering the provider into a std::string
   // tensor. TensorFlow will use that token via the ExternalDatasetOp to create
   // datasets and iterators.
@@ -235,7 +375,7 @@ HostObjectRegistration AddDatasetTokenToInputs(
 
 HostObjectRegistration AddDatasetTokenToInputsForTfLite(
     std::vector<ExampleIteratorFactory*> example_iterator_factories,
-    OpStatsLogger* opstats_logger,
+    OpStatsLogger* opstats_logger, const Flags* flags,
     absl::flat_hash_map<std::string, std::string>* inputs,
     const std::string& dataset_token_tensor_name,
     std::atomic<int>* total_example_count,
@@ -245,8 +385,9 @@ HostObjectRegistration AddDatasetTokenToInputsForTfLite(
   // ExternalDatasetProviderRegistry.
   auto host_registration = fcp::ExternalDatasetProviderRegistry::Register(
       std::make_shared<TrainingDatasetProvider>(
-          example_iterator_factories, opstats_logger, total_example_count,
-          total_example_size_bytes, example_iterator_status));
+          example_iterator_factories, opstats_logger, flags,
+          total_example_count, total_example_size_bytes,
+          example_iterator_status));
   // Adds the token returned from registering the provider to the map of inputs.
   // TfLite will use that token via the ExternalDatasetOp to create
   // datasets and iterators.
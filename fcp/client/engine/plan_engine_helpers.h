@@ -99,9 +99,12 @@ class ExampleIteratorStatus {
 // `example_iterator_factories` parameter will be iterated and the first
 // iterator factory that can handle the given query will be used to create the
 // example iterator to handle that query.
+//
+// If `flags` enables example prefetching, each example iterator is read ahead
+// of the plan on a background thread (see `PrefetchingExampleIterator`).
 HostObjectRegistration AddDatasetTokenToInputs(
     std::vector<ExampleIteratorFactory*> example_iterator_factories,
-    ::fcp::client::opstats::OpStatsLogger* opstats_logger,
+    ::fcp::client::opstats::OpStatsLogger* opstats_logger, const Flags* flags,
     std::vector<std::pair<std::string, tensorflow::Tensor>>* inputs,
     const std::string& dataset_token_tensor_name,
     std::atomic<int>* total_example_count,
@@ -119,7 +122,7 @@ HostObjectRegistration AddDatasetTokenToInputs(
 // example iterator to handle that query.
 HostObjectRegistration AddDatasetTokenToInputsForTfLite(
     std::vector<ExampleIteratorFactory*> example_iterator_factories,
-    ::fcp::client::opstats::OpStatsLogger* opstats_logger,
+    ::fcp::client::opstats::OpStatsLogger* opstats_logger, const Flags* flags,
     absl::flat_hash_map<std::string, std::string>* inputs,
     const std::string& dataset_token_tensor_name,
     std::atomic<int>* total_example_count,
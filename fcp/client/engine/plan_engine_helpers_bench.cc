@@ -0,0 +1,176 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "absl/status/statusor.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/engine/example_iterator_factory.h"
+#include "fcp/client/engine/plan_engine_helpers.h"
+#include "fcp/client/opstats/opstats_logger.h"
+#include "fcp/client/simple_task_environment.h"
+#include "fcp/client/test_helpers.h"
+#include "fcp/protos/plan.pb.h"
+#include "fcp/tensorflow/external_dataset.h"
+#include "fcp/tensorflow/host_object.h"
+#include "tensorflow/core/framework/tensor.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+using ::google::internal::federated::plan::ExampleSelector;
+
+constexpr int64_t kExampleSize = 256;
+
+// A dataset registered the same way the plan engines register theirs, i.e.
+// whose iterators are the ones the ExternalDataset op pulls examples from,
+// without the TensorFlow runtime around them.
+class BenchmarkDataset {
+ public:
+  explicit BenchmarkDataset(int64_t example_size = kExampleSize)
+      : example_iterator_factory_(
+            [example_size](const ExampleSelector&)
+                -> absl::StatusOr<std::unique_ptr<ExampleIterator>> {
+              return std::make_unique<RepeatedExampleIterator>(example_size);
+            }),
+        registration_(AddDatasetTokenToInputs(
+            {&example_iterator_factory_}, &opstats_logger_, &flags_, &inputs_,
+            "dataset_token", &total_example_count_, &total_example_size_bytes_,
+            &example_iterator_status_)) {
+    auto provider =
+        ExternalDatasetProviderRegistry::TryLookup(registration_.token());
+    FCP_CHECK(provider.has_value());
+    dataset_ =
+        (*provider)->MakeDataset(ExampleSelector().SerializeAsString()).value();
+    shared_iterator_ = dataset_->MakeIterator();
+  }
+
+  std::unique_ptr<ExternalDatasetIterator> MakeIterator() {
+    return dataset_->MakeIterator();
+  }
+  ExternalDatasetIterator& shared_iterator() { return *shared_iterator_; }
+
+ private:
+  FunctionalExampleIteratorFactory example_iterator_factory_;
+  opstats::OpStatsLogger opstats_logger_{/*opstats_enabled=*/false};
+  ::testing::NiceMock<MockFlags> flags_;
+  std::vector<std::pair<std::string, tensorflow::Tensor>> inputs_;
+  std::atomic<int> total_example_count_ = 0;
+  std::atomic<int64_t> total_example_size_bytes_ = 0;
+  ExampleIteratorStatus example_iterator_status_;
+  HostObjectRegistration registration_;
+  std::unique_ptr<ExternalDataset> dataset_;
+  std::unique_ptr<ExternalDatasetIterator> shared_iterator_;
+};
+
+BenchmarkDataset& GetBenchmarkDataset() {
+  static BenchmarkDataset* dataset = new BenchmarkDataset();
+  return *dataset;
+}
+
+// Several consumers pulling from the same iterator, as e.g. a parallel map over
+// the dataset does.
+void BM_GetNextSharedIterator(benchmark::State& state) {
+  ExternalDatasetIterator& iterator = GetBenchmarkDataset().shared_iterator();
+  for (auto s : state) {
+    benchmark::DoNotOptimize(iterator.GetNext());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Several consumers pulling from their own iterators over the same dataset, as
+// e.g. an interleave over several datasets does. The iterators only share the
+// stats across all datasets.
+void BM_GetNextIteratorPerConsumer(benchmark::State& state) {
+  std::unique_ptr<ExternalDatasetIterator> iterator =
+      GetBenchmarkDataset().MakeIterator();
+  for (auto s : state) {
+    benchmark::DoNotOptimize(iterator->GetNext());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Like BM_GetNextSharedIterator, but pulling batches of the given number of
+// examples at once, as the ExternalDataset op does in batched mode.
+void BM_GetNextBatchSharedIterator(benchmark::State& state) {
+  const int batch_size = state.range(0);
+  ExternalDatasetIterator& iterator = GetBenchmarkDataset().shared_iterator();
+  int64_t num_examples = 0;
+  for (auto s : state) {
+    absl::StatusOr<std::vector<std::string>> batch = iterator.GetNextBatch(
+        batch_size, std::numeric_limits<int64_t>::max());
+    num_examples += batch->size();
+  }
+  state.SetItemsProcessed(num_examples);
+}
+
+// Moves examples of the given size into TensorFlow string tensors the way the
+// ExternalDataset op used to, i.e. by copying the result of GetNext.
+void BM_GetNextCopyToTensor(benchmark::State& state) {
+  BenchmarkDataset dataset(state.range(0));
+  std::unique_ptr<ExternalDatasetIterator> iterator = dataset.MakeIterator();
+  for (auto s : state) {
+    tensorflow::Tensor tensor(tensorflow::DT_STRING, {});
+    absl::StatusOr<std::string> element = iterator->GetNext();
+    tensor.scalar<tensorflow::tstring>()() = *element;
+    benchmark::DoNotOptimize(tensor);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// Has examples of the given size written straight into TensorFlow string
+// tensors, the way the ExternalDataset op does.
+void BM_GetNextIntoTensor(benchmark::State& state) {
+  BenchmarkDataset dataset(state.range(0));
+  std::unique_ptr<ExternalDatasetIterator> iterator = dataset.MakeIterator();
+  for (auto s : state) {
+    tensorflow::Tensor tensor(tensorflow::DT_STRING, {});
+    tensorflow::tstring& element = tensor.scalar<tensorflow::tstring>()();
+    FCP_CHECK_STATUS(iterator->GetNextInto([&element](size_t size) {
+      element.resize_uninitialized(size);
+      return element.mdata();
+    }));
+    benchmark::DoNotOptimize(tensor);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_GetNextSharedIterator)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GetNextBatchSharedIterator)
+    ->RangeMultiplier(8)
+    ->Range(1, 512)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_GetNextIteratorPerConsumer)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GetNextCopyToTensor)->RangeMultiplier(16)->Range(64, 4 << 20);
+BENCHMARK(BM_GetNextIntoTensor)->RangeMultiplier(16)->Range(64, 4 << 20);
+
+}  // namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/prefetching_example_iterator.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/base/scheduler.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+PrefetchingExampleIterator::PrefetchingExampleIterator(
+    std::unique_ptr<ExampleIterator> iterator, int max_count,
+    int64_t max_bytes, Scheduler& scheduler)
+    : iterator_(std::move(iterator)),
+      max_count_(max_count),
+      max_bytes_(max_bytes),
+      scheduler_(scheduler) {
+  FCP_CHECK(max_count_ > 0);
+  FCP_CHECK(max_bytes_ > 0);
+  absl::MutexLock lock(&mutex_);
+  MaybeSchedulePrefetchLocked();
+}
+
+PrefetchingExampleIterator::~PrefetchingExampleIterator() { Close(); }
+
+bool PrefetchingExampleIterator::HasRoomLocked() {
+  return static_cast<int>(buffer_.size()) < max_count_ &&
+         buffered_bytes_ < max_bytes_;
+}
+
+void PrefetchingExampleIterator::MaybeSchedulePrefetchLocked() {
+  if (closed_ || prefetching_ || skipping_ || underlying_finished_ ||
+      !HasRoomLocked()) {
+    return;
+  }
+  prefetching_ = true;
+  scheduler_.Schedule([this]() { Prefetch(); });
+}
+
+void PrefetchingExampleIterator::Prefetch() {
+  for (;;) {
+    {
+      absl::MutexLock lock(&mutex_);
+      if (closed_ || skipping_ || !HasRoomLocked()) {
+        // `Next` schedules another task once there is room again. This object
+        // may be destroyed as soon as the lock is released.
+        prefetching_ = false;
+        return;
+      }
+    }
+    // The underlying iterator may block for a while (that's the point of
+    // reading ahead), so it is called without holding the lock.
+    absl::StatusOr<std::string> example = iterator_->Next();
+    absl::MutexLock lock(&mutex_);
+    const bool ok = example.ok();
+    if (ok) {
+      buffered_bytes_ += example->size();
+    }
+    buffer_.push_back(std::move(example));
+    if (!ok) {
+      underlying_finished_ = true;
+      prefetching_ = false;
+      return;
+    }
+  }
+}
+
+absl::StatusOr<std::string> PrefetchingExampleIterator::Next() {
+  absl::MutexLock lock(&mutex_);
+  if (!final_status_.ok()) return final_status_;
+  MaybeSchedulePrefetchLocked();
+  auto has_result_or_closed = [this]() -> bool {
+    mutex_.AssertHeld();
+    return closed_ || !buffer_.empty();
+  };
+  mutex_.Await(absl::Condition(&has_result_or_closed));
+  if (closed_) {
+    return absl::CancelledError("The example iterator was closed.");
+  }
+  absl::StatusOr<std::string> example = std::move(buffer_.front());
+  buffer_.pop_front();
+  if (example.ok()) {
+    buffered_bytes_ -= example->size();
+  } else {
+    final_status_ = example.status();
+  }
+  MaybeSchedulePrefetchLocked();
+  return example;
+}
+
+absl::Status PrefetchingExampleIterator::Skip(int64_t count) {
+  {
+    absl::MutexLock lock(&mutex_);
+    // Pause reading ahead, so that the examples which were read ahead can be
+    // dropped, and the underlying iterator can then be called from here.
+    skipping_ = true;
+    auto prefetch_paused_or_closed = [this]() -> bool {
+      mutex_.AssertHeld();
+      return closed_ || !prefetching_;
+    };
+    mutex_.Await(absl::Condition(&prefetch_paused_or_closed));
+    while (count > 0 && !buffer_.empty()) {
+      absl::StatusOr<std::string> example = std::move(buffer_.front());
+      buffer_.pop_front();
+      if (!example.ok()) {
+        final_status_ = example.status();
+        break;
+      }
+      buffered_bytes_ -= example->size();
+      --count;
+    }
+    if (closed_ || count == 0 || !final_status_.ok()) {
+      skipping_ = false;
+      MaybeSchedulePrefetchLocked();
+      if (closed_) {
+        return absl::CancelledError("The example iterator was closed.");
+      }
+      // Reaching the end of the iterator isn't an error, as for any other
+      // ExampleIterator.
+      return final_status_.code() == absl::StatusCode::kOutOfRange
+                 ? absl::OkStatus()
+                 : final_status_;
+    }
+  }
+  // The buffer is empty and reading ahead is paused, so only this call uses
+  // the underlying iterator.
+  absl::Status status = iterator_->Skip(count);
+  absl::MutexLock lock(&mutex_);
+  if (!status.ok()) {
+    underlying_finished_ = true;
+    final_status_ = status;
+  }
+  skipping_ = false;
+  MaybeSchedulePrefetchLocked();
+  return status;
+}
+
+void PrefetchingExampleIterator::Close() {
+  {
+    absl::MutexLock lock(&mutex_);
+    if (closed_) return;
+    closed_ = true;
+    auto underlying_idle = [this]() -> bool {
+      mutex_.AssertHeld();
+      return !prefetching_ && !skipping_;
+    };
+    mutex_.Await(absl::Condition(&underlying_idle));
+  }
+  iterator_->Close();
+  absl::MutexLock lock(&mutex_);
+  buffer_.clear();
+  buffered_bytes_ = 0;
+}
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_ENGINE_PREFETCHING_EXAMPLE_ITERATOR_H_
+#define FCP_CLIENT_ENGINE_PREFETCHING_EXAMPLE_ITERATOR_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "fcp/base/scheduler.h"
+#include "fcp/client/simple_task_environment.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+// An ExampleIterator which reads ahead from another iterator on a background
+// thread, so that the latency of the underlying example store (e.g. disk I/O)
+// overlaps with the consumer's processing of the examples returned earlier.
+//
+// At most `max_count` examples are buffered ahead of the consumer, and reading
+// ahead stops once the buffered examples add up to at least `max_bytes`
+// (although at least one example is always read ahead). Examples, errors and
+// the end of the underlying iterator are all returned in the order in which
+// the underlying iterator produced them. Once an error or OUT_OF_RANGE has
+// been returned, it is returned again by every later call, without calling
+// the underlying iterator anymore.
+//
+// Reading ahead runs as tasks on the given scheduler, which may be shared by
+// many iterators. A task only runs while the buffer has room, so an iterator
+// whose consumer has stopped pulling examples doesn't hold on to a thread.
+//
+// `NextInto` isn't forwarded to the underlying iterator: the examples are read
+// ahead before the consumer provides a buffer for them, so each one is copied
+// from the read-ahead buffer, as the default `NextInto` does. `Skip` drops the
+// examples which were read ahead first, and forwards the rest of the skip to
+// the underlying iterator.
+//
+// This class is thread-safe, but `Next` and `Skip` are meant to be called from
+// a single thread at a time, like those of any other ExampleIterator.
+class PrefetchingExampleIterator : public ExampleIterator {
+ public:
+  // `max_count` and `max_bytes` must be positive. The `scheduler` must outlive
+  // this object.
+  PrefetchingExampleIterator(std::unique_ptr<ExampleIterator> iterator,
+                             int max_count, int64_t max_bytes,
+                             Scheduler& scheduler);
+  // Closes the iterator, if it hasn't been closed yet.
+  ~PrefetchingExampleIterator() override;
+
+  PrefetchingExampleIterator(const PrefetchingExampleIterator&) = delete;
+  PrefetchingExampleIterator& operator=(const PrefetchingExampleIterator&) =
+      delete;
+
+  // Returns the next example, blocking until it has been read ahead. Returns
+  // CANCELLED once the iterator has been closed.
+  absl::StatusOr<std::string> Next() override;
+
+  // Drops up to `count` examples which were read ahead, and then has the
+  // underlying iterator skip the remaining ones (while reading ahead is
+  // paused). Returns CANCELLED once the iterator has been closed.
+  absl::Status Skip(int64_t count) override;
+
+  // Stops reading ahead, waits for the underlying iterator's pending `Next` or
+  // `Skip` call (if any) to return, and then closes the underlying iterator
+  // and drops any examples which were read ahead.
+  void Close() override;
+
+ private:
+  // Schedules a `Prefetch` task, unless one is already scheduled or there is
+  // nothing to read ahead.
+  void MaybeSchedulePrefetchLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool HasRoomLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Reads examples from the underlying iterator into `buffer_` until it is
+  // full, the underlying iterator returns an error (or reaches its end), or
+  // reading ahead is paused or stopped. Runs on `scheduler_`.
+  void Prefetch() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  const std::unique_ptr<ExampleIterator> iterator_;
+  const int max_count_;
+  const int64_t max_bytes_;
+  Scheduler& scheduler_;
+
+  absl::Mutex mutex_;
+  // The results read from the underlying iterator which haven't been returned
+  // yet. Only the last one may be an error.
+  std::deque<absl::StatusOr<std::string>> buffer_ ABSL_GUARDED_BY(mutex_);
+  // The total size of the examples in `buffer_`.
+  int64_t buffered_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  // True once the underlying iterator has returned an error (or reached its
+  // end), after which it isn't called anymore.
+  bool underlying_finished_ ABSL_GUARDED_BY(mutex_) = false;
+  // The error (or end of the iterator) returned by the last call to `Next`, if
+  // any, which is returned by all calls after it.
+  absl::Status final_status_ ABSL_GUARDED_BY(mutex_);
+  // True while a `Prefetch` task is scheduled or running, and while `Skip` is
+  // calling the underlying iterator. The underlying iterator is only called
+  // by one of them at a time.
+  bool prefetching_ ABSL_GUARDED_BY(mutex_) = false;
+  bool skipping_ ABSL_GUARDED_BY(mutex_) = false;
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_ENGINE_PREFETCHING_EXAMPLE_ITERATOR_H_
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/statusor.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "fcp/base/scheduler.h"
+#include "fcp/client/engine/prefetching_example_iterator.h"
+#include "fcp/client/simple_task_environment.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+constexpr int64_t kExampleSize = 1024;
+// How long the example store takes to produce each example, and how long the
+// plan takes to process each example.
+constexpr absl::Duration kExampleStoreLatency = absl::Microseconds(200);
+constexpr absl::Duration kProcessingTime = absl::Microseconds(200);
+
+// An endless ExampleIterator which sleeps before returning each example, which
+// stands in for an example store reading its examples from disk.
+class SlowExampleIterator : public ExampleIterator {
+ public:
+  absl::StatusOr<std::string> Next() override {
+    absl::SleepFor(kExampleStoreLatency);
+    return std::string(kExampleSize, 'e');
+  }
+  void Close() override {}
+};
+
+// Pulls examples the way the plan does, spending `kProcessingTime` on each.
+// With prefetching, the example store's latency is hidden behind the
+// processing time, rather than adding up with it.
+void BM_Next(benchmark::State& state) {
+  const int prefetch_count = state.range(0);
+  std::unique_ptr<Scheduler> scheduler = CreateThreadPoolScheduler(1);
+  std::unique_ptr<ExampleIterator> iterator =
+      std::make_unique<SlowExampleIterator>();
+  if (prefetch_count > 0) {
+    iterator = std::make_unique<PrefetchingExampleIterator>(
+        std::move(iterator), prefetch_count,
+        /*max_bytes=*/prefetch_count * kExampleSize, *scheduler);
+  }
+  for (auto s : state) {
+    benchmark::DoNotOptimize(iterator->Next());
+    absl::SleepFor(kProcessingTime);
+  }
+  iterator->Close();
+  scheduler->WaitUntilIdle();
+  state.SetItemsProcessed(state.iterations());
+}
+
+// A prefetch count of 0 disables prefetching.
+BENCHMARK(BM_Next)->Arg(0)->Arg(1)->Arg(4)->Arg(16)->UseRealTime();
+
+}  // namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
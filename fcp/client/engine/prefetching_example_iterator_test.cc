@@ -0,0 +1,275 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/prefetching_example_iterator.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "fcp/base/scheduler.h"
+#include "fcp/client/test_helpers.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+using ::testing::InSequence;
+using ::testing::Return;
+
+// An endless iterator which returns examples of the given size, and which
+// records how often it was called.
+class CountingExampleIterator : public ExampleIterator {
+ public:
+  explicit CountingExampleIterator(int example_size)
+      : example_size_(example_size) {}
+
+  absl::StatusOr<std::string> Next() override {
+    absl::MutexLock lock(&mutex_);
+    return std::string(example_size_, static_cast<char>('a' + num_calls_++));
+  }
+  // Skipping counts as calling `Next` for each skipped example.
+  absl::Status Skip(int64_t count) override {
+    absl::MutexLock lock(&mutex_);
+    num_calls_ += count;
+    ++num_skip_calls_;
+    return absl::OkStatus();
+  }
+  // The prefetcher reads examples ahead with `Next`, so this isn't called.
+  absl::Status NextInto(
+      const std::function<char*(size_t size)>& allocate) override {
+    return absl::InternalError("NextInto was forwarded.");
+  }
+  void Close() override {}
+
+  int num_skip_calls() {
+    absl::MutexLock lock(&mutex_);
+    return num_skip_calls_;
+  }
+
+  // Waits until `Next` was called at least `num_calls` times, and returns the
+  // actual number of calls after giving the prefetcher a chance to make more
+  // calls than it should.
+  int WaitForCalls(int num_calls) {
+    {
+      absl::MutexLock lock(&mutex_);
+      auto called = [this, num_calls]() -> bool {
+        mutex_.AssertHeld();
+        return num_calls_ >= num_calls;
+      };
+      mutex_.Await(absl::Condition(&called));
+    }
+    absl::SleepFor(absl::Milliseconds(50));
+    absl::MutexLock lock(&mutex_);
+    return num_calls_;
+  }
+
+ private:
+  const int example_size_;
+  absl::Mutex mutex_;
+  int num_calls_ ABSL_GUARDED_BY(mutex_) = 0;
+  int num_skip_calls_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+class PrefetchingExampleIteratorTest : public testing::Test {
+ protected:
+  // A closed iterator's last task may still be returning, and the scheduler
+  // must be idle when it is destroyed.
+  ~PrefetchingExampleIteratorTest() override { scheduler_->WaitUntilIdle(); }
+
+  // A single thread is shared by all iterators of a test, like the plan's
+  // datasets share the prefetching threads.
+  std::unique_ptr<Scheduler> scheduler_ = CreateThreadPoolScheduler(1);
+};
+
+void ExpectNextExample(ExampleIterator& iterator, const std::string& expected) {
+  absl::StatusOr<std::string> example = iterator.Next();
+  ASSERT_OK(example);
+  EXPECT_EQ(*example, expected);
+}
+
+TEST_F(PrefetchingExampleIteratorTest, ReturnsExamplesThenEndOfIterator) {
+  PrefetchingExampleIterator iterator(
+      std::make_unique<SimpleExampleIterator>(
+          std::vector<const char*>{"a", "b", "c"}),
+      /*max_count=*/2, /*max_bytes=*/1024, *scheduler_);
+
+  ExpectNextExample(iterator, "a");
+  ExpectNextExample(iterator, "b");
+  ExpectNextExample(iterator, "c");
+  EXPECT_THAT(iterator.Next(), IsCode(OUT_OF_RANGE));
+  EXPECT_THAT(iterator.Next(), IsCode(OUT_OF_RANGE));
+}
+
+TEST_F(PrefetchingExampleIteratorTest, ReturnsErrorAfterPrecedingExamples) {
+  auto mock_iterator = std::make_unique<MockExampleIterator>();
+  {
+    InSequence seq;
+    EXPECT_CALL(*mock_iterator, Next()).WillOnce(Return(std::string("a")));
+    EXPECT_CALL(*mock_iterator, Next())
+        .WillOnce(Return(absl::InvalidArgumentError("I/O error")));
+    EXPECT_CALL(*mock_iterator, Close());
+  }
+  PrefetchingExampleIterator iterator(std::move(mock_iterator),
+                                      /*max_count=*/4,
+                                      /*max_bytes=*/1024, *scheduler_);
+
+  ExpectNextExample(iterator, "a");
+  EXPECT_THAT(iterator.Next(), IsCode(INVALID_ARGUMENT));
+  // The underlying iterator isn't called anymore after returning the error.
+  EXPECT_THAT(iterator.Next(), IsCode(INVALID_ARGUMENT));
+}
+
+TEST_F(PrefetchingExampleIteratorTest, ReadsAheadAtMostMaxCountExamples) {
+  auto counting_iterator = std::make_unique<CountingExampleIterator>(
+      /*example_size=*/1);
+  CountingExampleIterator* counting_iterator_ptr = counting_iterator.get();
+  PrefetchingExampleIterator iterator(std::move(counting_iterator),
+                                      /*max_count=*/3,
+                                      /*max_bytes=*/1024, *scheduler_);
+
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(3), 3);
+  ExpectNextExample(iterator, "a");
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(4), 4);
+  ExpectNextExample(iterator, "b");
+  ExpectNextExample(iterator, "c");
+  ExpectNextExample(iterator, "d");
+}
+
+TEST_F(PrefetchingExampleIteratorTest, StopsReadingAheadAtMaxBytes) {
+  auto counting_iterator = std::make_unique<CountingExampleIterator>(
+      /*example_size=*/10);
+  CountingExampleIterator* counting_iterator_ptr = counting_iterator.get();
+  PrefetchingExampleIterator iterator(std::move(counting_iterator),
+                                      /*max_count=*/100,
+                                      /*max_bytes=*/25, *scheduler_);
+
+  // Reading ahead stops once the buffered examples reach `max_bytes`.
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(3), 3);
+  ExpectNextExample(iterator, std::string(10, 'a'));
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(4), 4);
+  ExpectNextExample(iterator, std::string(10, 'b'));
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(5), 5);
+}
+
+TEST_F(PrefetchingExampleIteratorTest, AlwaysReadsAheadOneExample) {
+  auto counting_iterator = std::make_unique<CountingExampleIterator>(
+      /*example_size=*/100);
+  CountingExampleIterator* counting_iterator_ptr = counting_iterator.get();
+  PrefetchingExampleIterator iterator(std::move(counting_iterator),
+                                      /*max_count=*/100,
+                                      /*max_bytes=*/10, *scheduler_);
+
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(1), 1);
+  ExpectNextExample(iterator, std::string(100, 'a'));
+}
+
+TEST_F(PrefetchingExampleIteratorTest, CloseClosesUnderlyingIteratorOnce) {
+  auto mock_iterator = std::make_unique<MockExampleIterator>();
+  EXPECT_CALL(*mock_iterator, Next())
+      .WillRepeatedly(Return(std::string("a")));
+  EXPECT_CALL(*mock_iterator, Close()).Times(1);
+  PrefetchingExampleIterator iterator(std::move(mock_iterator),
+                                      /*max_count=*/2,
+                                      /*max_bytes=*/1024, *scheduler_);
+
+  ExpectNextExample(iterator, "a");
+  iterator.Close();
+  // Examples which were read ahead are dropped.
+  EXPECT_THAT(iterator.Next(), IsCode(CANCELLED));
+}
+
+TEST_F(PrefetchingExampleIteratorTest, IteratorsShareTheScheduler) {
+  // Each iterator's buffer fills up before any of its examples are returned,
+  // which mustn't keep the scheduler's only thread from reading ahead for the
+  // other iterators.
+  std::vector<std::unique_ptr<PrefetchingExampleIterator>> iterators;
+  for (int i = 0; i < 3; ++i) {
+    iterators.push_back(std::make_unique<PrefetchingExampleIterator>(
+        std::make_unique<SimpleExampleIterator>(
+            std::vector<const char*>{"a", "b", "c"}),
+        /*max_count=*/1, /*max_bytes=*/1024, *scheduler_));
+  }
+  for (int i = static_cast<int>(iterators.size()) - 1; i >= 0; --i) {
+    ExpectNextExample(*iterators[i], "a");
+    ExpectNextExample(*iterators[i], "b");
+  }
+  for (const auto& iterator : iterators) {
+    ExpectNextExample(*iterator, "c");
+    EXPECT_THAT(iterator->Next(), IsCode(OUT_OF_RANGE));
+  }
+}
+
+TEST_F(PrefetchingExampleIteratorTest, SkipDropsReadAheadExamplesFirst) {
+  auto counting_iterator = std::make_unique<CountingExampleIterator>(
+      /*example_size=*/1);
+  CountingExampleIterator* counting_iterator_ptr = counting_iterator.get();
+  PrefetchingExampleIterator iterator(std::move(counting_iterator),
+                                      /*max_count=*/3,
+                                      /*max_bytes=*/1024, *scheduler_);
+
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(3), 3);
+  ASSERT_OK(iterator.Skip(2));
+  // Only the examples which were read ahead were skipped.
+  EXPECT_EQ(counting_iterator_ptr->num_skip_calls(), 0);
+  ExpectNextExample(iterator, "c");
+  // The rest of the skip is forwarded to the underlying iterator, once the
+  // examples which were read ahead in the meantime are dropped.
+  EXPECT_EQ(counting_iterator_ptr->WaitForCalls(6), 6);
+  ASSERT_OK(iterator.Skip(5));
+  EXPECT_EQ(counting_iterator_ptr->num_skip_calls(), 1);
+  ExpectNextExample(iterator, "i");
+}
+
+TEST_F(PrefetchingExampleIteratorTest, SkipPastEndOfIterator) {
+  PrefetchingExampleIterator iterator(
+      std::make_unique<SimpleExampleIterator>(
+          std::vector<const char*>{"a", "b"}),
+      /*max_count=*/4, /*max_bytes=*/1024, *scheduler_);
+
+  ASSERT_OK(iterator.Skip(5));
+  EXPECT_THAT(iterator.Next(), IsCode(OUT_OF_RANGE));
+  ASSERT_OK(iterator.Skip(1));
+}
+
+TEST_F(PrefetchingExampleIteratorTest, NextIntoCopiesReadAheadExamples) {
+  PrefetchingExampleIterator iterator(
+      std::make_unique<CountingExampleIterator>(/*example_size=*/2),
+      /*max_count=*/2, /*max_bytes=*/1024, *scheduler_);
+
+  std::string buffer;
+  ASSERT_OK(iterator.NextInto([&buffer](size_t size) {
+    buffer.resize(size);
+    return buffer.data();
+  }));
+  EXPECT_EQ(buffer, "aa");
+}
+
+}  // anonymous namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
@@ -25,6 +25,8 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "fcp/client/engine/plan_engine_helpers.h"
+#include "fcp/client/engine/tf_session_cache.h"
+#include "fcp/client/engine/thread_policy.h"
 #include "fcp/client/simple_task_environment.h"
 #include "tensorflow/core/protobuf/struct.pb.h"
 
@@ -38,12 +40,13 @@ using ::google::internal::federated::plan::TensorflowSpec;
 SimplePlanEngine::SimplePlanEngine(
     std::vector<ExampleIteratorFactory*> example_iterator_factories,
     std::function<bool()> should_abort, LogManager* log_manager,
-    OpStatsLogger* opstats_logger,
+    OpStatsLogger* opstats_logger, const Flags* flags,
     const InterruptibleRunner::TimingConfig* timing_config)
     : example_iterator_factories_(example_iterator_factories),
       should_abort_(should_abort),
       log_manager_(log_manager),
       opstats_logger_(opstats_logger),
+      flags_(*flags),
       timing_config_(timing_config) {}
 
 PlanResult SimplePlanEngine::RunPlan(
@@ -65,9 +68,15 @@ PlanResult SimplePlanEngine::RunPlan(
                       std::move(validity_checks));
   }
 
+  TensorFlowSessionCache* session_cache = nullptr;
+  if (flags_.max_cached_tensorflow_sessions() > 0) {
+    session_cache = &TensorFlowSessionCache::Global();
+    session_cache->SetMaxSessions(flags_.max_cached_tensorflow_sessions());
+  }
   absl::StatusOr<std::unique_ptr<TensorFlowWrapper>> tf_wrapper_or =
       TensorFlowWrapper::Create(graph, config_proto, should_abort_,
-                                *timing_config_, log_manager_);
+                                *timing_config_, log_manager_, session_cache,
+                                CreateThreadPolicy(flags_));
   if (!tf_wrapper_or.ok()) {
     return PlanResult(PlanOutcome::kTensorflowError, tf_wrapper_or.status());
   }
@@ -121,7 +130,7 @@ SimplePlanEngine::RunPlanInternal(
   // object. Hold onto the HostObjectRegistration object since it de-registers
   // upon destruction.
   HostObjectRegistration host_registration = AddDatasetTokenToInputs(
-      example_iterator_factories_, opstats_logger_, inputs.get(),
+      example_iterator_factories_, opstats_logger_, &flags_, inputs.get(),
       tensorflow_spec.dataset_token_tensor_name(), total_example_count,
       total_example_size_bytes, example_iterator_status);
 
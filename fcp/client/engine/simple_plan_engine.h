@@ -54,7 +54,7 @@ class SimplePlanEngine {
   SimplePlanEngine(
       std::vector<ExampleIteratorFactory*> example_iterator_factories,
       std::function<bool()> should_abort, LogManager* log_manager,
-      ::fcp::client::opstats::OpStatsLogger* opstats_logger,
+      ::fcp::client::opstats::OpStatsLogger* opstats_logger, const Flags* flags,
       const InterruptibleRunner::TimingConfig* timing_config);
 
   PlanResult RunPlan(
@@ -94,6 +94,7 @@ class SimplePlanEngine {
   std::function<bool()> should_abort_;
   LogManager* log_manager_;
   ::fcp::client::opstats::OpStatsLogger* opstats_logger_;
+  const Flags& flags_;
   const InterruptibleRunner::TimingConfig* timing_config_;
 };
 
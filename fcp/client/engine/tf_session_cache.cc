@@ -0,0 +1,216 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/tf_session_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "openssl/sha.h"
+#include "tensorflow/core/common_runtime/device_mgr.h"
+#include "tensorflow/core/framework/function.h"
+#include "tensorflow/core/framework/function.pb.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_def.pb.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/public/session.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+TensorFlowSessionCache& TensorFlowSessionCache::Global() {
+  static TensorFlowSessionCache* cache =
+      new TensorFlowSessionCache(/*max_sessions=*/0);
+  return *cache;
+}
+
+std::string TensorFlowSessionCache::ComputeKey(
+    const std::string& graph, const tensorflow::ConfigProto& config) {
+  std::string serialized_config = config.SerializeAsString();
+  SHA256_CTX context;
+  SHA256_Init(&context);
+  // Both parts are prefixed by their size, so that no two different pairs of
+  // graph and config hash the same bytes.
+  uint64_t graph_size = graph.size();
+  SHA256_Update(&context, &graph_size, sizeof(graph_size));
+  SHA256_Update(&context, graph.data(), graph.size());
+  uint64_t config_size = serialized_config.size();
+  SHA256_Update(&context, &config_size, sizeof(config_size));
+  SHA256_Update(&context, serialized_config.data(), serialized_config.size());
+  std::string digest(SHA256_DIGEST_LENGTH, '\0');
+  SHA256_Final(reinterpret_cast<uint8_t*>(digest.data()), &context);
+  return digest;
+}
+
+namespace {
+
+// The stateful ops whose state lives entirely in the session's resource
+// containers (which `Put` clears), or which don't keep any state across runs
+// at all. Kernels of all other stateful ops may keep state of their own, e.g.
+// the random number generator of a seeded random op, or the resource that a
+// named iterator or table created on its first run, which clearing the
+// containers doesn't reset.
+constexpr const char* kCacheableStatefulOps[] = {
+    // Variables.
+    "VarHandleOp",
+    "ReadVariableOp",
+    "AssignVariableOp",
+    "AssignAddVariableOp",
+    "AssignSubVariableOp",
+    "VariableV2",
+    "Assign",
+    "AssignAdd",
+    "AssignSub",
+    // Read and write checkpoint files, without keeping any state across runs.
+    "SaveV2",
+    "RestoreV2",
+    "MergeV2Checkpoints",
+    // Reads the examples of the current run (see
+    // fcp/tensorflow/external_dataset_op.cc).
+    "ExternalDataset",
+    // Calls a function from the graph's library, whose ops are checked too.
+    "StatefulPartitionedCall",
+};
+
+bool IsCacheableStatefulOp(const std::string& op) {
+  return std::find(std::begin(kCacheableStatefulOps),
+                   std::end(kCacheableStatefulOps),
+                   op) != std::end(kCacheableStatefulOps);
+}
+
+bool IsCacheable(const tensorflow::FunctionLibraryDefinition& library,
+                 const tensorflow::NodeDef& node) {
+  if (IsCacheableStatefulOp(node.op())) return true;
+  // Ops which aren't registered can't be checked, so they're not cached.
+  const tensorflow::OpDef* op_def = nullptr;
+  if (!library.LookUpOpDef(node.op(), &op_def).ok()) return false;
+  return !op_def->is_stateful();
+}
+
+}  // namespace
+
+bool TensorFlowSessionCache::CanCache(const tensorflow::GraphDef& graph) {
+  // Functions in the graph's library are looked up like registered ops.
+  const tensorflow::FunctionLibraryDefinition library(
+      tensorflow::OpRegistry::Global(), graph.library());
+  auto is_cacheable = [&library](const tensorflow::NodeDef& node) {
+    return IsCacheable(library, node);
+  };
+  if (!std::all_of(graph.node().begin(), graph.node().end(), is_cacheable)) {
+    return false;
+  }
+  for (const tensorflow::FunctionDef& function : graph.library().function()) {
+    if (!std::all_of(function.node_def().begin(), function.node_def().end(),
+                     is_cacheable)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<tensorflow::Session> TensorFlowSessionCache::Take(
+    const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->first == key) {
+      std::unique_ptr<tensorflow::Session> session = std::move(it->second);
+      entries_.erase(it);
+      ++hits_;
+      return session;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void TensorFlowSessionCache::Put(
+    const std::string& key, std::unique_ptr<tensorflow::Session> session) {
+  // Clearing the default resource container drops all variables, iterators
+  // etc. the session's ops created (and which they would otherwise see again
+  // when the session is next run), while keeping the graph and the executors
+  // created for it. Kernels which keep state of their own would still use it,
+  // which is why such graphs are never cached (see `CanCache`).
+  const tensorflow::DeviceMgr* device_mgr = nullptr;
+  if (!session->LocalDeviceManager(&device_mgr).ok()) {
+    session->Close().IgnoreError();
+    return;
+  }
+  device_mgr->ClearContainers({});
+
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    entries_.emplace_front(key, std::move(session));
+    evicted = EvictLocked();
+  }
+  for (Entry& entry : evicted) {
+    entry.second->Close().IgnoreError();
+  }
+}
+
+void TensorFlowSessionCache::SetMaxSessions(int max_sessions) {
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    max_sessions_ = max_sessions;
+    evicted = EvictLocked();
+  }
+  for (Entry& entry : evicted) {
+    entry.second->Close().IgnoreError();
+  }
+}
+
+void TensorFlowSessionCache::Clear() {
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    evicted = std::move(entries_);
+    entries_.clear();
+  }
+  for (Entry& entry : evicted) {
+    entry.second->Close().IgnoreError();
+  }
+}
+
+int64_t TensorFlowSessionCache::hits() const {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+int64_t TensorFlowSessionCache::misses() const {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+std::list<TensorFlowSessionCache::Entry> TensorFlowSessionCache::EvictLocked() {
+  std::list<Entry> evicted;
+  while (static_cast<int>(entries_.size()) > std::max(max_sessions_, 0)) {
+    evicted.splice(evicted.end(), entries_, std::prev(entries_.end()));
+  }
+  return evicted;
+}
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
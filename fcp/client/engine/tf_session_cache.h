@@ -0,0 +1,123 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_ENGINE_TF_SESSION_CACHE_H_
+#define FCP_CLIENT_ENGINE_TF_SESSION_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/public/session.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+// A cache of TensorFlow sessions which were already created from a plan's
+// graph, so that running the same graph again (e.g. the same plan in a later
+// round, or the same eligibility eval plan) skips importing and optimizing the
+// graph, which dominates the startup time of large models.
+//
+// A session is owned by at most one user at a time: `Take` removes it from the
+// cache, and `Put` returns it once the user is done with it. Before a session
+// is cached, all of its resources (e.g. variables and dataset iterators) are
+// cleared, so that the next run starts from the same state as in a newly
+// created session. Some kernels keep state of their own though, so only
+// sessions of graphs for which `CanCache` returns true may be cached.
+//
+// The cache holds at most `max_sessions` sessions, evicting the least recently
+// used ones first. Since cached sessions can hold on to a considerable amount
+// of memory, `Clear` should be called when the device is low on memory.
+//
+// This class is thread-safe.
+class TensorFlowSessionCache {
+ public:
+  explicit TensorFlowSessionCache(int max_sessions)
+      : max_sessions_(max_sessions) {}
+  // Closes all cached sessions.
+  ~TensorFlowSessionCache() { Clear(); }
+
+  TensorFlowSessionCache(const TensorFlowSessionCache&) = delete;
+  TensorFlowSessionCache& operator=(const TensorFlowSessionCache&) = delete;
+
+  // Returns the cache shared by all plan engines in the process, which
+  // initially doesn't cache any sessions (see `SetMaxSessions`).
+  static TensorFlowSessionCache& Global();
+
+  // Returns the key under which sessions created from the given graph and
+  // config are cached.
+  static std::string ComputeKey(const std::string& graph,
+                                const tensorflow::ConfigProto& config);
+
+  // Returns whether sessions created from the given graph can be cached. This
+  // is only the case if none of the ops in the graph (or in a function in its
+  // library) are stateful, other than a few known-safe ones whose state lives
+  // in the session's resources, such as variables. Other stateful kernels may
+  // keep state that clearing the session's resources doesn't reset, e.g. a
+  // named iterator's position, a table's contents, or the random number
+  // generator of a seeded random op, so the next run of a cached session would
+  // behave differently from a run of a newly created session.
+  static bool CanCache(const tensorflow::GraphDef& graph);
+
+  // Removes the session cached under the given key from the cache, and returns
+  // it, or returns nullptr if there is no such session.
+  std::unique_ptr<tensorflow::Session> Take(const std::string& key);
+
+  // Clears the resources of the given session, and caches it under the given
+  // key, evicting the least recently used sessions if the cache is full. The
+  // session is closed instead if its resources can't be cleared, or if the
+  // cache doesn't hold any sessions.
+  void Put(const std::string& key,
+           std::unique_ptr<tensorflow::Session> session);
+
+  // Changes the maximum number of cached sessions, evicting the least recently
+  // used sessions if there are more than that.
+  void SetMaxSessions(int max_sessions);
+
+  // Closes all cached sessions.
+  void Clear();
+
+  // The number of `Take` calls which did or didn't find a cached session.
+  int64_t hits() const;
+  int64_t misses() const;
+
+ private:
+  using Entry = std::pair<std::string, std::unique_ptr<tensorflow::Session>>;
+
+  // Removes the least recently used sessions from `entries_` until at most
+  // `max_sessions_` are left, and returns them so that they can be closed
+  // without holding the lock.
+  std::list<Entry> EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  mutable absl::Mutex mutex_;
+  int max_sessions_ ABSL_GUARDED_BY(mutex_);
+  // The cached sessions, most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  int64_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_ENGINE_TF_SESSION_CACHE_H_
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/tf_session_cache.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "fcp/base/monitoring.h"
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/public/session.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+using ::tensorflow::Tensor;
+using ::tensorflow::ops::Assign;
+using ::tensorflow::ops::Const;
+using ::tensorflow::ops::Identity;
+using ::tensorflow::ops::RandomUniform;
+using ::tensorflow::ops::Variable;
+
+// Returns a graph with a variable `v`, an op `assign_v` which sets it to 3,
+// and an op `read_v` which reads it.
+std::string CreateVariableGraph() {
+  tensorflow::Scope root = tensorflow::Scope::NewRootScope();
+  auto v = Variable(root.WithOpName("v"), {}, tensorflow::DT_INT32);
+  Assign(root.WithOpName("assign_v"), v, Const(root, 3));
+  Identity(root.WithOpName("read_v"), v);
+  tensorflow::GraphDef graph;
+  TF_CHECK_OK(root.ToGraphDef(&graph));
+  return graph.SerializeAsString();
+}
+
+// A graph which reads all elements of a dataset in a single run, the way plans
+// iterate over their example datasets: `batch` returns the numbers 0 to 2.
+constexpr char kDatasetGraph[] = R"pb(
+  node {
+    name: "start"
+    op: "Const"
+    attr {
+      key: "dtype"
+      value { type: DT_INT64 }
+    }
+    attr {
+      key: "value"
+      value { tensor { dtype: DT_INT64 tensor_shape {} int64_val: 0 } }
+    }
+  }
+  node {
+    name: "stop"
+    op: "Const"
+    attr {
+      key: "dtype"
+      value { type: DT_INT64 }
+    }
+    attr {
+      key: "value"
+      value { tensor { dtype: DT_INT64 tensor_shape {} int64_val: 3 } }
+    }
+  }
+  node {
+    name: "step"
+    op: "Const"
+    attr {
+      key: "dtype"
+      value { type: DT_INT64 }
+    }
+    attr {
+      key: "value"
+      value { tensor { dtype: DT_INT64 tensor_shape {} int64_val: 1 } }
+    }
+  }
+  node {
+    name: "range"
+    op: "RangeDataset"
+    input: "start"
+    input: "stop"
+    input: "step"
+    attr {
+      key: "output_types"
+      value { list { type: DT_INT64 } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape {} } }
+    }
+  }
+  node {
+    name: "batch_size"
+    op: "Const"
+    attr {
+      key: "dtype"
+      value { type: DT_INT64 }
+    }
+    attr {
+      key: "value"
+      value { tensor { dtype: DT_INT64 tensor_shape {} int64_val: 3 } }
+    }
+  }
+  node {
+    name: "drop_remainder"
+    op: "Const"
+    attr {
+      key: "dtype"
+      value { type: DT_BOOL }
+    }
+    attr {
+      key: "value"
+      value { tensor { dtype: DT_BOOL tensor_shape {} bool_val: false } }
+    }
+  }
+  node {
+    name: "batched"
+    op: "BatchDatasetV2"
+    input: "range"
+    input: "batch_size"
+    input: "drop_remainder"
+    attr {
+      key: "output_types"
+      value { list { type: DT_INT64 } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape { dim { size: -1 } } } }
+    }
+  }
+  node {
+    name: "batch"
+    op: "DatasetToSingleElement"
+    input: "batched"
+    attr {
+      key: "output_types"
+      value { list { type: DT_INT64 } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape { dim { size: -1 } } } }
+    }
+  }
+)pb";
+
+std::string CreateDatasetGraph() {
+  tensorflow::GraphDef graph;
+  FCP_CHECK(google::protobuf::TextFormat::ParseFromString(kDatasetGraph,
+                                                          &graph));
+  return graph.SerializeAsString();
+}
+
+std::unique_ptr<tensorflow::Session> CreateSession(const std::string& graph) {
+  tensorflow::GraphDef graph_def;
+  FCP_CHECK(graph_def.ParseFromString(graph));
+  std::unique_ptr<tensorflow::Session> session(
+      tensorflow::NewSession(tensorflow::SessionOptions()));
+  TF_CHECK_OK(session->Create(graph_def));
+  return session;
+}
+
+TEST(TensorFlowSessionCacheTest, TakeReturnsCachedSession) {
+  TensorFlowSessionCache cache(/*max_sessions=*/2);
+  std::unique_ptr<tensorflow::Session> session =
+      CreateSession(CreateVariableGraph());
+  tensorflow::Session* session_ptr = session.get();
+
+  EXPECT_EQ(cache.Take("key"), nullptr);
+  cache.Put("key", std::move(session));
+  EXPECT_EQ(cache.Take("other_key"), nullptr);
+  EXPECT_EQ(cache.Take("key").get(), session_ptr);
+  // The session is no longer cached once it has been taken.
+  EXPECT_EQ(cache.Take("key"), nullptr);
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 3);
+}
+
+TEST(TensorFlowSessionCacheTest, EvictsLeastRecentlyUsedSessions) {
+  const std::string graph = CreateVariableGraph();
+  TensorFlowSessionCache cache(/*max_sessions=*/2);
+  cache.Put("a", CreateSession(graph));
+  cache.Put("b", CreateSession(graph));
+  cache.Put("c", CreateSession(graph));
+
+  EXPECT_EQ(cache.Take("a"), nullptr);
+  EXPECT_NE(cache.Take("b"), nullptr);
+  EXPECT_NE(cache.Take("c"), nullptr);
+}
+
+TEST(TensorFlowSessionCacheTest, SetMaxSessionsEvictsSessions) {
+  const std::string graph = CreateVariableGraph();
+  TensorFlowSessionCache cache(/*max_sessions=*/2);
+  cache.Put("a", CreateSession(graph));
+  cache.Put("b", CreateSession(graph));
+  cache.SetMaxSessions(1);
+
+  EXPECT_EQ(cache.Take("a"), nullptr);
+  EXPECT_NE(cache.Take("b"), nullptr);
+
+  cache.SetMaxSessions(0);
+  cache.Put("c", CreateSession(graph));
+  EXPECT_EQ(cache.Take("c"), nullptr);
+}
+
+TEST(TensorFlowSessionCacheTest, ClearClosesAllSessions) {
+  const std::string graph = CreateVariableGraph();
+  TensorFlowSessionCache cache(/*max_sessions=*/2);
+  cache.Put("a", CreateSession(graph));
+  cache.Put("b", CreateSession(graph));
+  cache.Clear();
+
+  EXPECT_EQ(cache.Take("a"), nullptr);
+  EXPECT_EQ(cache.Take("b"), nullptr);
+}
+
+TEST(TensorFlowSessionCacheTest, CachedSessionsStartWithoutVariables) {
+  TensorFlowSessionCache cache(/*max_sessions=*/1);
+  std::unique_ptr<tensorflow::Session> session =
+      CreateSession(CreateVariableGraph());
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(session->Run({}, {}, {"assign_v"}, nullptr));
+  TF_ASSERT_OK(session->Run({}, {"read_v"}, {}, &outputs));
+  tensorflow::test::ExpectTensorEqual<int32_t>(
+      outputs[0], tensorflow::test::AsScalar<int32_t>(3));
+
+  cache.Put("key", std::move(session));
+  session = cache.Take("key");
+  ASSERT_NE(session, nullptr);
+
+  // Like in a new session, the variable must be initialized again before it
+  // can be read.
+  EXPECT_EQ(session->Run({}, {"read_v"}, {}, &outputs).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  TF_ASSERT_OK(session->Run({}, {}, {"assign_v"}, nullptr));
+  TF_ASSERT_OK(session->Run({}, {"read_v"}, {}, &outputs));
+  tensorflow::test::ExpectTensorEqual<int32_t>(
+      outputs[0], tensorflow::test::AsScalar<int32_t>(3));
+}
+
+TEST(TensorFlowSessionCacheTest, CachedSessionRunsDatasetGraphAgain) {
+  const std::string graph = CreateDatasetGraph();
+  tensorflow::GraphDef graph_def;
+  ASSERT_TRUE(graph_def.ParseFromString(graph));
+  ASSERT_TRUE(TensorFlowSessionCache::CanCache(graph_def));
+  TensorFlowSessionCache cache(/*max_sessions=*/1);
+  std::unique_ptr<tensorflow::Session> session = CreateSession(graph);
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(session->Run({}, {"batch"}, {}, &outputs));
+  tensorflow::test::ExpectTensorEqual<int64_t>(
+      outputs[0], tensorflow::test::AsTensor<int64_t>({0, 1, 2}));
+
+  cache.Put("key", std::move(session));
+  session = cache.Take("key");
+  ASSERT_NE(session, nullptr);
+
+  // The dataset is iterated from its start again.
+  TF_ASSERT_OK(session->Run({}, {"batch"}, {}, &outputs));
+  tensorflow::test::ExpectTensorEqual<int64_t>(
+      outputs[0], tensorflow::test::AsTensor<int64_t>({0, 1, 2}));
+}
+
+TEST(TensorFlowSessionCacheTest, GraphsWithIteratorsOrTablesCannotBeCached) {
+  tensorflow::GraphDef graph;
+  ASSERT_TRUE(graph.ParseFromString(CreateVariableGraph()));
+  EXPECT_TRUE(TensorFlowSessionCache::CanCache(graph));
+
+  // A named iterator keeps its position across runs.
+  tensorflow::GraphDef iterator_graph = graph;
+  iterator_graph.add_node()->set_op("IteratorV2");
+  EXPECT_FALSE(TensorFlowSessionCache::CanCache(iterator_graph));
+
+  // A table keeps its contents across runs.
+  tensorflow::GraphDef table_graph = graph;
+  table_graph.add_node()->set_op("HashTableV2");
+  EXPECT_FALSE(TensorFlowSessionCache::CanCache(table_graph));
+
+  // Ops in functions are created like those in the graph itself.
+  tensorflow::GraphDef function_graph = graph;
+  function_graph.mutable_library()
+      ->add_function()
+      ->add_node_def()
+      ->set_op("MutableHashTableV2");
+  EXPECT_FALSE(TensorFlowSessionCache::CanCache(function_graph));
+}
+
+TEST(TensorFlowSessionCacheTest, GraphsWithSeededRandomOpsCannotBeCached) {
+  // A seeded random op's kernel keeps its random number generator across runs,
+  // so a cached session would return different numbers than a new one.
+  tensorflow::Scope root = tensorflow::Scope::NewRootScope();
+  RandomUniform(root.WithOpName("random"), Const(root, {2}),
+                tensorflow::DT_FLOAT, RandomUniform::Seed(1).Seed2(2));
+  tensorflow::GraphDef random_graph;
+  TF_ASSERT_OK(root.ToGraphDef(&random_graph));
+  EXPECT_FALSE(TensorFlowSessionCache::CanCache(random_graph));
+
+  // Running the same session again indeed returns different numbers.
+  std::unique_ptr<tensorflow::Session> session =
+      CreateSession(random_graph.SerializeAsString());
+  std::vector<Tensor> first_outputs;
+  TF_ASSERT_OK(session->Run({}, {"random"}, {}, &first_outputs));
+  std::vector<Tensor> second_outputs;
+  TF_ASSERT_OK(session->Run({}, {"random"}, {}, &second_outputs));
+  EXPECT_NE(first_outputs[0].flat<float>()(0),
+            second_outputs[0].flat<float>()(0));
+}
+
+TEST(TensorFlowSessionCacheTest, GraphsWithUnknownOpsCannotBeCached) {
+  tensorflow::GraphDef graph;
+  ASSERT_TRUE(graph.ParseFromString(CreateVariableGraph()));
+  graph.add_node()->set_op("SomeUnregisteredOp");
+  EXPECT_FALSE(TensorFlowSessionCache::CanCache(graph));
+}
+
+TEST(TensorFlowSessionCacheTest, KeyDependsOnGraphAndConfig) {
+  tensorflow::ConfigProto config;
+  tensorflow::ConfigProto other_config;
+  other_config.mutable_graph_options()->set_place_pruned_graph(true);
+
+  EXPECT_EQ(TensorFlowSessionCache::ComputeKey("graph", config),
+            TensorFlowSessionCache::ComputeKey("graph", config));
+  EXPECT_NE(TensorFlowSessionCache::ComputeKey("graph", config),
+            TensorFlowSessionCache::ComputeKey("other_graph", config));
+  EXPECT_NE(TensorFlowSessionCache::ComputeKey("graph", config),
+            TensorFlowSessionCache::ComputeKey("graph", other_config));
+}
+
+}  // namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
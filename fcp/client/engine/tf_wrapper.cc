@@ -15,17 +15,29 @@
  */
 #include "fcp/client/engine/tf_wrapper.h"
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/engine/plan_engine_helpers.h"
+#include "fcp/client/engine/tf_session_cache.h"
+#include "fcp/client/engine/thread_policy.h"
+#include "fcp/client/histogram_counters.pb.h"
 #include "fcp/client/interruptible_runner.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/threadpool.h"
+#include "tensorflow/core/platform/threadpool_options.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 
 namespace fcp {
 namespace client {
@@ -33,6 +45,34 @@ namespace engine {
 
 using ::google::protobuf::Any;
 
+// The prefix of the global name of the inter-op thread pool shared by all
+// sessions if `ThreadPolicy::share_inter_op_thread_pool` is set. The name ends
+// in the pool's size, since TensorFlow rejects sessions asking for a pool of
+// an existing name but of a different size.
+constexpr char kSharedInterOpThreadPoolName[] = "fcp_plan_inter_op";
+
+namespace {
+
+// Creates a thread pool whose threads run on the given CPU cores, or returns
+// nullptr if the affinity can't be applied. `num_threads` of 0 creates one
+// thread per core.
+std::unique_ptr<tensorflow::thread::ThreadPool> CreatePinnedThreadPool(
+    const std::string& name, int32_t num_threads,
+    const std::vector<int32_t>& cpu_affinity) {
+  // The pool's threads are all started by its constructor, and inherit the
+  // affinity of the calling thread.
+  ScopedCpuAffinity affinity(cpu_affinity);
+  if (!affinity.status().ok()) {
+    FCP_LOG(WARNING) << "Not applying CPU affinity: " << affinity.status();
+    return nullptr;
+  }
+  return std::make_unique<tensorflow::thread::ThreadPool>(
+      tensorflow::Env::Default(), tensorflow::ThreadOptions(), name,
+      num_threads > 0 ? num_threads : static_cast<int>(cpu_affinity.size()));
+}
+
+}  // namespace
+
 // If `external_config_proto` contains a non-empty config proto, use that.
 // Otherwise initializes a config proto from a set of defaults.
 absl::StatusOr<tensorflow::ConfigProto>
@@ -84,32 +124,61 @@ absl::StatusOr<std::unique_ptr<TensorFlowWrapper>> TensorFlowWrapper::Create(
     const std::string& graph, const Any& config_proto,
     std::function<bool()> should_abort,
     const InterruptibleRunner::TimingConfig& timing_config,
-    LogManager* log_manager) {
-  // Create a tensorflow::Session.
-  tensorflow::Session* session_ptr;
-  std::unique_ptr<tensorflow::Session> session;
+    LogManager* log_manager, TensorFlowSessionCache* session_cache,
+    const ThreadPolicy& thread_policy) {
+  absl::Time start_time = absl::Now();
   tensorflow::SessionOptions session_options;
   FCP_ASSIGN_OR_RETURN(session_options.config,
                        InitializeConfigProto(config_proto));
+  ApplyThreadPolicy(thread_policy, &session_options.config);
 
-  tensorflow::Status status =
-      tensorflow::NewSession(session_options, &session_ptr);
-  if (!status.ok()) {
-    return ToFcpStatus(status, "Error in tensorflow::NewSession()");
+  // Reuse a session which already has the graph loaded, if possible.
+  std::string session_cache_key;
+  std::unique_ptr<tensorflow::Session> session;
+  if (session_cache != nullptr) {
+    session_cache_key =
+        TensorFlowSessionCache::ComputeKey(graph, session_options.config);
+    session = session_cache->Take(session_cache_key);
   }
-  session = absl::WrapUnique(session_ptr);
-
-  // Parse GraphDef.
-  tensorflow::GraphDef graph_def;
-  bool parse_result = graph_def.ParseFromString(graph);
-  if (parse_result == false) {
-    return absl::InvalidArgumentError("Could not parse GraphDef.");
+  if (session == nullptr) {
+    tensorflow::GraphDef graph_def;
+    if (!graph_def.ParseFromString(graph)) {
+      return absl::InvalidArgumentError("Could not parse GraphDef.");
+    }
+    // A cached session was necessarily created from a graph that can be
+    // cached, so this only needs to be checked when creating a new one.
+    if (session_cache != nullptr &&
+        !TensorFlowSessionCache::CanCache(graph_def)) {
+      session_cache = nullptr;
+      session_cache_key.clear();
+    }
+    FCP_ASSIGN_OR_RETURN(session,
+                         CreateSession(std::move(graph_def), session_options));
   }
-  // Load graph.
-  status = session->Create(std::move(graph_def));
-  if (!status.ok()) {
-    return ToFcpStatus(status, "Error in Session::Create()");
+  // The session's ops are run on thread pools of this wrapper, which run on the
+  // cores of the CPU affinity, rather than on the session's thread pools,
+  // which may well be shared with other sessions in the process (and would
+  // otherwise stay pinned to those cores even after this plan has run).
+  std::unique_ptr<tensorflow::thread::ThreadPool> inter_op_thread_pool;
+  std::unique_ptr<tensorflow::thread::ThreadPool> intra_op_thread_pool;
+  if (!thread_policy.cpu_affinity.empty()) {
+    inter_op_thread_pool = CreatePinnedThreadPool(
+        "fcp_plan_pinned_inter_op",
+        session_options.config.inter_op_parallelism_threads(),
+        thread_policy.cpu_affinity);
+    intra_op_thread_pool = CreatePinnedThreadPool(
+        "fcp_plan_pinned_intra_op",
+        session_options.config.intra_op_parallelism_threads(),
+        thread_policy.cpu_affinity);
+    if (inter_op_thread_pool == nullptr || intra_op_thread_pool == nullptr) {
+      inter_op_thread_pool.reset();
+      intra_op_thread_pool.reset();
+    }
   }
+  // This is close to zero when a cached session is reused.
+  log_manager->LogToLongHistogram(
+      HistogramCounters::TRAINING_TF_SESSION_CREATE_LATENCY,
+      absl::ToInt64Milliseconds(absl::Now() - start_time));
 
   // Create an InterruptibleRunner to execute TF calls in a background thread,
   // allowing us to abort them if need be.
@@ -125,10 +194,58 @@ absl::StatusOr<std::unique_ptr<TensorFlowWrapper>> TensorFlowWrapper::Create(
           .interrupt_timeout_extended = ProdDiagCode::
               BACKGROUND_TRAINING_INTERRUPT_TF_EXTENDED_EXECUTION_TIMED_OUT});
   auto wrapper = absl::WrapUnique(new TensorFlowWrapper(
-      std::move(session), std::move(interruptible_runner), log_manager));
+      std::move(session), std::move(interruptible_runner), log_manager,
+      session_cache, std::move(session_cache_key), thread_policy.cpu_affinity,
+      std::move(inter_op_thread_pool), std::move(intra_op_thread_pool)));
   return wrapper;
 }
 
+void TensorFlowWrapper::ApplyThreadPolicy(
+    const ThreadPolicy& thread_policy, tensorflow::ConfigProto* config_proto) {
+  if (config_proto->intra_op_parallelism_threads() == 0) {
+    config_proto->set_intra_op_parallelism_threads(
+        thread_policy.intra_op_threads);
+  }
+  if (config_proto->inter_op_parallelism_threads() == 0) {
+    config_proto->set_inter_op_parallelism_threads(
+        thread_policy.inter_op_threads);
+  }
+  if (thread_policy.share_inter_op_thread_pool &&
+      config_proto->session_inter_op_thread_pool_size() == 0 &&
+      !config_proto->use_per_session_threads()) {
+    // Sessions using a thread pool with the same global name share it. The
+    // pool is created with the first such session, and lives as long as the
+    // process. It is sized by the policy alone (not by a plan's own
+    // inter-op setting), so that all plans share the same pool.
+    tensorflow::ThreadPoolOptionProto* pool =
+        config_proto->add_session_inter_op_thread_pool();
+    pool->set_num_threads(thread_policy.inter_op_threads);
+    pool->set_global_name(absl::StrCat(kSharedInterOpThreadPoolName, "_",
+                                       thread_policy.inter_op_threads));
+  }
+}
+
+absl::StatusOr<std::unique_ptr<tensorflow::Session>>
+TensorFlowWrapper::CreateSession(
+    tensorflow::GraphDef graph_def,
+    const tensorflow::SessionOptions& session_options) {
+  // Create a tensorflow::Session.
+  tensorflow::Session* session_ptr;
+  tensorflow::Status status =
+      tensorflow::NewSession(session_options, &session_ptr);
+  if (!status.ok()) {
+    return ToFcpStatus(status, "Error in tensorflow::NewSession()");
+  }
+  std::unique_ptr<tensorflow::Session> session = absl::WrapUnique(session_ptr);
+
+  // Load graph.
+  status = session->Create(std::move(graph_def));
+  if (!status.ok()) {
+    return ToFcpStatus(status, "Error in Session::Create()");
+  }
+  return session;
+}
+
 TensorFlowWrapper::~TensorFlowWrapper() { FCP_CHECK(CloseAndRelease().ok()); }
 
 absl::Status TensorFlowWrapper::ToFcpStatus(tensorflow::Status s,
@@ -152,8 +269,23 @@ absl::Status TensorFlowWrapper::Run(
 
   auto tensorflow_runnable = [&inputs, &output_tensor_names, &target_node_names,
                               &outputs, this]() -> absl::Status {
-    tensorflow::Status status = this->session_->Run(inputs, output_tensor_names,
-                                                    target_node_names, outputs);
+    // Any failure was already logged when the session was created.
+    ScopedCpuAffinity affinity(cpu_affinity_);
+    tensorflow::Status status;
+    if (inter_op_thread_pool_ != nullptr) {
+      tensorflow::thread::ThreadPoolOptions thread_pool_options;
+      thread_pool_options.inter_op_threadpool =
+          inter_op_thread_pool_->AsEigenThreadPool();
+      thread_pool_options.intra_op_threadpool =
+          intra_op_thread_pool_->AsEigenThreadPool();
+      status = this->session_->Run(tensorflow::RunOptions(), inputs,
+                                   output_tensor_names, target_node_names,
+                                   outputs, /*run_metadata=*/nullptr,
+                                   thread_pool_options);
+    } else {
+      status = this->session_->Run(inputs, output_tensor_names,
+                                   target_node_names, outputs);
+    }
     if (!status.ok()) {
       return ToFcpStatus(status, "Error in Session::Run()");
     }
@@ -172,6 +304,13 @@ absl::Status TensorFlowWrapper::Run(
 
 absl::Status TensorFlowWrapper::CloseAndRelease() {
   absl::MutexLock _(&session_lock_);
+  // If the session wasn't aborted, return it to the cache rather than closing
+  // it, so that the next run of the same graph can reuse it.
+  if (!session_closed_ && session_cache_ != nullptr && session_) {
+    session_cache_->Put(session_cache_key_, std::move(session_));
+    session_closed_ = true;
+    return absl::OkStatus();
+  }
   // If the TensorFlow session hasn't been closed yet, close it.
   if (!session_closed_) {
     FCP_ENGINE_RETURN_IF_ERROR(
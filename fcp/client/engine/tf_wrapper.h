@@ -16,9 +16,12 @@
 #ifndef FCP_CLIENT_ENGINE_TF_WRAPPER_H_
 #define FCP_CLIENT_ENGINE_TF_WRAPPER_H_
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "absl/status/status.h"
@@ -27,8 +30,12 @@
 #include "fcp/base/future.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/scheduler.h"
+#include "fcp/client/engine/tf_session_cache.h"
+#include "fcp/client/engine/thread_policy.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/log_manager.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/platform/threadpool.h"
 #include "tensorflow/core/public/session.h"
 
 namespace fcp {
@@ -46,11 +53,22 @@ namespace engine {
 // should_abort function.
 class TensorFlowWrapper {
  public:
+  // If `session_cache` is not null, a session previously created from the same
+  // graph and config is taken from it (if there is one) rather than creating a
+  // new one, and the session is returned to it by `CloseAndRelease` (unless
+  // the session was aborted, or the graph can't be cached, see
+  // `TensorFlowSessionCache::CanCache`).
+  //
+  // The session's thread pools are sized as per `thread_policy` (see
+  // `ApplyThreadPolicy`). If `thread_policy.cpu_affinity` is set, the session
+  // is instead run on thread pools of the wrapper (of the same sizes), whose
+  // threads run on those CPU cores only.
   static absl::StatusOr<std::unique_ptr<TensorFlowWrapper>> Create(
       const std::string& graph, const ::google::protobuf::Any& config_proto,
       std::function<bool()> should_abort,
       const InterruptibleRunner::TimingConfig& timing_config,
-      LogManager* log_manager);
+      LogManager* log_manager, TensorFlowSessionCache* session_cache,
+      const ThreadPolicy& thread_policy);
 
   // Utility method for creating a ConfigProto from an optionally
   // externally provided value, or from hardcoded defaults. This is a separate
@@ -58,6 +76,11 @@ class TensorFlowWrapper {
   static absl::StatusOr<::tensorflow::ConfigProto> InitializeConfigProto(
       const ::google::protobuf::Any& external_config_proto);
 
+  // Sets the thread pool options of `config_proto` which it leaves unset from
+  // `thread_policy`, so that a plan's own ConfigProto still takes precedence.
+  static void ApplyThreadPolicy(const ThreadPolicy& thread_policy,
+                                ::tensorflow::ConfigProto* config_proto);
+
   ~TensorFlowWrapper();
 
   // Wrapper around TensorFlow's Session::Run method with full support for
@@ -69,19 +92,36 @@ class TensorFlowWrapper {
       const std::vector<std::string>& target_node_names,
       std::vector<tensorflow::Tensor>* outputs);
 
-  // Closes and releases the TensorFlow session. After this is called, no
-  // further calls on this TensorFlowWrapper should be made. Subsequent calls to
-  // CloseAndRelease() will have no effect.
+  // Closes and releases the TensorFlow session (or returns it to the session
+  // cache). After this is called, no further calls on this TensorFlowWrapper
+  // should be made. Subsequent calls to CloseAndRelease() will have no effect.
   absl::Status CloseAndRelease();
 
  private:
   TensorFlowWrapper(std::unique_ptr<tensorflow::Session> session,
                     std::unique_ptr<InterruptibleRunner> interruptible_runner,
-                    LogManager* log_manager)
-      : session_(std::move(session)),
+                    LogManager* log_manager,
+                    TensorFlowSessionCache* session_cache,
+                    std::string session_cache_key,
+                    std::vector<int32_t> cpu_affinity,
+                    std::unique_ptr<tensorflow::thread::ThreadPool>
+                        inter_op_thread_pool,
+                    std::unique_ptr<tensorflow::thread::ThreadPool>
+                        intra_op_thread_pool)
+      : inter_op_thread_pool_(std::move(inter_op_thread_pool)),
+        intra_op_thread_pool_(std::move(intra_op_thread_pool)),
+        session_(std::move(session)),
         interruptible_runner_(std::move(interruptible_runner)),
+        session_cache_(session_cache),
+        session_cache_key_(std::move(session_cache_key)),
+        cpu_affinity_(std::move(cpu_affinity)),
         session_closed_(false) {}
 
+  // Creates a new session with the given options, and loads the graph into it.
+  static absl::StatusOr<std::unique_ptr<tensorflow::Session>> CreateSession(
+      tensorflow::GraphDef graph_def,
+      const tensorflow::SessionOptions& session_options);
+
   // Converts a TensorFlow status to an absl::Status.
   //
   // Rule:
@@ -93,8 +133,15 @@ class TensorFlowWrapper {
   static absl::Status ToFcpStatus(tensorflow::Status s,
                                   const std::string& message_prefix);
 
+  // The thread pools the session is run on, if any, which outlive it.
+  std::unique_ptr<tensorflow::thread::ThreadPool> inter_op_thread_pool_;
+  std::unique_ptr<tensorflow::thread::ThreadPool> intra_op_thread_pool_;
   std::unique_ptr<tensorflow::Session> session_;
   std::unique_ptr<InterruptibleRunner> interruptible_runner_;
+  TensorFlowSessionCache* session_cache_;
+  const std::string session_cache_key_;
+  // The CPU cores of the thread calling into the session in `Run`.
+  const std::vector<int32_t> cpu_affinity_;
   absl::Mutex session_lock_;
   bool session_closed_;
 };
@@ -19,7 +19,15 @@
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "fcp/client/engine/thread_policy.h"
+#include "fcp/client/interruptible_runner.h"
+#include "fcp/client/test_helpers.h"
 #include "fcp/testing/testing.h"
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 
 namespace fcp {
 namespace client {
@@ -125,6 +133,123 @@ TEST(TfWrapperInitializeConfigProtoTest, ValidEmptyPackedConfigProtoValue) {
   EXPECT_THAT(*result, EqualsProto(expected_config_proto));
 }
 
+TEST(TfWrapperApplyThreadPolicyTest, DefaultPolicyLeavesConfigProtoAsIs) {
+  ConfigProto config_proto;
+  config_proto.set_intra_op_parallelism_threads(3);
+
+  TensorFlowWrapper::ApplyThreadPolicy(ThreadPolicy(), &config_proto);
+
+  ConfigProto expected_config_proto;
+  expected_config_proto.set_intra_op_parallelism_threads(3);
+  EXPECT_THAT(config_proto, EqualsProto(expected_config_proto));
+}
+
+TEST(TfWrapperApplyThreadPolicyTest, SetsThreadsUnsetByPlan) {
+  ConfigProto config_proto;
+  config_proto.set_intra_op_parallelism_threads(3);
+
+  TensorFlowWrapper::ApplyThreadPolicy(
+      ThreadPolicy{.intra_op_threads = 2, .inter_op_threads = 1},
+      &config_proto);
+
+  // The plan's own setting takes precedence.
+  ConfigProto expected_config_proto;
+  expected_config_proto.set_intra_op_parallelism_threads(3);
+  expected_config_proto.set_inter_op_parallelism_threads(1);
+  EXPECT_THAT(config_proto, EqualsProto(expected_config_proto));
+}
+
+TEST(TfWrapperApplyThreadPolicyTest, SharesInterOpThreadPool) {
+  ConfigProto config_proto;
+
+  TensorFlowWrapper::ApplyThreadPolicy(
+      ThreadPolicy{.inter_op_threads = 2, .share_inter_op_thread_pool = true},
+      &config_proto);
+
+  EXPECT_EQ(config_proto.inter_op_parallelism_threads(), 2);
+  ASSERT_EQ(config_proto.session_inter_op_thread_pool_size(), 1);
+  EXPECT_EQ(config_proto.session_inter_op_thread_pool(0).num_threads(), 2);
+  EXPECT_FALSE(
+      config_proto.session_inter_op_thread_pool(0).global_name().empty());
+}
+
+TEST(TfWrapperApplyThreadPolicyTest, SizesSharedThreadPoolByPolicyOnly) {
+  ConfigProto plan_config_proto;
+  plan_config_proto.set_inter_op_parallelism_threads(3);
+  ConfigProto other_plan_config_proto;
+
+  ThreadPolicy thread_policy{.inter_op_threads = 2,
+                             .share_inter_op_thread_pool = true};
+  TensorFlowWrapper::ApplyThreadPolicy(thread_policy, &plan_config_proto);
+  TensorFlowWrapper::ApplyThreadPolicy(thread_policy, &other_plan_config_proto);
+
+  // Both plans ask for the same pool, regardless of their own settings.
+  ASSERT_EQ(plan_config_proto.session_inter_op_thread_pool_size(), 1);
+  ASSERT_EQ(other_plan_config_proto.session_inter_op_thread_pool_size(), 1);
+  EXPECT_THAT(
+      plan_config_proto.session_inter_op_thread_pool(0),
+      EqualsProto(other_plan_config_proto.session_inter_op_thread_pool(0)));
+  EXPECT_EQ(plan_config_proto.session_inter_op_thread_pool(0).num_threads(), 2);
+}
+
+TEST(TfWrapperApplyThreadPolicyTest, NamesSharedThreadPoolBySize) {
+  ConfigProto config_proto;
+  ConfigProto other_config_proto;
+
+  TensorFlowWrapper::ApplyThreadPolicy(
+      ThreadPolicy{.inter_op_threads = 2, .share_inter_op_thread_pool = true},
+      &config_proto);
+  TensorFlowWrapper::ApplyThreadPolicy(
+      ThreadPolicy{.inter_op_threads = 4, .share_inter_op_thread_pool = true},
+      &other_config_proto);
+
+  // TensorFlow rejects a pool whose name is already taken by a pool of another
+  // size.
+  EXPECT_NE(config_proto.session_inter_op_thread_pool(0).global_name(),
+            other_config_proto.session_inter_op_thread_pool(0).global_name());
+}
+
+TEST(TfWrapperApplyThreadPolicyTest, KeepsThreadPoolsOfPlan) {
+  ConfigProto config_proto;
+  config_proto.add_session_inter_op_thread_pool()->set_num_threads(4);
+
+  TensorFlowWrapper::ApplyThreadPolicy(
+      ThreadPolicy{.share_inter_op_thread_pool = true}, &config_proto);
+
+  ASSERT_EQ(config_proto.session_inter_op_thread_pool_size(), 1);
+  EXPECT_EQ(config_proto.session_inter_op_thread_pool(0).num_threads(), 4);
+  EXPECT_TRUE(
+      config_proto.session_inter_op_thread_pool(0).global_name().empty());
+}
+
+TEST(TfWrapperTest, RunsOnThreadPoolsPinnedToCpuAffinity) {
+  tensorflow::Scope root = tensorflow::Scope::NewRootScope();
+  tensorflow::ops::Add(root.WithOpName("sum"),
+                       tensorflow::ops::Const(root, 1),
+                       tensorflow::ops::Const(root, 2));
+  tensorflow::GraphDef graph;
+  ASSERT_TRUE(root.ToGraphDef(&graph).ok());
+  MockLogManager log_manager;
+  InterruptibleRunner::TimingConfig timing_config{
+      .polling_period = absl::Milliseconds(1000),
+      .graceful_shutdown_period = absl::Milliseconds(1000),
+      .extended_shutdown_period = absl::Milliseconds(2000),
+  };
+
+  auto wrapper = TensorFlowWrapper::Create(
+      graph.SerializeAsString(), Any(), []() { return false; }, timing_config,
+      &log_manager, /*session_cache=*/nullptr,
+      ThreadPolicy{.intra_op_threads = 1,
+                   .inter_op_threads = 1,
+                   .cpu_affinity = {0}});
+  ASSERT_OK(wrapper);
+  std::vector<tensorflow::Tensor> outputs;
+  ASSERT_OK((*wrapper)->Run({}, {"sum"}, {}, &outputs));
+  tensorflow::test::ExpectTensorEqual<int32_t>(
+      outputs[0], tensorflow::test::AsScalar<int32_t>(3));
+  ASSERT_OK((*wrapper)->CloseAndRelease());
+}
+
 }  // namespace
 }  // namespace engine
 }  // namespace client
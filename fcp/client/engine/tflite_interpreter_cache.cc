@@ -0,0 +1,160 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/tflite_interpreter_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "openssl/sha.h"
+#include "tensorflow/lite/interpreter.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+namespace {
+
+// Hashes the size of the given bytes followed by the bytes, so that no two
+// different sequences of byte strings hash the same bytes.
+void UpdateWithSizePrefix(SHA256_CTX* context, const std::string& bytes) {
+  uint64_t size = bytes.size();
+  SHA256_Update(context, &size, sizeof(size));
+  SHA256_Update(context, bytes.data(), bytes.size());
+}
+
+// Returns whether any of the interpreter's nodes were replaced by a delegate's
+// kernel.
+bool HasDelegatedNodes(const tflite::Interpreter& interpreter) {
+  for (int node_index : interpreter.execution_plan()) {
+    const auto* node_and_registration =
+        interpreter.node_and_registration(node_index);
+    if (node_and_registration != nullptr &&
+        node_and_registration->first.delegate != nullptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // anonymous namespace
+
+TfLiteInterpreterCache& TfLiteInterpreterCache::Global() {
+  static TfLiteInterpreterCache* cache =
+      new TfLiteInterpreterCache(/*max_interpreters=*/0);
+  return *cache;
+}
+
+std::string TfLiteInterpreterCache::ComputeKey(
+    const std::string& model, std::vector<std::string> input_names,
+    int32_t num_threads) {
+  std::sort(input_names.begin(), input_names.end());
+  SHA256_CTX context;
+  SHA256_Init(&context);
+  UpdateWithSizePrefix(&context, model);
+  for (const std::string& input_name : input_names) {
+    UpdateWithSizePrefix(&context, input_name);
+  }
+  SHA256_Update(&context, &num_threads, sizeof(num_threads));
+  std::string digest(SHA256_DIGEST_LENGTH, '\0');
+  SHA256_Final(reinterpret_cast<uint8_t*>(digest.data()), &context);
+  return digest;
+}
+
+std::unique_ptr<PreparedTfLiteInterpreter> TfLiteInterpreterCache::Take(
+    const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->first == key) {
+      std::unique_ptr<PreparedTfLiteInterpreter> interpreter =
+          std::move(it->second);
+      entries_.erase(it);
+      ++hits_;
+      return interpreter;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void TfLiteInterpreterCache::Put(
+    const std::string& key,
+    std::unique_ptr<PreparedTfLiteInterpreter> interpreter) {
+  // The delegate's TensorFlow state can't be reset.
+  if (HasDelegatedNodes(*interpreter->interpreter)) {
+    return;
+  }
+  // Variable tensors are reset to their initial values, as they would be in a
+  // newly prepared interpreter. The tensor arenas are kept allocated.
+  if (interpreter->interpreter->ResetVariableTensors() != kTfLiteOk) {
+    return;
+  }
+  interpreter->error_reporter->Clear();
+
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    entries_.emplace_front(key, std::move(interpreter));
+    evicted = EvictLocked();
+  }
+  // The evicted interpreters are destroyed here, without holding the lock.
+}
+
+void TfLiteInterpreterCache::SetMaxInterpreters(int max_interpreters) {
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    max_interpreters_ = max_interpreters;
+    evicted = EvictLocked();
+  }
+}
+
+void TfLiteInterpreterCache::Clear() {
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    evicted = std::move(entries_);
+    entries_.clear();
+  }
+}
+
+int64_t TfLiteInterpreterCache::hits() const {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+int64_t TfLiteInterpreterCache::misses() const {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+std::list<TfLiteInterpreterCache::Entry> TfLiteInterpreterCache::EvictLocked() {
+  std::list<Entry> evicted;
+  while (static_cast<int>(entries_.size()) > std::max(max_interpreters_, 0)) {
+    evicted.splice(evicted.end(), entries_, std::prev(entries_.end()));
+  }
+  return evicted;
+}
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
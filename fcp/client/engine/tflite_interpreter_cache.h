@@ -0,0 +1,131 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_ENGINE_TFLITE_INTERPRETER_CACHE_H_
+#define FCP_CLIENT_ENGINE_TFLITE_INTERPRETER_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "fcp/client/engine/caching_error_reporter.h"
+#include "tensorflow/lite/delegates/flex/delegate.h"
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/model_builder.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+// A TFLite interpreter which has been built for a model, had the Flex delegate
+// applied and its tensors allocated, along with everything it refers to. The
+// members are destroyed in reverse order, i.e. the interpreter first.
+struct PreparedTfLiteInterpreter {
+  // A copy of the serialized model, which `model` refers to. Only set if the
+  // interpreter can outlive the caller's copy of the model (i.e. if it may be
+  // cached), and the model wasn't loaded from a file.
+  std::string model_buffer;
+  std::unique_ptr<tflite::FlatBufferModel> model;
+  std::unique_ptr<CachingErrorReporter> error_reporter;
+  tflite::TfLiteDelegateUniquePtr delegate;
+  std::unique_ptr<tflite::Interpreter> interpreter;
+};
+
+// A cache of TFLite interpreters which were already prepared for a plan's
+// model, so that running the same model again skips loading the model, and if
+// possible building the interpreter and allocating the tensor arenas.
+//
+// An interpreter is owned by at most one user at a time: `Take` removes it from
+// the cache, and `Put` returns it once the user is done with it. Before an
+// interpreter is cached its variable tensors are reset; its input tensors are
+// expected to be assigned again by the next user. The Flex delegate can't be
+// reset though: it holds on to TensorFlow state (e.g. resources and the
+// kernels which created them) from the previous run, and preparing it again is
+// what dominates the cost of preparing an interpreter which uses it. So
+// interpreters which delegated any ops to it aren't cached at all.
+//
+// The cache holds at most `max_interpreters` interpreters, evicting the least
+// recently used ones first. `Clear` should be called when the device is low on
+// memory.
+//
+// This class is thread-safe.
+class TfLiteInterpreterCache {
+ public:
+  explicit TfLiteInterpreterCache(int max_interpreters)
+      : max_interpreters_(max_interpreters) {}
+
+  TfLiteInterpreterCache(const TfLiteInterpreterCache&) = delete;
+  TfLiteInterpreterCache& operator=(const TfLiteInterpreterCache&) = delete;
+
+  // Returns the cache shared by all plan engines in the process, which
+  // initially doesn't cache any interpreters (see `SetMaxInterpreters`).
+  static TfLiteInterpreterCache& Global();
+
+  // Returns the key under which interpreters for the given model (i.e. its
+  // contents, or an identifier of a file holding them), input tensor names and
+  // number of threads are cached. The order of the input names doesn't matter.
+  static std::string ComputeKey(const std::string& model,
+                                std::vector<std::string> input_names,
+                                int32_t num_threads);
+
+  // Removes the interpreter cached under the given key from the cache, and
+  // returns it, or returns nullptr if there is no such interpreter.
+  std::unique_ptr<PreparedTfLiteInterpreter> Take(const std::string& key);
+
+  // Resets the given interpreter and caches it under the given key, evicting
+  // the least recently used interpreters if the cache is full. The
+  // interpreter is destroyed instead if it delegated any ops to the Flex
+  // delegate, or if it can't be reset.
+  void Put(const std::string& key,
+           std::unique_ptr<PreparedTfLiteInterpreter> interpreter);
+
+  // Changes the maximum number of cached interpreters, evicting the least
+  // recently used interpreters if there are more than that.
+  void SetMaxInterpreters(int max_interpreters);
+
+  // Destroys all cached interpreters.
+  void Clear();
+
+  // The number of `Take` calls which did or didn't find a cached interpreter.
+  int64_t hits() const;
+  int64_t misses() const;
+
+ private:
+  using Entry =
+      std::pair<std::string, std::unique_ptr<PreparedTfLiteInterpreter>>;
+
+  // Removes the least recently used interpreters from `entries_` until at most
+  // `max_interpreters_` are left, and returns them so that they can be
+  // destroyed without holding the lock.
+  std::list<Entry> EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  mutable absl::Mutex mutex_;
+  int max_interpreters_ ABSL_GUARDED_BY(mutex_);
+  // The cached interpreters, most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  int64_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_ENGINE_TFLITE_INTERPRETER_CACHE_H_
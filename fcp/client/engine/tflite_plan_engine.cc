@@ -15,14 +15,29 @@
  */
 #include "fcp/client/engine/tflite_plan_engine.h"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fcp/base/clock.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/cache/file_backed_resource_cache.h"
 #include "fcp/client/engine/plan_engine_helpers.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
 #include "fcp/client/engine/tflite_wrapper.h"
+#include "fcp/client/engine/thread_policy.h"
 #include "fcp/protos/plan.pb.h"
+#include "google/protobuf/any.pb.h"
+#include "openssl/sha.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/protobuf/struct.pb.h"
 
@@ -60,19 +75,122 @@ PlanResult CreatePlanResultFromOutput(
   return PlanResult(PlanOutcome::kTensorflowError, absl::InternalError(""));
 }
 
+// How long a model file stays in the cache after the last run which used it.
+constexpr absl::Duration kModelMaxAge = absl::Hours(24 * 7);
+
+// Returns the id of the cache entry holding `model`, which is derived from the
+// model's SHA-256 digest.
+std::string GetModelCacheId(const std::string& model) {
+  std::string digest(SHA256_DIGEST_LENGTH, '\0');
+  SHA256(reinterpret_cast<const uint8_t*>(model.data()), model.size(),
+         reinterpret_cast<uint8_t*>(digest.data()));
+  return absl::StrCat("tflite_model_", absl::BytesToHexString(digest));
+}
+
 TfLiteInterpreterOptions CreateOptions(const Flags& flags) {
+  ThreadPolicy thread_policy = CreateThreadPolicy(flags);
   return TfLiteInterpreterOptions{
       .ensure_dynamic_tensors_are_released =
           flags.ensure_dynamic_tensors_are_released(),
       .large_tensor_threshold_for_dynamic_allocation =
-          flags.large_tensor_threshold_for_dynamic_allocation()};
+          flags.large_tensor_threshold_for_dynamic_allocation(),
+      .num_threads = thread_policy.tflite_threads,
+      .cpu_affinity = std::move(thread_policy.cpu_affinity)};
 }
 }  // namespace
 
+std::unique_ptr<cache::FileBackedResourceCache> CreateTfLiteModelCache(
+    SimpleTaskEnvironment* env_deps, LogManager* log_manager,
+    const Flags* flags) {
+  if (!flags->load_tflite_models_from_files() || !flags->enable_cache_dir()) {
+    return nullptr;
+  }
+  absl::StatusOr<std::unique_ptr<cache::FileBackedResourceCache>> model_cache =
+      cache::FileBackedResourceCache::Create(
+          env_deps->GetBaseDir(), env_deps->GetCacheDir(), log_manager,
+          Clock::RealClock(), flags->tflite_model_cache_size_bytes());
+  if (!model_cache.ok()) {
+    FCP_LOG(WARNING) << "Not running plans from model files: "
+                     << model_cache.status();
+    return nullptr;
+  }
+  return *std::move(model_cache);
+}
+
 PlanResult TfLitePlanEngine::RunPlan(
     const TensorflowSpec& tensorflow_spec, const std::string& model,
     std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
     const std::vector<std::string>& output_names) {
+  return RunPlanInternal(
+      tensorflow_spec,
+      [this, &model, &output_names](
+          std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+          TfLiteInterpreterCache* interpreter_cache) {
+        return TfLiteWrapper::Create(model, should_abort_, *timing_config_,
+                                     log_manager_, std::move(inputs),
+                                     output_names, CreateOptions(flags_),
+                                     interpreter_cache);
+      },
+      std::move(inputs), output_names);
+}
+
+PlanResult TfLitePlanEngine::RunPlanFromFile(
+    const TensorflowSpec& tensorflow_spec, const std::string& model_path,
+    std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+    const std::vector<std::string>& output_names) {
+  return RunPlanInternal(
+      tensorflow_spec,
+      [this, &model_path, &output_names](
+          std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+          TfLiteInterpreterCache* interpreter_cache) {
+        return TfLiteWrapper::CreateFromFile(
+            model_path, should_abort_, *timing_config_, log_manager_,
+            std::move(inputs), output_names, CreateOptions(flags_),
+            interpreter_cache);
+      },
+      std::move(inputs), output_names);
+}
+
+PlanResult TfLitePlanEngine::RunPlanFromResourceCache(
+    const TensorflowSpec& tensorflow_spec, std::string model,
+    cache::FileBackedResourceCache* model_cache,
+    std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+    const std::vector<std::string>& output_names) {
+  if (model_cache == nullptr) {
+    return RunPlan(tensorflow_spec, model, std::move(inputs), output_names);
+  }
+  const std::string cache_id = GetModelCacheId(model);
+  absl::StatusOr<cache::FileBackedResourceCache::CachedFile> model_file =
+      model_cache->GetFile(cache_id, kModelMaxAge);
+  if (!model_file.ok()) {
+    // The cache takes over the model, and only keeps it in memory until its
+    // file has been written, which `GetFile` waits for.
+    absl::Cord model_cord(std::move(model));
+    absl::Status put_status = model_cache->Put(
+        cache_id, model_cord, google::protobuf::Any(), kModelMaxAge);
+    if (put_status.ok()) {
+      model_file = model_cache->GetFile(cache_id, kModelMaxAge);
+    } else {
+      model_file = put_status;
+    }
+    if (!model_file.ok()) {
+      FCP_LOG(WARNING) << "Not running the plan from a model file: "
+                       << model_file.status();
+      return RunPlan(tensorflow_spec, std::string(model_cord),
+                     std::move(inputs), output_names);
+    }
+  }
+  // The model is only read from the (memory-mapped) file from here on, so
+  // don't keep it in the heap while the plan runs.
+  std::string().swap(model);
+  return RunPlanFromFile(tensorflow_spec, model_file->path(),
+                         std::move(inputs), output_names);
+}
+
+PlanResult TfLitePlanEngine::RunPlanInternal(
+    const TensorflowSpec& tensorflow_spec, CreateWrapperFn create_wrapper,
+    std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+    const std::vector<std::string>& output_names) {
   log_manager_->LogDiag(ProdDiagCode::BACKGROUND_TRAINING_TFLITE_ENGINE_USED);
   // Check that all inputs have corresponding TensorSpecProtos.
   absl::flat_hash_set<std::string> expected_input_tensor_names_set;
@@ -90,13 +208,17 @@ PlanResult TfLitePlanEngine::RunPlan(
   std::atomic<int64_t> total_example_size_bytes = 0;
   ExampleIteratorStatus example_iterator_status;
   HostObjectRegistration host_registration = AddDatasetTokenToInputsForTfLite(
-      example_iterator_factories_, opstats_logger_, inputs.get(),
+      example_iterator_factories_, opstats_logger_, &flags_, inputs.get(),
       tensorflow_spec.dataset_token_tensor_name(), &total_example_count,
       &total_example_size_bytes, &example_iterator_status);
+  TfLiteInterpreterCache* interpreter_cache = nullptr;
+  if (flags_.max_cached_tflite_interpreters() > 0) {
+    interpreter_cache = &TfLiteInterpreterCache::Global();
+    interpreter_cache->SetMaxInterpreters(
+        flags_.max_cached_tflite_interpreters());
+  }
   absl::StatusOr<std::unique_ptr<TfLiteWrapper>> tflite_wrapper =
-      TfLiteWrapper::Create(model, should_abort_, *timing_config_, log_manager_,
-                            std::move(inputs), output_names,
-                            CreateOptions(flags_));
+      create_wrapper(std::move(inputs), interpreter_cache);
   if (!tflite_wrapper.ok()) {
     return PlanResult(PlanOutcome::kTensorflowError, tflite_wrapper.status());
   }
@@ -17,11 +17,15 @@
 #define FCP_CLIENT_ENGINE_TFLITE_PLAN_ENGINE_H_
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "fcp/client/cache/file_backed_resource_cache.h"
 #include "fcp/client/engine/common.h"
 #include "fcp/client/engine/example_iterator_factory.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
+#include "fcp/client/engine/tflite_wrapper.h"
 #include "fcp/client/event_publisher.h"
 #include "fcp/client/flags.h"
 #include "fcp/client/interruptible_runner.h"
@@ -33,6 +37,13 @@ namespace fcp {
 namespace client {
 namespace engine {
 
+// Returns the cache which `TfLitePlanEngine::RunPlanFromResourceCache` should
+// keep model files in, or nullptr if models shouldn't be run from files (see
+// `Flags::load_tflite_models_from_files`) or the cache can't be created.
+std::unique_ptr<cache::FileBackedResourceCache> CreateTfLiteModelCache(
+    SimpleTaskEnvironment* env_deps, LogManager* log_manager,
+    const Flags* flags);
+
 // A class used to "run" (interpret) a TensorflowSpec-based plan with TfLite.
 // Each instance should generally only be used once to run a plan.
 class TfLitePlanEngine {
@@ -64,7 +75,40 @@ class TfLitePlanEngine {
       std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
       const std::vector<std::string>& output_names);
 
+  // Like `RunPlan`, but loads the model from the file at `model_path` (see
+  // `TfLiteWrapper::CreateFromFile`).
+  PlanResult RunPlanFromFile(
+      const google::internal::federated::plan::TensorflowSpec& tensorflow_spec,
+      const std::string& model_path,
+      std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+      const std::vector<std::string>& output_names);
+
+  // Like `RunPlan`, but unless `model_cache` is null, runs the plan from the
+  // cached file holding the model (see `RunPlanFromFile`), which is keyed by
+  // the model's contents, and only written if no earlier run cached it
+  // already. The model itself is released before the plan runs, so that it
+  // isn't kept in the heap. Falls back to `RunPlan` if the model can't be
+  // cached.
+  PlanResult RunPlanFromResourceCache(
+      const google::internal::federated::plan::TensorflowSpec& tensorflow_spec,
+      std::string model, cache::FileBackedResourceCache* model_cache,
+      std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+      const std::vector<std::string>& output_names);
+
  private:
+  // Creates the TfLiteWrapper for the plan's model, given the plan's inputs and
+  // the interpreter cache to use (if any).
+  using CreateWrapperFn =
+      std::function<absl::StatusOr<std::unique_ptr<TfLiteWrapper>>(
+          std::unique_ptr<absl::flat_hash_map<std::string, std::string>>,
+          TfLiteInterpreterCache*)>;
+
+  PlanResult RunPlanInternal(
+      const google::internal::federated::plan::TensorflowSpec& tensorflow_spec,
+      CreateWrapperFn create_wrapper,
+      std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+      const std::vector<std::string>& output_names);
+
   std::vector<ExampleIteratorFactory*> example_iterator_factories_;
   std::function<bool()> should_abort_;
   LogManager* log_manager_;
@@ -15,22 +15,34 @@
  */
 #include "fcp/client/engine/tflite_wrapper.h"
 
+#include <sys/stat.h>
+
 #include <functional>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
+#include "fcp/client/engine/thread_policy.h"
+#include "fcp/client/histogram_counters.pb.h"
+#include "flatbuffers/flatbuffers.h"
 #include "tensorflow/lite/delegates/flex/util.h"
 #include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/interpreter_builder.h"
 #include "tensorflow/lite/kernels/register.h"
 #include "tensorflow/lite/model_builder.h"
+#include "tensorflow/lite/schema/schema_generated.h"
 #include "tensorflow/lite/string_util.h"
+#include "tensorflow/lite/util.h"
 
 namespace fcp {
 namespace client {
@@ -40,6 +52,42 @@ using ::tflite::ops::builtin::BuiltinOpResolver;
 
 namespace {
 
+// Identifies the file at `path` by its path, device, inode, size and
+// modification time, so that interpreters cached for the file aren't reused
+// once it is replaced or rewritten.
+absl::StatusOr<std::string> GetModelFileId(const std::string& path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to build FlatBufferModel from ", path));
+  }
+  return absl::StrCat(path, ":", info.st_dev, ":", info.st_ino, ":",
+                      info.st_size, ":", info.st_mtime);
+}
+
+// Returns whether interpreters for the given serialized model may be cached,
+// i.e. whether the model is valid and none of its ops are run by the Flex
+// delegate (see `TfLiteInterpreterCache`). This only looks at the model's
+// operator codes, so it's much cheaper than hashing or copying the model.
+bool CanCacheInterpreter(const std::string& model) {
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t*>(model.data()), model.size());
+  if (!tflite::VerifyModelBuffer(verifier)) {
+    return false;
+  }
+  const auto* operator_codes = tflite::GetModel(model.data())->operator_codes();
+  if (operator_codes == nullptr) {
+    return true;
+  }
+  for (const tflite::OperatorCode* operator_code : *operator_codes) {
+    if (operator_code->custom_code() != nullptr &&
+        tflite::IsFlexOp(operator_code->custom_code()->c_str())) {
+      return false;
+    }
+  }
+  return true;
+}
+
 absl::Status AssignStringInput(int index, const std::string& value,
                                tflite::Interpreter* interpreter) {
   TfLiteTensor* tensor = interpreter->tensor(index);
@@ -61,38 +109,116 @@ absl::StatusOr<std::unique_ptr<TfLiteWrapper>> TfLiteWrapper::Create(
     LogManager* log_manager,
     std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
     std::vector<std::string> output_names,
-    const TfLiteInterpreterOptions& interpreter_options) {
-  std::unique_ptr<tflite::FlatBufferModel> flat_buffer_model =
-      tflite::FlatBufferModel::BuildFromBuffer(model.c_str(), model.size());
-  if (flat_buffer_model == nullptr) {
-    return absl::InvalidArgumentError("Failed to build FlatBufferModel.");
+    const TfLiteInterpreterOptions& interpreter_options,
+    TfLiteInterpreterCache* interpreter_cache) {
+  // Interpreters for models with Flex ops aren't cached anyway, so don't spend
+  // time on computing the model's cache key and copying it.
+  if (interpreter_cache != nullptr && !CanCacheInterpreter(model)) {
+    interpreter_cache = nullptr;
   }
-  // The training delegate needs to be created before the interpreter.
-  auto delegate = tflite::FlexDelegate::Create();
-  auto error_reporter = std::make_unique<CachingErrorReporter>();
-  auto interpreter = std::make_unique<tflite::Interpreter>();
+  // A cached interpreter may outlive the caller's model, so it needs its own
+  // copy.
+  const bool copy_model = interpreter_cache != nullptr;
+  auto build_model = [&model, copy_model]()
+      -> absl::StatusOr<std::unique_ptr<PreparedTfLiteInterpreter>> {
+    auto prepared = std::make_unique<PreparedTfLiteInterpreter>();
+    const std::string* model_buffer = &model;
+    if (copy_model) {
+      prepared->model_buffer = model;
+      model_buffer = &prepared->model_buffer;
+    }
+    prepared->model = tflite::FlatBufferModel::BuildFromBuffer(
+        model_buffer->c_str(), model_buffer->size());
+    if (prepared->model == nullptr) {
+      return absl::InvalidArgumentError("Failed to build FlatBufferModel.");
+    }
+    return prepared;
+  };
+  return CreateInternal(model, build_model, std::move(should_abort),
+                        timing_config, log_manager, std::move(inputs),
+                        std::move(output_names), interpreter_options,
+                        interpreter_cache);
+}
 
-  if (tflite::InterpreterBuilder(
-          flat_buffer_model->GetModel(), BuiltinOpResolver(),
-          error_reporter.get())(&interpreter) != kTfLiteOk) {
-    return absl::InvalidArgumentError("Failed to initiate interpreter.");
+absl::StatusOr<std::unique_ptr<TfLiteWrapper>> TfLiteWrapper::CreateFromFile(
+    const std::string& model_path, std::function<bool()> should_abort,
+    const InterruptibleRunner::TimingConfig& timing_config,
+    LogManager* log_manager,
+    std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+    std::vector<std::string> output_names,
+    const TfLiteInterpreterOptions& interpreter_options,
+    TfLiteInterpreterCache* interpreter_cache) {
+  auto build_model = [&model_path]()
+      -> absl::StatusOr<std::unique_ptr<PreparedTfLiteInterpreter>> {
+    auto prepared = std::make_unique<PreparedTfLiteInterpreter>();
+    // The file is memory-mapped rather than read into memory, and the mapping
+    // is owned by the model.
+    prepared->model =
+        tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
+    if (prepared->model == nullptr) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Failed to build FlatBufferModel from ", model_path));
+    }
+    return prepared;
+  };
+  // Interpreters for model files are cached by the file's identity rather
+  // than its contents, since hashing the file would read all of it.
+  std::string model_id = model_path;
+  if (interpreter_cache != nullptr) {
+    FCP_ASSIGN_OR_RETURN(model_id, GetModelFileId(model_path));
   }
-  if (interpreter->ModifyGraphWithDelegate(delegate.get()) != kTfLiteOk) {
-    return absl::InvalidArgumentError(
-        "Failed to modify graph with TrainingFlexDelegate.");
+  return CreateInternal(model_id, build_model, std::move(should_abort),
+                        timing_config, log_manager, std::move(inputs),
+                        std::move(output_names), interpreter_options,
+                        interpreter_cache);
+}
+
+absl::StatusOr<std::unique_ptr<TfLiteWrapper>> TfLiteWrapper::CreateInternal(
+    const std::string& model_id,
+    std::function<absl::StatusOr<std::unique_ptr<PreparedTfLiteInterpreter>>()>
+        build_model,
+    std::function<bool()> should_abort,
+    const InterruptibleRunner::TimingConfig& timing_config,
+    LogManager* log_manager,
+    std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+    std::vector<std::string> output_names,
+    const TfLiteInterpreterOptions& interpreter_options,
+    TfLiteInterpreterCache* interpreter_cache) {
+  absl::Time start_time = absl::Now();
+  // Reuse an interpreter which was already prepared for the model, if
+  // possible.
+  std::string interpreter_cache_key;
+  std::unique_ptr<PreparedTfLiteInterpreter> prepared;
+  if (interpreter_cache != nullptr) {
+    std::vector<std::string> input_names;
+    input_names.reserve(inputs->size());
+    for (const auto& [name, value] : *inputs) {
+      input_names.push_back(name);
+    }
+    interpreter_cache_key =
+        TfLiteInterpreterCache::ComputeKey(model_id, std::move(input_names),
+                                           interpreter_options.num_threads);
+    prepared = interpreter_cache->Take(interpreter_cache_key);
   }
-  if (interpreter->AllocateTensors() != kTfLiteOk) {
-    return absl::InvalidArgumentError("Failed to allocate tensors.");
+  if (prepared == nullptr) {
+    FCP_ASSIGN_OR_RETURN(prepared, build_model());
+    FCP_RETURN_IF_ERROR(
+        PrepareInterpreter(interpreter_options, prepared.get()));
   }
-  interpreter->SetCancellationFunction(delegate->data_,
-                                       tflite::FlexDelegate::HasCancelled);
+  // This is close to zero when a cached interpreter is reused.
+  log_manager->LogToLongHistogram(
+      HistogramCounters::TRAINING_TFLITE_INTERPRETER_CREATE_LATENCY,
+      absl::ToInt64Milliseconds(absl::Now() - start_time));
+
+  // Only the inputs are set for each run. The tensor arenas of a reused
+  // interpreter are left as they are.
+  tflite::Interpreter* interpreter = prepared->interpreter.get();
   for (const auto& input : interpreter->inputs()) {
     std::string key = interpreter->GetInputName(input);
     if (inputs->find(key) == inputs->end()) {
       return absl::InvalidArgumentError("Unexpected input tensor.");
     }
-    FCP_RETURN_IF_ERROR(
-        AssignStringInput(input, inputs->at(key), interpreter.get()));
+    FCP_RETURN_IF_ERROR(AssignStringInput(input, inputs->at(key), interpreter));
   }
   // Create an InterruptibleRunner to execute TF calls in a background thread,
   // allowing us to abort them if need be.
@@ -107,15 +233,67 @@ absl::StatusOr<std::unique_ptr<TfLiteWrapper>> TfLiteWrapper::Create(
               BACKGROUND_TRAINING_INTERRUPT_TF_EXTENDED_EXECUTION_COMPLETED,
           .interrupt_timeout_extended = ProdDiagCode::
               BACKGROUND_TRAINING_INTERRUPT_TF_EXTENDED_EXECUTION_TIMED_OUT});
-  return absl::WrapUnique(
-      new TfLiteWrapper(std::move(flat_buffer_model), std::move(error_reporter),
-                        std::move(delegate), std::move(interpreter),
-                        std::move(runner), std::move(output_names)));
+  return absl::WrapUnique(new TfLiteWrapper(
+      std::move(prepared), std::move(runner), std::move(output_names),
+      interpreter_cache, std::move(interpreter_cache_key),
+      interpreter_options.cpu_affinity));
+}
+
+absl::Status TfLiteWrapper::PrepareInterpreter(
+    const TfLiteInterpreterOptions& interpreter_options,
+    PreparedTfLiteInterpreter* prepared) {
+  // The Flex delegate's thread pool is created along with it, and inherits the
+  // affinity.
+  ScopedCpuAffinity affinity(interpreter_options.cpu_affinity);
+  if (!affinity.status().ok()) {
+    FCP_LOG(WARNING) << "Not applying CPU affinity: " << affinity.status();
+  }
+  // The training delegate needs to be created before the interpreter.
+  prepared->delegate = tflite::FlexDelegate::Create();
+  prepared->error_reporter = std::make_unique<CachingErrorReporter>();
+
+  if (tflite::InterpreterBuilder(prepared->model->GetModel(),
+                                 BuiltinOpResolver(),
+                                 prepared->error_reporter.get())(
+          &prepared->interpreter) != kTfLiteOk) {
+    return absl::InvalidArgumentError("Failed to initiate interpreter.");
+  }
+  tflite::Interpreter* interpreter = prepared->interpreter.get();
+  // This has to happen before the delegate is applied, which sizes its
+  // intra-op thread pool from it.
+  if (interpreter_options.num_threads > 0 &&
+      interpreter->SetNumThreads(interpreter_options.num_threads) !=
+          kTfLiteOk) {
+    return absl::InvalidArgumentError("Failed to set the number of threads.");
+  }
+  if (interpreter->ModifyGraphWithDelegate(prepared->delegate.get()) !=
+      kTfLiteOk) {
+    return absl::InvalidArgumentError(
+        "Failed to modify graph with TrainingFlexDelegate.");
+  }
+  if (interpreter->AllocateTensors() != kTfLiteOk) {
+    return absl::InvalidArgumentError("Failed to allocate tensors.");
+  }
+  interpreter->SetCancellationFunction(prepared->delegate->data_,
+                                       tflite::FlexDelegate::HasCancelled);
+  return absl::OkStatus();
+}
+
+TfLiteWrapper::~TfLiteWrapper() {
+  // Return the interpreter to the cache, so that the next run of the same
+  // model can reuse it. The delegate can't be reset once it was cancelled, so
+  // an aborted interpreter is destroyed instead.
+  if (interpreter_cache_ != nullptr && reusable_ &&
+      !tflite::FlexDelegate::HasCancelled(delegate_->data_)) {
+    interpreter_cache_->Put(interpreter_cache_key_, std::move(prepared_));
+  }
 }
 
 absl::StatusOr<OutputTensors> TfLiteWrapper::Run() {
-  auto* interpreter_raw_pointer = interpreter_.get();
+  auto* interpreter_raw_pointer = interpreter_;
   auto tflite_runnable = [interpreter_raw_pointer, this]() {
+    // Any failure was already logged when the interpreter was prepared.
+    ScopedCpuAffinity affinity(cpu_affinity_);
     return ConvertTfLiteStatus(interpreter_raw_pointer->Invoke());
   };
   auto* delegate_raw_pointer =
@@ -123,8 +301,10 @@ absl::StatusOr<OutputTensors> TfLiteWrapper::Run() {
   auto abort_tflite = [delegate_raw_pointer]() {
     delegate_raw_pointer->Cancel();
   };
-  FCP_RETURN_IF_ERROR(
-      interruptible_runner_->Run(tflite_runnable, abort_tflite));
+  absl::Status status =
+      interruptible_runner_->Run(tflite_runnable, abort_tflite);
+  reusable_ = status.ok();
+  FCP_RETURN_IF_ERROR(status);
   // handles output tensors
   return ConstructOutputs();
 }
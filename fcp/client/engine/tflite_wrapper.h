@@ -16,13 +16,16 @@
 #ifndef FCP_CLIENT_ENGINE_TFLITE_WRAPPER_H_
 #define FCP_CLIENT_ENGINE_TFLITE_WRAPPER_H_
 
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "fcp/client/engine/caching_error_reporter.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/log_manager.h"
 #include "fcp/client/simple_task_environment.h"
@@ -47,6 +50,11 @@ struct TfLiteInterpreterOptions {
   // When the threshold is zero, dynamic allocation is not enabled for any
   // tensor.
   int32_t large_tensor_threshold_for_dynamic_allocation = 0;
+  // The number of threads the interpreter and the Flex delegate use. 0 lets
+  // TFLite choose.
+  int32_t num_threads = 0;
+  // The CPU cores the interpreter and its threads run on. Empty means any core.
+  std::vector<int32_t> cpu_affinity;
 };
 
 // A class to call into TFLite.
@@ -71,6 +79,13 @@ struct TfLiteInterpreterOptions {
 //    value.
 //    6. output_names: The names of the output tensors. The order for these
 //    tensor names must be deterministic.
+//    7. interpreter_options: The TfLiteInterpreterOptions.
+//    8. interpreter_cache: If not null, an interpreter previously prepared for
+//    the same model and inputs is taken from it (if there is one) rather than
+//    preparing a new one, and the interpreter is returned to it when the
+//    TfLiteWrapper is destroyed (unless the last run failed or was aborted).
+//    Interpreters which use the Flex delegate aren't cached though (see
+//    `TfLiteInterpreterCache`).
 class TfLiteWrapper {
  public:
   static absl::StatusOr<std::unique_ptr<TfLiteWrapper>> Create(
@@ -79,7 +94,26 @@ class TfLiteWrapper {
       LogManager* log_manager,
       std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
       std::vector<std::string> output_names,
-      const TfLiteInterpreterOptions& interpreter_options);
+      const TfLiteInterpreterOptions& interpreter_options,
+      TfLiteInterpreterCache* interpreter_cache);
+
+  // Like `Create`, but loads the model from the file at `model_path`, which is
+  // memory-mapped rather than read into memory. This keeps large models out of
+  // the heap, and lets runs of the same model share its pages in the page
+  // cache (e.g. a model file from `FileBackedResourceCache::GetFile`).
+  // Interpreters for the file are cached by its path, inode, size and
+  // modification time, so a file should be replaced (e.g. renamed over) rather
+  // than modified in place.
+  static absl::StatusOr<std::unique_ptr<TfLiteWrapper>> CreateFromFile(
+      const std::string& model_path, std::function<bool()> should_abort,
+      const InterruptibleRunner::TimingConfig& timing_config,
+      LogManager* log_manager,
+      std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+      std::vector<std::string> output_names,
+      const TfLiteInterpreterOptions& interpreter_options,
+      TfLiteInterpreterCache* interpreter_cache);
+
+  ~TfLiteWrapper();
 
   // Wrapper around TfLite's Interpreter::Invoke method.
   // If the run succeeds, a vector of output tensors (empty if there's no
@@ -88,27 +122,61 @@ class TfLiteWrapper {
   absl::StatusOr<OutputTensors> Run();
 
  private:
-  TfLiteWrapper(std::unique_ptr<tflite::FlatBufferModel> model,
-                std::unique_ptr<CachingErrorReporter> error_reporter,
-                tflite::TfLiteDelegateUniquePtr delegate,
-                std::unique_ptr<tflite::Interpreter> interpreter,
+  TfLiteWrapper(std::unique_ptr<PreparedTfLiteInterpreter> prepared,
                 std::unique_ptr<InterruptibleRunner> interruptible_runner,
-                std::vector<std::string> output_names)
-      : model_(std::move(model)),
-        error_reporter_(std::move(error_reporter)),
-        delegate_(std::move(delegate)),
-        interpreter_(std::move(interpreter)),
+                std::vector<std::string> output_names,
+                TfLiteInterpreterCache* interpreter_cache,
+                std::string interpreter_cache_key,
+                std::vector<int32_t> cpu_affinity)
+      : prepared_(std::move(prepared)),
+        error_reporter_(prepared_->error_reporter.get()),
+        delegate_(prepared_->delegate.get()),
+        interpreter_(prepared_->interpreter.get()),
         interruptible_runner_(std::move(interruptible_runner)),
-        output_names_(std::move(output_names)) {}
+        output_names_(std::move(output_names)),
+        interpreter_cache_(interpreter_cache),
+        interpreter_cache_key_(std::move(interpreter_cache_key)),
+        cpu_affinity_(std::move(cpu_affinity)) {}
+
+  // Takes a cached interpreter for the model identified by `model_id` (its
+  // contents or its file's identity), or else builds the model via
+  // `build_model` and prepares a new interpreter for it, and then assigns the
+  // inputs.
+  static absl::StatusOr<std::unique_ptr<TfLiteWrapper>> CreateInternal(
+      const std::string& model_id,
+      std::function<
+          absl::StatusOr<std::unique_ptr<PreparedTfLiteInterpreter>>()>
+          build_model,
+      std::function<bool()> should_abort,
+      const InterruptibleRunner::TimingConfig& timing_config,
+      LogManager* log_manager,
+      std::unique_ptr<absl::flat_hash_map<std::string, std::string>> inputs,
+      std::vector<std::string> output_names,
+      const TfLiteInterpreterOptions& interpreter_options,
+      TfLiteInterpreterCache* interpreter_cache);
+
+  // Builds an interpreter for `prepared->model`, applies the Flex delegate to
+  // it and allocates its tensors.
+  static absl::Status PrepareInterpreter(
+      const TfLiteInterpreterOptions& interpreter_options,
+      PreparedTfLiteInterpreter* prepared);
+
   absl::Status ConvertTfLiteStatus(TfLiteStatus status);
   absl::StatusOr<OutputTensors> ConstructOutputs();
 
-  std::unique_ptr<tflite::FlatBufferModel> model_;
-  std::unique_ptr<CachingErrorReporter> error_reporter_;
-  tflite::TfLiteDelegateUniquePtr delegate_;
-  std::unique_ptr<tflite::Interpreter> interpreter_;
+  std::unique_ptr<PreparedTfLiteInterpreter> prepared_;
+  // These are owned by `prepared_`.
+  CachingErrorReporter* error_reporter_;
+  TfLiteDelegate* delegate_;
+  tflite::Interpreter* interpreter_;
   std::unique_ptr<InterruptibleRunner> interruptible_runner_;
   const std::vector<std::string> output_names_;
+  TfLiteInterpreterCache* interpreter_cache_;
+  const std::string interpreter_cache_key_;
+  const std::vector<int32_t> cpu_affinity_;
+  // Whether the interpreter can be reused, i.e. whether the last run neither
+  // failed nor was aborted.
+  bool reusable_ = true;
 };
 
 }  // namespace engine
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "absl/container/flat_hash_map.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/engine/tflite_wrapper.h"
+#include "fcp/client/interruptible_runner.h"
+#include "fcp/client/test_helpers.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+constexpr char kJoinModelPath[] =
+    "fcp/client/engine/data/join_model.flatbuffer";
+
+const std::string& GetJoinModel() {
+  static std::string* model = []() {
+    std::ifstream input_stream(kJoinModelPath);
+    FCP_CHECK(input_stream) << "Failed to open " << kJoinModelPath;
+    std::stringstream output_stream;
+    output_stream << input_stream.rdbuf();
+    return new std::string(output_stream.str());
+  }();
+  return *model;
+}
+
+// Prepares an interpreter for the join model and runs it once, using the given
+// number of threads (0 lets TFLite choose) and, if the second argument is 1,
+// pinning it to CPU 0. This is what a plan run costs apart from the examples.
+void BM_CreateAndRunJoinModel(benchmark::State& state) {
+  ::testing::NiceMock<MockLogManager> log_manager;
+  InterruptibleRunner::TimingConfig timing_config{
+      .polling_period = absl::Milliseconds(100),
+      .graceful_shutdown_period = absl::Milliseconds(1000),
+      .extended_shutdown_period = absl::Milliseconds(2000)};
+  TfLiteInterpreterOptions options{.num_threads =
+                                       static_cast<int32_t>(state.range(0))};
+  if (state.range(1) == 1) {
+    options.cpu_affinity = {0};
+  }
+  const std::string& model = GetJoinModel();
+  for (auto s : state) {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    (*inputs)["x"] = "abc";
+    (*inputs)["y"] = "def";
+    auto wrapper = TfLiteWrapper::Create(
+        model, []() { return false; }, timing_config, &log_manager,
+        std::move(inputs), {"Identity"}, options,
+        /*interpreter_cache=*/nullptr);
+    FCP_CHECK_STATUS(wrapper.status());
+    benchmark::DoNotOptimize((*wrapper)->Run());
+  }
+}
+
+void ThreadPolicyArgs(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t num_threads : {0, 1, 2, 4}) {
+    for (int64_t pinned : {0, 1}) {
+      benchmark->Args({num_threads, pinned});
+    }
+  }
+}
+
+BENCHMARK(BM_CreateAndRunJoinModel)
+    ->Apply(ThreadPolicyArgs)
+    ->ArgNames({"threads", "pinned"})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
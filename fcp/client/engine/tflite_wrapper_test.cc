@@ -15,14 +15,20 @@
  */
 #include "fcp/client/engine/tflite_wrapper.h"
 
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
+#include "flatbuffers/flatbuffers.h"
+#include "fcp/client/engine/tflite_interpreter_cache.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/test_helpers.h"
 #include "fcp/testing/testing.h"
+#include "tensorflow/lite/schema/schema_generated.h"
 
 namespace fcp {
 namespace client {
@@ -44,6 +50,37 @@ class TfLiteWrapperTest : public testing::Test {
     return output_stream.str();
   }
 
+  // Returns a model without any ops, which returns its string input "x" as its
+  // output. Unlike the models in `kAssetsPath`, it doesn't use the Flex
+  // delegate, so interpreters for it can be cached.
+  std::string CreateModelWithoutFlexOps() {
+    flatbuffers::FlatBufferBuilder builder;
+    std::vector<flatbuffers::Offset<tflite::Buffer>> buffers = {
+        tflite::CreateBuffer(builder)};
+    std::vector<flatbuffers::Offset<tflite::Tensor>> tensors = {
+        tflite::CreateTensor(builder, builder.CreateVector<int32_t>({1}),
+                             tflite::TensorType_STRING, /*buffer=*/0,
+                             builder.CreateString("x"))};
+    std::vector<flatbuffers::Offset<tflite::SubGraph>> subgraphs = {
+        tflite::CreateSubGraph(
+            builder, builder.CreateVector(tensors),
+            /*inputs=*/builder.CreateVector<int32_t>({0}),
+            /*outputs=*/builder.CreateVector<int32_t>({0}),
+            builder.CreateVector(
+                std::vector<flatbuffers::Offset<tflite::Operator>>()))};
+    tflite::FinishModelBuffer(
+        builder,
+        tflite::CreateModel(
+            builder, TFLITE_SCHEMA_VERSION,
+            builder.CreateVector(
+                std::vector<flatbuffers::Offset<tflite::OperatorCode>>()),
+            builder.CreateVector(subgraphs),
+            /*description=*/0, builder.CreateVector(buffers)));
+    return std::string(
+        reinterpret_cast<const char*>(builder.GetBufferPointer()),
+        builder.GetSize());
+  }
+
   MockLogManager mock_log_manager_;
   InterruptibleRunner::TimingConfig default_timing_config_ =
       InterruptibleRunner::TimingConfig{
@@ -63,7 +100,7 @@ TEST_F(TfLiteWrapperTest, InvalidModel) {
           "INVALID_FLATBUFFER", []() { return false; }, default_timing_config_,
           &mock_log_manager_,
           std::make_unique<absl::flat_hash_map<std::string, std::string>>(),
-          output_names_, options_),
+          output_names_, options_, /*interpreter_cache=*/nullptr),
       IsCode(INVALID_ARGUMENT));
 }
 
@@ -78,7 +115,7 @@ TEST_F(TfLiteWrapperTest, InputNotSet) {
           *plan, []() { return false; }, default_timing_config_,
           &mock_log_manager_,
           std::make_unique<absl::flat_hash_map<std::string, std::string>>(),
-          output_names_, options_),
+          output_names_, options_, /*interpreter_cache=*/nullptr),
       IsCode(INVALID_ARGUMENT));
 }
 
@@ -93,7 +130,7 @@ TEST_F(TfLiteWrapperTest, WrongNumberOfOutputs) {
           *plan, []() { return false; }, default_timing_config_,
           &mock_log_manager_,
           std::make_unique<absl::flat_hash_map<std::string, std::string>>(),
-          {"Identity", "EXTRA"}, options_),
+          {"Identity", "EXTRA"}, options_, /*interpreter_cache=*/nullptr),
       IsCode(INVALID_ARGUMENT));
 }
 
@@ -108,7 +145,8 @@ TEST_F(TfLiteWrapperTest, Aborted) {
   // to see a CANCELLED status when we run the plan.
   auto wrapper = TfLiteWrapper::Create(
       *plan, []() { return true; }, default_timing_config_, &mock_log_manager_,
-      std::move(inputs), output_names_, options_);
+      std::move(inputs), output_names_, options_,
+      /*interpreter_cache=*/nullptr);
   ASSERT_OK(wrapper);
   EXPECT_THAT((*wrapper)->Run(), IsCode(CANCELLED));
 }
@@ -122,7 +160,8 @@ TEST_F(TfLiteWrapperTest, Success) {
   (*inputs)["y"] = "def";
   auto wrapper = TfLiteWrapper::Create(
       *plan, []() { return false; }, default_timing_config_, &mock_log_manager_,
-      std::move(inputs), output_names_, options_);
+      std::move(inputs), output_names_, options_,
+      /*interpreter_cache=*/nullptr);
   EXPECT_THAT(wrapper, IsCode(OK));
   auto outputs = (*wrapper)->Run();
   ASSERT_OK(outputs);
@@ -132,6 +171,183 @@ TEST_F(TfLiteWrapperTest, Success) {
       "abcdef");
 }
 
+TEST_F(TfLiteWrapperTest, SuccessWithThreadPolicy) {
+  auto plan = ReadFileAsString(absl::StrCat(kAssetsPath, kJoinModelFile));
+  ASSERT_OK(plan);
+  auto inputs =
+      std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+  (*inputs)["x"] = "abc";
+  (*inputs)["y"] = "def";
+  TfLiteInterpreterOptions options = options_;
+  options.num_threads = 2;
+  options.cpu_affinity = {0};
+  auto wrapper = TfLiteWrapper::Create(
+      *plan, []() { return false; }, default_timing_config_, &mock_log_manager_,
+      std::move(inputs), output_names_, options,
+      /*interpreter_cache=*/nullptr);
+  ASSERT_OK(wrapper);
+  auto outputs = (*wrapper)->Run();
+  ASSERT_OK(outputs);
+  EXPECT_EQ(
+      *static_cast<tensorflow::tstring*>(outputs->output_tensors.at(0).data()),
+      "abcdef");
+}
+
+TEST_F(TfLiteWrapperTest, SuccessFromFile) {
+  auto inputs =
+      std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+  (*inputs)["x"] = "abc";
+  (*inputs)["y"] = "def";
+  auto wrapper = TfLiteWrapper::CreateFromFile(
+      absl::StrCat(kAssetsPath, kJoinModelFile), []() { return false; },
+      default_timing_config_, &mock_log_manager_, std::move(inputs),
+      output_names_, options_, /*interpreter_cache=*/nullptr);
+  ASSERT_OK(wrapper);
+  auto outputs = (*wrapper)->Run();
+  ASSERT_OK(outputs);
+  EXPECT_EQ(
+      *static_cast<tensorflow::tstring*>(outputs->output_tensors.at(0).data()),
+      "abcdef");
+}
+
+TEST_F(TfLiteWrapperTest, MissingModelFile) {
+  EXPECT_THAT(
+      TfLiteWrapper::CreateFromFile(
+          absl::StrCat(kAssetsPath, "missing.flatbuffer"),
+          []() { return false; }, default_timing_config_, &mock_log_manager_,
+          std::make_unique<absl::flat_hash_map<std::string, std::string>>(),
+          output_names_, options_, /*interpreter_cache=*/nullptr),
+      IsCode(INVALID_ARGUMENT));
+}
+
+TEST_F(TfLiteWrapperTest, ReusesCachedInterpreter) {
+  const std::string plan = CreateModelWithoutFlexOps();
+  TfLiteInterpreterCache cache(/*max_interpreters=*/1);
+  for (const std::string& x : {"abc", "defg"}) {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    (*inputs)["x"] = x;
+    auto wrapper = TfLiteWrapper::Create(
+        plan, []() { return false; }, default_timing_config_,
+        &mock_log_manager_, std::move(inputs), output_names_, options_, &cache);
+    ASSERT_OK(wrapper);
+    auto outputs = (*wrapper)->Run();
+    ASSERT_OK(outputs);
+    // The second run sees its own input, rather than that of the first run.
+    EXPECT_EQ(*static_cast<tensorflow::tstring*>(
+                  outputs->output_tensors.at(0).data()),
+              x);
+  }
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 1);
+}
+
+TEST_F(TfLiteWrapperTest, DoesNotReuseInterpreterOfReplacedModelFile) {
+  std::filesystem::path model_path =
+      std::filesystem::path(testing::TempDir()) / "replaced_model.flatbuffer";
+  std::filesystem::path new_model_path =
+      std::filesystem::path(testing::TempDir()) / "new_model.flatbuffer";
+  const std::string plan = CreateModelWithoutFlexOps();
+  auto write_model = [&plan](const std::filesystem::path& path) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << plan;
+  };
+  write_model(model_path);
+  TfLiteInterpreterCache cache(/*max_interpreters=*/1);
+  auto run_from_file = [&]() {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    (*inputs)["x"] = "abc";
+    auto wrapper = TfLiteWrapper::CreateFromFile(
+        model_path.string(), []() { return false; }, default_timing_config_,
+        &mock_log_manager_, std::move(inputs), output_names_, options_,
+        &cache);
+    ASSERT_OK(wrapper);
+    ASSERT_OK((*wrapper)->Run());
+  };
+  run_from_file();
+  run_from_file();
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 1);
+
+  // Replacing the file (even with the same contents) gives it a new identity,
+  // so the interpreter cached for the old file isn't used for the new one.
+  write_model(new_model_path);
+  std::filesystem::rename(new_model_path, model_path);
+  run_from_file();
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 2);
+}
+
+TEST_F(TfLiteWrapperTest, DoesNotCacheFlexInterpreter) {
+  // The join model runs its op on the Flex delegate, whose TensorFlow state
+  // can't be reset, so its interpreters are never cached.
+  auto plan = ReadFileAsString(absl::StrCat(kAssetsPath, kJoinModelFile));
+  ASSERT_OK(plan);
+  TfLiteInterpreterCache cache(/*max_interpreters=*/1);
+  auto create_inputs = []() {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    (*inputs)["x"] = "abc";
+    (*inputs)["y"] = "def";
+    return inputs;
+  };
+  for (int i = 0; i < 2; ++i) {
+    auto wrapper = TfLiteWrapper::Create(
+        *plan, []() { return false; }, default_timing_config_,
+        &mock_log_manager_, create_inputs(), output_names_, options_, &cache);
+    ASSERT_OK(wrapper);
+    auto outputs = (*wrapper)->Run();
+    ASSERT_OK(outputs);
+    EXPECT_EQ(*static_cast<tensorflow::tstring*>(
+                  outputs->output_tensors.at(0).data()),
+              "abcdef");
+  }
+  // The model's Flex ops are detected before the cache is even looked up.
+  EXPECT_EQ(cache.hits(), 0);
+  EXPECT_EQ(cache.misses(), 0);
+
+  // Models loaded from files are looked up by the file's identity, but their
+  // interpreters aren't cached either.
+  for (int i = 0; i < 2; ++i) {
+    auto wrapper = TfLiteWrapper::CreateFromFile(
+        absl::StrCat(kAssetsPath, kJoinModelFile), []() { return false; },
+        default_timing_config_, &mock_log_manager_, create_inputs(),
+        output_names_, options_, &cache);
+    ASSERT_OK(wrapper);
+    ASSERT_OK((*wrapper)->Run());
+  }
+  EXPECT_EQ(cache.hits(), 0);
+  EXPECT_EQ(cache.misses(), 2);
+}
+
+TEST_F(TfLiteWrapperTest, DoesNotCacheAbortedInterpreter) {
+  // The model is loaded from a file, so that the cache is looked up even
+  // though the model uses the Flex delegate.
+  const std::string model_path = absl::StrCat(kAssetsPath, kJoinModelFile);
+  TfLiteInterpreterCache cache(/*max_interpreters=*/1);
+  auto create_inputs = []() {
+    auto inputs =
+        std::make_unique<absl::flat_hash_map<std::string, std::string>>();
+    (*inputs)["x"] = "abc";
+    (*inputs)["y"] = "def";
+    return inputs;
+  };
+  {
+    auto wrapper = TfLiteWrapper::CreateFromFile(
+        model_path, []() { return true; }, default_timing_config_,
+        &mock_log_manager_, create_inputs(), output_names_, options_, &cache);
+    ASSERT_OK(wrapper);
+    EXPECT_THAT((*wrapper)->Run(), IsCode(CANCELLED));
+  }
+  auto wrapper = TfLiteWrapper::CreateFromFile(
+      model_path, []() { return false; }, default_timing_config_,
+      &mock_log_manager_, create_inputs(), output_names_, options_, &cache);
+  ASSERT_OK(wrapper);
+  ASSERT_OK((*wrapper)->Run());
+  EXPECT_EQ(cache.hits(), 0);
+  EXPECT_EQ(cache.misses(), 2);
+}
+
 }  // anonymous namespace
 }  // namespace engine
 }  // namespace client
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/thread_policy.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+ThreadPolicy CreateThreadPolicy(const Flags& flags) {
+  return ThreadPolicy{
+      .intra_op_threads = flags.plan_intra_op_threads(),
+      .inter_op_threads = flags.plan_inter_op_threads(),
+      .share_inter_op_thread_pool = flags.share_plan_inter_op_thread_pool(),
+      .tflite_threads = flags.tflite_num_threads(),
+      .cpu_affinity = flags.plan_cpu_affinity()};
+}
+
+#ifdef __linux__
+
+ScopedCpuAffinity::ScopedCpuAffinity(const std::vector<int32_t>& cpus) {
+  if (cpus.empty()) return;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int32_t cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      status_ = absl::InvalidArgumentError(absl::StrCat("Invalid CPU ", cpu));
+      return;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  cpu_set_t previous_cpu_set;
+  // A pid of 0 refers to the calling thread.
+  if (sched_getaffinity(0, sizeof(previous_cpu_set), &previous_cpu_set) != 0 ||
+      sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    status_ = absl::InternalError(
+        absl::StrCat("Failed to set CPU affinity: ", std::strerror(errno)));
+    return;
+  }
+  previous_cpu_set_.resize(sizeof(previous_cpu_set));
+  std::memcpy(previous_cpu_set_.data(), &previous_cpu_set,
+              sizeof(previous_cpu_set));
+  restore_ = true;
+}
+
+ScopedCpuAffinity::~ScopedCpuAffinity() {
+  if (!restore_) return;
+  cpu_set_t previous_cpu_set;
+  std::memcpy(&previous_cpu_set, previous_cpu_set_.data(),
+              sizeof(previous_cpu_set));
+  sched_setaffinity(0, sizeof(previous_cpu_set), &previous_cpu_set);
+}
+
+#else
+
+ScopedCpuAffinity::ScopedCpuAffinity(const std::vector<int32_t>& cpus) {
+  if (!cpus.empty()) {
+    status_ =
+        absl::UnimplementedError("Setting the CPU affinity is unsupported");
+  }
+}
+
+ScopedCpuAffinity::~ScopedCpuAffinity() = default;
+
+#endif
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
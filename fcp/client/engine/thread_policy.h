@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_ENGINE_THREAD_POLICY_H_
+#define FCP_CLIENT_ENGINE_THREAD_POLICY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "fcp/client/flags.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+
+// How the plan engines use threads and CPU cores to run a plan. The defaults
+// leave all of these decisions to TensorFlow and TFLite.
+struct ThreadPolicy {
+  // The number of threads TensorFlow uses to parallelize a single op. 0 lets
+  // TensorFlow choose (i.e. one per core).
+  int32_t intra_op_threads = 0;
+  // The number of threads TensorFlow uses to run independent ops in parallel.
+  // 0 lets TensorFlow choose.
+  int32_t inter_op_threads = 0;
+  // Whether all sessions run their ops on a single, process-wide inter-op
+  // thread pool of `inter_op_threads` threads (even those of plans setting
+  // their own inter-op parallelism). TensorFlow's default global pool is sized
+  // by whichever session in the process happens to be created first.
+  bool share_inter_op_thread_pool = false;
+  // The number of threads a TFLite interpreter uses, which also sizes the Flex
+  // delegate's intra-op thread pool. 0 lets TFLite choose.
+  int32_t tflite_threads = 0;
+  // The CPU cores the plan may run on (e.g. only the big cores of a big.LITTLE
+  // CPU). Empty means any core.
+  std::vector<int32_t> cpu_affinity;
+};
+
+// Returns the ThreadPolicy configured by the given flags.
+ThreadPolicy CreateThreadPolicy(const Flags& flags);
+
+// Restricts the calling thread to the given CPU cores for the lifetime of this
+// object, and restores its previous affinity afterwards. Threads created by the
+// calling thread in the meantime (e.g. the thread pools of a TensorFlow session
+// or a TFLite interpreter) inherit the affinity, and keep it. Does nothing if
+// `cpus` is empty, or if the platform doesn't support setting the affinity of a
+// thread, in which case `status()` returns UNIMPLEMENTED.
+class ScopedCpuAffinity {
+ public:
+  explicit ScopedCpuAffinity(const std::vector<int32_t>& cpus);
+  ~ScopedCpuAffinity();
+
+  ScopedCpuAffinity(const ScopedCpuAffinity&) = delete;
+  ScopedCpuAffinity& operator=(const ScopedCpuAffinity&) = delete;
+
+  // Whether the affinity was applied.
+  absl::Status status() const { return status_; }
+
+ private:
+  absl::Status status_;
+  bool restore_ = false;
+  // The previous affinity, as a platform-specific CPU set.
+  std::vector<char> previous_cpu_set_;
+};
+
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_ENGINE_THREAD_POLICY_H_
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/engine/thread_policy.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "fcp/client/test_helpers.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp {
+namespace client {
+namespace engine {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+TEST(ThreadPolicyTest, CreateThreadPolicyFromFlags) {
+  NiceMock<MockFlags> flags;
+  ON_CALL(flags, plan_intra_op_threads()).WillByDefault(Return(2));
+  ON_CALL(flags, plan_inter_op_threads()).WillByDefault(Return(1));
+  ON_CALL(flags, share_plan_inter_op_thread_pool()).WillByDefault(Return(true));
+  ON_CALL(flags, tflite_num_threads()).WillByDefault(Return(4));
+  ON_CALL(flags, plan_cpu_affinity())
+      .WillByDefault(Return(std::vector<int32_t>{4, 5}));
+
+  ThreadPolicy policy = CreateThreadPolicy(flags);
+  EXPECT_EQ(policy.intra_op_threads, 2);
+  EXPECT_EQ(policy.inter_op_threads, 1);
+  EXPECT_TRUE(policy.share_inter_op_thread_pool);
+  EXPECT_EQ(policy.tflite_threads, 4);
+  EXPECT_THAT(policy.cpu_affinity, ElementsAre(4, 5));
+}
+
+TEST(ScopedCpuAffinityTest, EmptyAffinityDoesNothing) {
+  ScopedCpuAffinity affinity({});
+  EXPECT_OK(affinity.status());
+}
+
+#ifdef __linux__
+
+bool IsPinnedToCpu0() {
+  cpu_set_t cpu_set;
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) return false;
+  return CPU_COUNT(&cpu_set) == 1 && CPU_ISSET(0, &cpu_set);
+}
+
+TEST(ScopedCpuAffinityTest, PinsAndRestoresCallingThread) {
+  cpu_set_t initial_cpu_set;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(initial_cpu_set), &initial_cpu_set),
+            0);
+  {
+    ScopedCpuAffinity affinity({0});
+    ASSERT_OK(affinity.status());
+    EXPECT_TRUE(IsPinnedToCpu0());
+
+    // Threads created in the meantime inherit the affinity.
+    bool thread_pinned = false;
+    std::thread thread(
+        [&thread_pinned]() { thread_pinned = IsPinnedToCpu0(); });
+    thread.join();
+    EXPECT_TRUE(thread_pinned);
+  }
+  cpu_set_t cpu_set;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(cpu_set), &cpu_set), 0);
+  EXPECT_TRUE(CPU_EQUAL(&cpu_set, &initial_cpu_set));
+}
+
+TEST(ScopedCpuAffinityTest, InvalidCpu) {
+  ScopedCpuAffinity affinity({-1});
+  EXPECT_THAT(affinity.status(), IsCode(INVALID_ARGUMENT));
+}
+
+#endif
+
+}  // anonymous namespace
+}  // namespace engine
+}  // namespace client
+}  // namespace fcp
@@ -93,6 +93,21 @@ grpc::Status FakeServer::Session(
       protocol_options_response->set_chunk_size_for_upload(
           chunk_size_for_upload_);
       protocol_options_response->set_max_pending_chunks(max_pending_chunks_);
+      const auto& protocol_options_request =
+          request.has_eligibility_eval_checkin_request()
+              ? request.eligibility_eval_checkin_request()
+                    .protocol_options_request()
+              : request.checkin_request().protocol_options_request();
+      if (protocol_options_request.supports_adaptive_flow_control() &&
+          (adaptive_max_chunk_size_for_upload_ > 0 ||
+           adaptive_max_pending_chunks_ > 0)) {
+        auto adaptive_flow_control =
+            protocol_options_response->mutable_adaptive_flow_control();
+        adaptive_flow_control->set_max_chunk_size_for_upload(
+            adaptive_max_chunk_size_for_upload_);
+        adaptive_flow_control->set_max_pending_chunks(
+            adaptive_max_pending_chunks_);
+      }
     }
     if (!(status = Handle(request, &response, &chunked_bidi_stream)).ok()) {
       FCP_LOG(INFO) << "Server returning status " << status;
@@ -49,6 +49,18 @@ class FakeServer
       : chunk_size_for_upload_(chunk_size_for_upload),
         max_pending_chunks_(max_pending_chunks),
         compression_level_(compression_level) {}
+  // Additionally advertises the given upper bounds for adaptive flow control
+  // to clients which support it.
+  FakeServer(
+      int32_t chunk_size_for_upload, int32_t max_pending_chunks,
+      google::internal::federatedml::v2::CompressionLevel compression_level,
+      int32_t adaptive_max_chunk_size_for_upload,
+      int32_t adaptive_max_pending_chunks)
+      : chunk_size_for_upload_(chunk_size_for_upload),
+        max_pending_chunks_(max_pending_chunks),
+        compression_level_(compression_level),
+        adaptive_max_chunk_size_for_upload_(adaptive_max_chunk_size_for_upload),
+        adaptive_max_pending_chunks_(adaptive_max_pending_chunks) {}
 
   // FakeServer is neither copyable nor movable.
   FakeServer(const FakeServer&) = delete;
@@ -76,6 +88,8 @@ class FakeServer
   int32_t chunk_size_for_upload_;
   int32_t max_pending_chunks_;
   google::internal::federatedml::v2::CompressionLevel compression_level_;
+  int32_t adaptive_max_chunk_size_for_upload_ = 0;
+  int32_t adaptive_max_pending_chunks_ = 0;
   absl::Notification session_done_;
 
  private:
@@ -17,9 +17,7 @@
 
 #include <deque>
 #include <filesystem>
-#include <fstream>
 #include <functional>
-#include <ios>
 #include <memory>
 #include <string>
 #include <utility>
@@ -27,7 +25,6 @@
 
 #include "google/protobuf/any.pb.h"
 #include "absl/status/statusor.h"
-#include "absl/strings/cord.h"
 #include "absl/strings/str_replace.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/wall_clock_stopwatch.h"
@@ -37,6 +34,7 @@
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/http/http_client_util.h"
 #include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/http/resource_fetcher.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/log_manager.h"
 #include "fcp/client/stats.h"
@@ -46,7 +44,6 @@ namespace fcp {
 namespace client {
 
 using fcp::client::http::HttpClient;
-using fcp::client::http::InMemoryHttpResponse;
 using fcp::client::http::UriOrInlineData;
 using ::google::internal::federated::plan::SlicesSelector;
 
@@ -74,11 +71,17 @@ class DisabledFederatedSelectExampleIteratorFactory
   LogManager& log_manager_;
 };
 
-absl::StatusOr<std::deque<absl::Cord>> FetchSlicesViaHttp(
-    const SlicesSelector& slices_selector, absl::string_view uri_template,
-    HttpClient& http_client, InterruptibleRunner& interruptible_runner,
-    bool client_decoded_http_resources, int64_t* bytes_received_acc,
-    int64_t* bytes_sent_acc) {
+// Fetches the slices into the given files (one per slice key), streaming the
+// data of each slice to disk as it arrives.
+absl::Status FetchSlicesViaHttp(const SlicesSelector& slices_selector,
+                                absl::string_view uri_template,
+                                const std::deque<std::string>& slice_filenames,
+                                HttpClient& http_client,
+                                InterruptibleRunner& interruptible_runner,
+                                bool client_decoded_http_resources,
+                                int max_concurrent_fetches,
+                                int64_t* bytes_received_acc,
+                                int64_t* bytes_sent_acc) {
   std::vector<UriOrInlineData> resources;
   for (int32_t slice_key : slices_selector.keys()) {
     std::string slice_uri = absl::StrReplaceAll(
@@ -89,12 +92,19 @@ absl::StatusOr<std::deque<absl::Cord>> FetchSlicesViaHttp(
 
     resources.push_back(UriOrInlineData::CreateUri(slice_uri));
   }
+  std::vector<http::FileResourceSink> sinks(slice_filenames.begin(),
+                                            slice_filenames.end());
+  std::vector<http::ResourceSink*> sink_ptrs;
+  for (http::FileResourceSink& sink : sinks) {
+    sink_ptrs.push_back(&sink);
+  }
 
   // Perform the requests.
-  absl::StatusOr<std::vector<absl::StatusOr<InMemoryHttpResponse>>>
-      slice_fetch_result = http::FetchResourcesInMemory(
-          http_client, interruptible_runner, std::move(resources),
-          bytes_received_acc, bytes_sent_acc, client_decoded_http_resources);
+  absl::StatusOr<std::vector<absl::Status>> slice_fetch_result =
+      http::FetchResources(http_client, interruptible_runner, resources,
+                           sink_ptrs, bytes_received_acc, bytes_sent_acc,
+                           client_decoded_http_resources,
+                           max_concurrent_fetches);
 
   // Check whether issuing the requests failed as a whole (generally indicating
   // a programming error).
@@ -104,22 +114,19 @@ absl::StatusOr<std::deque<absl::Cord>> FetchSlicesViaHttp(
         "): ", absl::StatusCodeToString(slice_fetch_result.status().code())));
   }
 
-  std::deque<absl::Cord> slices;
-  for (const absl::StatusOr<InMemoryHttpResponse>& http_response :
-       *slice_fetch_result) {
-    if (!http_response.ok()) {
+  for (const absl::Status& slice_result : *slice_fetch_result) {
+    if (!slice_result.ok()) {
       return absl::UnavailableError(absl::StrCat(
           "Slice fetch request failed (URI template: ", uri_template,
-          "): ", absl::StatusCodeToString(http_response.status().code())));
+          "): ", absl::StatusCodeToString(slice_result.code())));
     }
-    slices.push_back(http_response->body);
   }
-  return slices;
+  return absl::OkStatus();
 }
 
 // A Federated Select `ExampleIteratorFactory` that, upon creation of an
-// iterator, fetches the slice data via HTTP, buffers it in-memory, and then
-// exposes it to the plan via an `InMemoryFederatedSelectExampleIterator`.
+// iterator, fetches the slice data via HTTP into scratch files, and then
+// exposes it to the plan via a `FileBackedFederatedSelectExampleIterator`.
 class HttpFederatedSelectExampleIteratorFactory
     : public FederatedSelectExampleIteratorFactory {
  public:
@@ -170,44 +177,56 @@ HttpFederatedSelectExampleIteratorFactory::CreateExampleIterator(
 
   log_manager_.LogDiag(ProdDiagCode::FEDSELECT_SLICE_HTTP_FETCH_REQUESTED);
 
-  // Create the temporary scratch file to store the checkpoint data in.
-  // Deletion of the file is done in the
-  // InMemoryFederatedSelectExampleIterator::Close() method or its destructor.
-  absl::StatusOr<std::string> scratch_filename =
-      files_.CreateTempFile("slice", ".ckp");
-
-  if (!scratch_filename.ok()) {
-    return absl::InternalError(absl::StrCat(
-        "Failed to create scratch file for slice data (URI template: ",
-        uri_template_,
-        "): ", absl::StatusCodeToString(scratch_filename.status().code()), ": ",
-        scratch_filename.status().message()));
+  // Create the temporary scratch files to store the checkpoint data in, one per
+  // slice. Deletion of the files is done in the
+  // FileBackedFederatedSelectExampleIterator::Close() method or its destructor
+  // (or below, if fetching the slices fails).
+  std::deque<std::string> slice_filenames;
+  auto delete_slice_files = [&slice_filenames]() {
+    for (const std::string& slice_filename : slice_filenames) {
+      std::filesystem::remove(slice_filename);
+    }
+  };
+  for (int i = 0; i < slices_selector.keys_size(); ++i) {
+    absl::StatusOr<std::string> scratch_filename =
+        files_.CreateTempFile("slice", ".ckp");
+    if (!scratch_filename.ok()) {
+      delete_slice_files();
+      return absl::InternalError(absl::StrCat(
+          "Failed to create scratch file for slice data (URI template: ",
+          uri_template_,
+          "): ", absl::StatusCodeToString(scratch_filename.status().code()),
+          ": ", scratch_filename.status().message()));
+    }
+    slice_filenames.push_back(*std::move(scratch_filename));
   }
 
   // Fetch the slices.
   int64_t bytes_received = 0;
   int64_t bytes_sent = 0;
-  absl::StatusOr<std::deque<absl::Cord>> slices;
+  absl::Status fetch_result;
   {
     auto started_stopwatch = network_stopwatch_.Start();
-    slices = FetchSlicesViaHttp(slices_selector, uri_template_, http_client_,
-                                interruptible_runner_,
-                                flags_.client_decoded_http_resources(),
-                                /*bytes_received_acc=*/&bytes_received,
-                                /*bytes_sent_acc=*/&bytes_sent);
+    fetch_result = FetchSlicesViaHttp(
+        slices_selector, uri_template_, slice_filenames, http_client_,
+        interruptible_runner_, flags_.client_decoded_http_resources(),
+        flags_.max_concurrent_resource_fetches(),
+        /*bytes_received_acc=*/&bytes_received,
+        /*bytes_sent_acc=*/&bytes_sent);
   }
   bytes_sent_acc_ += bytes_sent;
   bytes_received_acc_ += bytes_received;
-  if (!slices.ok()) {
+  if (!fetch_result.ok()) {
+    delete_slice_files();
     log_manager_.LogDiag(ProdDiagCode::FEDSELECT_SLICE_HTTP_FETCH_FAILED);
-    return absl::Status(slices.status().code(),
+    return absl::Status(fetch_result.code(),
                         absl::StrCat("Failed to fetch slice data: ",
-                                     slices.status().message()));
+                                     fetch_result.message()));
   }
   log_manager_.LogDiag(ProdDiagCode::FEDSELECT_SLICE_HTTP_FETCH_SUCCEEDED);
 
-  return std::make_unique<InMemoryFederatedSelectExampleIterator>(
-      *scratch_filename, std::move(*slices));
+  return std::make_unique<FileBackedFederatedSelectExampleIterator>(
+      std::move(slice_filenames));
 }
 }  // namespace
 
@@ -257,50 +276,42 @@ HttpFederatedSelectManager::CreateExampleIteratorFactoryForUriTemplate(
       network_stopwatch_.get());
 }
 
-absl::StatusOr<std::string> InMemoryFederatedSelectExampleIterator::Next() {
+absl::StatusOr<std::string> FileBackedFederatedSelectExampleIterator::Next() {
   absl::MutexLock lock(&mutex_);
 
-  if (slices_.empty()) {
-    // Eagerly delete the scratch file, since we won't need it anymore.
-    std::filesystem::remove(scratch_filename_);
-    return absl::OutOfRangeError("end of iterator reached");
+  // The plan is done with the previous slice once it asks for the next one, so
+  // eagerly delete the previous slice's file.
+  if (!returned_filename_.empty()) {
+    std::filesystem::remove(returned_filename_);
+    returned_filename_.clear();
   }
-
-  absl::Cord& slice_data = slices_.front();
-
-  // Write the checkpoint data to the file (truncating any data previously
-  // written to the file).
-  std::fstream checkpoint_stream(scratch_filename_,
-                                 std::ios_base::out | std::ios_base::trunc);
-  if (checkpoint_stream.fail()) {
-    return absl::InternalError("Failed to write slice to file");
-  }
-  for (absl::string_view chunk : slice_data.Chunks()) {
-    if (!(checkpoint_stream << chunk).good()) {
-      return absl::InternalError("Failed to write slice to file");
-    }
+  if (slice_filenames_.empty()) {
+    return absl::OutOfRangeError("end of iterator reached");
   }
-  checkpoint_stream.close();
-
-  // Remove the slice from the deque, releasing its data from memory.
-  slices_.pop_front();
-
-  return scratch_filename_;
+  returned_filename_ = std::move(slice_filenames_.front());
+  slice_filenames_.pop_front();
+  return returned_filename_;
 }
 
-void InMemoryFederatedSelectExampleIterator::Close() { CleanupInternal(); }
+void FileBackedFederatedSelectExampleIterator::Close() { CleanupInternal(); }
 
-InMemoryFederatedSelectExampleIterator::
-    ~InMemoryFederatedSelectExampleIterator() {
-  // Remove the scratch file, even if Close() wasn't called first.
+FileBackedFederatedSelectExampleIterator::
+    ~FileBackedFederatedSelectExampleIterator() {
+  // Remove the slice files, even if Close() wasn't called first.
   CleanupInternal();
 }
 
-void InMemoryFederatedSelectExampleIterator::CleanupInternal() {
+void FileBackedFederatedSelectExampleIterator::CleanupInternal() {
   absl::MutexLock lock(&mutex_);
-  // Remove the scratch filename, if it hadn't been removed yet.
-  slices_.clear();
-  std::filesystem::remove(scratch_filename_);
+  // Remove the slice files, if they hadn't been removed yet.
+  if (!returned_filename_.empty()) {
+    std::filesystem::remove(returned_filename_);
+    returned_filename_.clear();
+  }
+  for (const std::string& slice_filename : slice_filenames_) {
+    std::filesystem::remove(slice_filename);
+  }
+  slice_filenames_.clear();
 }
 
 }  // namespace client
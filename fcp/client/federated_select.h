@@ -22,8 +22,9 @@
 #include <string>
 #include <utility>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/statusor.h"
-#include "absl/strings/cord.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "fcp/base/wall_clock_stopwatch.h"
 #include "fcp/client/engine/example_iterator_factory.h"
@@ -144,29 +145,29 @@ class HttpFederatedSelectManager : public FederatedSelectManager {
   std::unique_ptr<InterruptibleRunner> interruptible_runner_;
 };
 
-// A Federated Select ExampleIterator that simply returns slice data that is
-// already in-memory.
-class InMemoryFederatedSelectExampleIterator : public ExampleIterator {
+// A Federated Select ExampleIterator that returns slice data which was already
+// fetched into files.
+class FileBackedFederatedSelectExampleIterator : public ExampleIterator {
  public:
-  // Each time another slice is requested by a call to Next(), the slice data at
-  // the front of the `slices` deque will be written to the `scratch_filename`
-  // and the filename will be returned as the example data. The scratch file
-  // will be deleted at the end of the iterator, or when the iterator is closed.
-  InMemoryFederatedSelectExampleIterator(std::string scratch_filename,
-                                         std::deque<absl::Cord> slices)
-      : scratch_filename_(scratch_filename), slices_(std::move(slices)) {}
+  // Each call to Next() returns the filename at the front of the
+  // `slice_filenames` deque as the example data, and deletes the file returned
+  // by the previous call. All files will be deleted at the end of the
+  // iterator, or when the iterator is closed.
+  explicit FileBackedFederatedSelectExampleIterator(
+      std::deque<std::string> slice_filenames)
+      : slice_filenames_(std::move(slice_filenames)) {}
   absl::StatusOr<std::string> Next() override;
   void Close() override;
 
-  ~InMemoryFederatedSelectExampleIterator() override;
+  ~FileBackedFederatedSelectExampleIterator() override;
 
  private:
   void CleanupInternal() ABSL_LOCKS_EXCLUDED(mutex_);
 
-  std::string scratch_filename_;
-
   absl::Mutex mutex_;
-  std::deque<absl::Cord> slices_ ABSL_GUARDED_BY(mutex_);
+  std::deque<std::string> slice_filenames_ ABSL_GUARDED_BY(mutex_);
+  // The file returned by the last call to Next(), if any.
+  std::string returned_filename_ ABSL_GUARDED_BY(mutex_);
 };
 
 }  // namespace client
@@ -265,14 +265,17 @@ TEST_F(HttpFederatedSelectManagerTest,
   ASSERT_OK(second_slice);
   ASSERT_TRUE(FileExists(*second_slice));
   EXPECT_THAT(ReadFile(*second_slice), expected_key1_data);
+  // Each slice is fetched into its own file, and the previous slice's file
+  // should be deleted as soon as the next slice is requested.
+  EXPECT_NE(*first_slice, *second_slice);
+  EXPECT_FALSE(FileExists(*first_slice));
 
   // We should now have reached the end of the first iterator.
   EXPECT_THAT((*iterator1)->Next(), IsCode(OUT_OF_RANGE));
 
   // Closing the iterator should not fail/crash.
   (*iterator1)->Close();
-  // The slice files we saw earlier (possibly all the same file) should now be
-  // deleted.
+  // The slice files we saw earlier should now be deleted.
   ASSERT_FALSE(FileExists(*first_slice));
   ASSERT_FALSE(FileExists(*second_slice));
 
@@ -30,8 +30,11 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/cord.h"
 #include "absl/time/time.h"
+#include "fcp/base/clock.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/platform.h"
+#include "fcp/client/cache/file_backed_resource_cache.h"
+#include "fcp/client/cord_utils.h"
 #include "fcp/client/engine/engine.pb.h"
 #include "fcp/client/engine/example_iterator_factory.h"
 #include "fcp/client/engine/plan_engine_helpers.h"
@@ -66,8 +69,6 @@
 #include "fcp/protos/federated_api.pb.h"
 #include "fcp/protos/opstats.pb.h"
 #include "fcp/protos/plan.pb.h"
-#include "openssl/digest.h"
-#include "openssl/evp.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/tensor_shape.pb.h"
@@ -101,38 +102,21 @@ void AddValuesToQuantized(QuantizedTensor* quantized,
   }
 }
 
-// Parses a proto from either an std::string or an absl::Cord. This allows the
-// proto data to be provided in either format.
-template <typename MessageT>
-bool ParseFromStringOrCord(MessageT& proto,
-                           std::variant<std::string, absl::Cord> data) {
-  if (std::holds_alternative<std::string>(data)) {
-    return proto.ParseFromString(std::get<std::string>(data));
-  } else {
-    return proto.ParseFromString(std::string(std::get<absl::Cord>(data)));
-  }
-}
-
-std::string ComputeSHA256FromStringOrCord(
-    std::variant<std::string, absl::Cord> data) {
-  std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX*)> mdctx(EVP_MD_CTX_create(),
-                                                           EVP_MD_CTX_destroy);
-  FCP_CHECK(EVP_DigestInit_ex(mdctx.get(), EVP_sha256(), nullptr));
-
-  std::string plan_str;
-  if (std::holds_alternative<std::string>(data)) {
-    plan_str = std::get<std::string>(data);
+// Computes the computation ID of a plan. For compatibility with the IDs
+// reported by earlier client versions, only the first sizeof(int) bytes of the
+// plan are hashed (zero-padded if the plan is shorter than that).
+std::string ComputeComputationId(
+    const std::variant<std::string, absl::Cord>& plan_bytes) {
+  std::string id_prefix(sizeof(int), '\0');
+  if (std::holds_alternative<std::string>(plan_bytes)) {
+    const std::string& plan_str = std::get<std::string>(plan_bytes);
+    plan_str.copy(id_prefix.data(), id_prefix.size());
   } else {
-    plan_str = std::string(std::get<absl::Cord>(data));
+    absl::CopyCordToString(
+        std::get<absl::Cord>(plan_bytes).Subcord(0, sizeof(int)), &id_prefix);
+    id_prefix.resize(sizeof(int), '\0');
   }
-
-  FCP_CHECK(EVP_DigestUpdate(mdctx.get(), plan_str.c_str(), sizeof(int)));
-  const int hash_len = 32;  // 32 bytes for SHA-256.
-  uint8_t computation_id_bytes[hash_len];
-  FCP_CHECK(EVP_DigestFinal_ex(mdctx.get(), computation_id_bytes, nullptr));
-
-  return std::string(reinterpret_cast<char const*>(computation_id_bytes),
-                     hash_len);
+  return ComputeSHA256FromStringOrCord(id_prefix);
 }
 
 struct PlanResultAndCheckpointFile {
@@ -320,8 +304,8 @@ engine::PlanResult RunEligibilityEvalPlanWithTensorflowSpec(
     std::vector<engine::ExampleIteratorFactory*> example_iterator_factories,
     std::function<bool()> should_abort, LogManager* log_manager,
     OpStatsLogger* opstats_logger, const Flags* flags,
-    const ClientOnlyPlan& client_plan,
-    const std::string& checkpoint_input_filename,
+    ClientOnlyPlan& client_plan, const std::string& checkpoint_input_filename,
+    cache::FileBackedResourceCache* tflite_model_cache,
     const fcp::client::InterruptibleRunner::TimingConfig& timing_config,
     const absl::Time run_plan_start_time, const absl::Time reference_time) {
   // Check that this is a TensorflowSpec-based plan for federated eligibility
@@ -347,9 +331,10 @@ engine::PlanResult RunEligibilityEvalPlanWithTensorflowSpec(
     engine::TfLitePlanEngine plan_engine(example_iterator_factories,
                                          should_abort, log_manager,
                                          opstats_logger, flags, &timing_config);
-    return plan_engine.RunPlan(client_plan.phase().tensorflow_spec(),
-                               client_plan.tflite_graph(),
-                               std::move(tflite_inputs), output_names);
+    return plan_engine.RunPlanFromResourceCache(
+        client_plan.phase().tensorflow_spec(),
+        std::move(*client_plan.mutable_tflite_graph()), tflite_model_cache,
+        std::move(tflite_inputs), output_names);
   }
 #endif
 
@@ -360,7 +345,7 @@ engine::PlanResult RunEligibilityEvalPlanWithTensorflowSpec(
       io_router, checkpoint_input_filename);
   // Run plan and get a set of output tensors back.
   engine::SimplePlanEngine plan_engine(example_iterator_factories, should_abort,
-                                       log_manager, opstats_logger,
+                                       log_manager, opstats_logger, flags,
                                        &timing_config);
   return plan_engine.RunPlan(
       client_plan.phase().tensorflow_spec(), client_plan.graph(),
@@ -477,9 +462,9 @@ PlanResultAndCheckpointFile RunPlanWithTensorflowSpec(
     std::vector<engine::ExampleIteratorFactory*> example_iterator_factories,
     std::function<bool()> should_abort, LogManager* log_manager,
     OpStatsLogger* opstats_logger, const Flags* flags,
-    const ClientOnlyPlan& client_plan,
-    const std::string& checkpoint_input_filename,
+    ClientOnlyPlan& client_plan, const std::string& checkpoint_input_filename,
     const std::string& checkpoint_output_filename,
+    cache::FileBackedResourceCache* tflite_model_cache,
     const fcp::client::InterruptibleRunner::TimingConfig& timing_config) {
   if (!client_plan.phase().has_tensorflow_spec()) {
     return PlanResultAndCheckpointFile(engine::PlanResult(
@@ -513,8 +498,9 @@ PlanResultAndCheckpointFile RunPlanWithTensorflowSpec(
     engine::TfLitePlanEngine plan_engine(example_iterator_factories,
                                          should_abort, log_manager,
                                          opstats_logger, flags, &timing_config);
-    engine::PlanResult plan_result = plan_engine.RunPlan(
-        client_plan.phase().tensorflow_spec(), client_plan.tflite_graph(),
+    engine::PlanResult plan_result = plan_engine.RunPlanFromResourceCache(
+        client_plan.phase().tensorflow_spec(),
+        std::move(*client_plan.mutable_tflite_graph()), tflite_model_cache,
         std::move(tflite_inputs), *output_names);
     PlanResultAndCheckpointFile result(std::move(plan_result));
     result.checkpoint_file = checkpoint_output_filename;
@@ -531,7 +517,7 @@ PlanResultAndCheckpointFile RunPlanWithTensorflowSpec(
       client_plan.phase().federated_compute(), checkpoint_input_filename,
       checkpoint_output_filename);
   engine::SimplePlanEngine plan_engine(example_iterator_factories, should_abort,
-                                       log_manager, opstats_logger,
+                                       log_manager, opstats_logger, flags,
                                        &timing_config);
   engine::PlanResult plan_result = plan_engine.RunPlan(
       client_plan.phase().tensorflow_spec(), client_plan.graph(),
@@ -771,6 +757,7 @@ absl::StatusOr<std::optional<TaskEligibilityInfo>> RunEligibilityEvalPlan(
     std::function<bool()> should_abort, PhaseLogger& phase_logger, Files* files,
     LogManager* log_manager, OpStatsLogger* opstats_logger, const Flags* flags,
     FederatedProtocol* federated_protocol,
+    cache::FileBackedResourceCache* tflite_model_cache,
     const fcp::client::InterruptibleRunner::TimingConfig& timing_config,
     const absl::Time reference_time,
     const absl::Time time_before_eligibility_eval_checkin) {
@@ -813,8 +800,8 @@ absl::StatusOr<std::optional<TaskEligibilityInfo>> RunEligibilityEvalPlan(
   phase_logger.LogEligibilityEvalComputationStarted();
   engine::PlanResult plan_result = RunEligibilityEvalPlanWithTensorflowSpec(
       example_iterator_factories, should_abort, log_manager, opstats_logger,
-      flags, plan, *checkpoint_input_filename, timing_config,
-      run_plan_start_time, reference_time);
+      flags, plan, *checkpoint_input_filename, tflite_model_cache,
+      timing_config, run_plan_start_time, reference_time);
   absl::StatusOr<TaskEligibilityInfo> task_eligibility_info;
   if (plan_result.outcome == engine::PlanOutcome::kSuccess) {
     task_eligibility_info =
@@ -846,6 +833,7 @@ IssueEligibilityEvalCheckinAndRunPlan(
     std::function<bool()> should_abort, PhaseLogger& phase_logger, Files* files,
     LogManager* log_manager, OpStatsLogger* opstats_logger, const Flags* flags,
     FederatedProtocol* federated_protocol,
+    cache::FileBackedResourceCache* tflite_model_cache,
     const fcp::client::InterruptibleRunner::TimingConfig& timing_config,
     const absl::Time reference_time, FLRunnerResult& fl_runner_result) {
   absl::Time time_before_eligibility_eval_checkin = absl::Now();
@@ -936,7 +924,7 @@ IssueEligibilityEvalCheckinAndRunPlan(
       RunEligibilityEvalPlan(eligibility_eval_task, example_iterator_factories,
                              should_abort, phase_logger, files, log_manager,
                              opstats_logger, flags, federated_protocol,
-                             timing_config, reference_time,
+                             tflite_model_cache, timing_config, reference_time,
                              time_before_eligibility_eval_checkin);
   if (!task_eligibility_info.ok()) {
     // Note that none of the PhaseLogger methods will reflect the very little
@@ -1054,7 +1042,7 @@ absl::StatusOr<CheckinResult> IssueCheckin(
       absl::get<FederatedProtocol::TaskAssignment>(*checkin_result);
 
   ClientOnlyPlan plan;
-  auto plan_bytes = task_assignment.payloads.plan;
+  const auto& plan_bytes = task_assignment.payloads.plan;
   if (!ParseFromStringOrCord(plan, plan_bytes)) {
     auto message = "Failed to parse received plan";
     phase_logger.LogCheckinInvalidPayload(
@@ -1068,7 +1056,7 @@ absl::StatusOr<CheckinResult> IssueCheckin(
 
   std::string computation_id;
   if (flags->enable_computation_id()) {
-    computation_id = ComputeSHA256FromStringOrCord(plan_bytes);
+    computation_id = ComputeComputationId(plan_bytes);
   }
 
   int32_t minimum_clients_in_server_visible_aggregate = 0;
@@ -1142,6 +1130,7 @@ absl::StatusOr<FLRunnerResult> RunFederatedComputation(
           flags->tf_execution_teardown_grace_period_millis()),
       .extended_shutdown_period = absl::Milliseconds(
           flags->tf_execution_teardown_extended_period_millis()),
+      .abort_signal = env_deps->GetAbortSignal(),
   };
 
   auto should_abort_protocol_callback = [&env_deps, &timing_config]() -> bool {
@@ -1160,7 +1149,8 @@ absl::StatusOr<FLRunnerResult> RunFederatedComputation(
     federated_protocol = std::make_unique<http::HttpFederatedProtocol>(
         log_manager, flags, http_client.get(), federated_service_uri, api_key,
         population_name, retry_token, client_version, attestation_measurement,
-        should_abort_protocol_callback, absl::BitGen(), timing_config);
+        should_abort_protocol_callback, absl::BitGen(), timing_config,
+        Clock::RealClock());
   } else {
 #ifdef FCP_CLIENT_SUPPORT_GRPC
     // Check in with the server to either retrieve a plan + initial checkpoint,
@@ -1253,6 +1243,12 @@ absl::StatusOr<FLRunnerResult> RunFederatedComputation(
     return fl_runner_result;
   }
 
+  std::unique_ptr<cache::FileBackedResourceCache> tflite_model_cache;
+#ifdef FCP_CLIENT_SUPPORT_TFLITE
+  tflite_model_cache =
+      engine::CreateTfLiteModelCache(env_deps, log_manager, flags);
+#endif
+
   // Eligibility eval plans can use example iterators from the
   // SimpleTaskEnvironment and those reading the OpStats DB.
   opstats::OpStatsExampleIteratorFactory opstats_example_iterator_factory(
@@ -1272,7 +1268,8 @@ absl::StatusOr<FLRunnerResult> RunFederatedComputation(
       IssueEligibilityEvalCheckinAndRunPlan(
           eligibility_example_iterator_factories, should_abort, phase_logger,
           files, log_manager, opstats_logger, flags, federated_protocol,
-          timing_config, reference_time, fl_runner_result);
+          tflite_model_cache.get(), timing_config, reference_time,
+          fl_runner_result);
   if (!eligibility_eval_result.ok()) {
     return fl_runner_result;
   }
@@ -1361,7 +1358,8 @@ absl::StatusOr<FLRunnerResult> RunFederatedComputation(
                                 log_manager, opstats_logger, flags,
                                 checkin_result->plan,
                                 checkin_result->checkpoint_input_filename,
-                                *checkpoint_output_filename, timing_config);
+                                *checkpoint_output_filename,
+                                tflite_model_cache.get(), timing_config);
   // Update the FLRunnerResult fields to account for any network usage during
   // the execution of the plan (e.g. due to Federated Select slices having been
   // fetched).
@@ -1421,6 +1419,14 @@ FLRunnerTensorflowSpecResult RunPlanWithTensorflowSpecForTesting(
   PhaseLoggerImpl phase_logger(event_publisher, opstats_logger.get(),
                                log_manager, flags);
 
+  std::unique_ptr<cache::FileBackedResourceCache> tflite_model_cache;
+#ifdef FCP_CLIENT_SUPPORT_TFLITE
+  tflite_model_cache =
+      engine::CreateTfLiteModelCache(env_deps, log_manager, flags);
+#endif
+  // The plans run below move the TFLite model out of the plan they're given.
+  ClientOnlyPlan plan = client_plan;
+
   // Regular plans can use example iterators from the SimpleTaskEnvironment,
   // those reading the OpStats DB, or those serving Federated Select slices.
   // However, we don't provide a Federated Select-specific example iterator
@@ -1454,8 +1460,9 @@ FLRunnerTensorflowSpecResult RunPlanWithTensorflowSpecForTesting(
     PlanResultAndCheckpointFile plan_result_and_checkpoint_file =
         RunPlanWithTensorflowSpec(example_iterator_factories, should_abort,
                                   log_manager, opstats_logger.get(), flags,
-                                  client_plan, checkpoint_input_filename,
-                                  *checkpoint_output_filename, timing_config);
+                                  plan, checkpoint_input_filename,
+                                  *checkpoint_output_filename,
+                                  tflite_model_cache.get(), timing_config);
     result.set_checkpoint_output_filename(
         plan_result_and_checkpoint_file.checkpoint_file);
     plan_result = std::move(plan_result_and_checkpoint_file.plan_result);
@@ -1463,8 +1470,9 @@ FLRunnerTensorflowSpecResult RunPlanWithTensorflowSpecForTesting(
     // Eligibility eval plans.
     plan_result = RunEligibilityEvalPlanWithTensorflowSpec(
         example_iterator_factories, should_abort, log_manager,
-        opstats_logger.get(), flags, client_plan, checkpoint_input_filename,
-        timing_config, run_plan_start_time, reference_time);
+        opstats_logger.get(), flags, plan, checkpoint_input_filename,
+        tflite_model_cache.get(), timing_config, run_plan_start_time,
+        reference_time);
   } else {
     // This branch shouldn't be taken, unless we add an additional type of
     // TensorflowSpec-based plan in the future. We return a readable error so
@@ -18,6 +18,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 
@@ -173,6 +174,11 @@ class Flags {
   // Content-Type headers, and will decode them outside of the http engine.
   virtual bool client_decoded_http_resources() const { return false; }
 
+  // The maximum number of resources (e.g. the plan, the checkpoint, or
+  // Federated Select slices) that are received at the same time when fetching
+  // them via HTTP. If zero or negative, all of them are fetched at once.
+  virtual int32_t max_concurrent_resource_fetches() const { return 8; }
+
   // When true, native will use the passed in cache dir to store temporary files
   // and create and manage its own subdirectories.
   virtual bool enable_cache_dir() const { return false; }
@@ -189,6 +195,110 @@ class Flags {
   // stats will be somewhat incomplete and the period the stats cover will be
   // less defined.
   virtual bool enable_per_phase_network_stats() const { return false; }
+
+  // The minimum delay between two consecutive requests polling a long running
+  // operation which isn't done yet (measured from the start of one request to
+  // the start of the next one), used for the first such request.
+  virtual int64_t operation_polling_initial_delay_millis() const { return 250; }
+
+  // The upper bound on the delay between two consecutive requests polling a
+  // long running operation, regardless of how many requests were issued before
+  // (unless the server suggests a longer delay).
+  virtual int64_t operation_polling_max_delay_millis() const {
+    // 10 seconds
+    return 10 * 1000;
+  }
+
+  // The upper bound on a delay between two consecutive requests polling a long
+  // running operation which was suggested by the server via an
+  // `OperationPollingHint`. Longer suggested delays are capped to this value.
+  virtual int64_t operation_polling_max_suggested_delay_millis() const {
+    // 2 minutes
+    return 2 * 60 * 1000;
+  }
+
+  // The factor by which the delay between two consecutive requests polling a
+  // long running operation grows after each request. Must be at least 1.
+  virtual float operation_polling_delay_multiplier() const { return 2.0; }
+
+  // The amount of jitter to apply to the delay between two consecutive requests
+  // polling a long running operation. Must be a value between 0 and 1. E.g. a
+  // value of 0.2 means that delays will fall within [0.8 * target delay, 1.2 *
+  // target delay).
+  virtual float operation_polling_delay_jitter_fraction() const { return 0.2; }
+
+  // When true, the gRPC chunking layer adapts the upload chunk size and the
+  // number of chunks sent ahead of receiving acks to the measured ack round
+  // trip time and goodput, within the bounds advertised by the server.
+  virtual bool enable_grpc_adaptive_flow_control() const { return false; }
+
+  // The maximum uncompressed size of a chunked message received over gRPC.
+  // Larger messages are rejected before any of their data is buffered.
+  virtual int32_t grpc_max_incoming_chunked_message_size_bytes() const {
+    // 1 GiB
+    return 1024 * 1024 * 1024;
+  }
+
+  // The number of examples to read ahead of the plan from each example
+  // iterator, on a background thread, so that the example store's latency
+  // overlaps with the plan's computation. A value of 0 disables prefetching.
+  virtual int32_t example_iterator_prefetch_count() const { return 0; }
+
+  // The maximum total size of the examples read ahead from each example
+  // iterator when prefetching is enabled. At least one example is always read
+  // ahead, regardless of its size.
+  virtual int64_t example_iterator_prefetch_bytes() const {
+    // 4 MiB
+    return 4 * 1024 * 1024;
+  }
+
+  // The maximum number of TensorFlow sessions kept in the process after a
+  // plan has run, so that running the same plan (or eligibility eval plan)
+  // again doesn't need to load its graph again. A value of 0 disables caching
+  // sessions. Embedding apps can release the cached sessions early (e.g. when
+  // the device is low on memory) via `TensorFlowSessionCache::Global()`.
+  virtual int32_t max_cached_tensorflow_sessions() const { return 0; }
+
+  // The maximum number of prepared TFLite interpreters kept in the process
+  // after a plan has run, like `max_cached_tensorflow_sessions` but for plans
+  // run with TFLite. A value of 0 disables caching interpreters. Cached
+  // interpreters can be released early via `TfLiteInterpreterCache::Global()`.
+  virtual int32_t max_cached_tflite_interpreters() const { return 0; }
+
+  // When true (and `enable_cache_dir` is true as well), TFLite plans are run
+  // from a file in the resource cache holding their model, which is
+  // memory-mapped rather than kept in the heap, and which later runs of the
+  // same model reuse (along with any interpreter cached for it, see
+  // `max_cached_tflite_interpreters`).
+  virtual bool load_tflite_models_from_files() const { return false; }
+
+  // The maximum size of the resource cache which TFLite models are kept in
+  // when `load_tflite_models_from_files` is true. Models larger than half of
+  // it are run from the heap instead.
+  virtual int64_t tflite_model_cache_size_bytes() const {
+    return 256 * 1024 * 1024;
+  }
+
+  // The number of threads TensorFlow uses to parallelize a single op of a
+  // plan, unless the plan's ConfigProto specifies it. 0 lets TensorFlow choose.
+  virtual int32_t plan_intra_op_threads() const { return 0; }
+
+  // The number of threads TensorFlow uses to run independent ops of a plan in
+  // parallel, unless the plan's ConfigProto specifies it. 0 lets TensorFlow
+  // choose.
+  virtual int32_t plan_inter_op_threads() const { return 0; }
+
+  // When true, all TensorFlow sessions run their ops on a single process-wide
+  // thread pool of `plan_inter_op_threads` threads, unless the plan's
+  // ConfigProto specifies its own thread pools.
+  virtual bool share_plan_inter_op_thread_pool() const { return false; }
+
+  // The number of threads a TFLite interpreter uses. 0 lets TFLite choose.
+  virtual int32_t tflite_num_threads() const { return 0; }
+
+  // The CPU cores plans are run on (e.g. only the big cores of a big.LITTLE
+  // CPU), where supported. Empty means any core.
+  virtual std::vector<int32_t> plan_cpu_affinity() const { return {}; }
 };
 }  // namespace client
 }  // namespace fcp
@@ -38,14 +38,18 @@ GrpcBidiStream::GrpcBidiStream(const std::string& target,
                                const std::string& api_key,
                                const std::string& population_name,
                                int64_t grpc_channel_deadline_seconds,
-                               std::string cert_path)
+                               std::string cert_path,
+                               bool enable_adaptive_flow_control,
+                               int32_t max_incoming_message_size)
     : GrpcBidiStream(GrpcBidiChannel::Create(target, std::move(cert_path)),
-                     api_key, population_name, grpc_channel_deadline_seconds) {}
+                     api_key, population_name, grpc_channel_deadline_seconds,
+                     enable_adaptive_flow_control, max_incoming_message_size) {}
 
 GrpcBidiStream::GrpcBidiStream(
     const std::shared_ptr<grpc::ChannelInterface>& channel,
     const std::string& api_key, const std::string& population_name,
-    int64_t grpc_channel_deadline_seconds)
+    int64_t grpc_channel_deadline_seconds, bool enable_adaptive_flow_control,
+    int32_t max_incoming_message_size)
     : mu_(), stub_(FederatedTrainingApi::NewStub(channel)) {
   FCP_LOG(INFO) << "Connecting to stub: " << stub_;
   gpr_timespec deadline = gpr_time_add(
@@ -58,6 +62,8 @@ GrpcBidiStream::GrpcBidiStream(
   GrpcChunkedBidiStream<ClientStreamMessage,
                         ServerStreamMessage>::GrpcChunkedBidiStreamOptions
       options;
+  options.enable_adaptive_flow_control = enable_adaptive_flow_control;
+  options.max_incoming_message_size = max_incoming_message_size;
   chunked_bidi_stream_ = std::make_unique<
       GrpcChunkedBidiStream<ClientStreamMessage, ServerStreamMessage>>(
       client_reader_writer_.get(), client_reader_writer_.get(), options);
@@ -135,5 +141,15 @@ int64_t GrpcBidiStream::ChunkingLayerBytesSent() {
   return chunked_bidi_stream_->ChunkingLayerBytesSent();
 }
 
+int64_t GrpcBidiStream::ChunkingLayerFlowControlIncreases() {
+  absl::MutexLock _(&mu_);
+  return chunked_bidi_stream_->ChunkingLayerFlowControlIncreases();
+}
+
+int64_t GrpcBidiStream::ChunkingLayerFlowControlDecreases() {
+  absl::MutexLock _(&mu_);
+  return chunked_bidi_stream_->ChunkingLayerFlowControlDecreases();
+}
+
 }  // namespace client
 }  // namespace fcp
@@ -51,6 +51,10 @@ class GrpcBidiStreamInterface {
   virtual int64_t ChunkingLayerBytesSent() = 0;
 
   virtual int64_t ChunkingLayerBytesReceived() = 0;
+
+  virtual int64_t ChunkingLayerFlowControlIncreases() = 0;
+
+  virtual int64_t ChunkingLayerFlowControlDecreases() = 0;
 };
 
 /**
@@ -73,11 +77,17 @@ class GrpcBidiStream : public GrpcBidiStreamInterface {
    * channel.
    * @param cert_path Test-only path to a CA certificate root, to be used in
    * combination with an "https+test://" URI scheme.
+   * @param enable_adaptive_flow_control Whether the chunking layer should adapt
+   * its upload chunk size and window to the measured round trip time.
+   * @param max_incoming_message_size The maximum uncompressed size of a chunked
+   * message received from the server, or a negative value for no limit.
    */
   GrpcBidiStream(const std::string& target, const std::string& api_key,
                  const std::string& population_name,
                  int64_t grpc_channel_deadline_seconds,
-                 std::string cert_path = "");
+                 std::string cert_path = "",
+                 bool enable_adaptive_flow_control = false,
+                 int32_t max_incoming_message_size = -1);
 
   /**
    * @param channel A preexisting channel to the target endpoint.
@@ -87,10 +97,16 @@ class GrpcBidiStream : public GrpcBidiStreamInterface {
    * False.
    * @param grpc_channel_deadline_seconds The deadline (in seconds) for the gRPC
    * channel.
+   * @param enable_adaptive_flow_control Whether the chunking layer should adapt
+   * its upload chunk size and window to the measured round trip time.
+   * @param max_incoming_message_size The maximum uncompressed size of a chunked
+   * message received from the server, or a negative value for no limit.
    */
   GrpcBidiStream(const std::shared_ptr<grpc::ChannelInterface>& channel,
                  const std::string& api_key, const std::string& population_name,
-                 int64_t grpc_channel_deadline_seconds);
+                 int64_t grpc_channel_deadline_seconds,
+                 bool enable_adaptive_flow_control = false,
+                 int32_t max_incoming_message_size = -1);
   ~GrpcBidiStream() override = default;
 
   // GrpcBidiStream is neither copyable nor movable.
@@ -98,7 +114,11 @@ class GrpcBidiStream : public GrpcBidiStreamInterface {
   GrpcBidiStream& operator=(const GrpcBidiStream&) = delete;
 
   /**
-   * Send a ClientStreamMessage to the remote endpoint.
+   * Send a ClientStreamMessage to the remote endpoint. Blocking: a large
+   * message is sent in chunks, and once the chunking layer's window of unacked
+   * chunks is full this waits for the server to ack earlier chunks. Messages
+   * the server sends in the meantime are returned by subsequent Receive()
+   * calls.
    * @param message The message to send.
    * @return absl::Status, which will have code OK if the message was sent
    *   successfully.
@@ -135,6 +155,13 @@ class GrpcBidiStream : public GrpcBidiStreamInterface {
    */
   int64_t ChunkingLayerBytesReceived() override;
 
+  /**
+   * Returns the number of times adaptive flow control grew (resp. shrank) the
+   * upload chunk size or window of the chunking layer.
+   */
+  int64_t ChunkingLayerFlowControlIncreases() override;
+  int64_t ChunkingLayerFlowControlDecreases() override;
+
   // Note: Must be lowercase:
   static constexpr char kApiKeyHeader[] = "x-goog-api-key";
   static constexpr char kPopulationNameHeader[] = "x-goog-population";
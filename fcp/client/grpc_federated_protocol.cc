@@ -39,6 +39,7 @@
 #include "fcp/client/grpc_bidi_stream.h"
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/http/resource_fetcher.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/log_manager.h"
 #include "fcp/client/opstats/opstats_logger.h"
@@ -137,7 +138,9 @@ GrpcFederatedProtocol::GrpcFederatedProtocol(
           http_client,
           std::make_unique<GrpcBidiStream>(
               federated_service_uri, api_key, std::string(population_name),
-              grpc_channel_deadline_seconds, test_cert_path),
+              grpc_channel_deadline_seconds, test_cert_path,
+              flags->enable_grpc_adaptive_flow_control(),
+              flags->grpc_max_incoming_chunked_message_size_bytes()),
           population_name, retry_token, client_version, attestation_measurement,
           should_abort, absl::BitGen(), timing_config) {}
 
@@ -960,7 +963,8 @@ GrpcFederatedProtocol::FetchTaskResources(
     resource_responses = ::fcp::client::http::FetchResourcesInMemory(
         *http_client_, *interruptible_runner_,
         {plan_uri_or_data, checkpoint_uri_or_data}, &http_bytes_downloaded_,
-        &http_bytes_uploaded_, flags_->client_decoded_http_resources());
+        &http_bytes_uploaded_, flags_->client_decoded_http_resources(),
+        flags_->max_concurrent_resource_fetches());
   }
   if (!resource_responses.ok()) {
     log_manager_->LogDiag(
@@ -1062,7 +1066,11 @@ NetworkStats GrpcFederatedProtocol::GetNetworkStats() {
       .report_size_bytes = flags_->enable_per_phase_network_stats()
                                ? 0
                                : report_request_size_bytes_,
-      .network_duration = network_stopwatch_->GetTotalDuration()};
+      .network_duration = network_stopwatch_->GetTotalDuration(),
+      .chunking_layer_flow_control_increases =
+          grpc_bidi_stream_->ChunkingLayerFlowControlIncreases(),
+      .chunking_layer_flow_control_decreases =
+          grpc_bidi_stream_->ChunkingLayerFlowControlDecreases()};
 }
 
 }  // namespace client
@@ -115,6 +115,8 @@ class MockGrpcBidiStream : public GrpcBidiStreamInterface {
   MOCK_METHOD(void, Close, (), (override));
   MOCK_METHOD(int64_t, ChunkingLayerBytesSent, (), (override));
   MOCK_METHOD(int64_t, ChunkingLayerBytesReceived, (), (override));
+  MOCK_METHOD(int64_t, ChunkingLayerFlowControlIncreases, (), (override));
+  MOCK_METHOD(int64_t, ChunkingLayerFlowControlDecreases, (), (override));
 };
 
 constexpr int kTransientErrorsRetryPeriodSecs = 10;
@@ -352,6 +354,10 @@ class GrpcFederatedProtocolTest
         .WillRepeatedly(Return(0));
     EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerBytesSent())
         .WillRepeatedly(Return(0));
+    EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerFlowControlIncreases())
+        .WillRepeatedly(Return(0));
+    EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerFlowControlDecreases())
+        .WillRepeatedly(Return(0));
     EXPECT_CALL(mock_flags_,
                 federated_training_transient_errors_retry_delay_secs)
         .WillRepeatedly(Return(kTransientErrorsRetryPeriodSecs));
@@ -542,6 +548,10 @@ TEST_P(GrpcFederatedProtocolTest,
       .WillRepeatedly(Return(0));
   EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerBytesSent())
       .WillRepeatedly(Return(0));
+  EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerFlowControlIncreases())
+      .WillRepeatedly(Return(0));
+  EXPECT_CALL(*mock_grpc_bidi_stream_, ChunkingLayerFlowControlDecreases())
+      .WillRepeatedly(Return(0));
   EXPECT_CALL(*mock_grpc_bidi_stream_, Close());
   mock_secagg_runner_factory_ = new StrictMock<MockSecAggRunnerFactory>();
   // Create a new GrpcFederatedProtocol instance. It should not produce the same
@@ -28,6 +28,7 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 
 namespace fcp {
 namespace client {
@@ -407,6 +408,39 @@ class HttpRequestCallback {
                                       const HttpResponse& response,
                                       absl::string_view data) = 0;
 
+  // Optional alternative to `OnResponseBody`, allowing callees to provide the
+  // memory that response data should be written into (e.g. a buffer
+  // pre-reserved based on the "Content-Length" response header), so that the
+  // data doesn't have to be copied again once it has been received.
+  //
+  // `HttpClient` implementations may call this method before delivering a
+  // block of at most `min_size` bytes of response data. If the returned buffer
+  // is at least `min_size` bytes large, then implementations should write the
+  // data into the start of that buffer and call
+  // `OnResponseBodyBufferWritten` (instead of `OnResponseBody`). Otherwise, the
+  // data must be delivered via `OnResponseBody`.
+  //
+  // The returned buffer remains valid until the next call to any method of
+  // this `HttpRequestCallback` instance for the given `HttpRequest`.
+  //
+  // The default implementation returns an empty buffer, i.e. callees that
+  // don't override this method only ever receive data via `OnResponseBody`.
+  virtual absl::Span<char> GetResponseBodyBuffer(const HttpRequest& request,
+                                                 const HttpResponse& response,
+                                                 int64_t min_size) {
+    return {};
+  }
+
+  // Called after `size` bytes of response data have been written into the
+  // start of the buffer most recently returned by `GetResponseBodyBuffer`. The
+  // same ordering and error semantics as for `OnResponseBody` apply.
+  virtual absl::Status OnResponseBodyBufferWritten(const HttpRequest& request,
+                                                   const HttpResponse& response,
+                                                   int64_t size) {
+    return absl::UnimplementedError(
+        "OnResponseBodyBufferWritten is not supported");
+  }
+
   // Called when the request encountered an error or timed out while receiving
   // the response body (i.e. after `OnResponseStarted` was called). No further
   // methods must be called on this `HttpRequestCallback` instance for the given
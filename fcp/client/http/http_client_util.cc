@@ -16,6 +16,7 @@
 #include "fcp/client/http/http_client_util.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <optional>
 #include <string>
@@ -25,6 +26,7 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
@@ -200,6 +202,69 @@ std::optional<std::string> FindHeader(const HeaderList& headers,
   return std::get<1>(*header_entry);
 }
 
+absl::StatusOr<ResponseBodyHeaders> ParseResponseBodyHeaders(
+    const HttpRequest& request, const HttpResponse& response) {
+  ResponseBodyHeaders result;
+
+  std::optional<std::string> content_encoding_header =
+      FindHeader(response.headers(), kContentEncodingHdr);
+  if (content_encoding_header.has_value()) {
+    // We don't expect the response body to be "Content-Encoding" encoded,
+    // because the `HttpClient` is supposed to transparently handle the decoding
+    // for us (unless we specified a "Accept-Encoding" header in the request,
+    // which would indicate that we wanted to handle the response decoding).
+    if (!FindHeader(request.extra_headers(), kAcceptEncodingHdr).has_value()) {
+      // Note: technically, we should only receive Content-Encoding values that
+      // match the Accept-Encoding values provided in the request headers. The
+      // check above isn't quite that strict, but that's probably fine (since
+      // such issues should be rare, and can be handled farther up the stack).
+      return absl::InvalidArgumentError(
+          absl::StrCat("Unexpected header: ", kContentEncodingHdr));
+    }
+    result.content_encoding = *content_encoding_header;
+  }
+
+  result.content_type =
+      FindHeader(response.headers(), kContentTypeHdr).value_or("");
+
+  // Similarly, we should under no circumstances receive a non-identity
+  // Transfer-Encoding header, since the `HttpClient` is unconditionally
+  // required to undo any such encoding for us.
+  std::optional<std::string> transfer_encoding_header =
+      FindHeader(response.headers(), kTransferEncodingHdr);
+  if (transfer_encoding_header.has_value() &&
+      absl::AsciiStrToLower(*transfer_encoding_header) !=
+          kIdentityEncodingHdrValue) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unexpected header: ", kTransferEncodingHdr));
+  }
+
+  // If no Content-Length header is provided, this means that the server either
+  // didn't provide one and is streaming the response, or that the HttpClient
+  // implementation transparently decompressed the data for us and stripped the
+  // Content-Length header (as per the HttpClient contract).
+  std::optional<std::string> content_length_hdr =
+      FindHeader(response.headers(), kContentLengthHdr);
+  if (!content_length_hdr.has_value()) {
+    return result;
+  }
+
+  // A Content-Length header available. Let's parse it so that we know how much
+  // data to expect.
+  int64_t content_length;
+  // Note that SimpleAtoi safely handles non-ASCII data.
+  if (!absl::SimpleAtoi(*content_length_hdr, &content_length)) {
+    return absl::InvalidArgumentError(
+        "Could not parse Content-Length response header");
+  }
+  if (content_length < 0) {
+    return absl::OutOfRangeError(absl::StrCat(
+        "Invalid Content-Length response header: ", content_length));
+  }
+  result.content_length = content_length;
+  return result;
+}
+
 absl::StatusOr<std::string> JoinBaseUriWithSuffix(
     absl::string_view base_uri, absl::string_view uri_suffix) {
   if (!uri_suffix.empty() && uri_suffix[0] != '/') {
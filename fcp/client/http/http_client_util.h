@@ -16,6 +16,7 @@
 #ifndef FCP_CLIENT_HTTP_HTTP_CLIENT_UTIL_H_
 #define FCP_CLIENT_HTTP_HTTP_CLIENT_UTIL_H_
 
+#include <cstdint>
 #include <optional>
 #include <string>
 
@@ -81,6 +82,28 @@ std::string ConvertMethodToString(HttpRequest::Method method);
 std::optional<std::string> FindHeader(const HeaderList& headers,
                                       absl::string_view needle);
 
+// The properties of a response body, as described by the response headers.
+struct ResponseBodyHeaders {
+  // This is empty if no "Content-Encoding" header was present in the response
+  // headers.
+  std::string content_encoding;
+  // This is empty if no "Content-Type" header was present in the response
+  // headers.
+  std::string content_type;
+  // The amount of response body data to expect, if a "Content-Length" header
+  // was present in the response headers.
+  std::optional<int64_t> content_length;
+};
+
+// Extracts the `ResponseBodyHeaders` from a response's headers, validating that
+// the `HttpClient` implementation upheld its contract w.r.t. decoding the
+// response body (i.e. that no "Content-Encoding" or "Transfer-Encoding" was
+// left for us to undo, unless `request` asked for it).
+//
+// Returns an INVALID_ARGUMENT or OUT_OF_RANGE error if the headers are invalid.
+absl::StatusOr<ResponseBodyHeaders> ParseResponseBodyHeaders(
+    const HttpRequest& request, const HttpResponse& response);
+
 // Creates a URI out of a base URI and a suffix.
 //
 // The `base_uri` argument is expected to be a valid fully qualified URI on its
@@ -29,6 +29,7 @@
 #include "google/protobuf/any.pb.h"
 #include "google/rpc/code.pb.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/random/distributions.h"
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -37,10 +38,13 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "fcp/base/clock.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/time_util.h"
 #include "fcp/base/wall_clock_stopwatch.h"
+#include "fcp/client/cord_utils.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/engine/engine.pb.h"
 #include "fcp/client/federated_protocol.h"
@@ -50,6 +54,7 @@
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/http/http_client_util.h"
 #include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/http/resource_fetcher.h"
 #include "fcp/client/interruptible_runner.h"
 #include "fcp/client/log_manager.h"
 #include "fcp/client/stats.h"
@@ -73,15 +78,19 @@ using ::google::internal::federatedcompute::v1::ClientStats;
 using ::google::internal::federatedcompute::v1::EligibilityEvalTaskRequest;
 using ::google::internal::federatedcompute::v1::EligibilityEvalTaskResponse;
 using ::google::internal::federatedcompute::v1::ForwardingInfo;
+using ::google::internal::federatedcompute::v1::OperationPollingHint;
 using ::google::internal::federatedcompute::v1::
     ReportEligibilityEvalTaskResultRequest;
 using ::google::internal::federatedcompute::v1::ReportTaskResultRequest;
 using ::google::internal::federatedcompute::v1::Resource;
 using ::google::internal::federatedcompute::v1::ResourceCompressionFormat;
+using ::google::internal::federatedcompute::v1::
+    StartAggregationDataUploadMetadata;
 using ::google::internal::federatedcompute::v1::
     StartAggregationDataUploadRequest;
 using ::google::internal::federatedcompute::v1::
     StartAggregationDataUploadResponse;
+using ::google::internal::federatedcompute::v1::StartTaskAssignmentMetadata;
 using ::google::internal::federatedcompute::v1::StartTaskAssignmentRequest;
 using ::google::internal::federatedcompute::v1::StartTaskAssignmentResponse;
 using ::google::internal::federatedcompute::v1::SubmitAggregationResultRequest;
@@ -337,12 +346,16 @@ std::unique_ptr<InterruptibleRunner> CreateDelayedInterruptibleRunner(
     LogManager* log_manager, std::function<bool()> should_abort,
     const InterruptibleRunner::TimingConfig& timing_config,
     absl::Time deadline) {
+  // The abort signal would abort the requests before the deadline, so
+  // should_abort is polled instead.
+  InterruptibleRunner::TimingConfig polling_timing_config = timing_config;
+  polling_timing_config.abort_signal = nullptr;
   return std::make_unique<InterruptibleRunner>(
       log_manager,
       [deadline, should_abort]() {
         return absl::Now() > deadline && should_abort();
       },
-      timing_config,
+      polling_timing_config,
       InterruptibleRunner::DiagnosticsConfig{
           .interrupted = ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP,
           .interrupt_timeout =
@@ -359,9 +372,7 @@ absl::StatusOr<Operation> ParseOperationProtoFromHttpResponse(
   FCP_RETURN_IF_ERROR(http_response);
   Operation response_operation_proto;
   // Parse the response.
-    if
-    (!response_operation_proto.ParseFromString(std::string(http_response->body)))
-    {
+  if (!ParseFromCord(response_operation_proto, http_response->body)) {
     return absl::InvalidArgumentError("could not parse Operation proto");
   }
   return response_operation_proto;
@@ -375,6 +386,49 @@ absl::StatusOr<std::string> ExtractOperationName(const Operation& operation) {
   return operation.name();
 }
 
+// Returns the polling delay suggested by the server via the given pending
+// Operation's metadata, if any.
+std::optional<absl::Duration> GetServerSuggestedPollingDelay(
+    const Operation& operation) {
+  OperationPollingHint polling_hint;
+  if (operation.metadata().Is<StartTaskAssignmentMetadata>()) {
+    StartTaskAssignmentMetadata metadata;
+    if (operation.metadata().UnpackTo(&metadata)) {
+      polling_hint = metadata.polling_hint();
+    }
+  } else if (operation.metadata().Is<StartAggregationDataUploadMetadata>()) {
+    StartAggregationDataUploadMetadata metadata;
+    if (operation.metadata().UnpackTo(&metadata)) {
+      polling_hint = metadata.polling_hint();
+    }
+  }
+  if (!polling_hint.has_polling_delay()) {
+    return std::nullopt;
+  }
+  return std::max(
+      TimeUtil::ConvertProtoToAbslDuration(polling_hint.polling_delay()),
+      absl::ZeroDuration());
+}
+
+// A `Clock::Waiter` which lets a thread block until it is woken up, either by
+// the clock reaching the waiter's deadline or by the wait being aborted.
+class BlockingWaiter : public Clock::Waiter {
+ public:
+  void WakeUp() override {
+    absl::MutexLock lock(&mutex_);
+    woken_up_ = true;
+  }
+
+  void WaitForWakeUp() {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&woken_up_));
+  }
+
+ private:
+  absl::Mutex mutex_;
+  bool woken_up_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
 }  // namespace
 
 ProtocolRequestCreator::ProtocolRequestCreator(
@@ -461,12 +515,15 @@ ProtocolRequestCreator::Create(const ForwardingInfo& forwarding_info,
 
 ProtocolRequestHelper::ProtocolRequestHelper(
     HttpClient* http_client, int64_t* bytes_downloaded, int64_t* bytes_uploaded,
-    WallClockStopwatch* network_stopwatch, bool client_decoded_http_resources)
+    WallClockStopwatch* network_stopwatch, bool client_decoded_http_resources,
+    Clock* clock, const OperationPollingConfig& polling_config)
     : http_client_(*http_client),
       bytes_downloaded_(*bytes_downloaded),
       bytes_uploaded_(*bytes_uploaded),
       network_stopwatch_(*network_stopwatch),
-      client_decoded_http_resources_(client_decoded_http_resources) {}
+      client_decoded_http_resources_(client_decoded_http_resources),
+      clock_(*clock),
+      polling_config_(polling_config) {}
 
 absl::StatusOr<InMemoryHttpResponse>
 ProtocolRequestHelper::PerformProtocolRequest(
@@ -513,6 +570,10 @@ ProtocolRequestHelper::PollOperationResponseUntilDone(
   // In all other cases we continue to poll the Operation via a subsequent
   // GetOperationRequest.
   Operation response_operation_proto = initial_operation;
+  // We don't know when the request which produced the initial Operation was
+  // issued, so we measure the first delay from the time we start polling.
+  absl::Time last_request_start_time = clock_.Now();
+  absl::Duration next_backoff_delay = polling_config_.initial_delay;
   while (true) {
     // If the Operation is done then return it.
     if (response_operation_proto.done()) {
@@ -522,22 +583,74 @@ ProtocolRequestHelper::PollOperationResponseUntilDone(
     FCP_ASSIGN_OR_RETURN(std::string operation_name,
                          ExtractOperationName(response_operation_proto));
 
-    // TODO(team): Add a minimum amount of time between each request,
-    // and/or use Operation.metadata to allow server to steer the client's retry
-    // delays.
+    // The response Operation indicates that the result isn't ready yet. Wait
+    // for a bit, and then poll again.
+    const absl::Time iteration_start_time = clock_.Now();
+    absl::Duration polling_delay =
+        GetNextPollingDelay(response_operation_proto, next_backoff_delay);
+    absl::Status wait_status =
+        WaitUntil(last_request_start_time + polling_delay, runner);
+    if (!wait_status.ok()) {
+      operation_polling_duration_ += clock_.Now() - iteration_start_time;
+      return wait_status;
+    }
 
-    // The response Operation indicates that the result isn't ready yet. Poll
-    // again.
     FCP_ASSIGN_OR_RETURN(
         std::unique_ptr<HttpRequest> get_operation_request,
         request_creator.CreateGetOperationRequest(operation_name));
+    last_request_start_time = clock_.Now();
+    operation_poll_count_++;
     absl::StatusOr<InMemoryHttpResponse> http_response =
         PerformProtocolRequest(std::move(get_operation_request), runner);
+    operation_polling_duration_ += clock_.Now() - iteration_start_time;
     FCP_ASSIGN_OR_RETURN(response_operation_proto,
                          ParseOperationProtoFromHttpResponse(http_response));
   }
 }
 
+absl::Duration ProtocolRequestHelper::GetNextPollingDelay(
+    const Operation& pending_operation, absl::Duration& next_backoff_delay) {
+  // A delay suggested by the server takes precedence over our own backoff
+  // schedule, and doesn't advance it. It is capped, so that a misbehaving server
+  // can't stall the client indefinitely.
+  std::optional<absl::Duration> server_suggested_delay =
+      GetServerSuggestedPollingDelay(pending_operation);
+  if (server_suggested_delay.has_value()) {
+    return std::min(*server_suggested_delay,
+                    polling_config_.max_server_suggested_delay);
+  }
+
+  absl::Duration target_delay =
+      std::min(next_backoff_delay, polling_config_.max_delay);
+  next_backoff_delay =
+      std::min(target_delay * std::max(polling_config_.delay_multiplier, 1.0f),
+               polling_config_.max_delay);
+  float jitter_fraction =
+      std::clamp(polling_config_.delay_jitter_fraction, 0.0f, 1.0f);
+  if (jitter_fraction > 0) {
+    target_delay *=
+        absl::Uniform(bit_gen_, 1.0 - jitter_fraction, 1.0 + jitter_fraction);
+  }
+  return target_delay;
+}
+
+absl::Status ProtocolRequestHelper::WaitUntil(absl::Time deadline,
+                                              InterruptibleRunner& runner) {
+  if (deadline <= clock_.Now()) {
+    return absl::OkStatus();
+  }
+  auto waiter = std::make_shared<BlockingWaiter>();
+  clock_.WakeupWithDeadline(deadline, waiter);
+  return runner.Run(
+      [waiter]() {
+        waiter->WaitForWakeUp();
+        return absl::OkStatus();
+      },
+      // If we get interrupted then we stop waiting right away. The waiter will
+      // still get woken up by the clock at its deadline, but that is a no-op.
+      [waiter]() { waiter->WakeUp(); });
+}
+
 absl::StatusOr<InMemoryHttpResponse> ProtocolRequestHelper::CancelOperation(
     absl::string_view operation_name,
     const ProtocolRequestCreator& request_creator,
@@ -554,7 +667,7 @@ HttpFederatedProtocol::HttpFederatedProtocol(
     absl::string_view population_name, absl::string_view retry_token,
     absl::string_view client_version, absl::string_view attestation_measurement,
     std::function<bool()> should_abort, absl::BitGen bit_gen,
-    const InterruptibleRunner::TimingConfig& timing_config)
+    const InterruptibleRunner::TimingConfig& timing_config, Clock* clock)
     : object_state_(ObjectState::kInitialized),
       log_manager_(log_manager),
       flags_(flags),
@@ -573,9 +686,20 @@ HttpFederatedProtocol::HttpFederatedProtocol(
           std::make_unique<ProtocolRequestCreator>(
               entry_point_uri, HeaderList{},
               !flags->disable_http_request_body_compression())),
-      protocol_request_helper_(http_client, &bytes_downloaded_,
-                               &bytes_uploaded_, network_stopwatch_.get(),
-                               flags_->client_decoded_http_resources()),
+      protocol_request_helper_(
+          http_client, &bytes_downloaded_, &bytes_uploaded_,
+          network_stopwatch_.get(), flags_->client_decoded_http_resources(),
+          clock,
+          OperationPollingConfig{
+              .initial_delay = absl::Milliseconds(
+                  flags->operation_polling_initial_delay_millis()),
+              .max_delay = absl::Milliseconds(
+                  flags->operation_polling_max_delay_millis()),
+              .delay_multiplier = flags->operation_polling_delay_multiplier(),
+              .delay_jitter_fraction =
+                  flags->operation_polling_delay_jitter_fraction(),
+              .max_server_suggested_delay = absl::Milliseconds(
+                  flags->operation_polling_max_suggested_delay_millis())}),
       api_key_(api_key),
       population_name_(population_name),
       retry_token_(retry_token),
@@ -662,7 +786,7 @@ HttpFederatedProtocol::HandleEligibilityEvalTaskResponse(
   }
 
   EligibilityEvalTaskResponse response_proto;
-    if (!response_proto.ParseFromString(std::string(http_response->body))) {
+  if (!ParseFromCord(response_proto, http_response->body)) {
     return absl::InvalidArgumentError("Could not parse response_proto");
   }
 
@@ -1303,7 +1427,8 @@ HttpFederatedProtocol::FetchTaskResources(
     resource_responses = FetchResourcesInMemory(
         *http_client_, *interruptible_runner_,
         {plan_uri_or_data, checkpoint_uri_or_data}, &bytes_downloaded_,
-        &bytes_uploaded_, flags_->client_decoded_http_resources());
+        &bytes_uploaded_, flags_->client_decoded_http_resources(),
+        flags_->max_concurrent_resource_fetches());
   }
   FCP_RETURN_IF_ERROR(resource_responses);
   auto& plan_data_response = (*resource_responses)[0];
@@ -1354,7 +1479,10 @@ NetworkStats HttpFederatedProtocol::GetNetworkStats() {
       .chunking_layer_bytes_received = bytes_downloaded_,
       .chunking_layer_bytes_sent = bytes_uploaded_,
       .report_size_bytes = 0,
-      .network_duration = network_stopwatch_->GetTotalDuration()};
+      .network_duration = network_stopwatch_->GetTotalDuration(),
+      .operation_poll_count = protocol_request_helper_.operation_poll_count(),
+      .operation_polling_duration =
+          protocol_request_helper_.operation_polling_duration()};
 }
 
 }  // namespace http
@@ -31,6 +31,7 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "fcp/base/clock.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/wall_clock_stopwatch.h"
 #include "fcp/client/engine/engine.pb.h"
@@ -118,13 +119,30 @@ class ProtocolRequestCreator {
   const bool use_compression_;
 };
 
+// Parameters controlling how frequently a long running `Operation` which isn't
+// done yet is polled. See the `operation_polling_*` flags for details.
+struct OperationPollingConfig {
+  // The delay to use between the first two polling requests.
+  absl::Duration initial_delay = absl::ZeroDuration();
+  // The upper bound on the delay between two polling requests.
+  absl::Duration max_delay = absl::ZeroDuration();
+  // The factor by which the delay grows after each polling request.
+  float delay_multiplier = 1.0;
+  // The amount of jitter to apply to each delay, as a fraction between 0 and 1
+  // of the delay.
+  float delay_jitter_fraction = 0.0;
+  // The upper bound on a delay suggested by the server.
+  absl::Duration max_server_suggested_delay = absl::ZeroDuration();
+};
+
 // A helper for issuing protocol requests.
 class ProtocolRequestHelper {
  public:
   ProtocolRequestHelper(HttpClient* http_client, int64_t* bytes_downloaded,
                         int64_t* bytes_uploaded,
                         WallClockStopwatch* network_stopwatch,
-                        bool client_decoded_http_resources);
+                        bool client_decoded_http_resources, Clock* clock,
+                        const OperationPollingConfig& polling_config);
 
   // Performs the given request (handling any interruptions that may occur) and
   // updates the network stats.
@@ -150,6 +168,15 @@ class ProtocolRequestHelper {
   // is true, at which point that most recent response is returned. If at any
   // point an HTTP or response parsing error is encountered, then that error is
   // returned instead.
+  //
+  // Consecutive polling requests are spaced out according to the
+  // `OperationPollingConfig` (using exponential backoff with jitter), unless
+  // the pending `Operation`'s metadata contains an `OperationPollingHint`, in
+  // which case the delay suggested by the server is used instead (capped to
+  // `OperationPollingConfig::max_server_suggested_delay`). The delays
+  // are measured from the start of one request to the start of the next one.
+  // Waiting between requests is interruptible via the `runner`, in which case
+  // a CANCELLED error is returned.
   absl::StatusOr<::google::longrunning::Operation>
   PollOperationResponseUntilDone(
       const ::google::longrunning::Operation& initial_operation,
@@ -162,12 +189,35 @@ class ProtocolRequestHelper {
       const ProtocolRequestCreator& request_creator,
       InterruptibleRunner& runner);
 
+  // The number of requests issued to poll pending `Operation`s so far.
+  int64_t operation_poll_count() const { return operation_poll_count_; }
+  // The total amount of time spent in `PollOperationResponseUntilDone` calls
+  // which had to poll at least once, incl. the time spent waiting between
+  // requests.
+  absl::Duration operation_polling_duration() const {
+    return operation_polling_duration_;
+  }
+
  private:
+  // Returns the delay to wait for before polling the given pending `Operation`
+  // again, and advances the backoff state in `next_backoff_delay`.
+  absl::Duration GetNextPollingDelay(
+      const ::google::longrunning::Operation& pending_operation,
+      absl::Duration& next_backoff_delay);
+  // Waits until the clock reaches `deadline`, or until the `runner` is
+  // interrupted (in which case a CANCELLED error is returned).
+  absl::Status WaitUntil(absl::Time deadline, InterruptibleRunner& runner);
+
   HttpClient& http_client_;
   int64_t& bytes_downloaded_;
   int64_t& bytes_uploaded_;
   WallClockStopwatch& network_stopwatch_;
   const bool client_decoded_http_resources_;
+  Clock& clock_;
+  const OperationPollingConfig polling_config_;
+  absl::BitGen bit_gen_;
+  int64_t operation_poll_count_ = 0;
+  absl::Duration operation_polling_duration_ = absl::ZeroDuration();
 };
 
 // Implements a single session of the HTTP-based Federated Compute protocol.
@@ -180,7 +230,7 @@ class HttpFederatedProtocol : public fcp::client::FederatedProtocol {
       absl::string_view client_version,
       absl::string_view attestation_measurement,
       std::function<bool()> should_abort, absl::BitGen bit_gen,
-      const InterruptibleRunner::TimingConfig& timing_config);
+      const InterruptibleRunner::TimingConfig& timing_config, Clock* clock);
 
   ~HttpFederatedProtocol() override = default;
 
@@ -16,8 +16,10 @@
 #include "fcp/client/http/http_federated_protocol.h"
 
 #include <cstdint>
+#include <deque>
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
 #include <vector>
 
@@ -33,10 +35,12 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/platform.h"
+#include "fcp/base/simulated_clock.h"
 #include "fcp/base/time_util.h"
 #include "fcp/base/wall_clock_stopwatch.h"
 #include "fcp/client/diag_codes.pb.h"
@@ -73,6 +77,7 @@ using ::google::internal::federatedcompute::v1::EligibilityEvalTask;
 using ::google::internal::federatedcompute::v1::EligibilityEvalTaskRequest;
 using ::google::internal::federatedcompute::v1::EligibilityEvalTaskResponse;
 using ::google::internal::federatedcompute::v1::ForwardingInfo;
+using ::google::internal::federatedcompute::v1::OperationPollingHint;
 using ::google::internal::federatedcompute::v1::
     ReportEligibilityEvalTaskResultRequest;
 using ::google::internal::federatedcompute::v1::ReportTaskResultRequest;
@@ -84,6 +89,7 @@ using ::google::internal::federatedcompute::v1::
     StartAggregationDataUploadRequest;
 using ::google::internal::federatedcompute::v1::
     StartAggregationDataUploadResponse;
+using ::google::internal::federatedcompute::v1::StartTaskAssignmentMetadata;
 using ::google::internal::federatedcompute::v1::StartTaskAssignmentRequest;
 using ::google::internal::federatedcompute::v1::StartTaskAssignmentResponse;
 using ::google::internal::federatedcompute::v1::SubmitAggregationResultRequest;
@@ -96,6 +102,7 @@ using ::google::protobuf::Any;
 using ::google::protobuf::Message;
 using ::testing::_;
 using ::testing::AllOf;
+using ::testing::Contains;
 using ::testing::ContainerEq;
 using ::testing::DescribeMatcher;
 using ::testing::DoubleEq;
@@ -112,6 +119,7 @@ using ::testing::Lt;
 using ::testing::MockFunction;
 using ::testing::NiceMock;
 using ::testing::Not;
+using ::testing::Pair;
 using ::testing::Return;
 using ::testing::StrEq;
 using ::testing::StrictMock;
@@ -488,7 +496,8 @@ class HttpFederatedProtocolTest : public ::testing::Test {
         InterruptibleRunner::TimingConfig{
             .polling_period = absl::ZeroDuration(),
             .graceful_shutdown_period = absl::InfiniteDuration(),
-            .extended_shutdown_period = absl::InfiniteDuration()});
+            .extended_shutdown_period = absl::InfiniteDuration()},
+        Clock::RealClock());
   }
 
   void TearDown() override {
@@ -731,7 +740,8 @@ TEST_F(HttpFederatedProtocolTest,
       InterruptibleRunner::TimingConfig{
           .polling_period = absl::ZeroDuration(),
           .graceful_shutdown_period = absl::InfiniteDuration(),
-          .extended_shutdown_period = absl::InfiniteDuration()});
+          .extended_shutdown_period = absl::InfiniteDuration()},
+      Clock::RealClock());
 
   const ::google::internal::federatedml::v2::RetryWindow& retry_window2 =
       federated_protocol_->GetLatestRetryWindow();
@@ -1964,6 +1974,72 @@ TEST_F(HttpFederatedProtocolTest, TestReportCompletedViaSimpleAggSuccess) {
       federated_protocol_->ReportCompleted(std::move(results), plan_duration));
 }
 
+TEST_F(HttpFederatedProtocolTest,
+       TestReportCompletedViaSimpleAggWithLargeCompressedCheckpoint) {
+  // Issue an eligibility eval checkin first.
+  ASSERT_OK(RunSuccessfulEligibilityEvalCheckin());
+  // Issue a regular checkin
+  ASSERT_OK(RunSuccessfulCheckin());
+
+  // Enable request body compression. This only affects the requests issued
+  // after the StartAggregationDataUpload response has been received, since the
+  // request creators for the earlier requests have already been created.
+  EXPECT_CALL(mock_flags_, disable_http_request_body_compression)
+      .WillRepeatedly(Return(false));
+
+  // Create a fake checkpoint that is large enough to be compressed while it is
+  // being uploaded, rather than upfront.
+  std::string checkpoint_str;
+  for (int i = 0; checkpoint_str.size() < 4 * 1024 * 1024; ++i) {
+    absl::StrAppend(&checkpoint_str, "checkpoint_", i, "_");
+  }
+  ComputationResults results;
+  results.emplace("tensorflow_checkpoint", checkpoint_str);
+  absl::Duration plan_duration = absl::Minutes(5);
+
+  ExpectSuccessfulReportTaskResultRequest(
+      "https://taskassignment.uri/v1/populations/TEST%2FPOPULATION/"
+      "taskassignments/CLIENT_SESSION_ID:reportresult?%24alt=proto",
+      kAggregationSessionId, plan_duration);
+  ExpectSuccessfulStartAggregationDataUploadRequest(
+      "https://aggregation.uri/v1/aggregations/AGGREGATION_SESSION_ID/"
+      "clients/CLIENT_TOKEN:startdataupload?%24alt=proto",
+      kResourceName, kByteStreamTargetUri, kSecondStageAggregationTargetUri);
+  // The compressed size isn't known upfront, so the upload should be sent
+  // without a Content-Length header.
+  std::string uploaded_body;
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://bytestream.uri/upload/v1/media/"
+                  "CHECKPOINT_RESOURCE?upload_protocol=raw",
+                  HttpRequest::Method::kPost,
+                  AllOf(Contains(Pair(kContentEncodingHdr,
+                                      kGzipEncodingHdrValue)),
+                        Not(Contains(Pair(kContentLengthHdr, _)))),
+                  _)))
+      .WillOnce(
+          [&uploaded_body](MockableHttpClient::SimpleHttpRequest request) {
+            uploaded_body = request.body;
+            return CreateEmptySuccessHttpResponse();
+          });
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://aggregation.second.uri/v1/aggregations/"
+                  "AGGREGATION_SESSION_ID/clients/CLIENT_TOKEN:"
+                  "submit?%24alt=proto",
+                  HttpRequest::Method::kPost, _, _)))
+      .WillOnce(Return(CreateEmptySuccessHttpResponse()));
+
+  EXPECT_OK(
+      federated_protocol_->ReportCompleted(std::move(results), plan_duration));
+
+  EXPECT_LT(uploaded_body.size(), checkpoint_str.size());
+  absl::StatusOr<absl::Cord> recovered_checkpoint =
+      internal::UncompressWithGzip(uploaded_body);
+  ASSERT_OK(recovered_checkpoint);
+  EXPECT_EQ(*recovered_checkpoint, checkpoint_str);
+}
+
 TEST_F(HttpFederatedProtocolTest, TestReportCompletedViaSecureAgg) {
   // Issue an eligibility eval checkin first.
   ASSERT_OK(RunSuccessfulEligibilityEvalCheckin());
@@ -2533,6 +2609,32 @@ TEST(ProtocolRequestCreatorTest, CreateCancelOperationRequest) {
   EXPECT_FALSE((*request)->HasBody());
 }
 
+// A `SimulatedClock` which lets tests wait until some thread starts waiting on
+// the clock, and find out which deadline it is waiting for.
+class ObservableSimulatedClock : public SimulatedClock {
+ public:
+  // Blocks until a wake-up is scheduled for a waiter whose deadline hasn't
+  // passed yet, and returns the time the wake-up was scheduled for.
+  absl::Time WaitForScheduledWakeup() {
+    absl::MutexLock lock(&wakeups_mutex_);
+    wakeups_mutex_.Await(absl::Condition(
+        +[](std::deque<absl::Time>* wakeups) { return !wakeups->empty(); },
+        &scheduled_wakeups_));
+    absl::Time wakeup_time = scheduled_wakeups_.front();
+    scheduled_wakeups_.pop_front();
+    return wakeup_time;
+  }
+
+ private:
+  void ScheduleWakeup(absl::Time wakeup_time) override {
+    absl::MutexLock lock(&wakeups_mutex_);
+    scheduled_wakeups_.push_back(wakeup_time);
+  }
+
+  absl::Mutex wakeups_mutex_;
+  std::deque<absl::Time> scheduled_wakeups_ ABSL_GUARDED_BY(wakeups_mutex_);
+};
+
 class ProtocolRequestHelperTest : public ::testing::Test {
  public:
   ProtocolRequestHelperTest()
@@ -2554,7 +2656,8 @@ class ProtocolRequestHelperTest : public ::testing::Test {
                                  /*use_compression=*/false),
         protocol_request_helper_(&mock_http_client_, &bytes_downloaded_,
                                  &bytes_uploaded_, network_stopwatch_.get(),
-                                 /*client_decoded_http_resources=*/false) {}
+                                 /*client_decoded_http_resources=*/false,
+                                 &clock_, OperationPollingConfig()) {}
 
  protected:
   void TearDown() override {
@@ -2575,6 +2678,7 @@ class ProtocolRequestHelperTest : public ::testing::Test {
   int64_t bytes_uploaded_ = 0;
   std::unique_ptr<WallClockStopwatch> network_stopwatch_ =
       WallClockStopwatch::Create();
+  ObservableSimulatedClock clock_;
 
   InterruptibleRunner interruptible_runner_;
   ProtocolRequestCreator initial_request_creator_;
@@ -2752,6 +2856,7 @@ TEST_F(ProtocolRequestHelperTest,
           interruptible_runner_);
   ASSERT_OK(result);
   EXPECT_THAT(*result, EqualsProto(expected_response));
+  EXPECT_EQ(protocol_request_helper_.operation_poll_count(), 3);
 }
 
 TEST_F(ProtocolRequestHelperTest, TestPollOperationResponseErrorAfterPolling) {
@@ -2783,6 +2888,226 @@ TEST_F(ProtocolRequestHelperTest, TestPollOperationResponseErrorAfterPolling) {
   EXPECT_THAT(*result, EqualsProto(expected_response));
 }
 
+TEST_F(ProtocolRequestHelperTest, TestPollOperationBacksOffExponentially) {
+  ProtocolRequestHelper protocol_request_helper(
+      &mock_http_client_, &bytes_downloaded_, &bytes_uploaded_,
+      network_stopwatch_.get(), /*client_decoded_http_resources=*/false,
+      &clock_,
+      OperationPollingConfig{.initial_delay = absl::Seconds(1),
+                             .max_delay = absl::Seconds(4),
+                             .delay_multiplier = 2.0,
+                             .delay_jitter_fraction = 0.0});
+  Operation pending_operation_response =
+      CreatePendingOperation("operations/foo");
+  Operation expected_response = CreateDoneOperation(GetFakeAnyProto());
+  // Each request takes 100ms, which shouldn't affect the time at which the
+  // next request is issued.
+  auto pending_response = [this, &pending_operation_response]() {
+    clock_.AdvanceTime(absl::Milliseconds(100));
+    return FakeHttpResponse(200, HeaderList(),
+                            pending_operation_response.SerializeAsString());
+  };
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://initial.uri/v1/operations/foo?%24alt=proto",
+                  HttpRequest::Method::kGet, _, IsEmpty())))
+      .WillOnce(pending_response)
+      .WillOnce(pending_response)
+      .WillOnce(pending_response)
+      .WillOnce([this, &expected_response]() {
+        clock_.AdvanceTime(absl::Milliseconds(100));
+        return FakeHttpResponse(200, HeaderList(),
+                                expected_response.SerializeAsString());
+      });
+
+  const absl::Time start_time = clock_.Now();
+  absl::StatusOr<Operation> result;
+  std::thread polling_thread([&]() {
+    result = protocol_request_helper.PollOperationResponseUntilDone(
+        pending_operation_response, initial_request_creator_,
+        interruptible_runner_);
+  });
+  // The delays should double after each request, until they hit the max delay.
+  absl::Time expected_wakeup_time = start_time;
+  for (absl::Duration expected_delay :
+       {absl::Seconds(1), absl::Seconds(2), absl::Seconds(4),
+        absl::Seconds(4)}) {
+    expected_wakeup_time += expected_delay;
+    absl::Time wakeup_time = clock_.WaitForScheduledWakeup();
+    EXPECT_EQ(wakeup_time, expected_wakeup_time);
+    clock_.SetTime(wakeup_time);
+  }
+  polling_thread.join();
+
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, EqualsProto(expected_response));
+  EXPECT_EQ(protocol_request_helper.operation_poll_count(), 4);
+  EXPECT_EQ(protocol_request_helper.operation_polling_duration(),
+            absl::Seconds(11) + absl::Milliseconds(100));
+}
+
+TEST_F(ProtocolRequestHelperTest, TestPollOperationAppliesJitter) {
+  ProtocolRequestHelper protocol_request_helper(
+      &mock_http_client_, &bytes_downloaded_, &bytes_uploaded_,
+      network_stopwatch_.get(), /*client_decoded_http_resources=*/false,
+      &clock_,
+      OperationPollingConfig{.initial_delay = absl::Seconds(10),
+                             .max_delay = absl::Seconds(10),
+                             .delay_multiplier = 1.0,
+                             .delay_jitter_fraction = 0.5});
+  Operation pending_operation_response =
+      CreatePendingOperation("operations/foo");
+  Operation expected_response = CreateDoneOperation(GetFakeAnyProto());
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://initial.uri/v1/operations/foo?%24alt=proto",
+                  HttpRequest::Method::kGet, _, IsEmpty())))
+      .WillOnce(Return(FakeHttpResponse(
+          200, HeaderList(), expected_response.SerializeAsString())));
+
+  const absl::Time start_time = clock_.Now();
+  absl::StatusOr<Operation> result;
+  std::thread polling_thread([&]() {
+    result = protocol_request_helper.PollOperationResponseUntilDone(
+        pending_operation_response, initial_request_creator_,
+        interruptible_runner_);
+  });
+  absl::Time wakeup_time = clock_.WaitForScheduledWakeup();
+  EXPECT_THAT(wakeup_time - start_time,
+              AllOf(Ge(absl::Seconds(5)), Lt(absl::Seconds(15))));
+  clock_.SetTime(wakeup_time);
+  polling_thread.join();
+
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, EqualsProto(expected_response));
+}
+
+TEST_F(ProtocolRequestHelperTest, TestPollOperationHonorsServerPollingHint) {
+  ProtocolRequestHelper protocol_request_helper(
+      &mock_http_client_, &bytes_downloaded_, &bytes_uploaded_,
+      network_stopwatch_.get(), /*client_decoded_http_resources=*/false,
+      &clock_,
+      OperationPollingConfig{.initial_delay = absl::Seconds(1),
+                             .max_delay = absl::Seconds(4),
+                             .delay_multiplier = 2.0,
+                             .delay_jitter_fraction = 0.0,
+                             .max_server_suggested_delay = absl::Minutes(1)});
+  // The server suggests a 30s delay for the first poll, but then doesn't
+  // provide a hint anymore.
+  Operation hinted_operation_response =
+      CreatePendingOperation("operations/foo");
+  StartTaskAssignmentMetadata metadata;
+  *metadata.mutable_polling_hint()->mutable_polling_delay() =
+      TimeUtil::ConvertAbslToProtoDuration(absl::Seconds(30));
+  hinted_operation_response.mutable_metadata()->PackFrom(metadata);
+  Operation pending_operation_response =
+      CreatePendingOperation("operations/foo");
+  Operation expected_response = CreateDoneOperation(GetFakeAnyProto());
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://initial.uri/v1/operations/foo?%24alt=proto",
+                  HttpRequest::Method::kGet, _, IsEmpty())))
+      .WillOnce(Return(FakeHttpResponse(
+          200, HeaderList(), pending_operation_response.SerializeAsString())))
+      .WillOnce(Return(FakeHttpResponse(
+          200, HeaderList(), expected_response.SerializeAsString())));
+
+  const absl::Time start_time = clock_.Now();
+  absl::StatusOr<Operation> result;
+  std::thread polling_thread([&]() {
+    result = protocol_request_helper.PollOperationResponseUntilDone(
+        hinted_operation_response, initial_request_creator_,
+        interruptible_runner_);
+  });
+  // The server-suggested delay should be used first, after which the client
+  // should fall back to its own (not yet advanced) backoff schedule.
+  absl::Time wakeup_time = clock_.WaitForScheduledWakeup();
+  EXPECT_EQ(wakeup_time, start_time + absl::Seconds(30));
+  clock_.SetTime(wakeup_time);
+  wakeup_time = clock_.WaitForScheduledWakeup();
+  EXPECT_EQ(wakeup_time, start_time + absl::Seconds(31));
+  clock_.SetTime(wakeup_time);
+  polling_thread.join();
+
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, EqualsProto(expected_response));
+  EXPECT_EQ(protocol_request_helper.operation_poll_count(), 2);
+  EXPECT_EQ(protocol_request_helper.operation_polling_duration(),
+            absl::Seconds(31));
+}
+
+TEST_F(ProtocolRequestHelperTest, TestPollOperationCapsServerPollingHint) {
+  ProtocolRequestHelper protocol_request_helper(
+      &mock_http_client_, &bytes_downloaded_, &bytes_uploaded_,
+      network_stopwatch_.get(), /*client_decoded_http_resources=*/false,
+      &clock_,
+      OperationPollingConfig{.initial_delay = absl::Seconds(1),
+                             .max_delay = absl::Seconds(4),
+                             .delay_multiplier = 2.0,
+                             .delay_jitter_fraction = 0.0,
+                             .max_server_suggested_delay = absl::Minutes(1)});
+  // The server suggests a delay that is much longer than the maximum.
+  Operation hinted_operation_response =
+      CreatePendingOperation("operations/foo");
+  StartTaskAssignmentMetadata metadata;
+  *metadata.mutable_polling_hint()->mutable_polling_delay() =
+      TimeUtil::ConvertAbslToProtoDuration(absl::Hours(24));
+  hinted_operation_response.mutable_metadata()->PackFrom(metadata);
+  Operation expected_response = CreateDoneOperation(GetFakeAnyProto());
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(SimpleHttpRequestMatcher(
+                  "https://initial.uri/v1/operations/foo?%24alt=proto",
+                  HttpRequest::Method::kGet, _, IsEmpty())))
+      .WillOnce(Return(FakeHttpResponse(
+          200, HeaderList(), expected_response.SerializeAsString())));
+
+  const absl::Time start_time = clock_.Now();
+  absl::StatusOr<Operation> result;
+  std::thread polling_thread([&]() {
+    result = protocol_request_helper.PollOperationResponseUntilDone(
+        hinted_operation_response, initial_request_creator_,
+        interruptible_runner_);
+  });
+  absl::Time wakeup_time = clock_.WaitForScheduledWakeup();
+  EXPECT_EQ(wakeup_time, start_time + absl::Minutes(1));
+  clock_.SetTime(wakeup_time);
+  polling_thread.join();
+
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, EqualsProto(expected_response));
+  EXPECT_EQ(protocol_request_helper.operation_poll_count(), 1);
+}
+
+TEST_F(ProtocolRequestHelperTest, TestPollOperationInterruptedWhileWaiting) {
+  ProtocolRequestHelper protocol_request_helper(
+      &mock_http_client_, &bytes_downloaded_, &bytes_uploaded_,
+      network_stopwatch_.get(), /*client_decoded_http_resources=*/false,
+      &clock_,
+      OperationPollingConfig{.initial_delay = absl::Seconds(10),
+                             .max_delay = absl::Seconds(10),
+                             .delay_multiplier = 1.0,
+                             .delay_jitter_fraction = 0.0});
+  absl::Notification should_abort;
+  ON_CALL(mock_should_abort_, Call()).WillByDefault([&should_abort]() {
+    return should_abort.HasBeenNotified();
+  });
+
+  absl::StatusOr<Operation> result;
+  std::thread polling_thread([&]() {
+    result = protocol_request_helper.PollOperationResponseUntilDone(
+        CreatePendingOperation("operations/foo"), initial_request_creator_,
+        interruptible_runner_);
+  });
+  // Interrupt the wait without ever advancing the clock. No polling request
+  // should be issued.
+  clock_.WaitForScheduledWakeup();
+  should_abort.Notify();
+  polling_thread.join();
+
+  EXPECT_THAT(result.status(), IsCode(CANCELLED));
+  EXPECT_EQ(protocol_request_helper.operation_poll_count(), 0);
+}
+
 TEST_F(ProtocolRequestHelperTest, PerformMultipleRequestsSuccess) {
   auto request_a = initial_request_creator_.CreateProtocolRequest(
       "/v1/request_a", QueryParams(), HttpRequest::Method::kPost, "body1",
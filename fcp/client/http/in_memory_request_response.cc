@@ -15,12 +15,14 @@
  */
 #include "fcp/client/http/in_memory_request_response.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
 #include <vector>
 
@@ -28,31 +30,47 @@
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
-#include "absl/strings/ascii.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/match.h"
-#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "fcp/base/monitoring.h"
+#include "fcp/base/scheduler.h"
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/http/http_client_util.h"
+#include "fcp/client/http/parallel_gzip_compressor.h"
 #include "fcp/client/interruptible_runner.h"
+#include "zlib.h"
 
 namespace fcp {
 namespace client {
 namespace http {
 
-using ::google::protobuf::io::ArrayInputStream;
-using ::google::protobuf::io::GzipInputStream;
 using ::google::protobuf::io::GzipOutputStream;
 using ::google::protobuf::io::StringOutputStream;
 
-using CompressionFormat =
-    ::fcp::client::http::UriOrInlineData::InlineData::CompressionFormat;
-
-static constexpr absl::string_view kClientDecodedGzipSuffix = "+gzip";
+// `internal::BlockCordBuilder` gathers data into blocks that start at this
+// size, and that then grow along with the amount of data gathered so far (up
+// to kMaxResponseBodyBlockSize). This keeps the number of Cord chunks small,
+// without over-allocating for small responses. The expected size (e.g. the
+// "Content-Length" header) is only used to avoid allocating more than the rest
+// of the data needs: it is provided by the server, so the allocations must not
+// be sized by it alone.
+static constexpr int64_t kMinResponseBodyBlockSize = 16 * 1024;
+static constexpr int64_t kMaxResponseBodyBlockSize = 4 * 1024 * 1024;
+
+// Request bodies at least this large are compressed in parallel while they are
+// being sent, rather than upfront.
+static constexpr int64_t kParallelCompressionThreshold = 1024 * 1024;
+// The maximum number of threads used to compress request bodies.
+static constexpr int kMaxParallelCompressionThreads = 4;
+
+static int GetNumCompressionThreads() {
+  return std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1,
+                    kMaxParallelCompressionThreads);
+}
 
 absl::StatusOr<std::unique_ptr<HttpRequest>> InMemoryHttpRequest::Create(
     absl::string_view uri, HttpRequest::Method method, HeaderList extra_headers,
@@ -64,8 +82,13 @@ absl::StatusOr<std::unique_ptr<HttpRequest>> InMemoryHttpRequest::Create(
     return absl::InvalidArgumentError(
         absl::StrCat("Non-HTTPS URIs are not supported: ", uri));
   }
+  bool use_parallel_compression = false;
   if (use_compression) {
-    FCP_ASSIGN_OR_RETURN(body, internal::CompressWithGzip(body));
+    if (static_cast<int64_t>(body.size()) >= kParallelCompressionThreshold) {
+      use_parallel_compression = true;
+    } else {
+      FCP_ASSIGN_OR_RETURN(body, internal::CompressWithGzip(body));
+    }
     extra_headers.push_back({kContentEncodingHdr, kGzipEncodingHdrValue});
   }
   std::optional<std::string> content_length_hdr =
@@ -86,16 +109,47 @@ absl::StatusOr<std::unique_ptr<HttpRequest>> InMemoryHttpRequest::Create(
         return absl::InvalidArgumentError(absl::StrCat(
             "Request method does not allow request body: ", method));
     }
-    // Add a Content-Length header, but only if there's a request body.
-    extra_headers.push_back({kContentLengthHdr, std::to_string(body.size())});
+    // Add a Content-Length header, but only if there's a request body (and
+    // its final size is already known).
+    if (!use_parallel_compression) {
+      extra_headers.push_back(
+          {kContentLengthHdr, std::to_string(body.size())});
+    }
   }
 
-  return absl::WrapUnique(new InMemoryHttpRequest(
+  auto request = absl::WrapUnique(new InMemoryHttpRequest(
       uri, method, std::move(extra_headers), std::move(body)));
+  if (use_parallel_compression) {
+    request->StartParallelCompression();
+  }
+  return request;
+}
+
+InMemoryHttpRequest::~InMemoryHttpRequest() = default;
+
+// Returns the scheduler that large request bodies are compressed on. It is
+// shared by all requests, and is only created once it's first needed.
+static Scheduler& GetCompressionScheduler() {
+  static Scheduler* const scheduler =
+      CreateThreadPoolScheduler(GetNumCompressionThreads()).release();
+  return *scheduler;
+}
+
+void InMemoryHttpRequest::StartParallelCompression() {
+  // Allow each thread to run a block ahead of the reader, so the threads stay
+  // busy while the previously compressed blocks are being sent.
+  compressor_ = std::make_unique<ParallelGzipCompressor>(
+      body_, GetCompressionScheduler(),
+      ParallelGzipCompressor::kDefaultBlockSize,
+      /*max_blocks_in_flight=*/2 * GetNumCompressionThreads());
 }
 
 absl::StatusOr<int64_t> InMemoryHttpRequest::ReadBody(char* buffer,
                                                       int64_t requested) {
+  if (compressor_ != nullptr) {
+    return compressor_->Read(buffer, requested);
+  }
+
   // This method is called from the HttpClient's thread (we don't really care
   // which one). Hence, we use a mutex to ensure that subsequent calls to this
   // method see the modifications to cursor_.
@@ -121,65 +175,15 @@ absl::Status InMemoryHttpRequestCallback::OnResponseStarted(
   absl::WriterMutexLock _(&mutex_);
   response_code_ = response.code();
 
-  std::optional<std::string> content_encoding_header =
-      FindHeader(response.headers(), kContentEncodingHdr);
-  if (content_encoding_header.has_value()) {
-    // We don't expect the response body to be "Content-Encoding" encoded,
-    // because the `HttpClient` is supposed to transparently handle the decoding
-    // for us (unless we specified a "Accept-Encoding" header in the request,
-    // which would indicate that we wanted to handle the response decoding).
-    if (!FindHeader(request.extra_headers(), kAcceptEncodingHdr).has_value()) {
-      // Note: technically, we should only receive Content-Encoding values that
-      // match the Accept-Encoding values provided in the request headers. The
-      // check above isn't quite that strict, but that's probably fine (since
-      // such issues should be rare, and can be handled farther up the stack).
-      status_ = absl::InvalidArgumentError(
-          absl::StrCat("Unexpected header: ", kContentEncodingHdr));
-      return status_;
-    }
-    content_encoding_ = *content_encoding_header;
-  }
-
-  content_type_ = FindHeader(response.headers(), kContentTypeHdr).value_or("");
-
-  // Similarly, we should under no circumstances receive a non-identity
-  // Transfer-Encoding header, since the `HttpClient` is unconditionally
-  // required to undo any such encoding for us.
-  std::optional<std::string> transfer_encoding_header =
-      FindHeader(response.headers(), kTransferEncodingHdr);
-  if (transfer_encoding_header.has_value() &&
-      absl::AsciiStrToLower(*transfer_encoding_header) !=
-          kIdentityEncodingHdrValue) {
-    status_ = absl::InvalidArgumentError(
-        absl::StrCat("Unexpected header: ", kTransferEncodingHdr));
-    return status_;
-  }
-
-  // If no Content-Length header is provided, this means that the server either
-  // didn't provide one and is streaming the response, or that the HttpClient
-  // implementation transparently decompressed the data for us and stripped the
-  // Content-Length header (as per the HttpClient contract).
-  std::optional<std::string> content_length_hdr =
-      FindHeader(response.headers(), kContentLengthHdr);
-  if (!content_length_hdr.has_value()) {
-    return absl::OkStatus();
-  }
-
-  // A Content-Length header available. Let's parse it so that we know how much
-  // data to expect.
-  int64_t content_length;
-  // Note that SimpleAtoi safely handles non-ASCII data.
-  if (!absl::SimpleAtoi(*content_length_hdr, &content_length)) {
-    status_ = absl::InvalidArgumentError(
-        "Could not parse Content-Length response header");
-    return status_;
-  }
-  if (content_length < 0) {
-    status_ = absl::OutOfRangeError(absl::StrCat(
-        "Invalid Content-Length response header: ", content_length));
+  absl::StatusOr<ResponseBodyHeaders> body_headers =
+      ParseResponseBodyHeaders(request, response);
+  if (!body_headers.ok()) {
+    status_ = body_headers.status();
     return status_;
   }
-  expected_content_length_ = content_length;
+  content_encoding_ = std::move(body_headers->content_encoding);
+  content_type_ = std::move(body_headers->content_type);
+  expected_content_length_ = body_headers->content_length;
 
   return absl::OkStatus();
 }
@@ -202,21 +206,46 @@ absl::Status InMemoryHttpRequestCallback::OnResponseBody(
   absl::WriterMutexLock _(&mutex_);
 
   // Ensure we're not receiving more data than expected.
+  FCP_RETURN_IF_ERROR(CheckReceivedBodySize(data.size()));
+
+  // The HttpClient implementation didn't write the data into our buffer
+  // directly, so this copy is unavoidable, but it at least ensures that the
+  // data ends up in a few large contiguous blocks rather than in many small
+  // Cord fragments.
+  response_buffer_.Append(data, expected_content_length_);
+  return absl::OkStatus();
+}
+
+absl::Span<char> InMemoryHttpRequestCallback::GetResponseBodyBuffer(
+    const HttpRequest& request, const HttpResponse& response,
+    int64_t min_size) {
+  absl::WriterMutexLock _(&mutex_);
+  if (min_size <= 0) {
+    return {};
+  }
+  return response_buffer_.GetBuffer(min_size, expected_content_length_);
+}
+
+absl::Status InMemoryHttpRequestCallback::OnResponseBodyBufferWritten(
+    const HttpRequest& request, const HttpResponse& response, int64_t size) {
+  absl::WriterMutexLock _(&mutex_);
+  FCP_RETURN_IF_ERROR(CheckReceivedBodySize(size));
+  absl::Status status = response_buffer_.CommitBuffer(size);
+  if (!status.ok()) {
+    status_ = status;
+  }
+  return status;
+}
+
+absl::Status InMemoryHttpRequestCallback::CheckReceivedBodySize(int64_t size) {
   if (expected_content_length_.has_value() &&
-      response_buffer_.size() + data.size() > *expected_content_length_) {
+      response_buffer_.size() + size > *expected_content_length_) {
     status_ = absl::OutOfRangeError(absl::StrCat(
-        "Too much response body data received (rcvd: ", response_buffer_.size(),
-        ", new: ", data.size(), ", max: ", *expected_content_length_, ")"));
+        "Too much response body data received (rcvd: ",
+        response_buffer_.size(), ", new: ", size,
+        ", max: ", *expected_content_length_, ")"));
     return status_;
   }
-
-  // Copy the data into the target buffer. Note that this means we'll always
-  // store the response body as a number of memory fragments (rather than a
-  // contiguous buffer). However, because HttpClient implementations are
-  // encouraged to return response data in fairly large chunks, we don't expect
-  // this too cause much overhead.
-  response_buffer_.Append(data);
-
   return absl::OkStatus();
 }
 
@@ -235,13 +264,14 @@ void InMemoryHttpRequestCallback::OnResponseCompleted(
   // Once the body has been received correctly, turn the response code into a
   // canonical code.
   absl::WriterMutexLock _(&mutex_);
+  response_body_ = response_buffer_.Build();
   // Note: the case when too *much* response data is unexpectedly received is
   // handled in OnResponseBody (while this handles the case of too little data).
   if (expected_content_length_.has_value() &&
-      response_buffer_.size() != *expected_content_length_) {
+      response_body_.size() != *expected_content_length_) {
     status_ = absl::InvalidArgumentError(
         absl::StrCat("Too little response body data received (rcvd: ",
-                     response_buffer_.size(),
+                     response_body_.size(),
                      ", expected: ", *expected_content_length_, ")"));
     return;
   }
@@ -257,7 +287,7 @@ absl::StatusOr<InMemoryHttpResponse> InMemoryHttpRequestCallback::Response()
   // to have values.
 
   return InMemoryHttpResponse{*response_code_, content_encoding_, content_type_,
-                              response_buffer_};
+                              response_body_};
 }
 
 absl::StatusOr<InMemoryHttpResponse> PerformRequestInMemory(
@@ -346,102 +376,6 @@ PerformMultipleRequestsInMemory(
   return results;
 }
 
-absl::StatusOr<std::vector<absl::StatusOr<InMemoryHttpResponse>>>
-FetchResourcesInMemory(HttpClient& http_client,
-                       InterruptibleRunner& interruptible_runner,
-                       const std::vector<UriOrInlineData>& resources,
-                       int64_t* bytes_received_acc, int64_t* bytes_sent_acc,
-                       bool client_decoded_http_resources) {
-  // Each resource may have the data already available (by having been included
-  // in a prior response inline), or may need to be fetched.
-
-  // We'll create an 'accessor' for each resource, providing access to that
-  // resource's data by the end of this function (either the fetched data, or
-  // the inline data).
-  std::vector<std::function<absl::StatusOr<InMemoryHttpResponse>()>>
-      response_accessors;
-
-  // We'll compile HttpRequest instances for those resources that do need to be
-  // fetched, then we'll fire them off all at once, and then we'll gather their
-  // responses once all requests have finished.
-  std::vector<std::unique_ptr<http::HttpRequest>> http_requests;
-  std::vector<absl::StatusOr<InMemoryHttpResponse>> http_responses;
-
-  for (const UriOrInlineData& resource : resources) {
-    if (!resource.uri().empty()) {
-      // If the resource URI is set, then create a request to fetch the data for
-      // it, and point the accessor at the slot in http_responses where that
-      // request's response will eventually live.
-      FCP_ASSIGN_OR_RETURN(
-          std::unique_ptr<http::HttpRequest> request,
-          InMemoryHttpRequest::Create(resource.uri(), HttpRequest::Method::kGet,
-                                      {}, "", /*use_compression=*/false));
-      http_requests.push_back(std::move(request));
-      int64_t response_index = http_requests.end() - http_requests.begin() - 1;
-      response_accessors.push_back([&http_responses, response_index]() {
-        return std::move(http_responses.at(response_index));
-      });
-    } else {
-      // The data is available inline. Make the accessor just return a "fake"
-      // successful HTTP response (that way the caller can have unified error
-      // handling logic and doesn't have to know whether a resource was truly
-      // fetched via HTTP or not). Because the inline_data field is an
-      // absl::Cord, making a copy of it should be very cheap.
-      response_accessors.push_back([resource]() {
-        std::string content_type = "application/octet-stream";
-        switch (resource.inline_data().compression_format) {
-          case UriOrInlineData::InlineData::CompressionFormat::kUncompressed:
-            break;
-          case UriOrInlineData::InlineData::CompressionFormat::kGzip:
-            absl::StrAppend(&content_type, kClientDecodedGzipSuffix);
-            break;
-        }
-        return InMemoryHttpResponse{kHttpOk, "", content_type,
-                                    resource.inline_data().data};
-      });
-    }
-  }
-
-  // Perform the requests.
-  auto resource_fetch_result = PerformMultipleRequestsInMemory(
-      http_client, interruptible_runner, std::move(http_requests),
-      bytes_received_acc, bytes_sent_acc, client_decoded_http_resources);
-  // Check whether issuing the requests failed as a whole (generally indicating
-  // a programming error).
-  FCP_RETURN_IF_ERROR(resource_fetch_result);
-  http_responses = std::move(*resource_fetch_result);
-
-  // Compile the result vector by getting each resource's response using the
-  // corresponding accessor.
-  // Note that the order of results returned corresponds to the order of
-  // resources in the vector we originally received.
-  std::vector<absl::StatusOr<InMemoryHttpResponse>> result;
-  result.reserve(response_accessors.size());
-  for (const auto& response_accessor : response_accessors) {
-    if (client_decoded_http_resources) {
-      absl::StatusOr<InMemoryHttpResponse> response = response_accessor();
-      if (response.ok() && absl::EndsWithIgnoreCase(response->content_type,
-                                                    kClientDecodedGzipSuffix)) {
-        std::string response_body_temp(response->body);
-        // We're going to overwrite the response body with the decoded contents
-        // shortly, no need to keep an extra copy of it in memory.
-        response->body.Clear();
-        absl::StatusOr<absl::Cord> decoded_response_body =
-            internal::UncompressWithGzip(response_body_temp);
-        if (!decoded_response_body.ok()) {
-          response = decoded_response_body.status();
-        } else {
-          response->body = *std::move(decoded_response_body);
-        }
-      }
-      result.push_back(response);
-    } else {
-      result.push_back(response_accessor());
-    }
-  }
-  return result;
-}
-
 namespace internal {
 absl::StatusOr<std::string> CompressWithGzip(
     const std::string& uncompressed_data) {
@@ -481,32 +415,158 @@ absl::StatusOr<std::string> CompressWithGzip(
   return output;
 }
 
+absl::Span<char> BlockCordBuilder::GetBuffer(
+    int64_t min_size, std::optional<int64_t> expected_size) {
+  if (block_capacity_ - block_size_ >= min_size) {
+    return absl::MakeSpan(block_.get() + block_size_,
+                          block_capacity_ - block_size_);
+  }
+  SealBlock();
+
+  int64_t gathered = size();
+  int64_t block_size = std::clamp(gathered, kMinResponseBodyBlockSize,
+                                  kMaxResponseBodyBlockSize);
+  if (expected_size.has_value() && *expected_size > gathered) {
+    // Don't allocate more than the rest of the data needs, so that the last
+    // block is filled completely.
+    block_size = std::min(block_size, *expected_size - gathered);
+  }
+  block_size = std::max(block_size, min_size);
+  // Note: we intentionally don't value-initialize the block, since it will be
+  // overwritten with the data anyway.
+  block_.reset(new char[block_size]);
+  block_capacity_ = block_size;
+  block_size_ = 0;
+  return absl::MakeSpan(block_.get(), block_size);
+}
+
+absl::Status BlockCordBuilder::CommitBuffer(int64_t size) {
+  if (size < 0 || size > block_capacity_ - block_size_) {
+    return absl::InternalError(absl::StrCat(
+        "Invalid amount of data written to buffer (written: ", size,
+        ", available: ", block_capacity_ - block_size_, ")"));
+  }
+  // The data is already where it needs to be.
+  block_size_ += size;
+  return absl::OkStatus();
+}
+
+void BlockCordBuilder::Append(absl::string_view data,
+                              std::optional<int64_t> expected_size) {
+  if (data.empty()) {
+    return;
+  }
+  absl::Span<char> buffer = GetBuffer(data.size(), expected_size);
+  std::memcpy(buffer.data(), data.data(), data.size());
+  block_size_ += data.size();
+}
+
+int64_t BlockCordBuilder::size() const {
+  return static_cast<int64_t>(data_.size()) + block_size_;
+}
+
+absl::Cord BlockCordBuilder::Build() {
+  SealBlock();
+  return data_;
+}
+
+void BlockCordBuilder::SealBlock() {
+  if (block_size_ == 0) {
+    block_.reset();
+  } else if (block_size_ < block_capacity_ / 2) {
+    // Most of the block is unused (e.g. a small response, or a response that
+    // ended early), so rather than retaining the whole allocation we copy the
+    // data out and release the block.
+    data_.Append(absl::string_view(block_.get(), block_size_));
+    block_.reset();
+  } else {
+    // Hand ownership of the block to the Cord, without copying the data.
+    char* block = block_.release();
+    data_.Append(absl::MakeCordFromExternal(
+        absl::string_view(block, block_size_), [block]() { delete[] block; }));
+  }
+  block_capacity_ = 0;
+  block_size_ = 0;
+}
+
 absl::StatusOr<absl::Cord> UncompressWithGzip(
     const std::string& compressed_data) {
   absl::Cord out;
-  const void* buffer;
-  int size;
-  ArrayInputStream sub_stream(compressed_data.data(),
-                              static_cast<int>(compressed_data.size()));
-  GzipInputStream input_stream(&sub_stream, GzipInputStream::GZIP);
-
-  while (input_stream.Next(&buffer, &size)) {
-    if (size <= -1) {
+  GzipDecoder decoder;
+  FCP_RETURN_IF_ERROR(
+      decoder.Decode(compressed_data, [&out](absl::string_view data) {
+        out.Append(data);
+        return absl::OkStatus();
+      }));
+  FCP_RETURN_IF_ERROR(decoder.Finish());
+  return out;
+}
+
+GzipDecoder::~GzipDecoder() {
+  if (initialized_) {
+    inflateEnd(&stream_);
+  }
+}
+
+absl::Status GzipDecoder::Decode(
+    absl::string_view data,
+    const std::function<absl::Status(absl::string_view)>& output) {
+  if (data.empty()) {
+    return absl::OkStatus();
+  }
+  if (!initialized_) {
+    // Adding 16 to the window bits makes zlib expect a gzip header and trailer.
+    if (inflateInit2(&stream_, 16 + MAX_WBITS) != Z_OK) {
       return absl::InternalError(
-          "Uncompress failed: invalid input size returned by the "
-          "GzipInputStream.");
+          "An error has occurred during decompression: init failed");
     }
-    out.Append(absl::string_view(reinterpret_cast<const char*>(buffer), size));
+    initialized_ = true;
+    output_buffer_ = std::make_unique<char[]>(kOutputBufferSize);
   }
+  stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream_.avail_in = static_cast<uInt>(data.size());
+  while (stream_.avail_in > 0) {
+    if (member_finished_) {
+      // Multiple concatenated gzip members are valid gzip data as well, so
+      // start decoding the next member.
+      if (inflateReset(&stream_) != Z_OK) {
+        return absl::InternalError(
+            "An error has occurred during decompression: reset failed");
+      }
+      member_finished_ = false;
+    }
+    // Decompress as much of the pending input as possible. A full output
+    // buffer means there may be more output pending.
+    do {
+      stream_.next_out = reinterpret_cast<Bytef*>(output_buffer_.get());
+      stream_.avail_out = kOutputBufferSize;
+      int result = inflate(&stream_, Z_NO_FLUSH);
+      if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        return absl::InternalError(absl::StrCat(
+            "An error has occurred during decompression: ",
+            stream_.msg != nullptr ? stream_.msg : zError(result)));
+      }
+      int produced = kOutputBufferSize - static_cast<int>(stream_.avail_out);
+      if (produced > 0) {
+        FCP_RETURN_IF_ERROR(
+            output(absl::string_view(output_buffer_.get(), produced)));
+      }
+      if (result == Z_STREAM_END) {
+        member_finished_ = true;
+        break;
+      }
+    } while (stream_.avail_out == 0);
+  }
+  return absl::OkStatus();
+}
 
-  if (input_stream.ZlibErrorMessage() != nullptr) {
-    // Some real error happened during decompression.
+absl::Status GzipDecoder::Finish() const {
+  // Note: empty data is treated as an empty (rather than truncated) stream.
+  if (initialized_ && !member_finished_) {
     return absl::InternalError(
-        absl::StrCat("An error has occurred during decompression:",
-                     input_stream.ZlibErrorMessage()));
+        "An error has occurred during decompression: unexpected end of data");
   }
-
-  return out;
+  return absl::OkStatus();
 }
 
 }  // namespace internal
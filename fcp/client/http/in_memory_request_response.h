@@ -17,6 +17,7 @@
 #define FCP_CLIENT_HTTP_IN_MEMORY_REQUEST_RESPONSE_H_
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
@@ -29,8 +30,11 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "fcp/client/http/http_client.h"
+#include "fcp/client/http/parallel_gzip_compressor.h"
 #include "fcp/client/interruptible_runner.h"
+#include "zlib.h"
 
 namespace fcp {
 namespace client {
@@ -49,7 +53,11 @@ class InMemoryHttpRequest : public HttpRequest {
   //
   // If "use_compression" is true, the body will be compressed with
   // gzip. A "Content-Encoding" header will be added, and the "Content-Length"
-  // header will be the compressed length.
+  // header will be the compressed length. Large bodies are instead compressed
+  // block-by-block on a small thread pool (shared by all requests) while the
+  // request is being sent (see `ParallelGzipCompressor`), in which case no
+  // "Content-Length" header is added, since the compressed length isn't known
+  // upfront.
   //
   // Returns an INVALID_ARGUMENT error if:
   // - the URI is a non-HTTPS URI,
@@ -66,6 +74,8 @@ class InMemoryHttpRequest : public HttpRequest {
 
   absl::StatusOr<int64_t> ReadBody(char* buffer, int64_t requested) override;
 
+  ~InMemoryHttpRequest() override;
+
  private:
   InMemoryHttpRequest(absl::string_view uri, Method method,
                       HeaderList extra_headers, std::string body)
@@ -74,10 +84,16 @@ class InMemoryHttpRequest : public HttpRequest {
         body_(std::move(body)),
         headers_(std::move(extra_headers)) {}
 
+  // Starts compressing `body_` in parallel, after which `ReadBody` returns the
+  // compressed data as it becomes available.
+  void StartParallelCompression();
+
   const std::string uri_;
   const Method method_;
   const std::string body_;
   const HeaderList headers_;
+  // Only set if the body is being compressed by `StartParallelCompression`.
+  std::unique_ptr<ParallelGzipCompressor> compressor_;
   int64_t cursor_ ABSL_GUARDED_BY(mutex_) = 0;
   mutable absl::Mutex mutex_;
 };
@@ -95,8 +111,66 @@ struct InMemoryHttpResponse {
   absl::Cord body;
 };
 
+namespace internal {
+// Gathers data of a (not necessarily known) size into geometrically growing
+// blocks of memory (up to a few MiB each), which are then adopted by the
+// resulting `absl::Cord` without being copied again. This means that the data
+// ends up as a small number of large Cord chunks, without over-allocating for
+// small amounts of data.
+//
+// The data can either be appended via `Append`, or be written straight into
+// the memory returned by `GetBuffer` and then committed via `CommitBuffer`.
+//
+// This class is not thread-safe.
+class BlockCordBuilder {
+ public:
+  BlockCordBuilder() = default;
+
+  BlockCordBuilder(const BlockCordBuilder&) = delete;
+  BlockCordBuilder& operator=(const BlockCordBuilder&) = delete;
+
+  // Returns a buffer of at least `min_size` bytes that the next `min_size` or
+  // more bytes of data can be written into. If `expected_size` is set, then it
+  // is used as a hint for the total amount of data to expect, so that the last
+  // block isn't larger than necessary (the hint must not be trusted to size
+  // allocations on its own, so blocks never exceed the usual maximum because of
+  // it). The buffer remains valid until the next call to any non-const method.
+  absl::Span<char> GetBuffer(int64_t min_size,
+                             std::optional<int64_t> expected_size);
+
+  // Marks the first `size` bytes of the buffer most recently returned by
+  // `GetBuffer` as written. Returns an error if `size` is larger than the
+  // space that is left in that buffer.
+  absl::Status CommitBuffer(int64_t size);
+
+  // Appends a copy of `data`. See `GetBuffer` for `expected_size`.
+  void Append(absl::string_view data, std::optional<int64_t> expected_size);
+
+  // Returns the total amount of data gathered so far.
+  int64_t size() const;
+
+  // Returns all data gathered so far (sharing rather than copying the blocks).
+  absl::Cord Build();
+
+ private:
+  // Moves the data in `block_` (if any) into `data_`.
+  void SealBlock();
+
+  absl::Cord data_;
+  // The block of memory that data is currently being gathered in, which has
+  // room for `block_capacity_` bytes, of which `block_size_` have been filled.
+  std::unique_ptr<char[]> block_;
+  int64_t block_capacity_ = 0;
+  int64_t block_size_ = 0;
+};
+}  // namespace internal
+
 // Simple `HttpRequestCallback` implementation that stores the response and its
 // body in an `InMemoryHttpResponse` object for later consumption.
+//
+// The response body is received via an `internal::BlockCordBuilder` (with the
+// "Content-Length" response header as the size hint), and hence ends up as a
+// small number of large Cord chunks.
 class InMemoryHttpRequestCallback : public HttpRequestCallback {
  public:
   InMemoryHttpRequestCallback() = default;
@@ -108,6 +182,12 @@ class InMemoryHttpRequestCallback : public HttpRequestCallback {
   absl::Status OnResponseBody(const HttpRequest& request,
                               const HttpResponse& response,
                               absl::string_view data) override;
+  absl::Span<char> GetResponseBodyBuffer(const HttpRequest& request,
+                                         const HttpResponse& response,
+                                         int64_t min_size) override;
+  absl::Status OnResponseBodyBufferWritten(const HttpRequest& request,
+                                           const HttpResponse& response,
+                                           int64_t size) override;
   void OnResponseBodyError(const HttpRequest& request,
                            const HttpResponse& response,
                            const absl::Status& error) override;
@@ -116,13 +196,20 @@ class InMemoryHttpRequestCallback : public HttpRequestCallback {
   absl::StatusOr<InMemoryHttpResponse> Response() const;
 
  private:
+  // Checks that receiving another `size` bytes of response body data would not
+  // exceed the expected content length, if any.
+  absl::Status CheckReceivedBodySize(int64_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   absl::Status status_ ABSL_GUARDED_BY(mutex_) =
       absl::UnavailableError("No response received");
   std::optional<int> response_code_ ABSL_GUARDED_BY(mutex_);
   std::string content_encoding_ ABSL_GUARDED_BY(mutex_);
   std::string content_type_ ABSL_GUARDED_BY(mutex_);
   std::optional<int64_t> expected_content_length_ ABSL_GUARDED_BY(mutex_);
-  absl::Cord response_buffer_ ABSL_GUARDED_BY(mutex_);
+  internal::BlockCordBuilder response_buffer_ ABSL_GUARDED_BY(mutex_);
+  // The complete response body, once it has been received.
+  absl::Cord response_body_ ABSL_GUARDED_BY(mutex_);
   mutable absl::Mutex mutex_;
 };
 
@@ -192,41 +279,45 @@ class UriOrInlineData {
   const InlineData inline_data_;
 };
 
-// Utility for (potentially) fetching multiple resources at once, each of which
-// either needs to be fetched from a URI using a HTTP GET request, or for which
-// its data is already available, and returning the eventual results (incl. the
-// response body) via in-memory objects, in an interruptible way. If resources
-// do need to be fetched, then a single `HttpClient::PerformRequests` call will
-// be made for all resources at once.
-//
-// This makes it a convenient way for callers to gather the data for a related
-// set of resources (some of which might already have their data available) in
-// one go, and to then access the data for the first resource at index 0, the
-// second resource at index 1, etc., transparently handling the various
-// permutations that are possible (e.g.  resource A having data inline but
-// B having to be fetched, or both being inlined, or ...) via a unified access
-// pattern and error handling mechanism.
-//
-// If `bytes_received_acc` and `bytes_sent_acc` are non-null then those
-// accumulators will also be incremented by the aggregate amount of data that
-// was received/sent by the HTTP requests that were issued.
-//
-// Returns an error if issuing the joint `HttpClient::PerformRequests` call
-// failed.  Otherwise it returns a vector containing the result for each
-// resource (in the same order the resources were provided in).
-absl::StatusOr<std::vector<absl::StatusOr<InMemoryHttpResponse>>>
-FetchResourcesInMemory(HttpClient& http_client,
-                       InterruptibleRunner& interruptible_runner,
-                       const std::vector<UriOrInlineData>& resources,
-                       int64_t* bytes_received_acc, int64_t* bytes_sent_acc,
-                       bool client_decoded_http_resources);
-
-// Used by the class and in tests only.
+// Used by the classes in this package and in tests only.
 namespace internal {
 absl::StatusOr<std::string> CompressWithGzip(
     const std::string& uncompressed_data);
 absl::StatusOr<absl::Cord> UncompressWithGzip(
     const std::string& compressed_data);
+
+// Decompresses gzip data (which may consist of multiple concatenated gzip
+// members) incrementally, as it arrives, without buffering the compressed or
+// the decompressed data.
+class GzipDecoder {
+ public:
+  GzipDecoder() = default;
+  ~GzipDecoder();
+
+  GzipDecoder(const GzipDecoder&) = delete;
+  GzipDecoder& operator=(const GzipDecoder&) = delete;
+
+  // Decompresses the next block of compressed data, handing each block of
+  // decompressed data to `output` (that data is only valid for the duration of
+  // the call). Returns an error if the data is invalid, or if `output` returns
+  // an error.
+  absl::Status Decode(
+      absl::string_view data,
+      const std::function<absl::Status(absl::string_view)>& output);
+
+  // Returns an error if the data passed to `Decode` so far ended in the middle
+  // of a gzip member.
+  absl::Status Finish() const;
+
+ private:
+  static constexpr int kOutputBufferSize = 64 * 1024;
+
+  z_stream stream_{};
+  bool initialized_ = false;
+  // Whether the current gzip member was decoded completely.
+  bool member_finished_ = false;
+  std::unique_ptr<char[]> output_buffer_;
+};
 }  // namespace internal
 
 };  // namespace http
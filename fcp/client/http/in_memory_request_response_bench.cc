@@ -0,0 +1,257 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/http/http_client.h"
+#include "fcp/client/http/http_client_util.h"
+#include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/http/resource_fetcher.h"
+#include "fcp/client/interruptible_runner.h"
+#include "fcp/client/test_helpers.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp::client::http {
+namespace {
+
+// The size of the blocks that the fake client receives data in, matching the
+// receive buffer size used by the curl-based `HttpClient`.
+constexpr int64_t kReceiveBufferSize = 256 * 1024;
+
+class FakeHttpResponse : public HttpResponse {
+ public:
+  explicit FakeHttpResponse(int64_t body_size)
+      : headers_({{kContentLengthHdr, absl::StrCat(body_size)}}) {}
+
+  int code() const override { return kHttpOk; }
+  const HeaderList& headers() const override { return headers_; }
+
+ private:
+  const HeaderList headers_;
+};
+
+class FakeHttpRequestHandle : public HttpRequestHandle {
+ public:
+  explicit FakeHttpRequestHandle(std::unique_ptr<HttpRequest> request)
+      : request_(std::move(request)) {}
+
+  HttpRequest& request() { return *request_; }
+  SentReceivedBytes TotalSentReceivedBytes() const override { return {0, 0}; }
+  void Cancel() override {}
+
+ private:
+  const std::unique_ptr<HttpRequest> request_;
+};
+
+// An `HttpClient` which responds to every request with the given body, without
+// touching the network. Like the curl-based `HttpClient`, it receives the body
+// into its own fixed-size buffer one block at a time, and then writes each
+// block into the callback's buffer if the callback provides one (or passes the
+// block to `OnResponseBody` otherwise).
+class FakeDownloadHttpClient : public HttpClient {
+ public:
+  explicit FakeDownloadHttpClient(std::string body)
+      : body_(std::move(body)), receive_buffer_(kReceiveBufferSize, '\0') {}
+
+  std::unique_ptr<HttpRequestHandle> EnqueueRequest(
+      std::unique_ptr<HttpRequest> request) override {
+    return std::make_unique<FakeHttpRequestHandle>(std::move(request));
+  }
+
+  absl::Status PerformRequests(
+      std::vector<std::pair<HttpRequestHandle*, HttpRequestCallback*>> requests)
+      override {
+    for (auto [generic_handle, callback] : requests) {
+      HttpRequest& request =
+          static_cast<FakeHttpRequestHandle*>(generic_handle)->request();
+      FakeHttpResponse response(body_.size());
+      FCP_RETURN_IF_ERROR(callback->OnResponseStarted(request, response));
+      for (size_t offset = 0; offset < body_.size();
+           offset += kReceiveBufferSize) {
+        const size_t size =
+            std::min(body_.size() - offset, receive_buffer_.size());
+        // Stands in for the data arriving from the network.
+        std::memcpy(receive_buffer_.data(), body_.data() + offset, size);
+        absl::Span<char> buffer =
+            callback->GetResponseBodyBuffer(request, response, size);
+        if (buffer.size() >= size) {
+          std::memcpy(buffer.data(), receive_buffer_.data(), size);
+          FCP_RETURN_IF_ERROR(
+              callback->OnResponseBodyBufferWritten(request, response, size));
+        } else {
+          FCP_RETURN_IF_ERROR(callback->OnResponseBody(
+              request, response,
+              absl::string_view(receive_buffer_.data(), size)));
+        }
+      }
+      callback->OnResponseCompleted(request, response);
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const std::string body_;
+  std::string receive_buffer_;
+};
+
+// A callback which only implements `OnResponseBody`, appending each block of
+// data to an `absl::Cord` as it arrives. This mimics how response bodies were
+// received before `HttpRequestCallback::GetResponseBodyBuffer` existed, and
+// serves as the baseline to compare `InMemoryHttpRequestCallback` against.
+class CordAppendingCallback : public HttpRequestCallback {
+ public:
+  absl::Status OnResponseStarted(const HttpRequest& request,
+                                 const HttpResponse& response) override {
+    return absl::OkStatus();
+  }
+  void OnResponseError(const HttpRequest& request,
+                       const absl::Status& error) override {}
+  absl::Status OnResponseBody(const HttpRequest& request,
+                              const HttpResponse& response,
+                              absl::string_view data) override {
+    absl::MutexLock lock(&mutex_);
+    body_.Append(data);
+    return absl::OkStatus();
+  }
+  void OnResponseBodyError(const HttpRequest& request,
+                           const HttpResponse& response,
+                           const absl::Status& error) override {}
+  void OnResponseCompleted(const HttpRequest& request,
+                           const HttpResponse& response) override {}
+
+  absl::Cord body() {
+    absl::MutexLock lock(&mutex_);
+    return body_;
+  }
+
+ private:
+  absl::Mutex mutex_;
+  absl::Cord body_ ABSL_GUARDED_BY(mutex_);
+};
+
+void ReportBody(benchmark::State& state, const absl::Cord& body) {
+  auto chunks = body.Chunks();
+  state.counters["chunks"] = std::distance(chunks.begin(), chunks.end());
+  state.SetBytesProcessed(state.iterations() * body.size());
+}
+
+// Downloads a plan-sized resource of `state.range(0)` bytes using the given
+// callback type to receive the body.
+template <typename Callback>
+void DownloadLargeResource(benchmark::State& state,
+                           absl::Cord (*get_body)(Callback&)) {
+  FakeDownloadHttpClient http_client(std::string(state.range(0), 'x'));
+  absl::Cord body;
+  for (auto s : state) {
+    auto request = InMemoryHttpRequest::Create(
+        "https://valid.com/plan", HttpRequest::Method::kGet, HeaderList(), "",
+        /*use_compression=*/false);
+    FCP_CHECK(request.ok());
+    std::unique_ptr<HttpRequestHandle> handle =
+        http_client.EnqueueRequest(std::move(*request));
+    Callback callback;
+    FCP_CHECK(http_client.PerformRequests({{handle.get(), &callback}}).ok());
+    body = get_body(callback);
+    benchmark::DoNotOptimize(body);
+  }
+  ReportBody(state, body);
+}
+
+static void BM_DownloadWithCordAppendingCallback(benchmark::State& state) {
+  DownloadLargeResource<CordAppendingCallback>(
+      state, [](CordAppendingCallback& callback) { return callback.body(); });
+}
+
+static void BM_DownloadWithInMemoryCallback(benchmark::State& state) {
+  DownloadLargeResource<InMemoryHttpRequestCallback>(
+      state, [](InMemoryHttpRequestCallback& callback) {
+        absl::StatusOr<InMemoryHttpResponse> response = callback.Response();
+        FCP_CHECK(response.ok());
+        return response->body;
+      });
+}
+
+// Downloads a plan-sized resource via `FetchResourcesInMemory`, i.e. the way
+// plans and checkpoints are fetched during checkin.
+static void BM_FetchResourcesInMemory(benchmark::State& state) {
+  FakeDownloadHttpClient http_client(std::string(state.range(0), 'x'));
+  ::testing::NiceMock<MockLogManager> log_manager;
+  InterruptibleRunner interruptible_runner(
+      &log_manager, []() { return false; },
+      InterruptibleRunner::TimingConfig{
+          .polling_period = absl::Milliseconds(100),
+          .graceful_shutdown_period = absl::InfiniteDuration(),
+          .extended_shutdown_period = absl::InfiniteDuration()},
+      InterruptibleRunner::DiagnosticsConfig{
+          .interrupted = ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP,
+          .interrupt_timeout =
+              ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP_TIMED_OUT,
+          .interrupted_extended = ProdDiagCode::
+              BACKGROUND_TRAINING_INTERRUPT_HTTP_EXTENDED_COMPLETED,
+          .interrupt_timeout_extended = ProdDiagCode::
+              BACKGROUND_TRAINING_INTERRUPT_HTTP_EXTENDED_TIMED_OUT});
+  absl::Cord body;
+  for (auto s : state) {
+    auto result = FetchResourcesInMemory(
+        http_client, interruptible_runner,
+        {UriOrInlineData::CreateUri("https://valid.com/plan")}, nullptr,
+        nullptr, /*client_decoded_http_resources=*/false,
+        /*max_concurrent_fetches=*/0);
+    FCP_CHECK(result.ok() && (*result)[0].ok());
+    body = (*result)[0]->body;
+    benchmark::DoNotOptimize(body);
+  }
+  ReportBody(state, body);
+}
+
+// Plan-sized payloads, from 1 MiB up to 256 MiB.
+BENCHMARK(BM_DownloadWithCordAppendingCallback)
+    ->RangeMultiplier(16)
+    ->Range(1 << 20, 1 << 28)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DownloadWithInMemoryCallback)
+    ->RangeMultiplier(16)
+    ->Range(1 << 20, 1 << 28)
+    ->Unit(benchmark::kMillisecond);
+// The fetch runs on the `InterruptibleRunner`'s thread, so measure wall time.
+BENCHMARK(BM_FetchResourcesInMemory)
+    ->RangeMultiplier(16)
+    ->Range(1 << 20, 1 << 28)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace fcp::client::http
@@ -15,7 +15,10 @@
  */
 #include "fcp/client/http/in_memory_request_response.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <utility>
@@ -28,10 +31,12 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/blocking_counter.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/http/http_client.h"
@@ -64,11 +69,6 @@ using ::testing::Return;
 using ::testing::StrEq;
 using ::testing::StrictMock;
 
-using CompressionFormat =
-    ::fcp::client::http::UriOrInlineData::InlineData::CompressionFormat;
-
-constexpr absl::string_view kOctetStream = "application/octet-stream";
-
 TEST(InMemoryHttpRequestTest, NonHttpsUriFails) {
   absl::StatusOr<std::unique_ptr<HttpRequest>> request =
       InMemoryHttpRequest::Create("http://invalid.com",
@@ -270,6 +270,56 @@ TEST(InMemoryHttpRequestTest, RequestWithCompressedBody) {
   EXPECT_EQ(*recovered_body, uncompressed_body);
 }
 
+TEST(InMemoryHttpRequestTest, RequestWithLargeCompressedBody) {
+  // Bodies this large are compressed in parallel while they're being read.
+  std::string uncompressed_body;
+  for (int i = 0; uncompressed_body.size() < 4 * 1024 * 1024; ++i) {
+    absl::StrAppend(&uncompressed_body, "request_body_", i, "_");
+  }
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kPost, {},
+                                  uncompressed_body, /*use_compression=*/true);
+  ASSERT_OK(request);
+  auto content_encoding_header =
+      FindHeader((*request)->extra_headers(), kContentEncodingHdr);
+  ASSERT_TRUE(content_encoding_header.has_value());
+  ASSERT_EQ(content_encoding_header.value(), kGzipEncodingHdrValue);
+  // The compressed length isn't known upfront, so no Content-Length header
+  // should be set (and the body should be sent in chunks instead).
+  EXPECT_FALSE(FindHeader((*request)->extra_headers(), kContentLengthHdr)
+                   .has_value());
+  EXPECT_TRUE((*request)->HasBody());
+
+  std::string actual_body;
+  absl::StatusOr<int64_t> read_result;
+  char buffer[10000];
+  while ((read_result = (*request)->ReadBody(buffer, sizeof(buffer))).ok()) {
+    ASSERT_GT(*read_result, 0);
+    actual_body.append(buffer, *read_result);
+  }
+  EXPECT_THAT(read_result, IsCode(OUT_OF_RANGE));
+  EXPECT_LT(actual_body.size(), uncompressed_body.size());
+
+  auto recovered_body = internal::UncompressWithGzip(actual_body);
+  ASSERT_OK(recovered_body);
+  EXPECT_EQ(*recovered_body, uncompressed_body);
+}
+
+TEST(InMemoryHttpRequestTest, RequestWithLargeCompressedBodyNotFullyRead) {
+  std::string uncompressed_body(8 * 1024 * 1024, 'A');
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kPost, {},
+                                  uncompressed_body, /*use_compression=*/true);
+  ASSERT_OK(request);
+  char buffer[100];
+  ASSERT_OK((*request)->ReadBody(buffer, sizeof(buffer)));
+  // Destroying the request before the body was fully read should cancel the
+  // remaining compression work.
+  request->reset();
+}
+
 TEST(InMemoryHttpRequestCallbackTest, ResponseFailsBeforeHeaders) {
   absl::StatusOr<std::unique_ptr<HttpRequest>> request =
       InMemoryHttpRequest::Create("https://valid.com",
@@ -524,6 +574,115 @@ TEST(InMemoryHttpRequestCallbackTest, OkResponseChunkedBody) {
   EXPECT_THAT(actual_response->body, StrEq("12345678"));
 }
 
+TEST(InMemoryHttpRequestCallbackTest,
+     OkResponseChunkedBodyWithoutContentLengthHasFewChunks) {
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kGet, {}, "",
+                                  /*use_compression=*/false);
+  ASSERT_OK(request);
+  auto fake_response = FakeHttpResponse(kHttpOk, {});
+
+  InMemoryHttpRequestCallback callback;
+  ASSERT_OK(callback.OnResponseStarted(**request, fake_response));
+  // Deliver 1 MiB of data in small chunks, like a typical HttpClient would.
+  std::string expected_body;
+  for (int i = 0; i < 256; ++i) {
+    std::string chunk(4096, static_cast<char>('a' + i % 26));
+    ASSERT_OK(callback.OnResponseBody(**request, fake_response, chunk));
+    expected_body += chunk;
+  }
+  callback.OnResponseCompleted(**request, fake_response);
+
+  absl::StatusOr<InMemoryHttpResponse> actual_response = callback.Response();
+  ASSERT_OK(actual_response);
+  EXPECT_EQ(actual_response->body, expected_body);
+  // The data should have been received into geometrically growing blocks,
+  // rather than into one Cord chunk per OnResponseBody call.
+  auto chunks = actual_response->body.Chunks();
+  EXPECT_LE(std::distance(chunks.begin(), chunks.end()), 8);
+}
+
+TEST(InMemoryHttpRequestCallbackTest,
+     OkResponseWrittenToBufferWithContentLengthHasFewChunks) {
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kGet, {}, "",
+                                  /*use_compression=*/false);
+  ASSERT_OK(request);
+
+  const std::string expected_body(100000, 'x');
+  auto fake_response = FakeHttpResponse(
+      kHttpOk, {{"Content-Length", std::to_string(expected_body.size())}});
+
+  InMemoryHttpRequestCallback callback;
+  ASSERT_OK(callback.OnResponseStarted(**request, fake_response));
+  // Write the data directly into the buffers provided by the callback, like
+  // an HttpClient supporting GetResponseBodyBuffer would.
+  for (int64_t offset = 0; offset < expected_body.size(); offset += 4096) {
+    int64_t size = std::min<int64_t>(4096, expected_body.size() - offset);
+    absl::Span<char> buffer =
+        callback.GetResponseBodyBuffer(**request, fake_response, size);
+    ASSERT_GE(buffer.size(), size);
+    // The buffers should never extend past the end of the body.
+    EXPECT_LE(buffer.size(), expected_body.size() - offset);
+    std::memcpy(buffer.data(), expected_body.data() + offset, size);
+    ASSERT_OK(
+        callback.OnResponseBodyBufferWritten(**request, fake_response, size));
+  }
+  callback.OnResponseCompleted(**request, fake_response);
+
+  absl::StatusOr<InMemoryHttpResponse> actual_response = callback.Response();
+  ASSERT_OK(actual_response);
+  EXPECT_EQ(actual_response->body, expected_body);
+  // The data should have been received into a few geometrically growing
+  // blocks, rather than into one Cord chunk per write.
+  auto chunks = actual_response->body.Chunks();
+  EXPECT_LE(std::distance(chunks.begin(), chunks.end()), 4);
+}
+
+TEST(InMemoryHttpRequestCallbackTest,
+     ResponseBufferIsNotSizedByLargeContentLength) {
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kGet, {}, "",
+                                  /*use_compression=*/false);
+  ASSERT_OK(request);
+  // A server claiming a 1 GiB body shouldn't make us allocate 1 GiB before
+  // receiving any data.
+  auto fake_response =
+      FakeHttpResponse(kHttpOk, {{"Content-Length", "1073741824"}});
+
+  InMemoryHttpRequestCallback callback;
+  ASSERT_OK(callback.OnResponseStarted(**request, fake_response));
+  absl::Span<char> buffer =
+      callback.GetResponseBodyBuffer(**request, fake_response, 10);
+  ASSERT_GE(buffer.size(), 10);
+  EXPECT_LE(buffer.size(), 16 * 1024);
+}
+
+TEST(InMemoryHttpRequestCallbackTest,
+     ResponseWrittenToBufferWithTooMuchDataFails) {
+  absl::StatusOr<std::unique_ptr<HttpRequest>> request =
+      InMemoryHttpRequest::Create("https://valid.com",
+                                  HttpRequest::Method::kGet, {}, "",
+                                  /*use_compression=*/false);
+  ASSERT_OK(request);
+  auto fake_response = FakeHttpResponse(kHttpOk, {{"Content-Length", "5"}});
+
+  InMemoryHttpRequestCallback callback;
+  ASSERT_OK(callback.OnResponseStarted(**request, fake_response));
+  absl::Span<char> buffer =
+      callback.GetResponseBodyBuffer(**request, fake_response, 10);
+  ASSERT_GE(buffer.size(), 10);
+  std::memcpy(buffer.data(), "0123456789", 10);
+  absl::Status result =
+      callback.OnResponseBodyBufferWritten(**request, fake_response, 10);
+  EXPECT_THAT(result, IsCode(OUT_OF_RANGE));
+  EXPECT_THAT(result.message(), HasSubstr("Too much response body data"));
+  EXPECT_THAT(callback.Response(), IsCode(OUT_OF_RANGE));
+}
+
 TEST(InMemoryHttpRequestCallbackTest,
      TestOkResponseWithEmptyBodyWithoutContentLength) {
   absl::StatusOr<std::unique_ptr<HttpRequest>> request =
@@ -920,406 +1079,5 @@ TEST_F(PerformRequestsTest, PerformTwoRequestsWithOneFailedOneSuccess) {
               Ge(success_response_body.size() + failure_response_body.size()));
 }
 
-// Tests the case where a zero-length vector of UriOrInlineData is passed in. It
-// should result in a zero-length result vector (as opposed to an error or a
-// crash).
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryEmptyInputVector) {
-  auto result = FetchResourcesInMemory(mock_http_client_, interruptible_runner_,
-                                       {}, nullptr, nullptr,
-                                       /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-  EXPECT_THAT(*result, IsEmpty());
-}
-
-// Tests the case where both fields of UriOrInlineData are empty. The empty
-// inline_data field should be returned.
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryEmptyUriAndInline) {
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_,
-      {UriOrInlineData::CreateInlineData(absl::Cord(),
-                                         CompressionFormat::kUncompressed)},
-      nullptr, nullptr,
-      /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  EXPECT_THAT(*(*result)[0],
-              FieldsAre(kHttpOk, IsEmpty(), kOctetStream, IsEmpty()));
-}
-
-// Tests the case where one of the URIs is invalid. The whole request should
-// result in an error in that case.
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryInvalidUri) {
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_,
-      {UriOrInlineData::CreateUri("https://valid.com"),
-       UriOrInlineData::CreateUri("http://invalid.com")},
-      nullptr, nullptr, /*client_decoded_http_resources=*/false);
-  EXPECT_THAT(result, IsCode(INVALID_ARGUMENT));
-  EXPECT_THAT(result.status().message(), HasSubstr("Non-HTTPS"));
-}
-
-// Tests the case where all of the requested resources must be fetched via URI.
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryAllUris) {
-  const std::string uri1 = "https://valid.com/1";
-  const std::string uri2 = "https://valid.com/2";
-  const std::string uri3 = "https://valid.com/3";
-  const std::string uri4 = "https://valid.com/4";
-  auto resource1 = UriOrInlineData::CreateUri(uri1);
-  auto resource2 = UriOrInlineData::CreateUri(uri2);
-  auto resource3 = UriOrInlineData::CreateUri(uri3);
-  auto resource4 = UriOrInlineData::CreateUri(uri4);
-
-  int expected_response_code1 = kHttpOk;
-  int expected_response_code2 = kHttpNotFound;
-  int expected_response_code3 = kHttpServiceUnavailable;
-  int expected_response_code4 = 204;  // "204 No Content"
-  std::string expected_response_body1 = "response_body1";
-  std::string expected_response_body4 = "response_body4";
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri1, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code1, {},
-                                        expected_response_body1)));
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri2, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code2, {}, "")));
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri3, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code3, {}, "")));
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri4, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code4, {},
-                                        expected_response_body4)));
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_,
-      {resource1, resource2, resource3, resource4},
-      // We pass in non-null pointers for the network
-      // stats, to ensure they are correctly updated.
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  EXPECT_THAT(*(*result)[0],
-              FieldsAre(expected_response_code1, IsEmpty(), IsEmpty(),
-                        StrEq(expected_response_body1)));
-  EXPECT_THAT((*result)[1], IsCode(NOT_FOUND));
-  EXPECT_THAT((*result)[1].status().message(), HasSubstr("404"));
-  EXPECT_THAT((*result)[2], IsCode(UNAVAILABLE));
-  EXPECT_THAT((*result)[2].status().message(), HasSubstr("503"));
-  ASSERT_OK((*result)[3]);
-  EXPECT_THAT(*(*result)[3],
-              FieldsAre(expected_response_code4, IsEmpty(), IsEmpty(),
-                        StrEq(expected_response_body4)));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(0));
-}
-
-// Tests the case where some of the requested resources have inline data
-// available.
-TEST_F(PerformRequestsTest, FetchResourcesInMemorySomeInlineData) {
-  const std::string uri1 = "https://valid.com/1";
-  const std::string uri3 = "https://valid.com/3";
-  std::string expected_response_body2 = "response_body2";
-  std::string expected_response_body4 = "response_body4";
-  auto resource1 = UriOrInlineData::CreateUri(uri1);
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body2), CompressionFormat::kUncompressed);
-  auto resource3 = UriOrInlineData::CreateUri(uri3);
-  auto resource4 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body4), CompressionFormat::kUncompressed);
-
-  int expected_response_code1 = kHttpServiceUnavailable;
-  int expected_response_code3 = 204;  // "204 No Content"
-  std::string expected_response_body3 = "response_body3";
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri1, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code1, {}, "")));
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri3, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code3, {},
-                                        expected_response_body3)));
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_,
-      {resource1, resource2, resource3, resource4}, &bytes_received,
-      &bytes_sent, /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-
-  EXPECT_THAT((*result)[0], IsCode(UNAVAILABLE));
-  EXPECT_THAT((*result)[0].status().message(), HasSubstr("503"));
-  ASSERT_OK((*result)[1]);
-  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
-                                       StrEq(expected_response_body2)));
-  ASSERT_OK((*result)[2]);
-  EXPECT_THAT(*(*result)[2],
-              FieldsAre(expected_response_code3, IsEmpty(), IsEmpty(),
-                        StrEq(expected_response_body3)));
-  ASSERT_OK((*result)[3]);
-  EXPECT_THAT(*(*result)[3], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
-                                       StrEq(expected_response_body4)));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(0));
-}
-
-// Tests the case where all of the requested resources have inline data
-// available (and hence no HTTP requests are expected to be issued).
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryOnlyInlineData) {
-  std::string expected_response_body1 = "response_body1";
-  std::string expected_response_body2 = "response_body2";
-  auto resource1 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body1), CompressionFormat::kUncompressed);
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body2), CompressionFormat::kUncompressed);
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  EXPECT_THAT(*(*result)[0], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
-                                       StrEq(expected_response_body1)));
-  ASSERT_OK((*result)[1]);
-  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
-                                       StrEq(expected_response_body2)));
-
-  // The network stats should be untouched, since no network requests were
-  // issued.
-  EXPECT_EQ(bytes_sent, 0);
-  EXPECT_EQ(bytes_received, 0);
-}
-
-// Tests the case where the fetches get interrupted.
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryCancellation) {
-  const std::string uri1 = "https://valid.com/1";
-  const std::string uri2 = "https://valid.com/2";
-  auto resource1 = UriOrInlineData::CreateUri(uri1);
-  auto resource2 = UriOrInlineData::CreateUri(uri2);
-
-  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri1, _, _, _)))
-      .WillOnce(Return(FakeHttpResponse(kHttpOk, {}, "")));
-
-  absl::Notification request_issued;
-  // We expect two calls to the cancellation listener, one for each request.
-  absl::BlockingCounter counter_should_abort(2);
-  // When the HttpClient receives a HttpRequestHandle::Cancel call, we decrement
-  // the counter.
-  mock_http_client_.SetCancellationListener(
-      [&counter_should_abort]() { counter_should_abort.DecrementCount(); });
-
-  // Make HttpClient::PerformRequests() block until the counter is decremented.
-  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri2, _, _, _)))
-      .WillOnce([&request_issued, &counter_should_abort](
-                    MockableHttpClient::SimpleHttpRequest ignored) {
-        request_issued.Notify();
-        counter_should_abort.Wait();
-        return FakeHttpResponse(503, {}, "");
-      });
-  // Make should_abort return false until we know that the 2nd request was
-  // issued (i.e. once InterruptibleRunner has actually started running the code
-  // it was given), and then make it return true, triggering an abort sequence
-  // and unblocking the PerformRequests() call we caused to block above.
-  EXPECT_CALL(mock_should_abort_, Call()).WillRepeatedly([&request_issued] {
-    return request_issued.HasBeenNotified();
-  });
-
-  EXPECT_CALL(mock_log_manager_,
-              LogDiag(ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP));
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  // The request should result in an overall CANCELLED outcome.
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false);
-  EXPECT_THAT(result, IsCode(CANCELLED));
-  EXPECT_THAT(result.status().message(),
-              HasSubstr("cancelled after graceful wait"));
-
-  // The network stats should still have been updated though (to reflect the
-  // data sent and received up until the point of interruption).
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(0));
-}
-
-TEST_F(PerformRequestsTest, FetchResourcesInMemoryCompressedResources) {
-  const std::string uri = "https://valid.com/";
-  auto resource1 = UriOrInlineData::CreateUri(uri);
-
-  int expected_response_code = kHttpOk;
-  std::string content_type = "bytes+gzip";
-  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
-  auto compressed_response_body =
-      internal::CompressWithGzip(expected_response_body);
-  ASSERT_OK(compressed_response_body);
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code,
-                                        {{kContentTypeHdr, content_type}},
-                                        *compressed_response_body)));
-
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(*compressed_response_body), CompressionFormat::kGzip);
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      // We pass in non-null pointers for the network
-      // stats, to ensure they are correctly updated.
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  EXPECT_THAT(*(*result)[0],
-              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
-                        StrEq(expected_response_body)));
-  EXPECT_THAT(*(*result)[1],
-              FieldsAre(kHttpOk, IsEmpty(), absl::StrCat(kOctetStream, "+gzip"),
-                        StrEq(expected_response_body)));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(2 * compressed_response_body->size()));
-}
-
-TEST_F(PerformRequestsTest,
-       FetchResourcesInMemoryFlagOnNotCompressedResources) {
-  const std::string uri = "https://valid.com/";
-  auto resource1 = UriOrInlineData::CreateUri(uri);
-
-  int expected_response_code = kHttpOk;
-  std::string content_type = "uncompressed-bytes-yay";
-  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code,
-                                        {{kContentTypeHdr, content_type}},
-                                        expected_response_body)));
-
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body), CompressionFormat::kUncompressed);
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      // We pass in non-null pointers for the network
-      // stats, to ensure they are correctly updated.
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  EXPECT_THAT(*(*result)[0],
-              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
-                        StrEq(expected_response_body)));
-  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
-                                       StrEq(expected_response_body)));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(2 * expected_response_body.size()));
-}
-
-TEST_F(PerformRequestsTest,
-       FetchResourcesInMemoryCompressedResourcesFlagOffDoesNotDecompress) {
-  const std::string uri = "https://valid.com/";
-  auto resource1 = UriOrInlineData::CreateUri(uri);
-
-  int expected_response_code = kHttpOk;
-  std::string content_type = "bytes+gzip";
-  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
-  auto compressed_response_body =
-      internal::CompressWithGzip(expected_response_body);
-  ASSERT_OK(compressed_response_body);
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code,
-                                        {{kContentTypeHdr, content_type}},
-                                        *compressed_response_body)));
-
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(*compressed_response_body), CompressionFormat::kGzip);
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      // We pass in non-null pointers for the network
-      // stats, to ensure they are correctly updated.
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false);
-  ASSERT_OK(result);
-
-  ASSERT_OK((*result)[0]);
-  // result body is still compressed!
-  EXPECT_THAT(*(*result)[0],
-              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
-                        StrEq(*compressed_response_body)));
-  EXPECT_THAT(*(*result)[1],
-              FieldsAre(kHttpOk, IsEmpty(), absl::StrCat(kOctetStream, "+gzip"),
-                        StrEq(*compressed_response_body)));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(2 * compressed_response_body->size()));
-}
-
-TEST_F(PerformRequestsTest,
-       FetchResourcesInMemoryCompressedResourcesFailToDecode) {
-  const std::string uri = "https://valid.com/";
-  auto resource1 = UriOrInlineData::CreateUri(uri);
-
-  int expected_response_code = kHttpOk;
-  std::string content_type = "not-actually-gzipped+gzip";
-  std::string expected_response_body = "I am not a valid gzipped body ლ(ಠ益ಠლ)";
-  EXPECT_CALL(mock_http_client_,
-              PerformSingleRequest(
-                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
-      .WillOnce(Return(FakeHttpResponse(expected_response_code,
-                                        {{kContentTypeHdr, content_type}},
-                                        expected_response_body)));
-
-  auto resource2 = UriOrInlineData::CreateInlineData(
-      absl::Cord(expected_response_body), CompressionFormat::kGzip);
-
-  int64_t bytes_received = 0;
-  int64_t bytes_sent = 0;
-  auto result = FetchResourcesInMemory(
-      mock_http_client_, interruptible_runner_, {resource1, resource2},
-      // We pass in non-null pointers for the network
-      // stats, to ensure they are correctly updated.
-      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true);
-  // Fetching will succeed
-  ASSERT_OK(result);
-
-  // ...but our responses will have failed to decode.
-  EXPECT_THAT((*result)[0], IsCode(INTERNAL));
-  EXPECT_THAT((*result)[1], IsCode(INTERNAL));
-
-  EXPECT_THAT(bytes_sent, Ne(bytes_received));
-  EXPECT_THAT(bytes_sent, Ge(0));
-  EXPECT_THAT(bytes_received, Ge(2 * expected_response_body.size()));
-}
-
 }  // namespace
 }  // namespace fcp::client::http
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/http/parallel_gzip_compressor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/base/scheduler.h"
+#include "zlib.h"
+
+namespace fcp {
+namespace client {
+namespace http {
+namespace {
+
+// The maximum distance deflate can refer back to, and hence the amount of
+// preceding input that is useful as a block's dictionary.
+constexpr int64_t kDeflateWindowSize = 32 * 1024;
+
+// A minimal gzip member header: deflate compression, no flags, no
+// modification time, no extra flags, and an unknown OS.
+constexpr char kGzipHeader[] = {'\x1f', '\x8b', '\x08', '\x00', '\x00',
+                                '\x00', '\x00', '\x00', '\x00', '\xff'};
+
+void AppendLittleEndian32(uint32_t value, std::string& out) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+}  // namespace
+
+ParallelGzipCompressor::State::State(absl::string_view input,
+                                     int64_t block_size, int64_t num_blocks,
+                                     int max_blocks_in_flight)
+    : input(input),
+      block_size(block_size),
+      num_blocks(num_blocks),
+      max_blocks_in_flight(max_blocks_in_flight) {}
+
+ParallelGzipCompressor::ParallelGzipCompressor(absl::string_view input,
+                                               Scheduler& scheduler,
+                                               int64_t block_size,
+                                               int max_blocks_in_flight)
+    : scheduler_(scheduler),
+      state_(std::make_shared<State>(
+          input, block_size,
+          // An empty input still results in a single (empty) final block.
+          std::max<int64_t>(
+              1, (static_cast<int64_t>(input.size()) + block_size - 1) /
+                     block_size),
+          max_blocks_in_flight)) {
+  FCP_CHECK(block_size > 0 &&
+            block_size <= std::numeric_limits<uInt>::max() / 2);
+  FCP_CHECK(max_blocks_in_flight > 0);
+  absl::MutexLock lock(&state_->mutex);
+  state_->blocks.resize(state_->num_blocks);
+  MaybeScheduleBlocks();
+}
+
+ParallelGzipCompressor::~ParallelGzipCompressor() {
+  State& state = *state_;
+  absl::MutexLock lock(&state.mutex);
+  state.cancelled = true;
+  // Tasks that haven't started yet will see the cancellation and return
+  // without touching the input, but those that are compressing a block have
+  // to finish before the input may go away.
+  auto not_compressing = [&state]() -> bool {
+    state.mutex.AssertHeld();
+    return state.compressing_tasks == 0;
+  };
+  state.mutex.Await(absl::Condition(&not_compressing));
+}
+
+void ParallelGzipCompressor::MaybeScheduleBlocks() {
+  State& state = *state_;
+  while (state.next_block_to_schedule < state.num_blocks &&
+         state.next_block_to_schedule - state.next_block_to_read <
+             state.max_blocks_in_flight) {
+    int64_t index = state.next_block_to_schedule++;
+    scheduler_.Schedule([state = state_, index]() {
+      {
+        absl::MutexLock lock(&state->mutex);
+        if (state->cancelled || !state->status.ok()) {
+          return;
+        }
+        state->compressing_tasks++;
+      }
+      CompressBlock(*state, index);
+    });
+  }
+}
+
+void ParallelGzipCompressor::CompressBlock(State& state, int64_t index) {
+  const absl::string_view input = state.input;
+  const int64_t block_size = state.block_size;
+  const int64_t offset = index * block_size;
+  const absl::string_view data = input.substr(offset, block_size);
+  const bool is_last_block = index == state.num_blocks - 1;
+
+  absl::Status status;
+  std::string compressed_data;
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  // Negative window bits produce a raw deflate stream, without a zlib or gzip
+  // wrapper, so that the blocks can simply be concatenated.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                   /*memLevel=*/8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    status = absl::InternalError("Failed to initialize deflate stream");
+  } else {
+    if (offset > 0) {
+      const int64_t dictionary_size = std::min(offset, kDeflateWindowSize);
+      deflateSetDictionary(
+          &stream,
+          reinterpret_cast<const Bytef*>(input.data() + offset -
+                                         dictionary_size),
+          static_cast<uInt>(dictionary_size));
+    }
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    // All blocks but the last one are ended with a sync flush, which aligns
+    // them to a byte boundary without marking them as the final block.
+    const int flush = is_last_block ? Z_FINISH : Z_SYNC_FLUSH;
+    // deflateBound doesn't account for the marker a sync flush emits.
+    compressed_data.resize(deflateBound(&stream, stream.avail_in) + 16);
+    int64_t produced = 0;
+    for (;;) {
+      stream.next_out = reinterpret_cast<Bytef*>(&compressed_data[produced]);
+      stream.avail_out = static_cast<uInt>(compressed_data.size() - produced);
+      int result = deflate(&stream, flush);
+      produced = compressed_data.size() - stream.avail_out;
+      if (result == Z_STREAM_ERROR) {
+        status = absl::InternalError(absl::StrCat(
+            "An error has occurred during compression: ",
+            stream.msg != nullptr ? stream.msg : "unknown error"));
+        break;
+      }
+      bool finished = is_last_block ? result == Z_STREAM_END
+                                    : stream.avail_in == 0 &&
+                                          stream.avail_out != 0;
+      if (finished) break;
+      compressed_data.resize(compressed_data.size() * 2);
+    }
+    compressed_data.resize(produced);
+    deflateEnd(&stream);
+  }
+
+  // This task still counts as compressing until it takes the lock below, so
+  // `input` is still alive at this point.
+  const uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(data.data()),
+                             static_cast<uInt>(data.size()));
+  absl::MutexLock lock(&state.mutex);
+  state.compressing_tasks--;
+  if (!status.ok()) {
+    if (state.status.ok()) state.status = status;
+    return;
+  }
+  Block& block = state.blocks[index];
+  block.compressed_data = std::move(compressed_data);
+  block.crc = crc;
+  block.done = true;
+}
+
+absl::StatusOr<bool> ParallelGzipCompressor::AdvanceOutput() {
+  current_output_.clear();
+  current_output_offset_ = 0;
+  if (!header_written_) {
+    header_written_ = true;
+    current_output_.assign(kGzipHeader, sizeof(kGzipHeader));
+    return true;
+  }
+  State& state = *state_;
+  if (state.next_block_to_read < state.num_blocks) {
+    const int64_t index = state.next_block_to_read;
+    auto block_done_or_failed = [&state, index]() -> bool {
+      state.mutex.AssertHeld();
+      return state.blocks[index].done || !state.status.ok();
+    };
+    state.mutex.Await(absl::Condition(&block_done_or_failed));
+    FCP_RETURN_IF_ERROR(state.status);
+    Block& block = state.blocks[index];
+    const int64_t uncompressed_size =
+        std::min(state.block_size, static_cast<int64_t>(state.input.size()) -
+                                       index * state.block_size);
+    crc_ = crc32_combine(crc_, block.crc, uncompressed_size);
+    current_output_ = std::move(block.compressed_data);
+    block.compressed_data = std::string();
+    state.next_block_to_read++;
+    MaybeScheduleBlocks();
+    return true;
+  }
+  if (!trailer_written_) {
+    trailer_written_ = true;
+    AppendLittleEndian32(crc_, current_output_);
+    // The gzip trailer records the uncompressed size modulo 2^32.
+    AppendLittleEndian32(static_cast<uint32_t>(state.input.size()),
+                         current_output_);
+    return true;
+  }
+  return false;
+}
+
+absl::StatusOr<int64_t> ParallelGzipCompressor::Read(char* buffer,
+                                                     int64_t requested) {
+  absl::MutexLock lock(&state_->mutex);
+  while (current_output_offset_ ==
+         static_cast<int64_t>(current_output_.size())) {
+    FCP_ASSIGN_OR_RETURN(bool has_more_output, AdvanceOutput());
+    if (!has_more_output) {
+      return absl::OutOfRangeError("End of stream reached");
+    }
+  }
+  FCP_CHECK(buffer != nullptr);
+  FCP_CHECK(requested > 0);
+  int64_t actual_read =
+      std::min(requested, static_cast<int64_t>(current_output_.size()) -
+                              current_output_offset_);
+  std::memcpy(buffer, current_output_.data() + current_output_offset_,
+              actual_read);
+  current_output_offset_ += actual_read;
+  return actual_read;
+}
+
+}  // namespace http
+}  // namespace client
+}  // namespace fcp
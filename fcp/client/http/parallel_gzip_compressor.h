@@ -0,0 +1,130 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_HTTP_PARALLEL_GZIP_COMPRESSOR_H_
+#define FCP_CLIENT_HTTP_PARALLEL_GZIP_COMPRESSOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "fcp/base/scheduler.h"
+
+namespace fcp {
+namespace client {
+namespace http {
+
+// Compresses a buffer into a single gzip stream, by splitting it into blocks
+// which are deflated independently and concurrently on a `Scheduler`, and
+// which are then concatenated (in the same manner as pigz does). Each block
+// uses the 32 KiB of input preceding it as its deflate dictionary, so the
+// compression ratio is close to that of a single-threaded compressor.
+//
+// The compressed stream is consumed via `Read`, which returns the compressed
+// data of each block as soon as that block (and all blocks before it) are
+// done, so that consuming the output (e.g. transmitting it over the network)
+// overlaps with compressing the remaining blocks. At most
+// `max_blocks_in_flight` blocks are compressed or buffered ahead of the reader
+// at any given time, which bounds the amount of memory used for the output.
+//
+// This class is thread-safe, but `Read` is meant to be called from a single
+// thread at a time.
+class ParallelGzipCompressor {
+ public:
+  static constexpr int64_t kDefaultBlockSize = 128 * 1024;
+
+  // The `input` must outlive this object, as must the `scheduler`.
+  ParallelGzipCompressor(absl::string_view input, Scheduler& scheduler,
+                         int64_t block_size, int max_blocks_in_flight);
+  // Cancels any blocks that haven't started compressing yet, and waits for
+  // those that are currently being compressed to finish. Tasks that are still
+  // queued on the scheduler only access state they share ownership of, so
+  // the scheduler doesn't have to be idle when this object is destroyed.
+  ~ParallelGzipCompressor();
+
+  ParallelGzipCompressor(const ParallelGzipCompressor&) = delete;
+  ParallelGzipCompressor& operator=(const ParallelGzipCompressor&) = delete;
+
+  // Reads up to `requested` bytes of compressed data into `buffer`, blocking
+  // until at least one byte is available. Returns the number of bytes read,
+  // `OUT_OF_RANGE` once the end of the gzip stream has been reached, or
+  // `INTERNAL` if compressing a block failed.
+  absl::StatusOr<int64_t> Read(char* buffer, int64_t requested);
+
+ private:
+  struct Block {
+    bool done = false;
+    std::string compressed_data;
+    uint32_t crc = 0;
+  };
+
+  // The state shared between this object and the tasks it schedules. Each
+  // task holds a reference to it, so that a task which is still running (e.g.
+  // still releasing `mutex`) never touches memory that has been freed.
+  struct State {
+    State(absl::string_view input, int64_t block_size, int64_t num_blocks,
+          int max_blocks_in_flight);
+
+    const absl::string_view input;
+    const int64_t block_size;
+    const int64_t num_blocks;
+    const int max_blocks_in_flight;
+
+    absl::Mutex mutex;
+    absl::Status status ABSL_GUARDED_BY(mutex);
+    bool cancelled ABSL_GUARDED_BY(mutex) = false;
+    // The number of tasks which are currently compressing a block (and hence
+    // reading `input`).
+    int compressing_tasks ABSL_GUARDED_BY(mutex) = 0;
+    std::vector<Block> blocks ABSL_GUARDED_BY(mutex);
+    int64_t next_block_to_schedule ABSL_GUARDED_BY(mutex) = 0;
+    // The index of the next block to hand to the reader. The header is
+    // returned before block 0, and the trailer after block `num_blocks - 1`.
+    int64_t next_block_to_read ABSL_GUARDED_BY(mutex) = 0;
+  };
+
+  // Schedules the compression of the next block, if there are any left and
+  // fewer than `max_blocks_in_flight` blocks are ahead of the reader.
+  void MaybeScheduleBlocks() ABSL_EXCLUSIVE_LOCKS_REQUIRED(state_->mutex);
+  // Compresses the block at the given index and stores the result.
+  static void CompressBlock(State& state, int64_t index);
+  // Fills `current_output_` with the next piece of the gzip stream (the
+  // header, a compressed block, or the trailer), waiting for the next block to
+  // be compressed if necessary. Returns false once the stream has ended.
+  absl::StatusOr<bool> AdvanceOutput()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(state_->mutex);
+
+  Scheduler& scheduler_;
+  const std::shared_ptr<State> state_;
+
+  bool header_written_ ABSL_GUARDED_BY(state_->mutex) = false;
+  bool trailer_written_ ABSL_GUARDED_BY(state_->mutex) = false;
+  // The CRC-32 of the uncompressed data of all blocks read so far.
+  uint32_t crc_ ABSL_GUARDED_BY(state_->mutex) = 0;
+  std::string current_output_ ABSL_GUARDED_BY(state_->mutex);
+  int64_t current_output_offset_ ABSL_GUARDED_BY(state_->mutex) = 0;
+};
+
+}  // namespace http
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_HTTP_PARALLEL_GZIP_COMPRESSOR_H_
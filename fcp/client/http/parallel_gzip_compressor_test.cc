@@ -0,0 +1,158 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/http/parallel_gzip_compressor.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
+#include "fcp/base/scheduler.h"
+#include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp::client::http {
+namespace {
+
+// Reads all of the compressor's output, `read_size` bytes at a time.
+std::string ReadAll(ParallelGzipCompressor& compressor, int64_t read_size) {
+  std::string result;
+  std::string buffer(read_size, '\0');
+  absl::StatusOr<int64_t> read_result;
+  while ((read_result = compressor.Read(buffer.data(), read_size)).ok()) {
+    EXPECT_GT(*read_result, 0);
+    result.append(buffer.data(), *read_result);
+  }
+  EXPECT_THAT(read_result, IsCode(OUT_OF_RANGE));
+  return result;
+}
+
+std::string CreateCompressibleData(int64_t size) {
+  std::string data;
+  for (int i = 0; data.size() < size; ++i) {
+    absl::StrAppend(&data, "some_data_", i % 1000, "_");
+  }
+  data.resize(size);
+  return data;
+}
+
+class ParallelGzipCompressorTest : public testing::Test {
+ protected:
+  void TearDown() override { scheduler_->WaitUntilIdle(); }
+
+  // Compresses the data in parallel, and checks that the result is a valid
+  // gzip stream which decompresses to the original data.
+  void CompressAndCheckRoundTrip(const std::string& data, int64_t block_size,
+                                 int max_blocks_in_flight, int64_t read_size) {
+    ParallelGzipCompressor compressor(data, *scheduler_, block_size,
+                                      max_blocks_in_flight);
+    std::string compressed = ReadAll(compressor, read_size);
+    absl::StatusOr<absl::Cord> uncompressed =
+        internal::UncompressWithGzip(compressed);
+    ASSERT_OK(uncompressed);
+    EXPECT_EQ(*uncompressed, data);
+  }
+
+  std::unique_ptr<Scheduler> scheduler_ = CreateThreadPoolScheduler(4);
+};
+
+TEST_F(ParallelGzipCompressorTest, EmptyInput) {
+  CompressAndCheckRoundTrip("", /*block_size=*/1024,
+                            /*max_blocks_in_flight=*/4, /*read_size=*/100);
+}
+
+TEST_F(ParallelGzipCompressorTest, InputSmallerThanOneBlock) {
+  CompressAndCheckRoundTrip(CreateCompressibleData(500), /*block_size=*/1024,
+                            /*max_blocks_in_flight=*/4, /*read_size=*/100);
+}
+
+TEST_F(ParallelGzipCompressorTest, InputOfExactlyOneBlock) {
+  CompressAndCheckRoundTrip(CreateCompressibleData(1024), /*block_size=*/1024,
+                            /*max_blocks_in_flight=*/4, /*read_size=*/100);
+}
+
+TEST_F(ParallelGzipCompressorTest, ManyBlocks) {
+  CompressAndCheckRoundTrip(CreateCompressibleData(1000 * 1000 + 7),
+                            /*block_size=*/4096, /*max_blocks_in_flight=*/8,
+                            /*read_size=*/64 * 1024);
+}
+
+TEST_F(ParallelGzipCompressorTest, ManyBlocksWithSingleBlockInFlight) {
+  CompressAndCheckRoundTrip(CreateCompressibleData(100 * 1000),
+                            /*block_size=*/1000, /*max_blocks_in_flight=*/1,
+                            /*read_size=*/1);
+}
+
+TEST_F(ParallelGzipCompressorTest, IncompressibleData) {
+  std::string data;
+  uint32_t state = 12345;
+  for (int i = 0; i < 300 * 1000; ++i) {
+    state = state * 1103515245 + 12345;
+    data.push_back(static_cast<char>(state >> 24));
+  }
+  CompressAndCheckRoundTrip(data, /*block_size=*/16 * 1024,
+                            /*max_blocks_in_flight=*/4,
+                            /*read_size=*/10000);
+}
+
+TEST_F(ParallelGzipCompressorTest, CompressionRatioCloseToSerialCompression) {
+  std::string data = CreateCompressibleData(4 * 1024 * 1024);
+  ParallelGzipCompressor compressor(
+      data, *scheduler_, ParallelGzipCompressor::kDefaultBlockSize,
+      /*max_blocks_in_flight=*/8);
+  std::string parallel_compressed = ReadAll(compressor, 64 * 1024);
+  absl::StatusOr<std::string> serial_compressed =
+      internal::CompressWithGzip(data);
+  ASSERT_OK(serial_compressed);
+  // Since each block is primed with the preceding data as its dictionary, the
+  // output should be at most a few percent larger.
+  EXPECT_LT(parallel_compressed.size(), serial_compressed->size() * 1.05);
+}
+
+TEST_F(ParallelGzipCompressorTest, DestroyBeforeFullyRead) {
+  std::string data = CreateCompressibleData(1024 * 1024);
+  auto compressor = std::make_unique<ParallelGzipCompressor>(
+      data, *scheduler_, /*block_size=*/1024, /*max_blocks_in_flight=*/16);
+  char buffer[10];
+  ASSERT_OK(compressor->Read(buffer, sizeof(buffer)));
+  compressor.reset();
+}
+
+TEST_F(ParallelGzipCompressorTest, DestroyWhileTasksAreStillQueued) {
+  // Keep the scheduler's only thread busy, so that all of the compressor's
+  // tasks are still queued when it is destroyed.
+  std::unique_ptr<Scheduler> scheduler = CreateThreadPoolScheduler(1);
+  absl::Notification compressor_destroyed;
+  scheduler->Schedule([&compressor_destroyed]() {
+    compressor_destroyed.WaitForNotification();
+  });
+  {
+    std::string data = CreateCompressibleData(64 * 1024);
+    ParallelGzipCompressor compressor(data, *scheduler, /*block_size=*/1024,
+                                      /*max_blocks_in_flight=*/16);
+  }
+  compressor_destroyed.Notify();
+  // The queued tasks should now run without touching the destroyed compressor
+  // or its input.
+  scheduler->WaitUntilIdle();
+}
+
+}  // namespace
+}  // namespace fcp::client::http
@@ -0,0 +1,565 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/http/resource_fetcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/http/http_client.h"
+#include "fcp/client/http/http_client_util.h"
+#include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/interruptible_runner.h"
+
+namespace fcp {
+namespace client {
+namespace http {
+namespace {
+
+using CompressionFormat =
+    ::fcp::client::http::UriOrInlineData::InlineData::CompressionFormat;
+
+constexpr absl::string_view kClientDecodedGzipSuffix = "+gzip";
+constexpr absl::string_view kInlineDataContentType = "application/octet-stream";
+
+// A `ResourceSink` which decompresses gzip data as it arrives, and forwards the
+// decompressed data to another sink.
+class GzipDecodingSink : public ResourceSink {
+ public:
+  explicit GzipDecodingSink(ResourceSink& sink) : sink_(sink) {}
+
+  absl::Status OnResourceStarted(int code,
+                                 absl::string_view content_type) override {
+    return sink_.OnResourceStarted(code, content_type);
+  }
+
+  absl::Status OnResourceData(absl::string_view data) override {
+    return decoder_.Decode(data, [this](absl::string_view decoded_data) {
+      return sink_.OnResourceData(decoded_data);
+    });
+  }
+
+  absl::Status OnResourceCompleted() override {
+    FCP_RETURN_IF_ERROR(decoder_.Finish());
+    return sink_.OnResourceCompleted();
+  }
+
+ private:
+  ResourceSink& sink_;
+  internal::GzipDecoder decoder_;
+};
+
+// A `ResourceSink` which gathers a resource's data in an
+// `InMemoryHttpResponse`. The data is gathered via an
+// `internal::BlockCordBuilder`, which the `HttpClient` can write into directly.
+class InMemoryResourceSink : public ResourceSink {
+ public:
+  absl::Status OnResourceStarted(int code,
+                                 absl::string_view content_type) override {
+    response_.code = code;
+    response_.content_type = std::string(content_type);
+    return absl::OkStatus();
+  }
+
+  absl::Status OnResourceData(absl::string_view data) override {
+    body_.Append(data, /*expected_size=*/std::nullopt);
+    return absl::OkStatus();
+  }
+
+  absl::Span<char> GetResourceBuffer(int64_t min_size) override {
+    return body_.GetBuffer(min_size, /*expected_size=*/std::nullopt);
+  }
+
+  absl::Status OnResourceBufferWritten(int64_t size) override {
+    return body_.CommitBuffer(size);
+  }
+
+  absl::Status OnResourceCompleted() override {
+    response_.body = body_.Build();
+    return absl::OkStatus();
+  }
+
+  InMemoryHttpResponse TakeResponse() { return std::move(response_); }
+
+ private:
+  InMemoryHttpResponse response_{};
+  internal::BlockCordBuilder body_;
+};
+
+// An `HttpRequestCallback` which streams the response body of a fetched
+// resource into a `ResourceSink`.
+class ResourceFetchCallback : public HttpRequestCallback {
+ public:
+  ResourceFetchCallback(ResourceSink& sink, bool client_decoded_http_resources)
+      : sink_(sink),
+        client_decoded_http_resources_(client_decoded_http_resources) {}
+
+  absl::Status OnResponseStarted(const HttpRequest& request,
+                                 const HttpResponse& response) override {
+    absl::MutexLock _(&mutex_);
+    absl::StatusOr<ResponseBodyHeaders> body_headers =
+        ParseResponseBodyHeaders(request, response);
+    if (!body_headers.ok()) {
+      return Fail(body_headers.status());
+    }
+    expected_content_length_ = body_headers->content_length;
+    http_status_ = ConvertHttpCodeToStatus(response.code());
+    if (!http_status_.ok()) {
+      // The body of an unsuccessful response isn't the resource's data, so we
+      // don't hand it to the sink (but we still receive it, so that the
+      // connection can be reused).
+      return absl::OkStatus();
+    }
+    if (client_decoded_http_resources_ &&
+        absl::EndsWithIgnoreCase(body_headers->content_type,
+                                 kClientDecodedGzipSuffix)) {
+      decoding_sink_ = std::make_unique<GzipDecodingSink>(sink_);
+    }
+    absl::Status sink_status =
+        Sink().OnResourceStarted(response.code(), body_headers->content_type);
+    if (!sink_status.ok()) {
+      return Fail(sink_status);
+    }
+    return absl::OkStatus();
+  }
+
+  void OnResponseError(const HttpRequest& request,
+                       const absl::Status& error) override {
+    absl::MutexLock _(&mutex_);
+    if (failed_in_callback_) {
+      return;
+    }
+    status_ = absl::Status(
+        error.code(), absl::StrCat("Error receiving response headers (error: ",
+                                   error.message(), ")"));
+  }
+
+  absl::Status OnResponseBody(const HttpRequest& request,
+                              const HttpResponse& response,
+                              absl::string_view data) override {
+    absl::MutexLock _(&mutex_);
+    FCP_RETURN_IF_ERROR(CheckReceivedBodySize(data.size()));
+    received_body_size_ += data.size();
+    if (!http_status_.ok() || data.empty()) {
+      return absl::OkStatus();
+    }
+    absl::Status sink_status = Sink().OnResourceData(data);
+    if (!sink_status.ok()) {
+      return Fail(sink_status);
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Span<char> GetResponseBodyBuffer(const HttpRequest& request,
+                                         const HttpResponse& response,
+                                         int64_t min_size) override {
+    absl::MutexLock _(&mutex_);
+    // Data that needs to be decoded first (or that isn't handed to the sink at
+    // all) can't be written into the sink's memory directly.
+    if (min_size <= 0 || !http_status_.ok() || decoding_sink_ != nullptr) {
+      return {};
+    }
+    return sink_.GetResourceBuffer(min_size);
+  }
+
+  absl::Status OnResponseBodyBufferWritten(const HttpRequest& request,
+                                           const HttpResponse& response,
+                                           int64_t size) override {
+    absl::MutexLock _(&mutex_);
+    FCP_RETURN_IF_ERROR(CheckReceivedBodySize(size));
+    received_body_size_ += size;
+    absl::Status sink_status = sink_.OnResourceBufferWritten(size);
+    if (!sink_status.ok()) {
+      return Fail(sink_status);
+    }
+    return absl::OkStatus();
+  }
+
+  void OnResponseBodyError(const HttpRequest& request,
+                           const HttpResponse& response,
+                           const absl::Status& error) override {
+    absl::MutexLock _(&mutex_);
+    if (failed_in_callback_) {
+      return;
+    }
+    status_ = absl::Status(
+        error.code(),
+        absl::StrCat("Error receiving response body (response code: ",
+                     response.code(), ", error: ", error.message(), ")"));
+  }
+
+  void OnResponseCompleted(const HttpRequest& request,
+                           const HttpResponse& response) override {
+    absl::MutexLock _(&mutex_);
+    if (failed_in_callback_) {
+      return;
+    }
+    // Note: the case when too *much* response data is unexpectedly received is
+    // handled in OnResponseBody (while this handles the case of too little
+    // data).
+    if (expected_content_length_.has_value() &&
+        received_body_size_ != *expected_content_length_) {
+      status_ = absl::InvalidArgumentError(absl::StrCat(
+          "Too little response body data received (rcvd: ", received_body_size_,
+          ", expected: ", *expected_content_length_, ")"));
+      return;
+    }
+    if (!http_status_.ok()) {
+      status_ = http_status_;
+      return;
+    }
+    status_ = Sink().OnResourceCompleted();
+  }
+
+  // Returns the result of fetching the resource.
+  absl::Status Result() const {
+    absl::MutexLock _(&mutex_);
+    return status_;
+  }
+
+  // Returns true if the fetch failed because one of this callback's methods
+  // returned an error (e.g. because the resource's data couldn't be decoded),
+  // as opposed to the `HttpClient` failing to perform the request.
+  bool failed_in_callback() const {
+    absl::MutexLock _(&mutex_);
+    return failed_in_callback_;
+  }
+
+ private:
+  ResourceSink& Sink() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return decoding_sink_ != nullptr ? *decoding_sink_ : sink_;
+  }
+
+  // Fails the fetch if receiving another `size` bytes of response body data
+  // would exceed the expected content length, if any.
+  absl::Status CheckReceivedBodySize(int64_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (expected_content_length_.has_value() &&
+        received_body_size_ + size > *expected_content_length_) {
+      return Fail(absl::OutOfRangeError(absl::StrCat(
+          "Too much response body data received (rcvd: ", received_body_size_,
+          ", new: ", size, ", max: ", *expected_content_length_, ")")));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Fail(absl::Status error) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    failed_in_callback_ = true;
+    status_ = std::move(error);
+    return status_;
+  }
+
+  ResourceSink& sink_;
+  const bool client_decoded_http_resources_;
+  mutable absl::Mutex mutex_;
+  std::unique_ptr<GzipDecodingSink> decoding_sink_ ABSL_GUARDED_BY(mutex_);
+  absl::Status status_ ABSL_GUARDED_BY(mutex_) =
+      absl::UnavailableError("No response received");
+  absl::Status http_status_ ABSL_GUARDED_BY(mutex_);
+  bool failed_in_callback_ ABSL_GUARDED_BY(mutex_) = false;
+  std::optional<int64_t> expected_content_length_ ABSL_GUARDED_BY(mutex_);
+  int64_t received_body_size_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// A resource which needs to be fetched via HTTP.
+struct PendingFetch {
+  std::unique_ptr<HttpRequestHandle> handle;
+  std::unique_ptr<ResourceFetchCallback> callback;
+};
+
+std::string GetInlineDataContentType(CompressionFormat compression_format) {
+  std::string content_type(kInlineDataContentType);
+  switch (compression_format) {
+    case CompressionFormat::kUncompressed:
+      break;
+    case CompressionFormat::kGzip:
+      absl::StrAppend(&content_type, kClientDecodedGzipSuffix);
+      break;
+  }
+  return content_type;
+}
+
+// Hands a resource's inline data to its sink, as if the data had been fetched
+// via a successful HTTP request.
+absl::Status DeliverInlineData(const UriOrInlineData::InlineData& inline_data,
+                               ResourceSink& sink,
+                               bool client_decoded_http_resources) {
+  std::unique_ptr<GzipDecodingSink> decoding_sink;
+  if (client_decoded_http_resources &&
+      inline_data.compression_format == CompressionFormat::kGzip) {
+    decoding_sink = std::make_unique<GzipDecodingSink>(sink);
+  }
+  ResourceSink& target = decoding_sink != nullptr ? *decoding_sink : sink;
+  FCP_RETURN_IF_ERROR(target.OnResourceStarted(
+      kHttpOk, GetInlineDataContentType(inline_data.compression_format)));
+  for (absl::string_view chunk : inline_data.data.Chunks()) {
+    FCP_RETURN_IF_ERROR(target.OnResourceData(chunk));
+  }
+  return target.OnResourceCompleted();
+}
+
+// Performs the given fetches concurrently, in an interruptible way.
+//
+// The requests are handed to `HttpClient::PerformRequests` in batches of at
+// most `max_concurrent_fetches` requests (or all at once, if that is not
+// positive), which lets the `HttpClient` implementation decide how to schedule
+// the requests within a batch (e.g. by multiplexing them over a single HTTP/2
+// connection), while bounding the number of responses that are being received
+// at the same time.
+absl::Status PerformFetches(HttpClient& http_client,
+                            InterruptibleRunner& interruptible_runner,
+                            std::vector<PendingFetch>& fetches,
+                            int max_concurrent_fetches) {
+  size_t batch_size = fetches.size();
+  if (max_concurrent_fetches > 0) {
+    batch_size =
+        std::min(batch_size, static_cast<size_t>(max_concurrent_fetches));
+  }
+
+  absl::Mutex mutex;
+  bool aborted = false;
+  return interruptible_runner.Run(
+      [&http_client, &fetches, batch_size, &mutex, &aborted]() -> absl::Status {
+        for (size_t start = 0; start < fetches.size(); start += batch_size) {
+          const size_t end = std::min(fetches.size(), start + batch_size);
+          std::vector<std::pair<HttpRequestHandle*, HttpRequestCallback*>>
+              requests;
+          requests.reserve(end - start);
+          for (size_t i = start; i < end; ++i) {
+            requests.push_back(
+                {fetches[i].handle.get(), fetches[i].callback.get()});
+          }
+          {
+            absl::MutexLock lock(&mutex);
+            if (aborted) {
+              return absl::CancelledError("Resource fetch was aborted");
+            }
+          }
+          absl::Status result = http_client.PerformRequests(requests);
+          absl::MutexLock lock(&mutex);
+          // An abort may have cancelled the handles right before they were
+          // passed to `PerformRequests`, in which case the call fails because
+          // of the cancellation rather than because of a problem with the
+          // requests.
+          if (aborted) {
+            return absl::CancelledError("Resource fetch was aborted");
+          }
+          if (result.ok()) {
+            continue;
+          }
+          // An error caused by one of our callbacks (e.g. because a sink
+          // failed) only fails the corresponding resource, and is reported via
+          // that resource's result instead. Any resources in the batch the
+          // `HttpClient` didn't get to as a result are reported as not having
+          // received a response.
+          bool failed_in_callback = false;
+          for (size_t i = start; i < end; ++i) {
+            failed_in_callback |= fetches[i].callback->failed_in_callback();
+          }
+          if (!failed_in_callback) {
+            return result;
+          }
+        }
+        return absl::OkStatus();
+      },
+      [&fetches, &mutex, &aborted] {
+        // If we get aborted then call HttpRequestHandle::Cancel on all handles.
+        // This should result in the ongoing PerformRequests call returning
+        // early (and no further ones being issued), and
+        // InterruptibleRunner::Run returning CANCELLED.
+        {
+          absl::MutexLock lock(&mutex);
+          aborted = true;
+        }
+        for (PendingFetch& fetch : fetches) {
+          fetch.handle->Cancel();
+        }
+      });
+}
+
+}  // namespace
+
+absl::Status FileResourceSink::OnResourceStarted(
+    int code, absl::string_view content_type) {
+  file_.open(path_, std::ios::binary | std::ios::trunc);
+  if (!file_.is_open()) {
+    return absl::InternalError(
+        absl::StrCat("Failed to open file for writing: ", path_));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileResourceSink::OnResourceData(absl::string_view data) {
+  if (!file_.write(data.data(), data.size())) {
+    return absl::InternalError(
+        absl::StrCat("Failed to write to file: ", path_));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileResourceSink::OnResourceCompleted() {
+  file_.close();
+  if (file_.fail()) {
+    return absl::InternalError(
+        absl::StrCat("Failed to write to file: ", path_));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<absl::Status>> FetchResources(
+    HttpClient& http_client, InterruptibleRunner& interruptible_runner,
+    const std::vector<UriOrInlineData>& resources,
+    const std::vector<ResourceSink*>& sinks, int64_t* bytes_received_acc,
+    int64_t* bytes_sent_acc, bool client_decoded_http_resources,
+    int max_concurrent_fetches) {
+  FCP_CHECK(resources.size() == sinks.size());
+  std::vector<absl::Status> results(resources.size());
+
+  // Create the requests for those resources that need to be fetched first, so
+  // that we fail early (without touching any sinks) if any URI is invalid.
+  std::vector<PendingFetch> fetches;
+  std::vector<size_t> fetched_resource_indices;
+  for (size_t i = 0; i < resources.size(); ++i) {
+    if (resources[i].uri().empty()) {
+      continue;
+    }
+    FCP_ASSIGN_OR_RETURN(
+        std::unique_ptr<HttpRequest> request,
+        InMemoryHttpRequest::Create(resources[i].uri(),
+                                    HttpRequest::Method::kGet, {}, "",
+                                    /*use_compression=*/false));
+    fetches.push_back(
+        {http_client.EnqueueRequest(std::move(request)),
+         std::make_unique<ResourceFetchCallback>(
+             *sinks[i], client_decoded_http_resources)});
+    fetched_resource_indices.push_back(i);
+  }
+
+  // The data of the other resources is available inline, so hand it to their
+  // sinks right away (that way the caller can have unified error handling
+  // logic and doesn't have to know whether a resource was truly fetched via
+  // HTTP or not).
+  for (size_t i = 0; i < resources.size(); ++i) {
+    if (resources[i].uri().empty()) {
+      results[i] = DeliverInlineData(resources[i].inline_data(), *sinks[i],
+                                     client_decoded_http_resources);
+    }
+  }
+
+  if (fetches.empty()) {
+    return results;
+  }
+
+  absl::Status fetch_result = PerformFetches(
+      http_client, interruptible_runner, fetches, max_concurrent_fetches);
+  // Update the network stats *before* we return (just in case a failed fetch
+  // caused some network traffic to have been sent anyway).
+  for (const PendingFetch& fetch : fetches) {
+    HttpRequestHandle::SentReceivedBytes sent_received_bytes =
+        fetch.handle->TotalSentReceivedBytes();
+    if (bytes_received_acc != nullptr) {
+      *bytes_received_acc += sent_received_bytes.received_bytes;
+    }
+    if (bytes_sent_acc != nullptr) {
+      *bytes_sent_acc += sent_received_bytes.sent_bytes;
+    }
+  }
+  FCP_RETURN_IF_ERROR(fetch_result);
+
+  for (size_t i = 0; i < fetches.size(); ++i) {
+    results[fetched_resource_indices[i]] = fetches[i].callback->Result();
+  }
+  return results;
+}
+
+absl::StatusOr<std::vector<absl::StatusOr<InMemoryHttpResponse>>>
+FetchResourcesInMemory(HttpClient& http_client,
+                       InterruptibleRunner& interruptible_runner,
+                       const std::vector<UriOrInlineData>& resources,
+                       int64_t* bytes_received_acc, int64_t* bytes_sent_acc,
+                       bool client_decoded_http_resources,
+                       int max_concurrent_fetches) {
+  std::vector<absl::StatusOr<InMemoryHttpResponse>> result;
+  result.reserve(resources.size());
+
+  // Resources which have to be fetched or decoded are handed to
+  // `FetchResources`, while inline data which can be returned as-is is
+  // returned directly (because the inline_data field is an absl::Cord, making a
+  // copy of it is very cheap).
+  std::vector<UriOrInlineData> resources_to_fetch;
+  std::vector<size_t> fetched_resource_indices;
+  for (size_t i = 0; i < resources.size(); ++i) {
+    const UriOrInlineData& resource = resources[i];
+    if (resource.uri().empty() &&
+        !(client_decoded_http_resources &&
+          resource.inline_data().compression_format ==
+              CompressionFormat::kGzip)) {
+      result.push_back(InMemoryHttpResponse{
+          kHttpOk, "",
+          GetInlineDataContentType(resource.inline_data().compression_format),
+          resource.inline_data().data});
+    } else {
+      result.push_back(absl::UnavailableError("No response received"));
+      resources_to_fetch.push_back(resource);
+      fetched_resource_indices.push_back(i);
+    }
+  }
+  if (resources_to_fetch.empty()) {
+    return result;
+  }
+
+  std::vector<InMemoryResourceSink> sinks(resources_to_fetch.size());
+  std::vector<ResourceSink*> sink_ptrs;
+  sink_ptrs.reserve(sinks.size());
+  for (InMemoryResourceSink& sink : sinks) {
+    sink_ptrs.push_back(&sink);
+  }
+  FCP_ASSIGN_OR_RETURN(
+      std::vector<absl::Status> fetch_results,
+      FetchResources(http_client, interruptible_runner, resources_to_fetch,
+                     sink_ptrs, bytes_received_acc, bytes_sent_acc,
+                     client_decoded_http_resources, max_concurrent_fetches));
+
+  // Note that the order of results returned corresponds to the order of
+  // resources in the vector we originally received.
+  for (size_t i = 0; i < resources_to_fetch.size(); ++i) {
+    if (fetch_results[i].ok()) {
+      result[fetched_resource_indices[i]] = sinks[i].TakeResponse();
+    } else {
+      result[fetched_resource_indices[i]] = fetch_results[i];
+    }
+  }
+  return result;
+}
+
+}  // namespace http
+}  // namespace client
+}  // namespace fcp
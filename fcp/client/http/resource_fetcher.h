@@ -0,0 +1,170 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_HTTP_RESOURCE_FETCHER_H_
+#define FCP_CLIENT_HTTP_RESOURCE_FETCHER_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "fcp/client/http/http_client.h"
+#include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/interruptible_runner.h"
+
+namespace fcp {
+namespace client {
+namespace http {
+
+// Consumes the data of a single resource fetched by `FetchResources`, as it
+// arrives. This allows callers to process (e.g. write to disk) a resource's
+// data incrementally, rather than having to buffer all of it in memory first.
+//
+// `OnResourceStarted` is called first, then the resource's data is delivered
+// (via `OnResourceData`, or via `GetResourceBuffer` and
+// `OnResourceBufferWritten`), and then `OnResourceCompleted` is called. The
+// methods of an instance are never called concurrently, but they may be called
+// on different threads. If any method returns an error, then no further methods
+// will be called, and that error will be returned as the resource's result.
+class ResourceSink {
+ public:
+  virtual ~ResourceSink() = default;
+
+  // Called once, before any of the resource's data is delivered, with the HTTP
+  // response code (or `kHttpOk` for inline data) and the resource's content
+  // type (which is empty if the response didn't specify one).
+  virtual absl::Status OnResourceStarted(int code,
+                                         absl::string_view content_type) {
+    return absl::OkStatus();
+  }
+
+  // Called for each consecutive block of the resource's data. If the resource
+  // was compressed for client-side decoding, then the data will already have
+  // been decompressed. The data is only valid for the duration of the call.
+  virtual absl::Status OnResourceData(absl::string_view data) = 0;
+
+  // Optional alternative to `OnResourceData`, allowing sinks to provide the
+  // memory that the next block of at most `min_size` bytes of the resource's
+  // data should be written into, so that the `HttpClient` can write the data
+  // there directly (see `HttpRequestCallback::GetResponseBodyBuffer`). If the
+  // returned buffer is at least `min_size` bytes large, then the data is
+  // written into the start of that buffer and `OnResourceBufferWritten` is
+  // called instead of `OnResourceData`. This is never used for data that has
+  // to be decompressed first.
+  //
+  // The default implementation returns an empty buffer, i.e. sinks that don't
+  // override this method only ever receive data via `OnResourceData`.
+  virtual absl::Span<char> GetResourceBuffer(int64_t min_size) { return {}; }
+
+  // Called after `size` bytes of the resource's data have been written into
+  // the start of the buffer most recently returned by `GetResourceBuffer`.
+  virtual absl::Status OnResourceBufferWritten(int64_t size) {
+    return absl::UnimplementedError(
+        "OnResourceBufferWritten is not supported");
+  }
+
+  // Called once all of the resource's data has been delivered.
+  virtual absl::Status OnResourceCompleted() { return absl::OkStatus(); }
+};
+
+// A `ResourceSink` which writes a resource's data to a file at the given path,
+// replacing any existing file at that path.
+class FileResourceSink : public ResourceSink {
+ public:
+  explicit FileResourceSink(std::string path) : path_(std::move(path)) {}
+
+  absl::Status OnResourceStarted(int code,
+                                 absl::string_view content_type) override;
+  absl::Status OnResourceData(absl::string_view data) override;
+  absl::Status OnResourceCompleted() override;
+
+ private:
+  const std::string path_;
+  std::ofstream file_;
+};
+
+// Utility for fetching multiple resources at once, each of which either needs
+// to be fetched from a URI using a HTTP GET request, or for which its data is
+// already available, and streaming each resource's data into the
+// correspondingly-indexed `ResourceSink` as it arrives, in an interruptible
+// way.
+//
+// The requests are issued via `HttpClient::PerformRequests` calls of at most
+// `max_concurrent_fetches` requests each (or via a single call for all of them,
+// if `max_concurrent_fetches` isn't positive), so that the `HttpClient` can
+// issue the requests within a call concurrently (e.g. multiplexed over a single
+// HTTP/2 connection), while the number of resources being received at the same
+// time stays bounded. Resources that were compressed for client-side decoding
+// (see `client_decoded_http_resources`) are decompressed on the fly, as their
+// data arrives, so the compressed data is never buffered in full.
+//
+// If `bytes_received_acc` and `bytes_sent_acc` are non-null then those
+// accumulators will also be incremented by the aggregate amount of data that
+// was received/sent by the HTTP requests that were issued.
+//
+// Returns an error if issuing the requests failed as a whole (e.g. because a
+// URI was invalid, or because the fetch was interrupted). Otherwise it returns
+// a vector containing the result for each resource (in the same order the
+// resources were provided in).
+absl::StatusOr<std::vector<absl::Status>> FetchResources(
+    HttpClient& http_client, InterruptibleRunner& interruptible_runner,
+    const std::vector<UriOrInlineData>& resources,
+    const std::vector<ResourceSink*>& sinks, int64_t* bytes_received_acc,
+    int64_t* bytes_sent_acc, bool client_decoded_http_resources,
+    int max_concurrent_fetches);
+
+// Utility for (potentially) fetching multiple resources at once, each of which
+// either needs to be fetched from a URI using a HTTP GET request, or for which
+// its data is already available, and returning the eventual results (incl. the
+// response body) via in-memory objects, in an interruptible way. The resources
+// are fetched using `FetchResources` (see there for `max_concurrent_fetches`),
+// and the `HttpClient` writes their data straight into the resulting
+// `absl::Cord`s' memory, if it supports doing so.
+//
+// This makes it a convenient way for callers to gather the data for a related
+// set of resources (some of which might already have their data available) in
+// one go, and to then access the data for the first resource at index 0, the
+// second resource at index 1, etc., transparently handling the various
+// permutations that are possible (e.g.  resource A having data inline but
+// B having to be fetched, or both being inlined, or ...) via a unified access
+// pattern and error handling mechanism.
+//
+// If `bytes_received_acc` and `bytes_sent_acc` are non-null then those
+// accumulators will also be incremented by the aggregate amount of data that
+// was received/sent by the HTTP requests that were issued.
+//
+// Returns an error if issuing the requests failed as a whole. Otherwise it
+// returns a vector containing the result for each resource (in the same order
+// the resources were provided in).
+absl::StatusOr<std::vector<absl::StatusOr<InMemoryHttpResponse>>>
+FetchResourcesInMemory(HttpClient& http_client,
+                       InterruptibleRunner& interruptible_runner,
+                       const std::vector<UriOrInlineData>& resources,
+                       int64_t* bytes_received_acc, int64_t* bytes_sent_acc,
+                       bool client_decoded_http_resources,
+                       int max_concurrent_fetches);
+
+}  // namespace http
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_HTTP_RESOURCE_FETCHER_H_
@@ -0,0 +1,912 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/http/resource_fetcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/base/platform.h"
+#include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/http/http_client.h"
+#include "fcp/client/http/http_client_util.h"
+#include "fcp/client/http/in_memory_request_response.h"
+#include "fcp/client/http/testing/test_helpers.h"
+#include "fcp/client/interruptible_runner.h"
+#include "fcp/client/test_helpers.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp::client::http {
+namespace {
+
+using ::fcp::IsCode;
+using ::fcp::client::http::FakeHttpResponse;
+using ::fcp::client::http::MockableHttpClient;
+using ::fcp::client::http::MockHttpClient;
+using ::testing::_;
+using ::testing::ElementsAre;
+using ::testing::FieldsAre;
+using ::testing::Ge;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+using ::testing::Le;
+using ::testing::MockFunction;
+using ::testing::Ne;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::StrEq;
+using ::testing::StrictMock;
+
+using CompressionFormat =
+    ::fcp::client::http::UriOrInlineData::InlineData::CompressionFormat;
+
+constexpr absl::string_view kOctetStream = "application/octet-stream";
+
+// A `ResourceSink` which records the data it receives, and which can be made
+// to fail once it has received a given amount of data.
+class RecordingResourceSink : public ResourceSink {
+ public:
+  explicit RecordingResourceSink(int64_t fail_after_bytes = -1)
+      : fail_after_bytes_(fail_after_bytes) {}
+
+  absl::Status OnResourceStarted(int code,
+                                 absl::string_view content_type) override {
+    code_ = code;
+    content_type_ = std::string(content_type);
+    return absl::OkStatus();
+  }
+  absl::Status OnResourceData(absl::string_view data) override {
+    data_.append(data.data(), data.size());
+    ++num_blocks_;
+    if (fail_after_bytes_ >= 0 && data_.size() > fail_after_bytes_) {
+      return absl::ResourceExhaustedError("Sink is full");
+    }
+    return absl::OkStatus();
+  }
+  absl::Status OnResourceCompleted() override {
+    completed_ = true;
+    return absl::OkStatus();
+  }
+
+  int code() const { return code_; }
+  const std::string& content_type() const { return content_type_; }
+  const std::string& data() const { return data_; }
+  int num_blocks() const { return num_blocks_; }
+  bool completed() const { return completed_; }
+
+ private:
+  const int64_t fail_after_bytes_;
+  int code_ = 0;
+  std::string content_type_;
+  std::string data_;
+  int num_blocks_ = 0;
+  bool completed_ = false;
+};
+
+class ResourceFetcherTest : public ::testing::Test {
+ protected:
+  ResourceFetcherTest()
+      : interruptible_runner_(
+            &mock_log_manager_, mock_should_abort_.AsStdFunction(),
+            InterruptibleRunner::TimingConfig{
+                .polling_period = absl::ZeroDuration(),
+                .graceful_shutdown_period = absl::InfiniteDuration(),
+                .extended_shutdown_period = absl::InfiniteDuration()},
+            InterruptibleRunner::DiagnosticsConfig{
+                .interrupted = ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP,
+                .interrupt_timeout =
+                    ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP_TIMED_OUT,
+                .interrupted_extended = ProdDiagCode::
+                    BACKGROUND_TRAINING_INTERRUPT_HTTP_EXTENDED_COMPLETED,
+                .interrupt_timeout_extended = ProdDiagCode::
+                    BACKGROUND_TRAINING_INTERRUPT_HTTP_EXTENDED_TIMED_OUT}) {}
+
+  NiceMock<MockLogManager> mock_log_manager_;
+  NiceMock<MockFunction<bool()>> mock_should_abort_;
+  InterruptibleRunner interruptible_runner_;
+  StrictMock<MockHttpClient> mock_http_client_;
+};
+
+// Tests the case where a zero-length vector of UriOrInlineData is passed in. It
+// should result in a zero-length result vector (as opposed to an error or a
+// crash).
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryEmptyInputVector) {
+  auto result = FetchResourcesInMemory(mock_http_client_, interruptible_runner_,
+                                       {}, nullptr, nullptr,
+                                       /*client_decoded_http_resources=*/false,
+                                       /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, IsEmpty());
+}
+
+// Tests the case where both fields of UriOrInlineData are empty. The empty
+// inline_data field should be returned.
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryEmptyUriAndInline) {
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateInlineData(absl::Cord(),
+                                         CompressionFormat::kUncompressed)},
+      nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  EXPECT_THAT(*(*result)[0],
+              FieldsAre(kHttpOk, IsEmpty(), kOctetStream, IsEmpty()));
+}
+
+// Tests the case where one of the URIs is invalid. The whole request should
+// result in an error in that case.
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryInvalidUri) {
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri("https://valid.com"),
+       UriOrInlineData::CreateUri("http://invalid.com")},
+      nullptr, nullptr, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  EXPECT_THAT(result, IsCode(INVALID_ARGUMENT));
+  EXPECT_THAT(result.status().message(), HasSubstr("Non-HTTPS"));
+}
+
+// Tests the case where all of the requested resources must be fetched via URI.
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryAllUris) {
+  const std::string uri1 = "https://valid.com/1";
+  const std::string uri2 = "https://valid.com/2";
+  const std::string uri3 = "https://valid.com/3";
+  const std::string uri4 = "https://valid.com/4";
+  auto resource1 = UriOrInlineData::CreateUri(uri1);
+  auto resource2 = UriOrInlineData::CreateUri(uri2);
+  auto resource3 = UriOrInlineData::CreateUri(uri3);
+  auto resource4 = UriOrInlineData::CreateUri(uri4);
+
+  int expected_response_code1 = kHttpOk;
+  int expected_response_code2 = kHttpNotFound;
+  int expected_response_code3 = kHttpServiceUnavailable;
+  int expected_response_code4 = 204;  // "204 No Content"
+  std::string expected_response_body1 = "response_body1";
+  std::string expected_response_body4 = "response_body4";
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri1, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code1, {},
+                                        expected_response_body1)));
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri2, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code2, {}, "")));
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri3, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code3, {}, "")));
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri4, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code4, {},
+                                        expected_response_body4)));
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_,
+      {resource1, resource2, resource3, resource4},
+      // We pass in non-null pointers for the network
+      // stats, to ensure they are correctly updated.
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  EXPECT_THAT(*(*result)[0],
+              FieldsAre(expected_response_code1, IsEmpty(), IsEmpty(),
+                        StrEq(expected_response_body1)));
+  EXPECT_THAT((*result)[1], IsCode(NOT_FOUND));
+  EXPECT_THAT((*result)[1].status().message(), HasSubstr("404"));
+  EXPECT_THAT((*result)[2], IsCode(UNAVAILABLE));
+  EXPECT_THAT((*result)[2].status().message(), HasSubstr("503"));
+  ASSERT_OK((*result)[3]);
+  EXPECT_THAT(*(*result)[3],
+              FieldsAre(expected_response_code4, IsEmpty(), IsEmpty(),
+                        StrEq(expected_response_body4)));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(0));
+}
+
+// Tests the case where some of the requested resources have inline data
+// available.
+TEST_F(ResourceFetcherTest, FetchResourcesInMemorySomeInlineData) {
+  const std::string uri1 = "https://valid.com/1";
+  const std::string uri3 = "https://valid.com/3";
+  std::string expected_response_body2 = "response_body2";
+  std::string expected_response_body4 = "response_body4";
+  auto resource1 = UriOrInlineData::CreateUri(uri1);
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body2), CompressionFormat::kUncompressed);
+  auto resource3 = UriOrInlineData::CreateUri(uri3);
+  auto resource4 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body4), CompressionFormat::kUncompressed);
+
+  int expected_response_code1 = kHttpServiceUnavailable;
+  int expected_response_code3 = 204;  // "204 No Content"
+  std::string expected_response_body3 = "response_body3";
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri1, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code1, {}, "")));
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri3, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code3, {},
+                                        expected_response_body3)));
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_,
+      {resource1, resource2, resource3, resource4}, &bytes_received,
+      &bytes_sent, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  EXPECT_THAT((*result)[0], IsCode(UNAVAILABLE));
+  EXPECT_THAT((*result)[0].status().message(), HasSubstr("503"));
+  ASSERT_OK((*result)[1]);
+  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
+                                       StrEq(expected_response_body2)));
+  ASSERT_OK((*result)[2]);
+  EXPECT_THAT(*(*result)[2],
+              FieldsAre(expected_response_code3, IsEmpty(), IsEmpty(),
+                        StrEq(expected_response_body3)));
+  ASSERT_OK((*result)[3]);
+  EXPECT_THAT(*(*result)[3], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
+                                       StrEq(expected_response_body4)));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(0));
+}
+
+// Tests the case where all of the requested resources have inline data
+// available (and hence no HTTP requests are expected to be issued).
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryOnlyInlineData) {
+  std::string expected_response_body1 = "response_body1";
+  std::string expected_response_body2 = "response_body2";
+  auto resource1 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body1), CompressionFormat::kUncompressed);
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body2), CompressionFormat::kUncompressed);
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  EXPECT_THAT(*(*result)[0], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
+                                       StrEq(expected_response_body1)));
+  ASSERT_OK((*result)[1]);
+  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
+                                       StrEq(expected_response_body2)));
+
+  // The network stats should be untouched, since no network requests were
+  // issued.
+  EXPECT_EQ(bytes_sent, 0);
+  EXPECT_EQ(bytes_received, 0);
+}
+
+// Tests the case where the fetches get interrupted.
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryCancellation) {
+  const std::string uri1 = "https://valid.com/1";
+  const std::string uri2 = "https://valid.com/2";
+  auto resource1 = UriOrInlineData::CreateUri(uri1);
+  auto resource2 = UriOrInlineData::CreateUri(uri2);
+
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri1, _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(kHttpOk, {}, "")));
+
+  absl::Notification request_issued;
+  // We expect two calls to the cancellation listener, one for each request.
+  absl::BlockingCounter counter_should_abort(2);
+  // When the HttpClient receives a HttpRequestHandle::Cancel call, we decrement
+  // the counter.
+  mock_http_client_.SetCancellationListener(
+      [&counter_should_abort]() { counter_should_abort.DecrementCount(); });
+
+  // Make HttpClient::PerformRequests() block until the counter is decremented.
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri2, _, _, _)))
+      .WillOnce([&request_issued, &counter_should_abort](
+                    MockableHttpClient::SimpleHttpRequest ignored) {
+        request_issued.Notify();
+        counter_should_abort.Wait();
+        return FakeHttpResponse(503, {}, "");
+      });
+  // Make should_abort return false until we know that the 2nd request was
+  // issued (i.e. once InterruptibleRunner has actually started running the code
+  // it was given), and then make it return true, triggering an abort sequence
+  // and unblocking the PerformRequests() call we caused to block above.
+  EXPECT_CALL(mock_should_abort_, Call()).WillRepeatedly([&request_issued] {
+    return request_issued.HasBeenNotified();
+  });
+
+  EXPECT_CALL(mock_log_manager_,
+              LogDiag(ProdDiagCode::BACKGROUND_TRAINING_INTERRUPT_HTTP));
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  // The request should result in an overall CANCELLED outcome.
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  EXPECT_THAT(result, IsCode(CANCELLED));
+  EXPECT_THAT(result.status().message(),
+              HasSubstr("cancelled after graceful wait"));
+
+  // The network stats should still have been updated though (to reflect the
+  // data sent and received up until the point of interruption).
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(0));
+}
+
+TEST_F(ResourceFetcherTest, FetchResourcesInMemoryCompressedResources) {
+  const std::string uri = "https://valid.com/";
+  auto resource1 = UriOrInlineData::CreateUri(uri);
+
+  int expected_response_code = kHttpOk;
+  std::string content_type = "bytes+gzip";
+  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
+  auto compressed_response_body =
+      internal::CompressWithGzip(expected_response_body);
+  ASSERT_OK(compressed_response_body);
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code,
+                                        {{kContentTypeHdr, content_type}},
+                                        *compressed_response_body)));
+
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(*compressed_response_body), CompressionFormat::kGzip);
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      // We pass in non-null pointers for the network
+      // stats, to ensure they are correctly updated.
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  EXPECT_THAT(*(*result)[0],
+              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
+                        StrEq(expected_response_body)));
+  EXPECT_THAT(*(*result)[1],
+              FieldsAre(kHttpOk, IsEmpty(), absl::StrCat(kOctetStream, "+gzip"),
+                        StrEq(expected_response_body)));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(2 * compressed_response_body->size()));
+}
+
+TEST_F(ResourceFetcherTest,
+       FetchResourcesInMemoryFlagOnNotCompressedResources) {
+  const std::string uri = "https://valid.com/";
+  auto resource1 = UriOrInlineData::CreateUri(uri);
+
+  int expected_response_code = kHttpOk;
+  std::string content_type = "uncompressed-bytes-yay";
+  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code,
+                                        {{kContentTypeHdr, content_type}},
+                                        expected_response_body)));
+
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body), CompressionFormat::kUncompressed);
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      // We pass in non-null pointers for the network
+      // stats, to ensure they are correctly updated.
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  EXPECT_THAT(*(*result)[0],
+              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
+                        StrEq(expected_response_body)));
+  EXPECT_THAT(*(*result)[1], FieldsAre(kHttpOk, IsEmpty(), kOctetStream,
+                                       StrEq(expected_response_body)));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(2 * expected_response_body.size()));
+}
+
+TEST_F(ResourceFetcherTest,
+       FetchResourcesInMemoryCompressedResourcesFlagOffDoesNotDecompress) {
+  const std::string uri = "https://valid.com/";
+  auto resource1 = UriOrInlineData::CreateUri(uri);
+
+  int expected_response_code = kHttpOk;
+  std::string content_type = "bytes+gzip";
+  std::string expected_response_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
+  auto compressed_response_body =
+      internal::CompressWithGzip(expected_response_body);
+  ASSERT_OK(compressed_response_body);
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code,
+                                        {{kContentTypeHdr, content_type}},
+                                        *compressed_response_body)));
+
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(*compressed_response_body), CompressionFormat::kGzip);
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      // We pass in non-null pointers for the network
+      // stats, to ensure they are correctly updated.
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+
+  ASSERT_OK((*result)[0]);
+  // result body is still compressed!
+  EXPECT_THAT(*(*result)[0],
+              FieldsAre(expected_response_code, IsEmpty(), StrEq(content_type),
+                        StrEq(*compressed_response_body)));
+  EXPECT_THAT(*(*result)[1],
+              FieldsAre(kHttpOk, IsEmpty(), absl::StrCat(kOctetStream, "+gzip"),
+                        StrEq(*compressed_response_body)));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(2 * compressed_response_body->size()));
+}
+
+TEST_F(ResourceFetcherTest,
+       FetchResourcesInMemoryCompressedResourcesFailToDecode) {
+  const std::string uri = "https://valid.com/";
+  auto resource1 = UriOrInlineData::CreateUri(uri);
+
+  int expected_response_code = kHttpOk;
+  std::string content_type = "not-actually-gzipped+gzip";
+  std::string expected_response_body = "I am not a valid gzipped body ლ(ಠ益ಠლ)";
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(expected_response_code,
+                                        {{kContentTypeHdr, content_type}},
+                                        expected_response_body)));
+
+  auto resource2 = UriOrInlineData::CreateInlineData(
+      absl::Cord(expected_response_body), CompressionFormat::kGzip);
+
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResourcesInMemory(
+      mock_http_client_, interruptible_runner_, {resource1, resource2},
+      // We pass in non-null pointers for the network
+      // stats, to ensure they are correctly updated.
+      &bytes_received, &bytes_sent, /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  // Fetching will succeed
+  ASSERT_OK(result);
+
+  // ...but our responses will have failed to decode.
+  EXPECT_THAT((*result)[0], IsCode(INTERNAL));
+  EXPECT_THAT((*result)[1], IsCode(INTERNAL));
+
+  EXPECT_THAT(bytes_sent, Ne(bytes_received));
+  EXPECT_THAT(bytes_sent, Ge(0));
+  EXPECT_THAT(bytes_received, Ge(2 * expected_response_body.size()));
+}
+
+TEST_F(ResourceFetcherTest, FetchResourcesStreamsIntoSinks) {
+  const std::string uri = "https://valid.com/1";
+  std::string expected_body1 = "response_body1";
+  std::string expected_body2 = "response_body2";
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(
+                  FieldsAre(uri, HttpRequest::Method::kGet, HeaderList{}, "")))
+      .WillOnce(Return(FakeHttpResponse(
+          kHttpOk, {{kContentTypeHdr, "some-type"}}, expected_body1)));
+
+  RecordingResourceSink sink1;
+  RecordingResourceSink sink2;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri(uri),
+       UriOrInlineData::CreateInlineData(absl::Cord(expected_body2),
+                                         CompressionFormat::kUncompressed)},
+      {&sink1, &sink2}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, ElementsAre(IsCode(OK), IsCode(OK)));
+
+  EXPECT_EQ(sink1.code(), kHttpOk);
+  EXPECT_EQ(sink1.content_type(), "some-type");
+  EXPECT_EQ(sink1.data(), expected_body1);
+  EXPECT_TRUE(sink1.completed());
+  EXPECT_EQ(sink2.code(), kHttpOk);
+  EXPECT_EQ(sink2.content_type(), kOctetStream);
+  EXPECT_EQ(sink2.data(), expected_body2);
+  EXPECT_TRUE(sink2.completed());
+}
+
+// Tests that the body of an unsuccessful response isn't handed to the sink.
+TEST_F(ResourceFetcherTest, FetchResourcesDoesNotStreamErrorResponseBody) {
+  const std::string uri = "https://valid.com/1";
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri, _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(kHttpNotFound, {}, "not found")));
+
+  RecordingResourceSink sink;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri(uri)}, {&sink},
+      nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT((*result)[0], IsCode(NOT_FOUND));
+  EXPECT_THAT((*result)[0].message(), HasSubstr("404"));
+  EXPECT_THAT(sink.data(), IsEmpty());
+  EXPECT_FALSE(sink.completed());
+}
+
+// Tests that a sink failing only fails the corresponding resource.
+TEST_F(ResourceFetcherTest, FetchResourcesSinkErrorOnlyFailsThatResource) {
+  const std::string uri1 = "https://valid.com/1";
+  const std::string uri2 = "https://valid.com/2";
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri1, _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(kHttpOk, {}, "response_body1")));
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri2, _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(kHttpOk, {}, "response_body2")));
+
+  RecordingResourceSink sink;
+  RecordingResourceSink failing_sink(/*fail_after_bytes=*/1);
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri(uri1), UriOrInlineData::CreateUri(uri2)},
+      {&sink, &failing_sink}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_OK((*result)[0]);
+  EXPECT_EQ(sink.data(), "response_body1");
+  EXPECT_THAT((*result)[1], IsCode(RESOURCE_EXHAUSTED));
+  EXPECT_FALSE(failing_sink.completed());
+}
+
+// Tests that compressed data is decoded incrementally, even when it arrives in
+// multiple blocks, and that the decoded data is delivered in multiple blocks
+// as well (rather than being buffered until the end).
+TEST_F(ResourceFetcherTest, FetchResourcesDecodesGzipIncrementally) {
+  std::string expected_body;
+  for (int i = 0; expected_body.size() < 1024 * 1024; ++i) {
+    absl::StrAppend(&expected_body, "line ", i, "\n");
+  }
+  auto compressed_body = internal::CompressWithGzip(expected_body);
+  ASSERT_OK(compressed_body);
+  // Split the compressed data into a Cord with multiple chunks.
+  absl::Cord compressed_cord;
+  for (size_t offset = 0; offset < compressed_body->size(); offset += 1000) {
+    compressed_cord.Append(absl::Cord(absl::string_view(*compressed_body)
+                                          .substr(offset, 1000)));
+  }
+
+  RecordingResourceSink sink;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateInlineData(compressed_cord,
+                                         CompressionFormat::kGzip)},
+      {&sink}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  ASSERT_OK((*result)[0]);
+  EXPECT_EQ(sink.data(), expected_body);
+  EXPECT_GT(sink.num_blocks(), 1);
+  EXPECT_TRUE(sink.completed());
+}
+
+TEST_F(ResourceFetcherTest, FetchResourcesTruncatedGzipDataFails) {
+  auto compressed_body = internal::CompressWithGzip("response_body");
+  ASSERT_OK(compressed_body);
+
+  RecordingResourceSink sink;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateInlineData(
+          absl::Cord(compressed_body->substr(0, compressed_body->size() - 4)),
+          CompressionFormat::kGzip)},
+      {&sink}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT((*result)[0], IsCode(INTERNAL));
+  EXPECT_FALSE(sink.completed());
+}
+
+// A `RecordingResourceSink` which lets the `HttpClient` write the data into its
+// own buffer.
+class BufferedRecordingResourceSink : public RecordingResourceSink {
+ public:
+  absl::Span<char> GetResourceBuffer(int64_t min_size) override {
+    buffer_.resize(min_size);
+    return absl::MakeSpan(buffer_);
+  }
+  absl::Status OnResourceBufferWritten(int64_t size) override {
+    ++num_buffers_written_;
+    return OnResourceData(absl::string_view(buffer_.data(), size));
+  }
+
+  int num_buffers_written() const { return num_buffers_written_; }
+
+ private:
+  std::string buffer_;
+  int num_buffers_written_ = 0;
+};
+
+// Tests that uncompressed data is written into the sink's buffer directly,
+// while data that needs to be decoded first is passed to `OnResourceData`.
+TEST_F(ResourceFetcherTest, FetchResourcesWritesIntoSinkBuffer) {
+  std::string expected_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
+  auto compressed_body = internal::CompressWithGzip(expected_body);
+  ASSERT_OK(compressed_body);
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(FieldsAre("https://valid.com/1", _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(kHttpOk, {}, expected_body)));
+  EXPECT_CALL(mock_http_client_,
+              PerformSingleRequest(FieldsAre("https://valid.com/2", _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(
+          kHttpOk, {{kContentTypeHdr, "bytes+gzip"}}, *compressed_body)));
+
+  BufferedRecordingResourceSink sink1;
+  BufferedRecordingResourceSink sink2;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri("https://valid.com/1"),
+       UriOrInlineData::CreateUri("https://valid.com/2")},
+      {&sink1, &sink2}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, ElementsAre(IsCode(OK), IsCode(OK)));
+  EXPECT_EQ(sink1.data(), expected_body);
+  EXPECT_EQ(sink1.num_buffers_written(), 1);
+  EXPECT_EQ(sink2.data(), expected_body);
+  EXPECT_EQ(sink2.num_buffers_written(), 0);
+}
+
+// An `HttpClient` which counts the `PerformRequests` calls it receives, and
+// which forwards all calls to another `HttpClient`.
+class CountingHttpClient : public HttpClient {
+ public:
+  explicit CountingHttpClient(HttpClient& http_client)
+      : http_client_(http_client) {}
+
+  std::unique_ptr<HttpRequestHandle> EnqueueRequest(
+      std::unique_ptr<HttpRequest> request) override {
+    return http_client_.EnqueueRequest(std::move(request));
+  }
+  absl::Status PerformRequests(
+      std::vector<std::pair<HttpRequestHandle*, HttpRequestCallback*>> requests)
+      override {
+    ++num_calls_;
+    num_requests_per_call_.push_back(requests.size());
+    return http_client_.PerformRequests(std::move(requests));
+  }
+
+  int num_calls() const { return num_calls_; }
+  const std::vector<size_t>& num_requests_per_call() const {
+    return num_requests_per_call_;
+  }
+
+ private:
+  HttpClient& http_client_;
+  int num_calls_ = 0;
+  std::vector<size_t> num_requests_per_call_;
+};
+
+// Tests that all requests are handed to the `HttpClient` at once, so that it
+// can issue them concurrently (e.g. multiplexed over one connection).
+TEST_F(ResourceFetcherTest, FetchResourcesIssuesAllRequestsInOneCall) {
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(_))
+      .Times(5)
+      .WillRepeatedly([](MockableHttpClient::SimpleHttpRequest request) {
+        return FakeHttpResponse(kHttpOk, {}, request.uri);
+      });
+
+  std::vector<UriOrInlineData> resources;
+  std::vector<RecordingResourceSink> sinks(5);
+  std::vector<ResourceSink*> sink_ptrs;
+  for (int i = 0; i < 5; ++i) {
+    resources.push_back(
+        UriOrInlineData::CreateUri(absl::StrCat("https://valid.com/", i)));
+    sink_ptrs.push_back(&sinks[i]);
+  }
+  CountingHttpClient http_client(mock_http_client_);
+  int64_t bytes_received = 0;
+  int64_t bytes_sent = 0;
+  auto result = FetchResources(http_client, interruptible_runner_, resources,
+                               sink_ptrs, &bytes_received, &bytes_sent,
+                               /*client_decoded_http_resources=*/false,
+                               /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_OK((*result)[i]);
+    EXPECT_EQ(sinks[i].data(), absl::StrCat("https://valid.com/", i));
+  }
+  EXPECT_EQ(http_client.num_calls(), 1);
+  EXPECT_THAT(http_client.num_requests_per_call(), ElementsAre(5));
+  EXPECT_EQ(bytes_received,
+            mock_http_client_.TotalSentReceivedBytes().received_bytes);
+  EXPECT_EQ(bytes_sent, mock_http_client_.TotalSentReceivedBytes().sent_bytes);
+}
+
+// Tests that no more than `max_concurrent_fetches` requests are handed to the
+// `HttpClient` at once.
+TEST_F(ResourceFetcherTest, FetchResourcesLimitsConcurrentFetches) {
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(_))
+      .Times(5)
+      .WillRepeatedly([](MockableHttpClient::SimpleHttpRequest request) {
+        return FakeHttpResponse(kHttpOk, {}, request.uri);
+      });
+
+  std::vector<UriOrInlineData> resources;
+  std::vector<RecordingResourceSink> sinks(5);
+  std::vector<ResourceSink*> sink_ptrs;
+  for (int i = 0; i < 5; ++i) {
+    resources.push_back(
+        UriOrInlineData::CreateUri(absl::StrCat("https://valid.com/", i)));
+    sink_ptrs.push_back(&sinks[i]);
+  }
+  CountingHttpClient http_client(mock_http_client_);
+  auto result = FetchResources(http_client, interruptible_runner_, resources,
+                               sink_ptrs, nullptr, nullptr,
+                               /*client_decoded_http_resources=*/false,
+                               /*max_concurrent_fetches=*/2);
+  ASSERT_OK(result);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_OK((*result)[i]);
+    EXPECT_EQ(sinks[i].data(), absl::StrCat("https://valid.com/", i));
+  }
+  EXPECT_THAT(http_client.num_requests_per_call(), ElementsAre(2, 2, 1));
+}
+
+// Tests that a sink failing in one batch of requests only fails its own
+// resource, and that the remaining batches are still fetched.
+TEST_F(ResourceFetcherTest,
+       FetchResourcesSinkFailureDoesNotStopLaterBatches) {
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(_))
+      .Times(2)
+      .WillRepeatedly([](MockableHttpClient::SimpleHttpRequest request) {
+        return FakeHttpResponse(kHttpOk, {}, request.uri);
+      });
+
+  RecordingResourceSink failing_sink(/*fail_after_bytes=*/0);
+  RecordingResourceSink sink;
+  CountingHttpClient http_client(mock_http_client_);
+  auto result = FetchResources(
+      http_client, interruptible_runner_,
+      {UriOrInlineData::CreateUri("https://valid.com/1"),
+       UriOrInlineData::CreateUri("https://valid.com/2")},
+      {&failing_sink, &sink}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/1);
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, ElementsAre(IsCode(RESOURCE_EXHAUSTED), IsCode(OK)));
+  EXPECT_EQ(sink.data(), "https://valid.com/2");
+  EXPECT_THAT(http_client.num_requests_per_call(), ElementsAre(1, 1));
+}
+
+// Tests that aborting a fetch before the requests were issued doesn't issue
+// them at all, and fails the fetch as a whole.
+TEST_F(ResourceFetcherTest, FetchResourcesAbortedBeforeStarting) {
+  EXPECT_CALL(mock_should_abort_, Call()).WillRepeatedly(Return(true));
+
+  RecordingResourceSink sink;
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri("https://valid.com/1")}, {&sink}, nullptr,
+      nullptr, /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  EXPECT_THAT(result, IsCode(CANCELLED));
+  EXPECT_THAT(sink.data(), IsEmpty());
+}
+
+TEST_F(ResourceFetcherTest, FileResourceSinkWritesFile) {
+  const std::string uri = "https://valid.com/1";
+  std::string expected_body = "response_body: AAAAAAAAAAAAAAAAAAAAA";
+  auto compressed_body = internal::CompressWithGzip(expected_body);
+  ASSERT_OK(compressed_body);
+  EXPECT_CALL(mock_http_client_, PerformSingleRequest(FieldsAre(uri, _, _, _)))
+      .WillOnce(Return(FakeHttpResponse(
+          kHttpOk, {{kContentTypeHdr, "bytes+gzip"}}, *compressed_body)));
+
+  std::string path1 = TemporaryTestFile(".1");
+  std::string path2 = TemporaryTestFile(".2");
+  FileResourceSink sink1(path1);
+  FileResourceSink sink2(path2);
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateUri(uri),
+       UriOrInlineData::CreateInlineData(absl::Cord(expected_body),
+                                         CompressionFormat::kUncompressed)},
+      {&sink1, &sink2}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/true,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT(*result, ElementsAre(IsCode(OK), IsCode(OK)));
+
+  absl::StatusOr<std::string> contents1 = ReadFileToString(path1);
+  ASSERT_OK(contents1);
+  EXPECT_EQ(*contents1, expected_body);
+  absl::StatusOr<std::string> contents2 = ReadFileToString(path2);
+  ASSERT_OK(contents2);
+  EXPECT_EQ(*contents2, expected_body);
+}
+
+TEST_F(ResourceFetcherTest, FileResourceSinkInvalidPathFails) {
+  FileResourceSink sink("/nonexistent-dir/file");
+  auto result = FetchResources(
+      mock_http_client_, interruptible_runner_,
+      {UriOrInlineData::CreateInlineData(absl::Cord("data"),
+                                         CompressionFormat::kUncompressed)},
+      {&sink}, nullptr, nullptr,
+      /*client_decoded_http_resources=*/false,
+      /*max_concurrent_fetches=*/0);
+  ASSERT_OK(result);
+  EXPECT_THAT((*result)[0], IsCode(INTERNAL));
+}
+
+}  // namespace
+}  // namespace fcp::client::http
@@ -16,6 +16,7 @@
 #include "fcp/client/http/testing/test_helpers.h"
 
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -30,6 +31,7 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/http/http_client_util.h"
@@ -105,40 +107,51 @@ absl::Status MockableHttpClient::PerformRequests(
       std::optional<std::string> content_length_hdr =
           FindHeader(headers, kContentLengthHdr);
       if (!content_length_hdr.has_value()) {
-        return absl::InternalError(
-            "MockableHttpClient only supports requests with known "
-            "Content-Length");
-      }
-      int64_t content_length;
-      if (!absl::SimpleAtoi(*content_length_hdr, &content_length)) {
-        return absl::InternalError(absl::StrCat(
-            "MockableHttpClient: unexpected Content-Length value: ",
-            content_length));
-      }
-      request_body.resize(content_length);
-
-      // Read the data all at once (our buffer should be big enough for it).
-      absl::StatusOr<int64_t> read_result =
-          request->ReadBody(&request_body[0], content_length);
-      if (!read_result.ok()) {
-        return absl::InternalError(
-            absl::StrCat("MockableHttpClient: ReadBody failed: ",
-                         read_result.status().ToString()));
-      }
-      if (*read_result != content_length) {
-        return absl::InternalError(
-            absl::StrCat("MockableHttpClient: 1st ReadBody didn't read all the "
-                         "data. Actual: ",
-                         *read_result, ", expected: ", content_length));
-      }
-
-      // Ensure we've hit the end of the data by checking for OUT_OF_RANGE.
-      absl::Status read_body_result =
-          request->ReadBody(&request_body[0], 1).status();
-      if (read_body_result.code() != absl::StatusCode::kOutOfRange) {
-        return absl::InternalError(
-            absl::StrCat("MockableHttpClient: 2nd ReadBody failed: ",
-                         read_body_result.ToString()));
+        // The body size isn't known upfront (e.g. because it is compressed
+        // while it is being read), so read it in chunks until we hit the end
+        // of the data.
+        char buffer[64 * 1024];
+        absl::StatusOr<int64_t> read_result;
+        while ((read_result = request->ReadBody(buffer, sizeof(buffer))).ok()) {
+          request_body.append(buffer, *read_result);
+        }
+        if (read_result.status().code() != absl::StatusCode::kOutOfRange) {
+          return absl::InternalError(
+              absl::StrCat("MockableHttpClient: ReadBody failed: ",
+                           read_result.status().ToString()));
+        }
+      } else {
+        int64_t content_length;
+        if (!absl::SimpleAtoi(*content_length_hdr, &content_length)) {
+          return absl::InternalError(absl::StrCat(
+              "MockableHttpClient: unexpected Content-Length value: ",
+              content_length));
+        }
+        request_body.resize(content_length);
+
+        // Read the data all at once (our buffer should be big enough for it).
+        absl::StatusOr<int64_t> read_result =
+            request->ReadBody(&request_body[0], content_length);
+        if (!read_result.ok()) {
+          return absl::InternalError(
+              absl::StrCat("MockableHttpClient: ReadBody failed: ",
+                           read_result.status().ToString()));
+        }
+        if (*read_result != content_length) {
+          return absl::InternalError(absl::StrCat(
+              "MockableHttpClient: 1st ReadBody didn't read all the data. "
+              "Actual: ",
+              *read_result, ", expected: ", content_length));
+        }
+
+        // Ensure we've hit the end of the data by checking for OUT_OF_RANGE.
+        absl::Status read_body_result =
+            request->ReadBody(&request_body[0], 1).status();
+        if (read_body_result.code() != absl::StatusCode::kOutOfRange) {
+          return absl::InternalError(
+              absl::StrCat("MockableHttpClient: 2nd ReadBody failed: ",
+                           read_body_result.ToString()));
+        }
       }
     }
 
@@ -186,8 +199,23 @@ absl::Status MockableHttpClient::PerformRequests(
 
     FCP_LOG(INFO) << "MockableHttpClient: Delivering response body for: "
                   << request->uri();
-    absl::Status response_body_result =
-        callback->OnResponseBody(*request, *response, response->body());
+    // Like a real `HttpClient`, write the data straight into the callback's
+    // memory if it provides a large enough buffer for it.
+    const std::string& body = response->body();
+    absl::Span<char> body_buffer;
+    if (!body.empty()) {
+      body_buffer =
+          callback->GetResponseBodyBuffer(*request, *response, body.size());
+    }
+    absl::Status response_body_result;
+    if (!body.empty() && body_buffer.size() >= body.size()) {
+      std::memcpy(body_buffer.data(), body.data(), body.size());
+      response_body_result = callback->OnResponseBodyBufferWritten(
+          *request, *response, body.size());
+    } else {
+      response_body_result =
+          callback->OnResponseBody(*request, *response, body);
+    }
     if (!response_body_result.ok()) {
       return absl::InternalError(
           absl::StrCat("MockableHttpClient: OnResponseBody failed: ",
@@ -15,10 +15,15 @@
  */
 #include "fcp/client/interruptible_runner.h"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <utility>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
 
 namespace fcp {
 namespace client {
@@ -26,9 +31,13 @@ namespace client {
 absl::Status InterruptibleRunner::Run(std::function<absl::Status()> f,
                                       std::function<void()> abort_function) {
   // Check before even making the call.
-  if (should_abort_()) {
+  if (should_abort_() || (timing_config_.abort_signal != nullptr &&
+                          timing_config_.abort_signal->IsAborted())) {
     return absl::CancelledError("cancelled before posting callable");
   }
+  if (timing_config_.abort_signal != nullptr) {
+    return RunUntilDoneOrAborted(std::move(f), std::move(abort_function));
+  }
   fcp::thread::Future<absl::Status> run_future =
       fcp::thread::ScheduleFuture<absl::Status>(thread_pool_.get(), f);
   return WaitUntilDone(std::move(run_future), abort_function);
@@ -54,6 +63,51 @@ absl::Status InterruptibleRunner::WaitUntilDone(
   }
 }
 
+absl::Status InterruptibleRunner::RunUntilDoneOrAborted(
+    std::function<absl::Status()> f, std::function<void()> abort_function) {
+  // Whether f() is done or the signal was aborted, whichever happens first.
+  // This is shared with the background thread and the signal's listener.
+  struct WaitState {
+    absl::Mutex mutex;
+    bool done ABSL_GUARDED_BY(mutex) = false;
+    bool aborted ABSL_GUARDED_BY(mutex) = false;
+  };
+  auto state = std::make_shared<WaitState>();
+  AbortSignal* abort_signal = timing_config_.abort_signal;
+  int64_t listener_id = abort_signal->AddListener([state]() {
+    absl::MutexLock lock(&state->mutex);
+    state->aborted = true;
+  });
+  fcp::thread::Future<absl::Status> run_future =
+      fcp::thread::ScheduleFuture<absl::Status>(
+          thread_pool_.get(), [f = std::move(f), state]() {
+            absl::Status status = f();
+            absl::MutexLock lock(&state->mutex);
+            state->done = true;
+            return status;
+          });
+  bool aborted;
+  {
+    absl::MutexLock lock(&state->mutex);
+    state->mutex.Await(absl::Condition(
+        +[](WaitState* state) -> bool {
+          state->mutex.AssertHeld();
+          return state->done || state->aborted;
+        },
+        state.get()));
+    aborted = !state->done;
+  }
+  abort_signal->RemoveListener(listener_id);
+  if (aborted) {
+    return Abort(std::move(run_future), abort_function);
+  }
+  // The future is set right after f() is done.
+  FCP_CHECK(run_future.Wait(absl::InfiniteDuration()));
+  std::optional<absl::Status> future_result = std::move(run_future).Take();
+  FCP_CHECK(future_result != std::nullopt);
+  return future_result.value();
+}
+
 absl::Status InterruptibleRunner::Abort(
     fcp::thread::Future<absl::Status> run_future,
     std::function<void()> abort_function) {
@@ -24,6 +24,7 @@
 #include "fcp/base/future.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/scheduler.h"
+#include "fcp/client/abort_signal.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/log_manager.h"
 
@@ -38,6 +39,9 @@ namespace client {
 // is then expected to abort within graceful_shutdown_period. If not, a diag
 // code is logged and we wait for some time longer (extended_shutdown_period),
 // and if the operation still does not finish, the program exits.
+// If an AbortSignal is provided, should_abort is only checked before starting
+// the operation. The operation is then aborted as soon as the signal is, with
+// no periodic wakeups in the meantime.
 // The destructor blocks until the background thread has become idle.
 class InterruptibleRunner {
  public:
@@ -46,6 +50,9 @@ class InterruptibleRunner {
     absl::Duration polling_period;
     absl::Duration graceful_shutdown_period;
     absl::Duration extended_shutdown_period;
+    // If set, the environment pushes aborts through this signal, rather than
+    // should_abort being polled every polling_period. Not owned.
+    AbortSignal* abort_signal = nullptr;
   };
 
   // A struct used to group diagnostics related parameters.
@@ -78,6 +85,10 @@ class InterruptibleRunner {
  private:
   absl::Status WaitUntilDone(fcp::thread::Future<absl::Status>&& run_future,
                              std::function<void()> abort_function);
+  // Like WaitUntilDone, but waits until either f() is done or the abort signal
+  // is aborted, without polling.
+  absl::Status RunUntilDoneOrAborted(std::function<absl::Status()> f,
+                                     std::function<void()> abort_function);
   absl::Status Abort(fcp::thread::Future<absl::Status> run_future,
                      std::function<void()> abort_function);
 
@@ -16,12 +16,16 @@
 #include "fcp/client/interruptible_runner.h"
 
 #include <functional>
+#include <thread>  // NOLINT(build/c++11)
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
 #include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
+#include "fcp/base/simulated_clock.h"
+#include "fcp/client/abort_signal.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/test_helpers.h"
 #include "fcp/testing/testing.h"
@@ -253,6 +257,116 @@ TEST(InterruptibleRunnerTest, TestAbortInExtendedGracePeriod) {
   EXPECT_EQ(abort_function_calls, 1);
 }
 
+// Tests that with an abort signal, should_abort isn't polled while the runnable
+// runs, even with a zero polling period.
+TEST(InterruptibleRunnerTest, TestAbortSignalNoPolling) {
+  AbortSignal abort_signal;
+  int should_abort_calls = 0;
+  std::function<bool()> should_abort = [&should_abort_calls]() {
+    should_abort_calls++;
+    return false;
+  };
+
+  InterruptibleRunner interruptibleRunner(
+      /*log_manager=*/nullptr, should_abort,
+      InterruptibleRunner::TimingConfig{
+          .polling_period = absl::ZeroDuration(),
+          .graceful_shutdown_period = absl::InfiniteDuration(),
+          .extended_shutdown_period = absl::InfiniteDuration(),
+          .abort_signal = &abort_signal},
+      getDiagnosticsConfig());
+  absl::Status status = interruptibleRunner.Run(
+      []() {
+        absl::SleepFor(absl::Milliseconds(50));
+        return absl::DataLossError("");
+      },
+      []() { FAIL() << "Unexpected abort"; });
+  EXPECT_THAT(status, IsCode(DATA_LOSS));
+  EXPECT_EQ(should_abort_calls, 1);
+
+  // The runner no longer listens to the signal once the run is done.
+  abort_signal.Abort();
+}
+
+// Tests that an already aborted signal prevents us from even kicking off the
+// run.
+TEST(InterruptibleRunnerTest, TestAbortSignalAbortBeforeRun) {
+  AbortSignal abort_signal;
+  abort_signal.Abort();
+  int runnable_calls = 0;
+
+  InterruptibleRunner interruptibleRunner(
+      /*log_manager=*/nullptr, []() { return false; },
+      InterruptibleRunner::TimingConfig{
+          .polling_period = absl::InfiniteDuration(),
+          .graceful_shutdown_period = absl::InfiniteDuration(),
+          .extended_shutdown_period = absl::InfiniteDuration(),
+          .abort_signal = &abort_signal},
+      getDiagnosticsConfig());
+  absl::Status status = interruptibleRunner.Run(
+      [&runnable_calls]() {
+        runnable_calls++;
+        return absl::OkStatus();
+      },
+      []() {});
+  EXPECT_THAT(status, IsCode(CANCELLED));
+  EXPECT_EQ(runnable_calls, 0);
+}
+
+// Tests that the runnable gets aborted as soon as the abort signal is pushed,
+// even though should_abort would only be polled once per hour, by measuring
+// the time from the push to the abort_function call on a simulated clock.
+TEST(InterruptibleRunnerTest, TestAbortSignalAbortLatency) {
+  StrictMock<MockLogManager> log_manager;
+  SimulatedClock clock;
+  AbortSignal abort_signal;
+  int should_abort_calls = 0;
+  std::function<bool()> should_abort = [&should_abort_calls]() {
+    should_abort_calls++;
+    return false;
+  };
+  absl::Notification runnable_started;
+  absl::Notification runnable_aborted;
+  absl::Time abort_function_time;
+  std::function<void()> abort_function = [&clock, &abort_function_time,
+                                          &runnable_aborted]() {
+    abort_function_time = clock.Now();
+    runnable_aborted.Notify();
+  };
+
+  InterruptibleRunner interruptibleRunner(
+      &log_manager, should_abort,
+      InterruptibleRunner::TimingConfig{
+          .polling_period = absl::Hours(1),
+          .graceful_shutdown_period = absl::InfiniteDuration(),
+          .extended_shutdown_period = absl::InfiniteDuration(),
+          .abort_signal = &abort_signal},
+      getDiagnosticsConfig());
+  EXPECT_CALL(log_manager, LogDiag(BACKGROUND_TRAINING_INTERRUPT_TF_EXECUTION))
+      .Times(testing::Exactly(1));
+  // The environment pushes the abort ten minutes into the run.
+  absl::Time abort_time;
+  std::thread environment([&clock, &abort_signal, &abort_time,
+                           &runnable_started]() {
+    runnable_started.WaitForNotification();
+    clock.AdvanceTime(absl::Minutes(10));
+    abort_time = clock.Now();
+    abort_signal.Abort();
+  });
+  absl::Status status = interruptibleRunner.Run(
+      [&runnable_started, &runnable_aborted]() {
+        runnable_started.Notify();
+        runnable_aborted.WaitForNotification();
+        return absl::OkStatus();
+      },
+      abort_function);
+  environment.join();
+
+  EXPECT_THAT(status, IsCode(CANCELLED));
+  EXPECT_EQ(abort_function_time - abort_time, absl::ZeroDuration());
+  EXPECT_EQ(should_abort_calls, 1);
+}
+
 }  // namespace
 }  // namespace client
 }  // namespace fcp
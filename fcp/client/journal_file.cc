@@ -0,0 +1,202 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/journal_file.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "fcp/base/monitoring.h"
+#include "zlib.h"
+
+namespace fcp {
+namespace client {
+namespace {
+
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+
+// Each record starts with its kind, the size of its payload, and a CRC-32 of
+// the kind and payload.
+constexpr int64_t kRecordHeaderSize = 1 + 4 + 4;
+
+uint32_t Crc32(uint32_t crc, absl::string_view data) {
+  while (!data.empty()) {
+    const size_t size = std::min<size_t>(data.size(), 1 << 30);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(data.data()),
+                static_cast<uInt>(size));
+    data.remove_prefix(size);
+  }
+  return crc;
+}
+
+// Reads the whole contents of the file with the given descriptor.
+absl::StatusOr<std::string> ReadFileContents(int fd) {
+  std::string contents;
+  char buffer[64 * 1024];
+  for (;;) {
+    ssize_t bytes_read = pread(fd, buffer, sizeof(buffer), contents.size());
+    if (bytes_read < 0) {
+      return absl::InternalError("Failed to read file.");
+    }
+    if (bytes_read == 0) break;
+    contents.append(buffer, bytes_read);
+  }
+  return contents;
+}
+
+// Decodes the record at the start of `journal`, and advances it past the
+// record. Returns false if there is no complete, intact record.
+bool DecodeRecord(absl::string_view& journal, char& kind,
+                  absl::string_view& payload) {
+  if (journal.size() < kRecordHeaderSize) return false;
+  const auto* buffer = reinterpret_cast<const uint8_t*>(journal.data());
+  uint32_t payload_size;
+  uint32_t crc;
+  CodedInputStream::ReadLittleEndian32FromArray(buffer + 1, &payload_size);
+  CodedInputStream::ReadLittleEndian32FromArray(buffer + 5, &crc);
+  if (journal.size() - kRecordHeaderSize < payload_size) return false;
+  kind = journal[0];
+  payload = journal.substr(kRecordHeaderSize, payload_size);
+  if (Crc32(Crc32(0, journal.substr(0, 1)), payload) != crc) return false;
+  journal.remove_prefix(kRecordHeaderSize + payload_size);
+  return true;
+}
+
+}  // anonymous namespace
+
+absl::Status JournalFile::Open() {
+  if (fd_ >= 0) return absl::OkStatus();
+  fd_ = open(path_.c_str(), O_CREAT | O_RDWR,
+             S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ < 0) {
+    return absl::InternalError(absl::StrCat("Failed to open file: ", path_));
+  }
+  return absl::OkStatus();
+}
+
+void JournalFile::Close() {
+  if (fd_ < 0) return;
+  close(fd_);
+  fd_ = -1;
+}
+
+absl::Status JournalFile::Load(
+    absl::string_view header,
+    const std::function<bool(char kind, absl::string_view payload)>& apply) {
+  FCP_RETURN_IF_ERROR(Open());
+  FCP_ASSIGN_OR_RETURN(std::string journal, ReadFileContents(fd_));
+  absl::string_view remaining = journal;
+  char kind;
+  absl::string_view payload;
+  if (!DecodeRecord(remaining, kind, payload) || kind != kHeaderRecordKind ||
+      payload != header) {
+    return Reset(header);
+  }
+  // Replay the journal until its end, or until the first record that is
+  // incomplete or corrupt, which can only be the result of an interrupted
+  // append and is dropped.
+  int64_t valid_size = journal.size() - remaining.size();
+  while (DecodeRecord(remaining, kind, payload) && apply(kind, payload)) {
+    valid_size = journal.size() - remaining.size();
+  }
+  size_bytes_ = valid_size;
+  if (valid_size < static_cast<int64_t>(journal.size()) &&
+      ftruncate(fd_, valid_size) != 0) {
+    return absl::InternalError("Failed to truncate journal.");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status JournalFile::Reset(absl::string_view header) {
+  FCP_RETURN_IF_ERROR(Open());
+  if (ftruncate(fd_, 0) != 0) {
+    return absl::InternalError("Failed to truncate journal.");
+  }
+  size_bytes_ = 0;
+  return Append(kHeaderRecordKind, header);
+}
+
+absl::Status JournalFile::Append(char kind, absl::string_view payload) {
+  return AppendEncoded(EncodeRecord(kind, payload));
+}
+
+absl::Status JournalFile::AppendEncoded(absl::string_view records) {
+  if (fd_ < 0) {
+    return absl::FailedPreconditionError("The journal is not open.");
+  }
+  int64_t written = 0;
+  while (written < static_cast<int64_t>(records.size())) {
+    ssize_t result = pwrite(fd_, records.data() + written,
+                            records.size() - written, size_bytes_ + written);
+    if (result <= 0) {
+      // Don't leave a partial record behind. Even if this fails, the partial
+      // record will be dropped when the journal is next loaded.
+      ftruncate(fd_, size_bytes_);
+      return absl::InternalError("Failed to append to journal.");
+    }
+    written += result;
+  }
+  if (fsync(fd_) != 0) {
+    ftruncate(fd_, size_bytes_);
+    return absl::InternalError("Failed to sync journal.");
+  }
+  size_bytes_ += written;
+  return absl::OkStatus();
+}
+
+std::string JournalFile::EncodeRecord(char kind, absl::string_view payload) {
+  std::string record(kRecordHeaderSize, '\0');
+  record[0] = kind;
+  auto* buffer = reinterpret_cast<uint8_t*>(record.data());
+  CodedOutputStream::WriteLittleEndian32ToArray(payload.size(), buffer + 1);
+  CodedOutputStream::WriteLittleEndian32ToArray(
+      Crc32(Crc32(0, absl::string_view(&kind, 1)), payload), buffer + 5);
+  record.append(payload.data(), payload.size());
+  return record;
+}
+
+absl::StatusOr<std::string> GetFileFingerprint(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::InternalError(absl::StrCat("Failed to open file: ", path));
+  }
+  absl::StatusOr<std::string> contents = ReadFileContents(fd);
+  close(fd);
+  FCP_RETURN_IF_ERROR(contents.status());
+  return GetFingerprint(*contents);
+}
+
+std::string GetFingerprint(absl::string_view data) {
+  std::string fingerprint(8 + 4, '\0');
+  auto* buffer = reinterpret_cast<uint8_t*>(fingerprint.data());
+  CodedOutputStream::WriteLittleEndian64ToArray(data.size(), buffer);
+  CodedOutputStream::WriteLittleEndian32ToArray(Crc32(0, data), buffer + 8);
+  return fingerprint;
+}
+
+}  // namespace client
+}  // namespace fcp
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FCP_CLIENT_JOURNAL_FILE_H_
+#define FCP_CLIENT_JOURNAL_FILE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace fcp {
+namespace client {
+
+// An append-only file of records, used to journal the changes made to a
+// snapshot file (e.g. a ProtoDataStore) since that snapshot was last written,
+// so that small changes don't require the whole snapshot to be rewritten.
+//
+// Each record consists of a kind byte, the size of its payload, a CRC-32 of the
+// kind and payload, and the payload itself, so that a partially written record
+// at the end of the journal (e.g. after a crash) is detected and dropped.
+//
+// Every journal starts with a header record, whose payload identifies the
+// snapshot the journal applies to (see `GetFileFingerprint`). This way, a
+// journal which was already folded into a newer snapshot (e.g. because a crash
+// happened after the snapshot was rewritten, but before the journal was reset)
+// is never replayed on top of that snapshot again.
+//
+// Each append is synced to disk (via fsync) before it returns, so that a
+// committed record survives a crash or power loss. Callers with many small
+// changes should batch them into a single `AppendEncoded` call.
+//
+// This class is not thread-safe.
+class JournalFile {
+ public:
+  // The kind of the header record. Other records must use a different kind.
+  static constexpr char kHeaderRecordKind = 1;
+
+  explicit JournalFile(std::string path) : path_(std::move(path)) {}
+  ~JournalFile() { Close(); }
+
+  JournalFile(const JournalFile&) = delete;
+  JournalFile& operator=(const JournalFile&) = delete;
+
+  // Opens the journal (creating it if necessary), and calls `apply` for each
+  // record following the header, in order. If the journal doesn't start with a
+  // header matching `header`, it is reset instead (see `Reset`), and no records
+  // are applied. Replay stops at the first incomplete or corrupt record, or
+  // once `apply` returns false, and the rest of the journal is truncated.
+  absl::Status Load(
+      absl::string_view header,
+      const std::function<bool(char kind, absl::string_view payload)>& apply);
+
+  // Empties the journal (opening or creating it if necessary), and writes a new
+  // header record with the given payload.
+  absl::Status Reset(absl::string_view header);
+
+  // Appends a single record to the journal. Returns FAILED_PRECONDITION if the
+  // journal hasn't been (successfully) loaded or reset before.
+  absl::Status Append(char kind, absl::string_view payload);
+
+  // Appends one or more records previously encoded by `EncodeRecord` at once.
+  // If appending fails, none of the records are kept.
+  absl::Status AppendEncoded(absl::string_view records);
+
+  // Closes the journal file, if it is open.
+  void Close();
+
+  // Returns the size of the journal, including its header.
+  int64_t size_bytes() const { return size_bytes_; }
+
+  // Encodes a single record, for use with `AppendEncoded`.
+  static std::string EncodeRecord(char kind, absl::string_view payload);
+
+ private:
+  absl::Status Open();
+
+  const std::string path_;
+  int fd_ = -1;
+  int64_t size_bytes_ = 0;
+};
+
+// Returns a fingerprint of the given data (its size and CRC-32), for use as a
+// journal header.
+std::string GetFingerprint(absl::string_view data);
+
+// Returns the fingerprint (see `GetFingerprint`) of the given file's contents.
+absl::StatusOr<std::string> GetFileFingerprint(const std::string& path);
+
+}  // namespace client
+}  // namespace fcp
+
+#endif  // FCP_CLIENT_JOURNAL_FILE_H_
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fcp/client/journal_file.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/string_view.h"
+#include "fcp/testing/testing.h"
+
+namespace fcp {
+namespace client {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Pair;
+
+constexpr char kHeader[] = "header";
+constexpr char kRecordKind = 2;
+
+class JournalFileTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = (std::filesystem::path(testing::TempDir()) / "test.journal")
+                .generic_string();
+  }
+
+  void TearDown() override { std::filesystem::remove(path_); }
+
+  // Loads the journal at `path_`, and returns the records that were replayed.
+  std::vector<std::pair<char, std::string>> LoadRecords(
+      absl::string_view header) {
+    JournalFile journal(path_);
+    std::vector<std::pair<char, std::string>> records;
+    EXPECT_OK(journal.Load(header,
+                           [&records](char kind, absl::string_view payload) {
+                             records.emplace_back(kind, std::string(payload));
+                             return true;
+                           }));
+    return records;
+  }
+
+  std::string path_;
+};
+
+TEST_F(JournalFileTest, LoadCreatesEmptyJournal) {
+  JournalFile journal(path_);
+  ASSERT_OK(journal.Load(kHeader, [](char, absl::string_view) {
+    ADD_FAILURE() << "No records expected";
+    return true;
+  }));
+  EXPECT_EQ(journal.size_bytes(), std::filesystem::file_size(path_));
+  EXPECT_THAT(LoadRecords(kHeader), IsEmpty());
+}
+
+TEST_F(JournalFileTest, AppendedRecordsAreReplayed) {
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Reset(kHeader));
+    ASSERT_OK(journal.Append(kRecordKind, "first"));
+    ASSERT_OK(journal.AppendEncoded(
+        JournalFile::EncodeRecord(kRecordKind, "second") +
+        JournalFile::EncodeRecord(kRecordKind + 1, "third")));
+    EXPECT_EQ(journal.size_bytes(), std::filesystem::file_size(path_));
+  }
+  EXPECT_THAT(LoadRecords(kHeader),
+              ElementsAre(Pair(kRecordKind, "first"),
+                          Pair(kRecordKind, "second"),
+                          Pair(kRecordKind + 1, "third")));
+}
+
+TEST_F(JournalFileTest, JournalWithDifferentHeaderIsReset) {
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Reset("old header"));
+    ASSERT_OK(journal.Append(kRecordKind, "record"));
+  }
+  EXPECT_THAT(LoadRecords(kHeader), IsEmpty());
+  // The journal now belongs to the new header.
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Load(kHeader, [](char, absl::string_view) {
+      return true;
+    }));
+    ASSERT_OK(journal.Append(kRecordKind, "record"));
+  }
+  EXPECT_THAT(LoadRecords(kHeader), ElementsAre(Pair(kRecordKind, "record")));
+}
+
+TEST_F(JournalFileTest, IncompleteRecordIsDropped) {
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Reset(kHeader));
+    ASSERT_OK(journal.Append(kRecordKind, "complete"));
+  }
+  // Simulate a crash in the middle of appending a record.
+  std::string torn_record = JournalFile::EncodeRecord(kRecordKind, "torn");
+  torn_record.resize(torn_record.size() - 1);
+  std::ofstream(path_, std::ios::binary | std::ios::app) << torn_record;
+
+  EXPECT_THAT(LoadRecords(kHeader),
+              ElementsAre(Pair(kRecordKind, "complete")));
+  // The incomplete record was truncated, so that records appended after it are
+  // replayed again.
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Load(kHeader, [](char, absl::string_view) {
+      return true;
+    }));
+    ASSERT_OK(journal.Append(kRecordKind, "next"));
+  }
+  EXPECT_THAT(LoadRecords(kHeader), ElementsAre(Pair(kRecordKind, "complete"),
+                                                Pair(kRecordKind, "next")));
+}
+
+TEST_F(JournalFileTest, ReplayStopsAtRejectedRecord) {
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Reset(kHeader));
+    ASSERT_OK(journal.Append(kRecordKind, "accepted"));
+    ASSERT_OK(journal.Append(kRecordKind + 1, "rejected"));
+    ASSERT_OK(journal.Append(kRecordKind, "after rejected"));
+  }
+  {
+    JournalFile journal(path_);
+    ASSERT_OK(journal.Load(kHeader, [](char kind, absl::string_view) {
+      return kind == kRecordKind;
+    }));
+  }
+  EXPECT_THAT(LoadRecords(kHeader),
+              ElementsAre(Pair(kRecordKind, "accepted")));
+}
+
+TEST_F(JournalFileTest, FingerprintChangesWithContents) {
+  std::ofstream(path_, std::ios::binary | std::ios::trunc) << "contents";
+  absl::StatusOr<std::string> fingerprint = GetFileFingerprint(path_);
+  ASSERT_OK(fingerprint);
+  absl::StatusOr<std::string> same_fingerprint = GetFileFingerprint(path_);
+  ASSERT_OK(same_fingerprint);
+  EXPECT_EQ(*same_fingerprint, *fingerprint);
+
+  std::ofstream(path_, std::ios::binary | std::ios::trunc) << "Contents";
+  absl::StatusOr<std::string> new_fingerprint = GetFileFingerprint(path_);
+  ASSERT_OK(new_fingerprint);
+  EXPECT_NE(*new_fingerprint, *fingerprint);
+
+  EXPECT_THAT(GetFileFingerprint(path_ + ".missing"), IsCode(INTERNAL));
+  // The fingerprint of a file is that of its contents.
+  EXPECT_EQ(GetFingerprint("Contents"), *new_fingerprint);
+}
+
+}  // namespace
+}  // namespace client
+}  // namespace fcp
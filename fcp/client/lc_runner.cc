@@ -17,6 +17,7 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 
@@ -25,6 +26,7 @@
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/base/platform.h"
+#include "fcp/client/cache/file_backed_resource_cache.h"
 #include "fcp/client/engine/example_iterator_factory.h"
 #include "fcp/client/engine/plan_engine_helpers.h"
 
@@ -147,8 +149,9 @@ absl::Status RunPlanWithTensorflowSpec(
     std::vector<engine::ExampleIteratorFactory*> example_iterator_factories,
     std::function<bool()> should_abort, LogManager* log_manager,
     OpStatsLogger* opstats_logger, const Flags* flags,
-    const ClientOnlyPlan& client_plan, const std::string& input_dir_uri,
+    ClientOnlyPlan& client_plan, const std::string& input_dir_uri,
     const std::string& output_dir_uri,
+    cache::FileBackedResourceCache* tflite_model_cache,
     const fcp::client::InterruptibleRunner::TimingConfig& timing_config,
     const absl::Time run_plan_start_time, const absl::Time reference_time) {
   // Check that this is a TensorflowSpec-based plan for local computation.
@@ -178,8 +181,9 @@ absl::Status RunPlanWithTensorflowSpec(
     engine::TfLitePlanEngine plan_engine(example_iterator_factories,
                                          should_abort, log_manager,
                                          opstats_logger, flags, &timing_config);
-    engine::PlanResult plan_result = plan_engine.RunPlan(
-        client_plan.phase().tensorflow_spec(), client_plan.tflite_graph(),
+    engine::PlanResult plan_result = plan_engine.RunPlanFromResourceCache(
+        client_plan.phase().tensorflow_spec(),
+        std::move(*client_plan.mutable_tflite_graph()), tflite_model_cache,
         std::move(inputs), output_names_unused);
     engine::PlanOutcome outcome = plan_result.outcome;
     LogComputationOutcome(std::move(plan_result), phase_logger,
@@ -194,7 +198,7 @@ absl::Status RunPlanWithTensorflowSpec(
   auto inputs = ConstructInputsForTensorflowSpecPlan(
       client_plan.phase().local_compute(), input_dir_uri, output_dir_uri);
   engine::SimplePlanEngine plan_engine(example_iterator_factories, should_abort,
-                                       log_manager, opstats_logger,
+                                       log_manager, opstats_logger, flags,
                                        &timing_config);
   engine::PlanResult plan_result = plan_engine.RunPlan(
       client_plan.phase().tensorflow_spec(), client_plan.graph(),
@@ -270,6 +274,7 @@ absl::Status RunLocalComputation(
           flags->tf_execution_teardown_grace_period_millis()),
       .extended_shutdown_period = absl::Milliseconds(
           flags->tf_execution_teardown_extended_period_millis()),
+      .abort_signal = env_deps->GetAbortSignal(),
   };
 
   absl::Time run_plan_start_time = absl::Now();
@@ -291,12 +296,19 @@ absl::Status RunLocalComputation(
     return error_status;
   }
 
+  std::unique_ptr<cache::FileBackedResourceCache> tflite_model_cache;
+#ifdef FCP_CLIENT_SUPPORT_TFLITE
+  tflite_model_cache =
+      engine::CreateTfLiteModelCache(env_deps, log_manager, flags);
+#endif
+
   std::vector<std::string> output_names;
   std::vector<tensorflow::Tensor> output_tensors;
   return RunPlanWithTensorflowSpec(
       phase_logger, example_iterator_factories, should_abort, log_manager,
-      opstats_logger, flags, plan, input_dir_uri, output_dir_uri, timing_config,
-      run_plan_start_time, reference_time);
+      opstats_logger, flags, plan, input_dir_uri, output_dir_uri,
+      tflite_model_cache.get(), timing_config, run_plan_start_time,
+      reference_time);
 }
 
 }  // namespace client
@@ -17,6 +17,8 @@
 #define FCP_CLIENT_OPSTATS_OPSTATS_DB_H_
 
 #include <functional>
+#include <memory>
+#include <utility>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -37,6 +39,33 @@ class OpStatsDb {
   // sequentially (first run to last run) within OpStatsSequence.
   virtual absl::StatusOr<OpStatsSequence> Read() { return OpStatsSequence(); }
 
+  // Reads the runs for which a selection function returns true one at a time,
+  // from the latest run to the earliest one.
+  class RunReader {
+   public:
+    virtual ~RunReader() = default;
+    // Returns the next (i.e. the next earlier) selected run, or OUT_OF_RANGE
+    // once there are no more selected runs.
+    virtual absl::StatusOr<OperationalStats> Next() = 0;
+    // The earliest trustworthy time of the data, as of when the reader was
+    // created.
+    virtual const google::protobuf::Timestamp& earliest_trustworthy_time()
+        const = 0;
+  };
+
+  // Returns a reader over the runs for which `select` returns true, from the
+  // latest run to the earliest one. Runs committed after the reader was
+  // created are not returned. By default this reads all the data via `Read()`
+  // upfront; implementations can override this to read the runs lazily
+  // instead. The reader must not outlive the db.
+  virtual absl::StatusOr<std::unique_ptr<RunReader>> ReadRuns(
+      std::function<bool(const OperationalStats&)> select) {
+    absl::StatusOr<OpStatsSequence> data = Read();
+    if (!data.ok()) return data.status();
+    return std::make_unique<SequenceRunReader>(*std::move(data),
+                                               std::move(select));
+  }
+
   // OpStatsDb has a Transform method instead of a Write method because
   // OpStatsSequence message already contains the operational stats for every
   // run, and the user only need to update the existing OpStatsSequence message
@@ -45,6 +74,53 @@ class OpStatsDb {
   virtual absl::Status Transform(std::function<void(OpStatsSequence&)> func) {
     return absl::OkStatus();
   }
+
+  // Commits the operational stats of the current run: if `is_new_run` is true
+  // they are added as the latest run, otherwise they replace the latest run
+  // (or, if the db has somehow been cleared since the run was first committed,
+  // e.g. due to a very low ttl, they are added again). Implementations can
+  // override this to avoid rewriting the stats of all previous runs.
+  virtual absl::Status CommitRun(const OperationalStats& stats,
+                                 bool is_new_run) {
+    return Transform([&stats, is_new_run](OpStatsSequence& data) {
+      if (is_new_run || data.opstats().empty()) {
+        *data.add_opstats() = stats;
+      } else {
+        *data.mutable_opstats(data.opstats_size() - 1) = stats;
+      }
+    });
+  }
+
+ private:
+  // A reader over an OpStatsSequence which was read upfront.
+  class SequenceRunReader : public RunReader {
+   public:
+    SequenceRunReader(OpStatsSequence data,
+                      std::function<bool(const OperationalStats&)> select)
+        : data_(std::move(data)),
+          select_(std::move(select)),
+          next_(data_.opstats_size() - 1) {}
+
+    absl::StatusOr<OperationalStats> Next() override {
+      for (; next_ >= 0; --next_) {
+        if (select_(data_.opstats(next_))) {
+          return std::move(*data_.mutable_opstats(next_--));
+        }
+      }
+      return absl::OutOfRangeError("No more runs.");
+    }
+
+    const google::protobuf::Timestamp& earliest_trustworthy_time()
+        const override {
+      return data_.earliest_trustworthy_time();
+    }
+
+   private:
+    OpStatsSequence data_;
+    std::function<bool(const OperationalStats&)> select_;
+    // The index of the next run to be considered, or -1 once all runs were.
+    int next_;
+  };
 };
 
 }  // namespace opstats
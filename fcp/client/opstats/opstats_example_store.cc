@@ -21,10 +21,15 @@
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/util/time_util.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fcp/base/monitoring.h"
 #include "fcp/client/diag_codes.pb.h"
 #include "fcp/client/engine/example_iterator_factory.h"
+#include "fcp/client/opstats/opstats_db.h"
 #include "fcp/client/simple_task_environment.h"
 #include "fcp/protos/federated_api.pb.h"
 #include "fcp/protos/opstats.pb.h"
@@ -49,132 +54,161 @@ absl::Time GetLastUpdatedTime(const OperationalStats& op_stats) {
   }
 }
 
-tensorflow::Feature CreateFeatureFromString(const std::string& str) {
-  tensorflow::Feature feature;
-  feature.mutable_bytes_list()->add_value(str);
-  return feature;
-}
+// Builds the serialized tensorflow::Example for each OperationalStats message.
+//
+// The Example and its features are allocated only once, and are then refilled
+// for every run, so that the repeated fields' capacity is reused rather than
+// reallocated for every example.
+class OpStatsExampleBuilder {
+ public:
+  OpStatsExampleBuilder(int64_t earliest_trustworthy_time,
+                        bool enable_per_phase_network_stats) {
+    auto* feature_map = example_.mutable_features()->mutable_feature();
+    population_name_ = (*feature_map)[kPopulationName].mutable_bytes_list();
+    session_name_ = (*feature_map)[kSessionName].mutable_bytes_list();
+    task_name_ = (*feature_map)[kTaskName].mutable_bytes_list();
+    event_types_ = (*feature_map)[kEventsEventType].mutable_int64_list();
+    event_time_millis_ =
+        (*feature_map)[kEventsTimestampMillis].mutable_int64_list();
+    dataset_uris_ = (*feature_map)[kDatasetStatsUri].mutable_bytes_list();
+    dataset_num_examples_read_ =
+        (*feature_map)[kDatasetStatsNumExamplesRead].mutable_int64_list();
+    dataset_num_bytes_read_ =
+        (*feature_map)[kDatasetStatsNumBytesRead].mutable_int64_list();
+    error_message_ = (*feature_map)[kErrorMessage].mutable_bytes_list();
+    retry_window_delay_min_ =
+        (*feature_map)[kRetryWindowDelayMinMillis].mutable_int64_list();
+    retry_window_delay_max_ =
+        (*feature_map)[kRetryWindowDelayMaxMillis].mutable_int64_list();
+    bytes_downloaded_ = (*feature_map)[kBytesDownloaded].mutable_int64_list();
+    bytes_uploaded_ = (*feature_map)[kBytesUploaded].mutable_int64_list();
+    chunking_layer_bytes_downloaded_ =
+        (*feature_map)[kChunkingLayerBytesDownloaded].mutable_int64_list();
+    chunking_layer_bytes_uploaded_ =
+        (*feature_map)[kChunkingLayerBytesUploaded].mutable_int64_list();
+    if (enable_per_phase_network_stats) {
+      network_duration_ =
+          (*feature_map)[kNetworkDuration].mutable_int64_list();
+    }
+    (*feature_map)[kEarliestTrustWorthyTimeMillis]
+        .mutable_int64_list()
+        ->add_value(earliest_trustworthy_time);
+  }
 
-tensorflow::Feature CreateFeatureFromInt(int64_t value) {
-  tensorflow::Feature feature;
-  feature.mutable_int64_list()->add_value(value);
-  return feature;
-}
+  std::string Build(const OperationalStats& op_stats) {
+    SetString(op_stats.population_name(), population_name_);
+    SetString(op_stats.session_name(), session_name_);
+    SetString(op_stats.task_name(), task_name_);
 
-tensorflow::Feature CreateFeatureFromStringVector(
-    const std::vector<std::string>& values) {
-  tensorflow::Feature feature;
-  auto* bytes_list = feature.mutable_bytes_list();
-  for (const auto& value : values) {
-    bytes_list->add_value(value);
-  }
-  return feature;
-}
+    // Events related features.
+    event_types_->clear_value();
+    event_time_millis_->clear_value();
+    for (const auto& event : op_stats.events()) {
+      event_types_->add_value(event.event_type());
+      event_time_millis_->add_value(
+          TimeUtil::TimestampToMilliseconds(event.timestamp()));
+    }
 
-tensorflow::Feature CreateFeatureFromIntVector(
-    const std::vector<int64_t>& values) {
-  tensorflow::Feature feature;
-  auto* int64_list = feature.mutable_int64_list();
-  for (const auto& value : values) {
-    int64_list->add_value(value);
-  }
-  return feature;
-}
+    // External dataset stats related features.
+    dataset_uris_->clear_value();
+    dataset_num_examples_read_->clear_value();
+    dataset_num_bytes_read_->clear_value();
+    for (const auto& stats : op_stats.dataset_stats()) {
+      dataset_uris_->add_value(stats.first);
+      dataset_num_examples_read_->add_value(stats.second.num_examples_read());
+      dataset_num_bytes_read_->add_value(stats.second.num_bytes_read());
+    }
 
-std::string CreateExample(const OperationalStats& op_stats,
-                          int64_t earliest_trustworthy_time,
-                          bool enable_per_phase_network_stats) {
-  tensorflow::Example example;
-  auto* feature_map = example.mutable_features()->mutable_feature();
-  (*feature_map)[kPopulationName] =
-      CreateFeatureFromString(op_stats.population_name());
-  (*feature_map)[kSessionName] =
-      CreateFeatureFromString(op_stats.session_name());
-  (*feature_map)[kTaskName] = CreateFeatureFromString(op_stats.task_name());
-
-  // Create events related features.
-  std::vector<int64_t> event_types;
-  std::vector<int64_t> event_time_millis;
-  for (const auto& event : op_stats.events()) {
-    event_types.push_back(event.event_type());
-    event_time_millis.push_back(
-        TimeUtil::TimestampToMilliseconds(event.timestamp()));
-  }
-  (*feature_map)[kEventsEventType] = CreateFeatureFromIntVector(event_types);
-  (*feature_map)[kEventsTimestampMillis] =
-      CreateFeatureFromIntVector(event_time_millis);
-
-  // Create external dataset stats related features.
-  std::vector<std::string> uris;
-  std::vector<int64_t> num_examples_read;
-  std::vector<int64_t> num_bytes_read;
-  for (const auto& stats : op_stats.dataset_stats()) {
-    uris.push_back(stats.first);
-    num_examples_read.push_back(stats.second.num_examples_read());
-    num_bytes_read.push_back(stats.second.num_bytes_read());
+    SetString(op_stats.error_message(), error_message_);
+
+    // RetryWindow related features.
+    SetInt(
+        TimeUtil::DurationToMilliseconds(op_stats.retry_window().delay_min()),
+        retry_window_delay_min_);
+    SetInt(
+        TimeUtil::DurationToMilliseconds(op_stats.retry_window().delay_max()),
+        retry_window_delay_max_);
+
+    SetInt(op_stats.bytes_downloaded(), bytes_downloaded_);
+    SetInt(op_stats.bytes_uploaded(), bytes_uploaded_);
+    SetInt(op_stats.chunking_layer_bytes_downloaded(),
+           chunking_layer_bytes_downloaded_);
+    SetInt(op_stats.chunking_layer_bytes_uploaded(),
+           chunking_layer_bytes_uploaded_);
+    if (network_duration_ != nullptr) {
+      SetInt(TimeUtil::DurationToMilliseconds(op_stats.network_duration()),
+             network_duration_);
+    }
+
+    return example_.SerializeAsString();
   }
-  (*feature_map)[kDatasetStatsUri] = CreateFeatureFromStringVector(uris);
-  (*feature_map)[kDatasetStatsNumExamplesRead] =
-      CreateFeatureFromIntVector(num_examples_read);
-  (*feature_map)[kDatasetStatsNumBytesRead] =
-      CreateFeatureFromIntVector(num_bytes_read);
-
-  (*feature_map)[kErrorMessage] =
-      CreateFeatureFromString(op_stats.error_message());
-
-  // Create RetryWindow related features.
-  (*feature_map)[kRetryWindowDelayMinMillis] = CreateFeatureFromInt(
-      TimeUtil::DurationToMilliseconds(op_stats.retry_window().delay_min()));
-  (*feature_map)[kRetryWindowDelayMaxMillis] = CreateFeatureFromInt(
-      TimeUtil::DurationToMilliseconds(op_stats.retry_window().delay_max()));
-
-  (*feature_map)[kBytesDownloaded] =
-      CreateFeatureFromInt(op_stats.bytes_downloaded());
-  (*feature_map)[kBytesUploaded] =
-      CreateFeatureFromInt(op_stats.bytes_uploaded());
-  (*feature_map)[kChunkingLayerBytesDownloaded] =
-      CreateFeatureFromInt(op_stats.chunking_layer_bytes_downloaded());
-  (*feature_map)[kChunkingLayerBytesUploaded] =
-      CreateFeatureFromInt(op_stats.chunking_layer_bytes_uploaded());
-  if (enable_per_phase_network_stats) {
-    (*feature_map)[kNetworkDuration] = CreateFeatureFromInt(
-        TimeUtil::DurationToMilliseconds(op_stats.network_duration()));
+
+ private:
+  static void SetString(const std::string& value,
+                        tensorflow::BytesList* list) {
+    list->clear_value();
+    list->add_value(value);
   }
 
-  (*feature_map)[kEarliestTrustWorthyTimeMillis] =
-      CreateFeatureFromInt(earliest_trustworthy_time);
+  static void SetInt(int64_t value, tensorflow::Int64List* list) {
+    list->clear_value();
+    list->add_value(value);
+  }
 
-  return example.SerializeAsString();
-}
+  tensorflow::Example example_;
+  // Pointers into `example_`'s feature map, which retains its entries for as
+  // long as `example_` is alive.
+  tensorflow::BytesList* population_name_;
+  tensorflow::BytesList* session_name_;
+  tensorflow::BytesList* task_name_;
+  tensorflow::Int64List* event_types_;
+  tensorflow::Int64List* event_time_millis_;
+  tensorflow::BytesList* dataset_uris_;
+  tensorflow::Int64List* dataset_num_examples_read_;
+  tensorflow::Int64List* dataset_num_bytes_read_;
+  tensorflow::BytesList* error_message_;
+  tensorflow::Int64List* retry_window_delay_min_;
+  tensorflow::Int64List* retry_window_delay_max_;
+  tensorflow::Int64List* bytes_downloaded_;
+  tensorflow::Int64List* bytes_uploaded_;
+  tensorflow::Int64List* chunking_layer_bytes_downloaded_;
+  tensorflow::Int64List* chunking_layer_bytes_uploaded_;
+  // Only set if per phase network stats are enabled.
+  tensorflow::Int64List* network_duration_ = nullptr;
+};
 
+// Iterates over the runs in the db in last in, first out order, skipping the
+// runs that were last updated outside of the selected time range.
+//
+// The runs are read from the db one at a time, as `Next()` is called, rather
+// than copying the whole history (or even just the selected runs) upfront.
 class OpStatsExampleIterator : public fcp::client::ExampleIterator {
  public:
-  explicit OpStatsExampleIterator(std::vector<OperationalStats> op_stats,
-                                  int64_t earliest_trustworthy_time,
-                                  bool enable_per_phase_network_stats)
-      : next_(0),
-        data_(std::move(op_stats)),
-        earliest_trustworthy_time_millis_(earliest_trustworthy_time),
-        enable_per_phase_network_stats_(enable_per_phase_network_stats) {}
+  OpStatsExampleIterator(std::unique_ptr<OpStatsDb::RunReader> run_reader,
+                         bool enable_per_phase_network_stats)
+      : run_reader_(std::move(run_reader)),
+        example_builder_(TimeUtil::TimestampToMilliseconds(
+                             run_reader_->earliest_trustworthy_time()),
+                         enable_per_phase_network_stats) {}
+
   absl::StatusOr<std::string> Next() override {
-    if (next_ < 0 || next_ >= data_.size()) {
+    if (run_reader_ == nullptr) {
+      return absl::OutOfRangeError("The iterator is out of range.");
+    }
+    absl::StatusOr<OperationalStats> op_stats = run_reader_->Next();
+    if (absl::IsOutOfRange(op_stats.status())) {
+      run_reader_ = nullptr;
       return absl::OutOfRangeError("The iterator is out of range.");
     }
-    return CreateExample(data_[next_++], earliest_trustworthy_time_millis_,
-                         enable_per_phase_network_stats_);
+    FCP_RETURN_IF_ERROR(op_stats.status());
+    return example_builder_.Build(*op_stats);
   }
 
-  void Close() override {
-    next_ = 0;
-    data_.clear();
-  }
+  void Close() override { run_reader_ = nullptr; }
 
  private:
-  // The index for the next OperationalStats to be used.
-  int next_;
-  std::vector<OperationalStats> data_;
-  const int64_t earliest_trustworthy_time_millis_;
-  const bool enable_per_phase_network_stats_;
+  std::unique_ptr<OpStatsDb::RunReader> run_reader_;
+  OpStatsExampleBuilder example_builder_;
 };
 
 }  // anonymous namespace
@@ -223,20 +257,16 @@ OpStatsExampleIteratorFactory::CreateExampleIterator(
     }
   }
 
-  FCP_ASSIGN_OR_RETURN(OpStatsSequence data,
-                       op_stats_logger_->GetOpStatsDb()->Read());
-  std::vector<OperationalStats> selected_data;
-  for (auto it = data.opstats().rbegin(); it != data.opstats().rend(); ++it) {
-    absl::Time last_update_time = GetLastUpdatedTime(*it);
-    if (last_update_time >= lower_bound_time &&
-        last_update_time <= upper_bound_time) {
-      selected_data.push_back(*it);
-    }
-  }
+  FCP_ASSIGN_OR_RETURN(
+      std::unique_ptr<OpStatsDb::RunReader> run_reader,
+      op_stats_logger_->GetOpStatsDb()->ReadRuns(
+          [lower_bound_time, upper_bound_time](const OperationalStats& run) {
+            absl::Time last_update_time = GetLastUpdatedTime(run);
+            return last_update_time >= lower_bound_time &&
+                   last_update_time <= upper_bound_time;
+          }));
   return std::make_unique<OpStatsExampleIterator>(
-      std::move(selected_data),
-      TimeUtil::TimestampToMilliseconds(data.earliest_trustworthy_time()),
-      enable_per_phase_network_stats_);
+      std::move(run_reader), enable_per_phase_network_stats_);
 }
 
 }  // namespace opstats
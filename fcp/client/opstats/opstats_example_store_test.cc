@@ -348,6 +348,58 @@ TEST_F(OpStatsExampleStoreTest, SelectionCriteriaOnlyContainsEndTime) {
   EXPECT_THAT(example_or.status(), IsCode(absl::StatusCode::kOutOfRange));
 }
 
+TEST_F(OpStatsExampleStoreTest, ExamplesDoNotContainDataOfPreviousRuns) {
+  OperationalStats older;
+  older.set_session_name("older");
+  older.mutable_events()->Add(CreateEvent(
+      OperationalStats::Event::EVENT_KIND_COMPUTATION_STARTED, 1000L));
+
+  OperationalStats newer;
+  newer.set_session_name("newer");
+  newer.set_error_message("error");
+  newer.mutable_events()->Add(CreateEvent(
+      OperationalStats::Event::EVENT_KIND_COMPUTATION_STARTED, 2000L));
+  newer.mutable_events()->Add(CreateEvent(
+      OperationalStats::Event::EVENT_KIND_COMPUTATION_FINISHED, 2500L));
+  (*newer.mutable_dataset_stats())["app:/train"] = CreateDatasetStats(10, 100);
+
+  OpStatsSequence opstats_sequence;
+  *opstats_sequence.add_opstats() = std::move(older);
+  *opstats_sequence.add_opstats() = std::move(newer);
+  EXPECT_CALL(mock_db_, Read()).WillOnce(Return(opstats_sequence));
+
+  ExampleSelector selector;
+  selector.set_collection_uri(kOpStatsCollectionUri);
+  absl::StatusOr<std::unique_ptr<ExampleIterator>> iterator_or =
+      iterator_factory_.CreateExampleIterator(selector);
+  ASSERT_TRUE(iterator_or.ok());
+  std::unique_ptr<ExampleIterator> iterator = std::move(iterator_or.value());
+
+  absl::StatusOr<std::string> example_or = iterator->Next();
+  ASSERT_TRUE(example_or.ok());
+  tensorflow::Example example;
+  ASSERT_TRUE(example.ParseFromString(example_or.value()));
+  EXPECT_EQ(ExtractSingleString(example, kSessionName), "newer");
+  EXPECT_EQ(ExtractRepeatedInt64(example, kEventsTimestampMillis).size(), 2);
+  EXPECT_EQ(ExtractRepeatedString(example, kDatasetStatsUri).size(), 1);
+
+  // The second example must only contain the data of the older run.
+  example_or = iterator->Next();
+  ASSERT_TRUE(example_or.ok());
+  ASSERT_TRUE(example.ParseFromString(example_or.value()));
+  EXPECT_EQ(ExtractSingleString(example, kSessionName), "older");
+  EXPECT_EQ(ExtractSingleString(example, kErrorMessage), "");
+  auto event_times = ExtractRepeatedInt64(example, kEventsTimestampMillis);
+  ASSERT_EQ(event_times.size(), 1);
+  EXPECT_EQ(event_times.at(0), 1000);
+  EXPECT_TRUE(ExtractRepeatedString(example, kDatasetStatsUri).empty());
+  EXPECT_TRUE(
+      ExtractRepeatedInt64(example, kDatasetStatsNumExamplesRead).empty());
+
+  example_or = iterator->Next();
+  EXPECT_THAT(example_or.status(), IsCode(absl::StatusCode::kOutOfRange));
+}
+
 TEST_F(OpStatsExampleStoreTest, FullSerialization) {
   OperationalStats stats;
   // Set singular fields
@@ -101,6 +101,10 @@ void OpStatsLoggerImpl::SetNetworkStats(const NetworkStats& network_stats) {
   if (enable_per_phase_network_stats_) {
     *stats_.mutable_network_duration() =
         TimeUtil::ConvertAbslToProtoDuration(network_stats.network_duration);
+    stats_.set_operation_poll_count(network_stats.operation_poll_count);
+    *stats_.mutable_operation_polling_duration() =
+        TimeUtil::ConvertAbslToProtoDuration(
+            network_stats.operation_polling_duration);
   }
 }
 
@@ -121,24 +125,7 @@ absl::Status OpStatsLoggerImpl::CommitToStorage() {
   absl::MutexLock lock(&mutex_);
   log_manager_->LogDiag(ProdDiagCode::OPSTATS_DB_COMMIT_ATTEMPTED);
   const absl::Time before_commit_time = absl::Now();
-  auto status = already_committed_
-                    ? db_->Transform([stats = &stats_](OpStatsSequence& data) {
-                        // Check if opstats on disk somehow got cleared between
-                        // the first commit and now, and handle appropriately.
-                        // This can happen e.g. if the ttl for the opstats db
-                        // is incorrectly configured to have a very low ttl,
-                        // causing the entire history to be lost as part of the
-                        // update.
-                        if (data.opstats_size() == 0) {
-                          *data.add_opstats() = *stats;
-                        } else {
-                          *data.mutable_opstats(data.opstats_size() - 1) =
-                              *stats;
-                        }
-                      })
-                    : db_->Transform([stats = &stats_](OpStatsSequence& data) {
-                        *data.add_opstats() = *stats;
-                      });
+  auto status = db_->CommitRun(stats_, /*is_new_run=*/!already_committed_);
   const absl::Time after_commit_time = absl::Now();
   log_manager_->LogToLongHistogram(
       HistogramCounters::TRAINING_OPSTATS_COMMIT_LATENCY,
@@ -462,7 +462,9 @@ TEST_F(OpStatsLoggerImplTest, SetNetworkStatsWithPerPhaseStatsOn) {
        .bytes_uploaded = 201,
        .chunking_layer_bytes_received = 202,
        .chunking_layer_bytes_sent = 203,
-       .network_duration = absl::Milliseconds(204)});
+       .network_duration = absl::Milliseconds(204),
+       .operation_poll_count = 205,
+       .operation_polling_duration = absl::Milliseconds(206)});
   opstats_logger.reset();
 
   auto db = PdsBackedOpStatsDb::Create(
@@ -482,6 +484,9 @@ TEST_F(OpStatsLoggerImplTest, SetNetworkStatsWithPerPhaseStatsOn) {
   // The new network_duration field should be set now.
   new_opstats->mutable_network_duration()->set_nanos(
       static_cast<int32_t>(absl::ToInt64Nanoseconds(absl::Milliseconds(204))));
+  new_opstats->set_operation_poll_count(205);
+  new_opstats->mutable_operation_polling_duration()->set_nanos(
+      static_cast<int32_t>(absl::ToInt64Nanoseconds(absl::Milliseconds(206))));
 
   (*data).clear_earliest_trustworthy_time();
   EXPECT_THAT(*data, EqualsProto(expected));
@@ -17,17 +17,27 @@
 
 #include <fcntl.h>
 #include <sys/file.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "google/protobuf/util/time_util.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
+#include "fcp/base/scheduler.h"
 #include "fcp/client/diag_codes.pb.h"
+#include "fcp/client/journal_file.h"
 #include "fcp/client/log_manager.h"
 #include "protostore/file-storage.h"
 #include "protostore/proto-data-store.h"
@@ -37,8 +47,19 @@ namespace client {
 namespace opstats {
 namespace {
 
+using ::google::protobuf::io::CodedOutputStream;
 using ::google::protobuf::util::TimeUtil;
 
+// The kinds of journal records. The journal header is the fingerprint of the
+// snapshot the journal applies to. The payload of the other records is a
+// serialized OperationalStats message.
+constexpr char kJournalAppendRun = 2;
+constexpr char kJournalReplaceLatestRun = 3;
+// The journal is only compacted because of its size once it is larger than
+// both this and the data itself, so that its size stays proportional to the
+// data while compactions remain rare.
+constexpr int64_t kMinJournalSizeForCompaction = 64 * 1024;
+
 ABSL_CONST_INIT absl::Mutex file_lock_mutex(absl::kConstInit);
 
 absl::flat_hash_set<std::string>* GetFilesInUseSet() {
@@ -99,31 +120,26 @@ std::unique_ptr<OpStatsSequence> CreateEmptyData() {
   return empty_data;
 }
 
-// Returns the data in the db, or an error from the read operation.
-absl::StatusOr<OpStatsSequence> ReadInternal(
-    protostore::ProtoDataStore<OpStatsSequence>& db, LogManager& log_manager) {
-  absl::StatusOr<const OpStatsSequence*> data = db.Read();
-  if (data.ok()) {
-    return *data.value();
-  } else {
-    log_manager.LogDiag(ProdDiagCode::OPSTATS_READ_FAILED);
-    return absl::InternalError(
-        absl::StrCat("Failed to read from database, with error message: ",
-                     data.status().message()));
+// Returns the fingerprint of a snapshot with the given data, for use as the
+// journal header. This is computed from the data in memory (serialized
+// deterministically), rather than from the snapshot file, so that writing a
+// snapshot doesn't require reading it back.
+std::string GetSnapshotFingerprint(const OpStatsSequence& data) {
+  std::string serialized;
+  {
+    google::protobuf::io::StringOutputStream string_output_stream(&serialized);
+    CodedOutputStream coded_output_stream(&string_output_stream);
+    coded_output_stream.SetSerializationDeterministic(true);
+    data.SerializeToCodedStream(&coded_output_stream);
   }
+  return GetFingerprint(serialized);
 }
 
-// Overwrites the db to contain an empty OpStatsSequence message.
-absl::Status ResetInternal(protostore::ProtoDataStore<OpStatsSequence>& db,
-                           LogManager& log_manager) {
-  absl::Status reset_status = db.Write(CreateEmptyData());
-  if (!reset_status.ok()) {
-    log_manager.LogDiag(ProdDiagCode::OPSTATS_RESET_FAILED);
-    return absl::InternalError(
-        absl::StrCat("Failed to reset the database, with error message: ",
-                     reset_status.code()));
-  }
-  return absl::OkStatus();
+// Returns the number of bytes a run with the given serialized size takes up in
+// a serialized OpStatsSequence, including its tag and length prefix.
+int64_t GetRunSize(size_t serialized_run_size) {
+  return 1 + CodedOutputStream::VarintSize64(serialized_run_size) +
+         serialized_run_size;
 }
 
 absl::Time GetLastUpdateTime(const OperationalStats& operational_stats) {
@@ -222,6 +238,7 @@ absl::StatusOr<std::unique_ptr<OpStatsDb>> PdsBackedOpStatsDb::Create(
     return absl::InternalError(
         absl::StrCat("Failed to create directory ", path.generic_string()));
   }
+  std::string journal_path = (path / kJournalFileName).generic_string();
   path /= kDbFileName;
   std::function<void()> lock_releaser;
   auto file_storage = std::make_unique<protostore::FileStorage>();
@@ -249,49 +266,349 @@ absl::StatusOr<std::unique_ptr<OpStatsDb>> PdsBackedOpStatsDb::Create(
       return write_status;
     }
   }
-  return absl::WrapUnique(
-      new PdsBackedOpStatsDb(std::move(pds), std::move(file_storage), ttl,
-                             log_manager, max_size_bytes, lock_releaser));
+  return absl::WrapUnique(new PdsBackedOpStatsDb(
+      std::move(pds), std::move(file_storage), journal_path, ttl,
+      log_manager, max_size_bytes, lock_releaser));
+}
+
+PdsBackedOpStatsDb::~PdsBackedOpStatsDb() {
+  // No other thread can be using this instance anymore, so no further
+  // compactions can be scheduled while waiting for the pending ones.
+  if (compaction_scheduler_ != nullptr) compaction_scheduler_->WaitUntilIdle();
+  {
+    absl::MutexLock lock(&mutex_);
+    journal_.Close();
+  }
+  lock_releaser_();
+}
+
+absl::Status PdsBackedOpStatsDb::LoadLocked() {
+  if (loaded_) return absl::OkStatus();
+  // The snapshot can't be read while a compaction is writing it.
+  WaitForCompactionLocked();
+  absl::Status status = LoadFromDiskLocked();
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::OPSTATS_READ_FAILED);
+    // Try resetting after a failed read.
+    FCP_RETURN_IF_ERROR(ResetLocked());
+    return absl::InternalError(
+        absl::StrCat("Failed to read from database, with error message: ",
+                     status.message()));
+  }
+  RebuildIndexLocked();
+  snapshot_outdated_ = false;
+  loaded_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status PdsBackedOpStatsDb::LoadFromDiskLocked() {
+  absl::StatusOr<const OpStatsSequence*> snapshot = db_->Read();
+  FCP_RETURN_IF_ERROR(snapshot.status());
+  data_ = **snapshot;
+  return journal_.Load(
+      GetSnapshotFingerprint(data_),
+      [this](char kind, absl::string_view payload) -> bool {
+        mutex_.AssertHeld();
+        OperationalStats run;
+        if ((kind != kJournalAppendRun && kind != kJournalReplaceLatestRun) ||
+            !run.ParseFromArray(payload.data(),
+                                static_cast<int>(payload.size()))) {
+          return false;
+        }
+        if (kind == kJournalAppendRun || data_.opstats().empty()) {
+          *data_.add_opstats() = std::move(run);
+        } else {
+          *data_.mutable_opstats(data_.opstats_size() - 1) = std::move(run);
+        }
+        return true;
+      });
+}
+
+absl::Status PdsBackedOpStatsDb::ResetLocked() {
+  data_ = *CreateEmptyData();
+  absl::Status reset_status = WriteSnapshotLocked();
+  if (!reset_status.ok()) {
+    loaded_ = false;
+    log_manager_.LogDiag(ProdDiagCode::OPSTATS_RESET_FAILED);
+    return absl::InternalError(
+        absl::StrCat("Failed to reset the database, with error message: ",
+                     reset_status.code()));
+  }
+  RebuildIndexLocked();
+  loaded_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status PdsBackedOpStatsDb::WriteSnapshotLocked() {
+  FCP_RETURN_IF_ERROR(db_->Write(std::make_unique<OpStatsSequence>(data_)));
+  FCP_RETURN_IF_ERROR(journal_.Reset(GetSnapshotFingerprint(data_)));
+  snapshot_outdated_ = false;
+  return absl::OkStatus();
+}
+
+void PdsBackedOpStatsDb::RebuildIndexLocked() {
+  run_sizes_.clear();
+  run_sizes_.reserve(data_.opstats_size());
+  run_ids_.clear();
+  run_ids_.reserve(data_.opstats_size());
+  for (const OperationalStats& run : data_.opstats()) {
+    run_sizes_.push_back(GetRunSize(run.ByteSizeLong()));
+    run_ids_.push_back(next_run_id_++);
+  }
+  data_size_bytes_ = data_.ByteSizeLong();
+}
+
+void PdsBackedOpStatsDb::RemoveOutdatedRunsLocked(
+    absl::Time earliest_accepted_time) {
+  auto& runs = *data_.mutable_opstats();
+  int kept = 0;
+  for (int i = 0; i < runs.size(); ++i) {
+    if (GetLastUpdateTime(runs.Get(i)) < earliest_accepted_time) {
+      data_size_bytes_ -= run_sizes_[i];
+      continue;
+    }
+    if (kept != i) {
+      runs.SwapElements(kept, i);
+      run_sizes_[kept] = run_sizes_[i];
+      run_ids_[kept] = run_ids_[i];
+    }
+    ++kept;
+  }
+  if (kept < runs.size()) {
+    runs.DeleteSubrange(kept, runs.size() - kept);
+    run_sizes_.resize(kept);
+    run_ids_.resize(kept);
+    *data_.mutable_earliest_trustworthy_time() =
+        TimeUtil::MillisecondsToTimestamp(
+            absl::ToUnixMillis(earliest_accepted_time));
+    snapshot_outdated_ = true;
+  }
+}
+
+void PdsBackedOpStatsDb::PruneRunsUntilBelowSizeLimitLocked() {
+  auto& runs = *data_.mutable_opstats();
+  if (data_size_bytes_ <= max_size_bytes_ || runs.empty()) return;
+  int num_pruned_entries = 0;
+  // The runs are sorted by time from earliest to latest, so we'll remove from
+  // the start.
+  while (data_size_bytes_ > max_size_bytes_ &&
+         num_pruned_entries < runs.size()) {
+    data_size_bytes_ -= run_sizes_[num_pruned_entries];
+    num_pruned_entries++;
+  }
+  absl::Time earliest_event_time = GetLastUpdateTime(runs.Get(0));
+  runs.DeleteSubrange(0, num_pruned_entries);
+  run_sizes_.erase(run_sizes_.begin(),
+                   run_sizes_.begin() + num_pruned_entries);
+  run_ids_.erase(run_ids_.begin(), run_ids_.begin() + num_pruned_entries);
+  *data_.mutable_earliest_trustworthy_time() =
+      GetEarliestTrustWorthyTime(runs);
+  snapshot_outdated_ = true;
+  log_manager_.LogToLongHistogram(
+      HistogramCounters::OPSTATS_NUM_PRUNED_ENTRIES, num_pruned_entries);
+  log_manager_.LogToLongHistogram(
+      HistogramCounters::OPSTATS_OLDEST_PRUNED_ENTRY_TENURE_HOURS,
+      absl::ToInt64Hours(absl::Now() - earliest_event_time));
+}
+
+void PdsBackedOpStatsDb::MaybeScheduleCompactionLocked() {
+  // A compaction which is in progress schedules the next one itself, once the
+  // journal has been reset.
+  if (compaction_scheduled_ || compaction_in_progress_) return;
+  // The runs are sorted from earliest to latest, so only the first one needs
+  // to be checked against the ttl here. The compaction then removes every run
+  // past its ttl.
+  const bool has_outdated_runs =
+      !data_.opstats().empty() &&
+      GetLastUpdateTime(data_.opstats(0)) < absl::Now() - ttl_;
+  if (!snapshot_outdated_ && !has_outdated_runs &&
+      journal_.size_bytes() <=
+          std::max(kMinJournalSizeForCompaction, data_size_bytes_)) {
+    return;
+  }
+  if (compaction_scheduler_ == nullptr) {
+    compaction_scheduler_ = CreateThreadPoolScheduler(1);
+  }
+  compaction_scheduled_ = true;
+  compaction_scheduler_->Schedule([this]() { Compact(); });
 }
 
-PdsBackedOpStatsDb::~PdsBackedOpStatsDb() { lock_releaser_(); }
+void PdsBackedOpStatsDb::WaitForCompactionLocked() {
+  mutex_.Await(absl::Condition(
+      +[](bool* compaction_in_progress) { return !*compaction_in_progress; },
+      &compaction_in_progress_));
+}
+
+void PdsBackedOpStatsDb::Compact() {
+  std::unique_ptr<OpStatsSequence> snapshot;
+  {
+    absl::MutexLock lock(&mutex_);
+    compaction_scheduled_ = false;
+    if (!loaded_) return;
+    RemoveOutdatedRunsLocked(absl::Now() - ttl_);
+    snapshot = std::make_unique<OpStatsSequence>(data_);
+    snapshot_outdated_ = false;
+    compaction_in_progress_ = true;
+  }
+  // Runs can be committed while the snapshot is written. They are still
+  // appended to the current journal, so that they are kept if writing the
+  // snapshot fails, and are also collected so that they can be appended to
+  // the new journal.
+  const std::string fingerprint = GetSnapshotFingerprint(*snapshot);
+  absl::Status status = db_->Write(std::move(snapshot));
+
+  absl::MutexLock lock(&mutex_);
+  if (status.ok()) status = journal_.Reset(fingerprint);
+  if (status.ok() && !records_committed_during_compaction_.empty()) {
+    status = journal_.AppendEncoded(records_committed_during_compaction_);
+  }
+  std::string().swap(records_committed_during_compaction_);
+  compaction_in_progress_ = false;
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::OPSTATS_WRITE_FAILED);
+    // The snapshot and journal may be out of sync with the in-memory data now,
+    // so reload them before the next access.
+    loaded_ = false;
+    return;
+  }
+  MaybeScheduleCompactionLocked();
+}
 
 absl::StatusOr<OpStatsSequence> PdsBackedOpStatsDb::Read() {
   absl::WriterMutexLock lock(&mutex_);
-  auto data_or = ReadInternal(*db_, log_manager_);
-  if (!data_or.ok()) {
-    // Try resetting after a failed read.
-    auto reset_status = ResetInternal(*db_, log_manager_);
+  FCP_RETURN_IF_ERROR(LoadLocked());
+  return data_;
+}
+
+class PdsBackedOpStatsDb::LazyRunReader : public OpStatsDb::RunReader {
+ public:
+  LazyRunReader(PdsBackedOpStatsDb* db,
+                std::function<bool(const OperationalStats&)> select,
+                int64_t end_run_id,
+                google::protobuf::Timestamp earliest_trustworthy_time)
+      : db_(db),
+        select_(std::move(select)),
+        next_run_id_(end_run_id),
+        earliest_trustworthy_time_(std::move(earliest_trustworthy_time)) {}
+
+  absl::StatusOr<OperationalStats> Next() override {
+    return db_->ReadRunBefore(select_, &next_run_id_);
+  }
+
+  const google::protobuf::Timestamp& earliest_trustworthy_time()
+      const override {
+    return earliest_trustworthy_time_;
+  }
+
+ private:
+  PdsBackedOpStatsDb* db_;
+  std::function<bool(const OperationalStats&)> select_;
+  // The runs returned next must have an id lower than this.
+  int64_t next_run_id_;
+  google::protobuf::Timestamp earliest_trustworthy_time_;
+};
+
+absl::StatusOr<std::unique_ptr<OpStatsDb::RunReader>>
+PdsBackedOpStatsDb::ReadRuns(
+    std::function<bool(const OperationalStats&)> select) {
+  absl::WriterMutexLock lock(&mutex_);
+  FCP_RETURN_IF_ERROR(LoadLocked());
+  return std::make_unique<LazyRunReader>(this, std::move(select),
+                                         next_run_id_,
+                                         data_.earliest_trustworthy_time());
+}
+
+absl::StatusOr<OperationalStats> PdsBackedOpStatsDb::ReadRunBefore(
+    const std::function<bool(const OperationalStats&)>& select,
+    int64_t* run_id) {
+  absl::WriterMutexLock lock(&mutex_);
+  if (!loaded_) {
+    // The data has been reset (e.g. after a failed write), and the runs that
+    // were being read are gone.
+    return absl::OutOfRangeError("No more runs.");
+  }
+  // The ids are sorted, so find the latest run with a lower id.
+  int index = static_cast<int>(
+                  std::lower_bound(run_ids_.begin(), run_ids_.end(), *run_id) -
+                  run_ids_.begin()) -
+              1;
+  for (; index >= 0; --index) {
+    if (select(data_.opstats(index))) {
+      *run_id = run_ids_[index];
+      return data_.opstats(index);
+    }
   }
-  return data_or;
+  *run_id = -1;
+  return absl::OutOfRangeError("No more runs.");
 }
 
 absl::Status PdsBackedOpStatsDb::Transform(
     std::function<void(OpStatsSequence&)> func) {
   absl::WriterMutexLock lock(&mutex_);
-  OpStatsSequence data;
-  auto data_or = ReadInternal(*db_, log_manager_);
-  if (!data_or.ok()) {
-    // Try resetting after a failed read.
-    FCP_RETURN_IF_ERROR(ResetInternal(*db_, log_manager_));
-  } else {
-    data = std::move(data_or).value();
-    RemoveOutdatedData(data, ttl_);
+  // A compaction which is still writing its snapshot must not overwrite the
+  // one written here, nor see the data while it is being transformed.
+  WaitForCompactionLocked();
+  absl::Status load_status = LoadLocked();
+  if (!loaded_) return load_status;
+  if (load_status.ok()) RemoveOutdatedData(data_, ttl_);
+  func(data_);
+  PruneOldDataUntilBelowSizeLimit(data_, max_size_bytes_, log_manager_);
+  if (!data_.has_earliest_trustworthy_time()) {
+    *data_.mutable_earliest_trustworthy_time() =
+        GetEarliestTrustWorthyTime(data_.opstats());
   }
-  func(data);
-  PruneOldDataUntilBelowSizeLimit(data, max_size_bytes_, log_manager_);
-  if (!data.has_earliest_trustworthy_time()) {
-    *data.mutable_earliest_trustworthy_time() =
-        GetEarliestTrustWorthyTime(data.opstats());
-  }
-  absl::Status status =
-      db_->Write(std::make_unique<OpStatsSequence>(std::move(data)));
+  absl::Status status = WriteSnapshotLocked();
   if (!status.ok()) {
     log_manager_.LogDiag(ProdDiagCode::OPSTATS_WRITE_FAILED);
+    loaded_ = false;
+    return status;
   }
+  RebuildIndexLocked();
   return status;
 }
 
+absl::Status PdsBackedOpStatsDb::CommitRun(const OperationalStats& stats,
+                                           bool is_new_run) {
+  absl::WriterMutexLock lock(&mutex_);
+  absl::Status load_status = LoadLocked();
+  if (!loaded_) return load_status;
+
+  const char kind = is_new_run ? kJournalAppendRun : kJournalReplaceLatestRun;
+  const std::string payload = stats.SerializeAsString();
+  absl::Status status = journal_.Append(kind, payload);
+  if (!status.ok()) {
+    log_manager_.LogDiag(ProdDiagCode::OPSTATS_WRITE_FAILED);
+    return status;
+  }
+  if (compaction_in_progress_) {
+    records_committed_during_compaction_ +=
+        JournalFile::EncodeRecord(kind, payload);
+  }
+  const int64_t run_size = GetRunSize(payload.size());
+  if (is_new_run || data_.opstats().empty()) {
+    *data_.add_opstats() = stats;
+    run_sizes_.push_back(run_size);
+    run_ids_.push_back(next_run_id_++);
+  } else {
+    *data_.mutable_opstats(data_.opstats_size() - 1) = stats;
+    data_size_bytes_ -= run_sizes_.back();
+    run_sizes_.back() = run_size;
+  }
+  data_size_bytes_ += run_size;
+  PruneRunsUntilBelowSizeLimitLocked();
+  if (!data_.has_earliest_trustworthy_time()) {
+    *data_.mutable_earliest_trustworthy_time() =
+        GetEarliestTrustWorthyTime(data_.opstats());
+    snapshot_outdated_ = true;
+  }
+  log_manager_.LogToLongHistogram(HistogramCounters::OPSTATS_DB_SIZE_BYTES,
+                                  data_size_bytes_);
+  log_manager_.LogToLongHistogram(HistogramCounters::OPSTATS_DB_NUM_ENTRIES,
+                                  data_.opstats_size());
+  MaybeScheduleCompactionLocked();
+  return absl::OkStatus();
+}
+
 }  // namespace opstats
 }  // namespace client
 }  // namespace fcp
@@ -19,10 +19,17 @@
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "fcp/base/scheduler.h"
+#include "fcp/client/journal_file.h"
 #include "fcp/client/log_manager.h"
 #include "fcp/client/opstats/opstats_db.h"
 #include "fcp/protos/opstats.pb.h"
@@ -34,10 +41,31 @@ namespace client {
 namespace opstats {
 
 // An implementation of OpStatsDb based on protodatastore cpp.
+//
+// The data is stored as a snapshot of the whole OpStatsSequence (written via
+// protodatastore), plus a `JournalFile` of the runs committed via `CommitRun`
+// since that snapshot was written.
+//
+// The data is kept in memory once loaded, along with a small index of the
+// serialized size of each run. This means that `CommitRun` doesn't serialize
+// any data other than the committed run: it appends a single record to the
+// journal, and uses the index to enforce the size limit. Removing data beyond
+// the size limit only happens in memory at commit time. The snapshot is then
+// rewritten (and the journal emptied) in the background, which also happens
+// once the journal has grown larger than the data itself, or once the oldest
+// run is past its ttl. Runs past their ttl are only removed by this background
+// compaction.
+//
+// The compaction writes a copy of the data taken under the lock, so that runs
+// can still be committed while the snapshot is written. These runs are
+// appended both to the current journal and, once the snapshot has been
+// written, to the new one. If the process crashes after the snapshot was
+// written but before the new journal was, these runs are lost.
 class PdsBackedOpStatsDb : public OpStatsDb {
  public:
   static constexpr char kParentDir[] = "fcp/opstats";
   static constexpr char kDbFileName[] = "opstats.pb";
+  static constexpr char kJournalFileName[] = "opstats.journal";
 
   // Factory method to create PdsBackedOpStatsDb. The provided path is the
   // absolute path for the base directory for storing files. OpStatsDb will
@@ -48,6 +76,7 @@ class PdsBackedOpStatsDb : public OpStatsDb {
       const std::string& base_dir, absl::Duration ttl, LogManager& log_manager,
       int64_t max_size_bytes);
 
+  // Waits for any background compaction to finish before releasing the db.
   ~PdsBackedOpStatsDb() override;
 
   // Returns the data in the db, or an error from the read operation. If the
@@ -55,33 +84,114 @@ class PdsBackedOpStatsDb : public OpStatsDb {
   // necessarily restricted according to the ttl.
   absl::StatusOr<OpStatsSequence> Read() override ABSL_LOCKS_EXCLUDED(mutex_);
 
+  // Returns a reader which copies only the selected runs, one at a time, out of
+  // the in-memory data as they are requested, rather than copying all of the
+  // data upfront. If the data is rewritten (e.g. by `Transform`) or reloaded
+  // while reading, the reader returns no further runs.
+  absl::StatusOr<std::unique_ptr<RunReader>> ReadRuns(
+      std::function<bool(const OperationalStats&)> select) override
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
   // Modifies the data in the db based on the supplied transformation function
   // and ttl restrictions. If there is an error fetching the existing data, the
-  // db is reset. No transformation is applied if the reset fails.
+  // db is reset. No transformation is applied if the reset fails. Note that
+  // this rewrites the whole db, unlike `CommitRun`.
   absl::Status Transform(std::function<void(OpStatsSequence&)> func) override
       ABSL_LOCKS_EXCLUDED(mutex_);
 
+  // Appends the run to the journal, and removes the oldest data if the size
+  // limit is exceeded. Data past its ttl is removed by a background compaction
+  // afterwards. If there is an error fetching the existing data, the db is
+  // reset. No data is committed if the reset fails.
+  absl::Status CommitRun(const OperationalStats& stats,
+                         bool is_new_run) override ABSL_LOCKS_EXCLUDED(mutex_);
+
  private:
   PdsBackedOpStatsDb(
       std::unique_ptr<protostore::ProtoDataStore<OpStatsSequence>> db,
-      std::unique_ptr<protostore::FileStorage> file_storage, absl::Duration ttl,
+      std::unique_ptr<protostore::FileStorage> file_storage,
+      std::string journal_path, absl::Duration ttl,
       LogManager& log_manager, int64_t max_size_bytes,
       std::function<void()> lock_releaser)
       : ttl_(std::move(ttl)),
         db_(std::move(db)),
         storage_(std::move(file_storage)),
+        journal_(std::move(journal_path)),
         log_manager_(log_manager),
         max_size_bytes_(max_size_bytes),
         lock_releaser_(lock_releaser) {}
 
+  class LazyRunReader;
+
+  // Returns the latest selected run whose id is lower than `*run_id`, and sets
+  // `*run_id` to its id. Returns OUT_OF_RANGE if there is no such run.
+  absl::StatusOr<OperationalStats> ReadRunBefore(
+      const std::function<bool(const OperationalStats&)>& select,
+      int64_t* run_id) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Loads the snapshot and replays the journal on top of it, unless the data
+  // has already been loaded. If that fails the db is reset, and the error is
+  // returned (unless the reset failed too, in which case that error is
+  // returned and `loaded_` remains false).
+  absl::Status LoadLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  absl::Status LoadFromDiskLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Replaces the data with an empty OpStatsSequence, and persists it.
+  absl::Status ResetLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Writes `data_` as the new snapshot, and starts a new, empty journal.
+  absl::Status WriteSnapshotLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Recomputes the size of each run in `data_`, and assigns new ids to them.
+  void RebuildIndexLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Removes the runs which were last updated before `earliest_accepted_time`
+  // from `data_` and the index.
+  void RemoveOutdatedRunsLocked(absl::Time earliest_accepted_time)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Removes the oldest runs from `data_` and the index until the data is
+  // within the size limit.
+  void PruneRunsUntilBelowSizeLimitLocked()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Schedules a rewrite of the snapshot if the in-memory data no longer
+  // matches the snapshot plus journal, if the journal has grown too large, or
+  // if the oldest run is past its ttl.
+  void MaybeScheduleCompactionLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Removes the runs past their ttl, and rewrites the snapshot without holding
+  // `mutex_` while it is written.
+  void Compact() ABSL_LOCKS_EXCLUDED(mutex_);
+  // Waits until no compaction is writing the snapshot anymore.
+  void WaitForCompactionLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   const absl::Duration ttl_;
-  std::unique_ptr<protostore::ProtoDataStore<OpStatsSequence>> db_
-      ABSL_GUARDED_BY(mutex_);
+  // Only accessed with `mutex_` held while no compaction is in progress, or by
+  // the compaction itself (see `compaction_in_progress_`).
+  std::unique_ptr<protostore::ProtoDataStore<OpStatsSequence>> db_;
   std::unique_ptr<protostore::FileStorage> storage_;
   LogManager& log_manager_;
   const int64_t max_size_bytes_;
   std::function<void()> lock_releaser_;
   absl::Mutex mutex_;
+
+  bool loaded_ ABSL_GUARDED_BY(mutex_) = false;
+  // The current data, i.e. the snapshot with the journal applied to it, minus
+  // whatever has been removed in memory since (see `snapshot_outdated_`).
+  OpStatsSequence data_ ABSL_GUARDED_BY(mutex_);
+  // The serialized size of each run in `data_` (including its tag and length
+  // prefix), and the serialized size of `data_` as a whole.
+  std::vector<int64_t> run_sizes_ ABSL_GUARDED_BY(mutex_);
+  int64_t data_size_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  // An id for each run in `data_`, which identifies the run to a
+  // `LazyRunReader`. Ids are assigned in increasing order and never reused, so
+  // that they remain sorted as runs are removed.
+  std::vector<int64_t> run_ids_ ABSL_GUARDED_BY(mutex_);
+  int64_t next_run_id_ ABSL_GUARDED_BY(mutex_) = 0;
+  JournalFile journal_ ABSL_GUARDED_BY(mutex_);
+  // True if data was removed from `data_` without rewriting the snapshot yet.
+  bool snapshot_outdated_ ABSL_GUARDED_BY(mutex_) = false;
+  bool compaction_scheduled_ ABSL_GUARDED_BY(mutex_) = false;
+  // True while a compaction is writing the snapshot without holding `mutex_`.
+  bool compaction_in_progress_ ABSL_GUARDED_BY(mutex_) = false;
+  // The journal records of the runs committed while a compaction is in
+  // progress, which are appended to the journal once it has been reset.
+  std::string records_committed_during_compaction_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<Scheduler> compaction_scheduler_;
 };
 
 }  // namespace opstats
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "google/protobuf/util/time_util.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fcp/base/monitoring.h"
+#include "fcp/client/log_manager.h"
+#include "fcp/client/opstats/opstats_db.h"
+#include "fcp/client/opstats/pds_backed_opstats_db.h"
+#include "fcp/protos/opstats.pb.h"
+
+// Open-source version of benchmarking library
+#include "benchmark//benchmark.h"
+
+namespace fcp {
+namespace client {
+namespace opstats {
+namespace {
+
+using ::google::protobuf::util::TimeUtil;
+
+class NoOpLogManager : public LogManager {
+ public:
+  void LogDiag(ProdDiagCode diag_code) override {}
+  void LogDiag(DebugDiagCode diag_code) override {}
+  void LogToLongHistogram(HistogramCounters histogram_counter,
+                          int execution_index, int epoch_index,
+                          engine::DataSourceType data_source_type,
+                          int64_t value) override {}
+  void SetModelIdentifier(const std::string& model_identifier) override {}
+};
+
+// Returns the stats of a run which got as far as uploading its results.
+OperationalStats CreateRun(int num_events) {
+  OperationalStats run;
+  run.set_session_name("session");
+  run.set_population_name("population");
+  run.set_task_name("task");
+  for (int i = 0; i < num_events; ++i) {
+    auto* event = run.add_events();
+    event->set_event_type(OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED);
+    *event->mutable_timestamp() = TimeUtil::GetCurrentTime();
+  }
+  auto& dataset_stats = (*run.mutable_dataset_stats())["app:/collection"];
+  dataset_stats.set_num_examples_read(100);
+  dataset_stats.set_num_bytes_read(10000);
+  run.set_chunking_layer_bytes_downloaded(1000000);
+  run.set_chunking_layer_bytes_uploaded(100000);
+  return run;
+}
+
+// Creates a db in a fresh directory, already containing `num_runs` runs.
+class DbWithHistory {
+ public:
+  explicit DbWithHistory(int64_t num_runs)
+      : base_dir_(std::filesystem::temp_directory_path() /
+                  absl::StrCat("opstats_bench_", getpid())) {
+    std::filesystem::remove_all(base_dir_);
+    db_ = PdsBackedOpStatsDb::Create(base_dir_.generic_string(),
+                                     absl::Hours(24 * 365), log_manager_,
+                                     /*max_size_bytes=*/int64_t{1} << 32)
+              .value();
+    OperationalStats run = CreateRun(/*num_events=*/8);
+    FCP_CHECK(db_->Transform([&run, num_runs](OpStatsSequence& data) {
+                    for (int64_t i = 0; i < num_runs; ++i) {
+                      *data.add_opstats() = run;
+                    }
+                  }).ok());
+  }
+
+  ~DbWithHistory() {
+    db_.reset();
+    std::filesystem::remove_all(base_dir_);
+  }
+
+  OpStatsDb& db() { return *db_; }
+
+ private:
+  const std::filesystem::path base_dir_;
+  NoOpLogManager log_manager_;
+  std::unique_ptr<OpStatsDb> db_;
+};
+
+// Commits the stats of a single run the way `OpStatsLoggerImpl` does over the
+// course of a typical run: once when it starts, a few times as it progresses,
+// and once more when it ends.
+template <typename CommitFn>
+void CommitTypicalRun(CommitFn commit) {
+  constexpr int kNumCommits = 5;
+  for (int i = 1; i <= kNumCommits; ++i) {
+    FCP_CHECK(commit(CreateRun(/*num_events=*/i * 2), /*is_new_run=*/i == 1)
+                  .ok());
+  }
+}
+
+// The commits are performed via `Transform`, rewriting the whole history each
+// time, as was done before `CommitRun` was introduced.
+static void BM_CommitRunViaTransform(benchmark::State& state) {
+  DbWithHistory db_with_history(state.range(0));
+  OpStatsDb& db = db_with_history.db();
+  for (auto s : state) {
+    CommitTypicalRun([&db](const OperationalStats& stats, bool is_new_run) {
+      return db.OpStatsDb::CommitRun(stats, is_new_run);
+    });
+  }
+}
+
+// The commits are appended to the journal.
+static void BM_CommitRun(benchmark::State& state) {
+  DbWithHistory db_with_history(state.range(0));
+  OpStatsDb& db = db_with_history.db();
+  for (auto s : state) {
+    CommitTypicalRun([&db](const OperationalStats& stats, bool is_new_run) {
+      return db.CommitRun(stats, is_new_run);
+    });
+  }
+}
+
+BENCHMARK(BM_CommitRunViaTransform)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CommitRun)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace opstats
+}  // namespace client
+}  // namespace fcp
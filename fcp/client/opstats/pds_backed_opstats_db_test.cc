@@ -17,15 +17,20 @@
 #include "fcp/client/opstats/pds_backed_opstats_db.h"
 
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iterator>
 #include <string>
 #include <thread>  // NOLINT(build/c++11)
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/util/time_util.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/status/statusor.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "fcp/client/test_helpers.h"
 #include "fcp/protos/opstats.pb.h"
 #include "fcp/testing/testing.h"
@@ -36,8 +41,10 @@ namespace opstats {
 namespace {
 
 using ::google::protobuf::util::TimeUtil;
+using ::testing::_;
 using ::testing::Ge;
 using ::testing::Gt;
+using ::testing::Lt;
 
 const absl::Duration ttl = absl::Hours(24);
 const absl::Time benchmark_time = absl::Now();
@@ -52,6 +59,26 @@ class BasePdsBackedOpStatsDbTest {
     std::filesystem::remove(std::filesystem::path(base_dir_) /
                             PdsBackedOpStatsDb::kParentDir /
                             PdsBackedOpStatsDb::kDbFileName);
+    std::filesystem::remove(JournalPath());
+  }
+
+  std::filesystem::path JournalPath() const {
+    return std::filesystem::path(base_dir_) / PdsBackedOpStatsDb::kParentDir /
+           PdsBackedOpStatsDb::kJournalFileName;
+  }
+
+  void ExpectSizeHistograms(int times) {
+    EXPECT_CALL(
+        log_manager_,
+        LogToLongHistogram(HistogramCounters::OPSTATS_DB_SIZE_BYTES,
+                           /*execution_index=*/0, /*epoch_index=*/0,
+                           engine::DataSourceType::DATASET, /*value=*/Gt(0)))
+        .Times(times);
+    EXPECT_CALL(log_manager_,
+                LogToLongHistogram(HistogramCounters::OPSTATS_DB_NUM_ENTRIES,
+                                   /*execution_index=*/0, /*epoch_index=*/0,
+                                   engine::DataSourceType::DATASET, _))
+        .Times(times);
   }
 
   static OperationalStats_Event CreateEvent(
@@ -513,6 +540,273 @@ TEST_F(PdsBackedOpStatsDbTest, OpStatsRemovedDueToSizeLimit) {
   EXPECT_THAT(*data, EqualsProto(expected));
 }
 
+TEST_F(PdsBackedOpStatsDbTest, CommitRunAppendsAndReplacesRuns) {
+  OperationalStats first_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  OperationalStats first_run_updated = first_run;
+  first_run_updated.mutable_events()->Add(
+      CreateEvent(OperationalStats::Event::EVENT_KIND_CHECKIN_ACCEPTED,
+                  benchmark_time_sec + 1));
+  OperationalStats second_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_ELIGIBILITY_CHECKIN_STARTED,
+      benchmark_time_sec + 2);
+  OpStatsSequence expected;
+  *expected.add_opstats() = first_run_updated;
+  *expected.add_opstats() = second_run;
+
+  ExpectSizeHistograms(3);
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    ASSERT_OK((*db)->CommitRun(first_run, /*is_new_run=*/true));
+    ASSERT_OK((*db)->CommitRun(first_run_updated, /*is_new_run=*/false));
+    ASSERT_OK((*db)->CommitRun(second_run, /*is_new_run=*/true));
+    absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+    ASSERT_OK(data);
+    data->clear_earliest_trustworthy_time();
+    EXPECT_THAT(*data, EqualsProto(expected));
+  }
+
+  // The commits were persisted to the journal.
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  data->clear_earliest_trustworthy_time();
+  EXPECT_THAT(*data, EqualsProto(expected));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, CommitRunDropsIncompleteJournalRecord) {
+  OperationalStats first_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  OperationalStats second_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      benchmark_time_sec + 1);
+  ExpectSizeHistograms(2);
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    ASSERT_OK((*db)->CommitRun(first_run, /*is_new_run=*/true));
+  }
+  // Simulate a crash in the middle of appending a record.
+  {
+    std::ofstream journal(JournalPath(), std::ios::binary | std::ios::app);
+    journal << std::string("\x02\xff\x00\x00\x00partial", 12);
+  }
+
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  ASSERT_OK((*db)->CommitRun(second_run, /*is_new_run=*/true));
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  OpStatsSequence expected;
+  *expected.add_opstats() = first_run;
+  *expected.add_opstats() = second_run;
+  data->clear_earliest_trustworthy_time();
+  EXPECT_THAT(*data, EqualsProto(expected));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, JournalFoldedIntoSnapshotIsNotReplayed) {
+  OperationalStats run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  ExpectSizeHistograms(2);
+  std::string old_journal;
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    ASSERT_OK((*db)->CommitRun(run, /*is_new_run=*/true));
+    std::ifstream journal(JournalPath(), std::ios::binary);
+    old_journal.assign(std::istreambuf_iterator<char>(journal), {});
+    // Rewrites the snapshot, which then contains the run.
+    ASSERT_OK((*db)->Transform([](OpStatsSequence& data) {}));
+  }
+  // Simulate a crash after the snapshot was rewritten, but before the journal
+  // was reset.
+  {
+    std::ofstream journal(JournalPath(), std::ios::binary | std::ios::trunc);
+    journal << old_journal;
+  }
+
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  ASSERT_EQ(data->opstats().size(), 1);
+  EXPECT_THAT(data->opstats(0), EqualsProto(run));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, CommitRunRemovesOpStatsDueToTtl) {
+  OperationalStats run_remove = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      absl::ToUnixSeconds(benchmark_time - absl::Hours(48)));
+  OperationalStats run_keep = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      absl::ToUnixSeconds(benchmark_time - absl::Hours(23)));
+  OperationalStats new_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  ExpectSizeHistograms(3);
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    ASSERT_OK((*db)->CommitRun(run_remove, /*is_new_run=*/true));
+    ASSERT_OK((*db)->CommitRun(run_keep, /*is_new_run=*/true));
+    ASSERT_OK((*db)->CommitRun(new_run, /*is_new_run=*/true));
+  }
+
+  // The outdated run was removed by the background compaction (which the db
+  // waits for before it is destroyed), and the journal was reset.
+  EXPECT_THAT(std::filesystem::file_size(JournalPath()), Lt(100));
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  ASSERT_EQ(data->opstats().size(), 2);
+  EXPECT_THAT(data->opstats(0), EqualsProto(run_keep));
+  EXPECT_THAT(data->opstats(1), EqualsProto(new_run));
+  EXPECT_THAT(data->earliest_trustworthy_time(),
+              Ge(TimeUtil::SecondsToTimestamp(
+                  absl::ToUnixSeconds(benchmark_time - ttl))));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, ReadRunsReadsSelectedRunsLatestFirst) {
+  OperationalStats first_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  OperationalStats second_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_ELIGIBILITY_CHECKIN_STARTED,
+      benchmark_time_sec + 1);
+  OperationalStats third_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      benchmark_time_sec + 2);
+  OperationalStats later_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      benchmark_time_sec + 3);
+  ExpectSizeHistograms(4);
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  ASSERT_OK((*db)->CommitRun(first_run, /*is_new_run=*/true));
+  ASSERT_OK((*db)->CommitRun(second_run, /*is_new_run=*/true));
+  ASSERT_OK((*db)->CommitRun(third_run, /*is_new_run=*/true));
+
+  auto reader = (*db)->ReadRuns([](const OperationalStats& run) {
+    return run.events(0).event_type() ==
+           OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED;
+  });
+  ASSERT_OK(reader);
+  absl::StatusOr<OperationalStats> run = (*reader)->Next();
+  ASSERT_OK(run);
+  EXPECT_THAT(*run, EqualsProto(third_run));
+  // Runs committed (or removed) while reading don't affect the runs that are
+  // still to be read, and aren't returned themselves.
+  ASSERT_OK((*db)->CommitRun(later_run, /*is_new_run=*/true));
+  run = (*reader)->Next();
+  ASSERT_OK(run);
+  EXPECT_THAT(*run, EqualsProto(first_run));
+  EXPECT_THAT((*reader)->Next(), IsCode(OUT_OF_RANGE));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, CommitRunEnforcesTtlExactly) {
+  // This run is only just past its ttl.
+  OperationalStats run_remove = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      absl::ToUnixSeconds(benchmark_time - ttl - absl::Minutes(1)));
+  OperationalStats new_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  ExpectSizeHistograms(2);
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    ASSERT_OK((*db)->CommitRun(run_remove, /*is_new_run=*/true));
+    ASSERT_OK((*db)->CommitRun(new_run, /*is_new_run=*/true));
+  }
+
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  ASSERT_EQ(data->opstats().size(), 1);
+  EXPECT_THAT(data->opstats(0), EqualsProto(new_run));
+}
+
+TEST_F(PdsBackedOpStatsDbTest, RunsCommittedDuringCompactionAreKept) {
+  // Each run is updated many times, so that the journal keeps outgrowing the
+  // data and compactions keep being scheduled, with runs being committed while
+  // they write the snapshot.
+  constexpr int kNumRuns = 10;
+  constexpr int kNumUpdatesPerRun = 100;
+  ExpectSizeHistograms(kNumRuns * kNumUpdatesPerRun);
+  std::vector<OperationalStats> runs;
+  {
+    auto db =
+        PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+    ASSERT_OK(db);
+    for (int i = 0; i < kNumRuns; ++i) {
+      OperationalStats run;
+      for (int j = 0; j < kNumUpdatesPerRun; ++j) {
+        run = CreateOperationalStatsWithSingleEvent(
+            OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+            benchmark_time_sec + i);
+        run.set_population_name(std::string(1024, 'a' + j % 26));
+        ASSERT_OK((*db)->CommitRun(run, /*is_new_run=*/j == 0));
+        // Gives the scheduled compaction a chance to start.
+        absl::SleepFor(absl::Microseconds(50));
+      }
+      runs.push_back(std::move(run));
+    }
+  }
+
+  auto db =
+      PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_, size_limit);
+  ASSERT_OK(db);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  ASSERT_EQ(data->opstats().size(), kNumRuns);
+  for (int i = 0; i < kNumRuns; ++i) {
+    EXPECT_THAT(data->opstats(i), EqualsProto(runs[i]));
+  }
+}
+
+TEST_F(PdsBackedOpStatsDbTest, CommitRunRemovesOpStatsDueToSizeLimit) {
+  OperationalStats first_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED, benchmark_time_sec);
+  OperationalStats second_run = CreateOperationalStatsWithSingleEvent(
+      OperationalStats::Event::EVENT_KIND_CHECKIN_STARTED,
+      benchmark_time_sec + 5);
+  auto db = PdsBackedOpStatsDb::Create(base_dir_, ttl, log_manager_,
+                                       /*max_size_bytes=*/30);
+  ASSERT_OK(db);
+  ExpectSizeHistograms(2);
+  EXPECT_CALL(log_manager_,
+              LogToLongHistogram(HistogramCounters::OPSTATS_NUM_PRUNED_ENTRIES,
+                                 /*execution_index=*/0, /*epoch_index=*/0,
+                                 engine::DataSourceType::DATASET, /*value=*/1));
+  EXPECT_CALL(log_manager_,
+              LogToLongHistogram(
+                  HistogramCounters::OPSTATS_OLDEST_PRUNED_ENTRY_TENURE_HOURS,
+                  /*execution_index=*/0, /*epoch_index=*/0,
+                  engine::DataSourceType::DATASET, /*value=*/Ge(0)));
+  ASSERT_OK((*db)->CommitRun(first_run, /*is_new_run=*/true));
+  ASSERT_OK((*db)->CommitRun(second_run, /*is_new_run=*/true));
+
+  OpStatsSequence expected;
+  *expected.add_opstats() = second_run;
+  *expected.mutable_earliest_trustworthy_time() =
+      TimeUtil::SecondsToTimestamp(benchmark_time_sec + 5);
+  absl::StatusOr<OpStatsSequence> data = (*db)->Read();
+  ASSERT_OK(data);
+  EXPECT_THAT(*data, EqualsProto(expected));
+}
+
 }  // anonymous namespace
 }  // namespace opstats
 }  // namespace client
@@ -15,11 +15,61 @@
  */
 #include "fcp/client/simple_task_environment.h"
 
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fcp/base/batch.h"
+
 namespace fcp {
 namespace client {
 
+absl::StatusOr<std::vector<std::string>> ExampleIterator::NextBatch(
+    int max_count, int64_t max_bytes) {
+  return ReadBatch([this]() { return Next(); }, max_count, max_bytes);
+}
+
+absl::Status ExampleIterator::NextInto(
+    const std::function<char*(size_t size)>& allocate) {
+  absl::StatusOr<std::string> example = Next();
+  if (!example.ok()) return example.status();
+  char* buffer = allocate(example->size());
+  if (!example->empty()) {
+    std::memcpy(buffer, example->data(), example->size());
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ExampleIterator::NextBatchInto(
+    int max_count, int64_t max_bytes,
+    const std::function<char*(size_t size)>& allocate) {
+  absl::StatusOr<std::vector<std::string>> batch =
+      NextBatch(max_count, max_bytes);
+  if (!batch.ok()) return batch.status();
+  WriteBatchInto(*batch, allocate);
+  return absl::OkStatus();
+}
+
+absl::Status ExampleIterator::Skip(int64_t count) {
+  for (int64_t i = 0; i < count; ++i) {
+    absl::StatusOr<std::string> example = Next();
+    if (!example.ok()) {
+      if (example.status().code() == absl::StatusCode::kOutOfRange) break;
+      return example.status();
+    }
+  }
+  return absl::OkStatus();
+}
+
 bool SimpleTaskEnvironment::ShouldAbort(
     absl::Time current_time, absl::Duration condition_polling_period) {
+  AbortSignal* abort_signal = GetAbortSignal();
+  if (abort_signal != nullptr && abort_signal->IsAborted()) {
+    return true;
+  }
   if (current_time - last_training_conditions_fetch_timestamp_ <
       condition_polling_period) {
     return false;
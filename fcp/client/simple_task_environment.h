@@ -16,12 +16,16 @@
 #ifndef FCP_CLIENT_SIMPLE_TASK_ENVIRONMENT_H_
 #define FCP_CLIENT_SIMPLE_TASK_ENVIRONMENT_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
+#include "fcp/client/abort_signal.h"
 #include "fcp/client/http/http_client.h"
 #include "fcp/client/selector_context.pb.h"
 #include "fcp/protos/plan.pb.h"
@@ -41,6 +45,57 @@ class ExampleIterator {
   //  - OUT_OF_RANGE if the end of the iterator was reached.
   virtual absl::StatusOr<std::string> Next() = 0;
 
+  // Returns up to `max_count` (which must be positive) serialized examples at
+  // once, which amortizes the per-call overhead when examples are small. Stops
+  // once the examples returned so far add up to at least `max_bytes`, but
+  // always returns at least one example. If the end of the iterator is reached
+  // after some examples were read, those are returned, and the next call
+  // returns OUT_OF_RANGE. Other errors are returned as by `Next()`, dropping
+  // any examples read by the same call.
+  //
+  // The default implementation calls `Next()` repeatedly, and relies on it to
+  // keep returning OUT_OF_RANGE once the end of the iterator was reached.
+  virtual absl::StatusOr<std::vector<std::string>> NextBatch(int max_count,
+                                                             int64_t max_bytes);
+
+  // Like `Next()`, but rather than returning the example, writes it to a
+  // buffer of the example's size obtained from `allocate`, which lets the
+  // caller decide where the example ends up (e.g. directly in a TensorFlow
+  // string tensor). Iterators which produce the example bytes themselves (e.g.
+  // by reading a file) should override this to write them to that buffer
+  // directly, which avoids copying each example. `allocate` must be called at
+  // most once, and only if OK is returned.
+  //
+  // The default implementation copies the example returned by `Next()`.
+  virtual absl::Status NextInto(
+      const std::function<char*(size_t size)>& allocate);
+
+  // Like `NextBatch()`, but rather than returning the examples, writes each of
+  // them to a buffer of its size obtained from `allocate`, in order, as
+  // `NextInto()` does. `allocate` is called once per example, and the buffers
+  // it returns must remain valid until the call returns. If an error other
+  // than OUT_OF_RANGE is returned, the caller must drop any examples written by
+  // the same call.
+  //
+  // The default implementation copies the examples returned by `NextBatch()`,
+  // so that iterators which only override `NextBatch()` keep amortizing the
+  // per-call overhead.
+  virtual absl::Status NextBatchInto(
+      int max_count, int64_t max_bytes,
+      const std::function<char*(size_t size)>& allocate);
+
+  // Skips the next `count` examples, which is used to resume iterating from
+  // where a previous iterator over the same examples left off (e.g. when an
+  // interrupted plan is restored from a checkpoint). Returns OK if the end of
+  // the iterator is reached before skipping `count` examples, in which case the
+  // next call to `Next()` returns OUT_OF_RANGE. Other errors are returned as by
+  // `Next()`.
+  //
+  // The default implementation calls `Next()` `count` times. Iterators which
+  // can seek to a given position more cheaply (e.g. with an OFFSET clause in a
+  // database query) should override it.
+  virtual absl::Status Skip(int64_t count);
+
   // Close the iterator to release associated resources.
   virtual void Close() = 0;
 };
@@ -89,9 +144,18 @@ class SimpleTaskEnvironment {
     return nullptr;
   }
 
-  // Checks whether the caller should abort computation. If less than
-  // condition_polling_period time has elapsed since the last call this function
-  // made to TrainingConditionsSatisfied, returns false.
+  // Returns the signal through which the environment pushes that the training
+  // conditions are no longer satisfied, or nullptr if it doesn't (in which
+  // case TrainingConditionsSatisfied is polled). The signal must outlive all
+  // runs using this environment. If a signal is returned, ongoing operations
+  // are only aborted via the signal, and no longer poll
+  // TrainingConditionsSatisfied.
+  virtual AbortSignal* GetAbortSignal() { return nullptr; }
+
+  // Checks whether the caller should abort computation. Returns true if the
+  // abort signal was aborted. Otherwise, if less than condition_polling_period
+  // time has elapsed since the last call this function made to
+  // TrainingConditionsSatisfied, returns false.
   bool ShouldAbort(absl::Time current_time,
                    absl::Duration condition_polling_period);
 
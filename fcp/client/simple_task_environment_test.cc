@@ -14,10 +14,15 @@
 
 #include "fcp/client/simple_task_environment.h"
 
+#include <deque>
+#include <string>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "fcp/client/abort_signal.h"
 #include "fcp/client/test_helpers.h"
 #include "fcp/testing/testing.h"
 
@@ -25,6 +30,8 @@ namespace fcp {
 namespace client {
 namespace {
 
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
 using ::testing::Return;
 using ::testing::StrictMock;
 
@@ -79,6 +86,139 @@ TEST(SimpleTaskEnvironmentTest, TestShouldAbortThrottling) {
   EXPECT_TRUE(result);
 }
 
+class TaskEnvironmentWithAbortSignal : public MockSimpleTaskEnvironment {
+ public:
+  AbortSignal* GetAbortSignal() override { return &abort_signal_; }
+
+  AbortSignal abort_signal_;
+};
+
+// Verify that an aborted signal bypasses the ShouldAbort throttling, without
+// polling the training conditions.
+TEST(SimpleTaskEnvironmentTest, TestShouldAbortWithAbortSignal) {
+  StrictMock<TaskEnvironmentWithAbortSignal> task_env;
+  EXPECT_CALL(task_env, TrainingConditionsSatisfied()).WillOnce(Return(true));
+  absl::Time now = absl::Now();
+  bool result = task_env.ShouldAbort(
+      /*current_time=*/now,
+      /*condition_polling_period=*/absl::Milliseconds(1500));
+  EXPECT_FALSE(result);
+
+  task_env.abort_signal_.Abort();
+  result = task_env.ShouldAbort(
+      /*current_time=*/now + absl::Seconds(1),
+      /*condition_polling_period=*/absl::Milliseconds(1500));
+  EXPECT_TRUE(result);
+
+  // Once the signal is reset, the throttling applies again.
+  task_env.abort_signal_.Reset();
+  result = task_env.ShouldAbort(
+      /*current_time=*/now + absl::Seconds(1),
+      /*condition_polling_period=*/absl::Milliseconds(1500));
+  EXPECT_FALSE(result);
+}
+
+TEST(ExampleIteratorTest, NextBatchReturnsUpToMaxCountExamples) {
+  SimpleExampleIterator iterator({"a", "b", "c", "d", "e"});
+  absl::StatusOr<std::vector<std::string>> batch;
+  batch = iterator.NextBatch(/*max_count=*/2, /*max_bytes=*/100);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("a", "b"));
+  batch = iterator.NextBatch(/*max_count=*/2, /*max_bytes=*/100);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("c", "d"));
+  // The last batch is cut short by the end of the iterator, which is only
+  // reported by the next call.
+  batch = iterator.NextBatch(/*max_count=*/2, /*max_bytes=*/100);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("e"));
+  EXPECT_THAT(iterator.NextBatch(/*max_count=*/2, /*max_bytes=*/100),
+              IsCode(OUT_OF_RANGE));
+}
+
+TEST(ExampleIteratorTest, NextBatchStopsAtMaxBytes) {
+  SimpleExampleIterator iterator({"aa", "bb", "cc", "dddddd", "e"});
+  absl::StatusOr<std::vector<std::string>> batch;
+  batch = iterator.NextBatch(/*max_count=*/10, /*max_bytes=*/3);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("aa", "bb"));
+  batch = iterator.NextBatch(/*max_count=*/10, /*max_bytes=*/2);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("cc"));
+  // A single example larger than max_bytes is still returned.
+  batch = iterator.NextBatch(/*max_count=*/10, /*max_bytes=*/2);
+  ASSERT_OK(batch);
+  EXPECT_THAT(*batch, ElementsAre("dddddd"));
+}
+
+TEST(ExampleIteratorTest, NextBatchReturnsErrors) {
+  StrictMock<MockExampleIterator> iterator;
+  EXPECT_CALL(iterator, Next())
+      .WillOnce(Return(std::string("a")))
+      .WillOnce(Return(absl::CancelledError("")));
+  EXPECT_THAT(iterator.NextBatch(/*max_count=*/10, /*max_bytes=*/100),
+              IsCode(CANCELLED));
+}
+
+TEST(ExampleIteratorTest, NextIntoWritesExampleToAllocatedBuffer) {
+  SimpleExampleIterator iterator({"abc", ""});
+  std::string buffer;
+  auto allocate = [&buffer](size_t size) {
+    buffer.resize(size);
+    return buffer.data();
+  };
+  ASSERT_OK(iterator.NextInto(allocate));
+  EXPECT_EQ(buffer, "abc");
+  ASSERT_OK(iterator.NextInto(allocate));
+  EXPECT_EQ(buffer, "");
+  buffer = "unchanged";
+  EXPECT_THAT(iterator.NextInto(allocate), IsCode(OUT_OF_RANGE));
+  EXPECT_EQ(buffer, "unchanged");
+}
+
+TEST(ExampleIteratorTest, NextBatchIntoWritesExamplesToAllocatedBuffers) {
+  SimpleExampleIterator iterator({"aa", "", "bb", "c"});
+  // The buffers must remain valid until the call returns, so they are kept in
+  // a deque.
+  std::deque<std::string> buffers;
+  auto allocate = [&buffers](size_t size) {
+    buffers.emplace_back(size, '\0');
+    return buffers.back().data();
+  };
+  ASSERT_OK(iterator.NextBatchInto(/*max_count=*/3, /*max_bytes=*/100,
+                                   allocate));
+  EXPECT_THAT(buffers, ElementsAre("aa", "", "bb"));
+  buffers.clear();
+  ASSERT_OK(iterator.NextBatchInto(/*max_count=*/3, /*max_bytes=*/100,
+                                   allocate));
+  EXPECT_THAT(buffers, ElementsAre("c"));
+  buffers.clear();
+  EXPECT_THAT(iterator.NextBatchInto(/*max_count=*/3, /*max_bytes=*/100,
+                                     allocate),
+              IsCode(OUT_OF_RANGE));
+  EXPECT_THAT(buffers, IsEmpty());
+}
+
+TEST(ExampleIteratorTest, SkipSkipsExamples) {
+  SimpleExampleIterator iterator({"a", "b", "c", "d"});
+  ASSERT_OK(iterator.Skip(0));
+  ASSERT_OK(iterator.Skip(2));
+  absl::StatusOr<std::string> example = iterator.Next();
+  ASSERT_OK(example);
+  EXPECT_EQ(*example, "c");
+  // Skipping past the end of the iterator isn't an error.
+  ASSERT_OK(iterator.Skip(5));
+  EXPECT_THAT(iterator.Next(), IsCode(OUT_OF_RANGE));
+}
+
+TEST(ExampleIteratorTest, SkipReturnsErrors) {
+  StrictMock<MockExampleIterator> iterator;
+  EXPECT_CALL(iterator, Next())
+      .WillOnce(Return(std::string("a")))
+      .WillOnce(Return(absl::InvalidArgumentError("I/O error")));
+  EXPECT_THAT(iterator.Skip(3), IsCode(INVALID_ARGUMENT));
+}
+
 }  // anonymous namespace
 }  // namespace client
 }  // namespace fcp
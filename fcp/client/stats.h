@@ -46,6 +46,17 @@ struct NetworkStats {
   // network requests to finish (but, for example, excluding any idle time spent
   // waiting between issuing polling requests).
   absl::Duration network_duration = absl::ZeroDuration();
+  // The number of requests issued to poll long running operations which were
+  // not done yet.
+  int64_t operation_poll_count = 0;
+  // The duration of wall clock time spent polling long running operations until
+  // they were done (incl. any idle time spent waiting between polling
+  // requests).
+  absl::Duration operation_polling_duration = absl::ZeroDuration();
+  // The number of times the gRPC chunking layer's adaptive flow control grew
+  // or shrank the upload chunk size or the number of pending chunks.
+  int64_t chunking_layer_flow_control_increases = 0;
+  int64_t chunking_layer_flow_control_decreases = 0;
 
   // Returns the difference between two sets of network stats.
   NetworkStats operator-(const NetworkStats& other) const {
@@ -57,7 +68,17 @@ struct NetworkStats {
         .chunking_layer_bytes_sent =
             chunking_layer_bytes_sent - other.chunking_layer_bytes_sent,
         .report_size_bytes = report_size_bytes - other.report_size_bytes,
-        .network_duration = network_duration - other.network_duration};
+        .network_duration = network_duration - other.network_duration,
+        .operation_poll_count =
+            operation_poll_count - other.operation_poll_count,
+        .operation_polling_duration =
+            operation_polling_duration - other.operation_polling_duration,
+        .chunking_layer_flow_control_increases =
+            chunking_layer_flow_control_increases -
+            other.chunking_layer_flow_control_increases,
+        .chunking_layer_flow_control_decreases =
+            chunking_layer_flow_control_decreases -
+            other.chunking_layer_flow_control_decreases};
   }
 
   NetworkStats operator+(const NetworkStats& other) const {
@@ -69,7 +90,17 @@ struct NetworkStats {
         .chunking_layer_bytes_sent =
             chunking_layer_bytes_sent + other.chunking_layer_bytes_sent,
         .report_size_bytes = report_size_bytes + other.report_size_bytes,
-        .network_duration = network_duration + other.network_duration};
+        .network_duration = network_duration + other.network_duration,
+        .operation_poll_count =
+            operation_poll_count + other.operation_poll_count,
+        .operation_polling_duration =
+            operation_polling_duration + other.operation_polling_duration,
+        .chunking_layer_flow_control_increases =
+            chunking_layer_flow_control_increases +
+            other.chunking_layer_flow_control_increases,
+        .chunking_layer_flow_control_decreases =
+            chunking_layer_flow_control_decreases +
+            other.chunking_layer_flow_control_decreases};
   }
 };
 
@@ -79,7 +110,13 @@ inline bool operator==(const NetworkStats& s1, const NetworkStats& s2) {
          s1.chunking_layer_bytes_received == s2.chunking_layer_bytes_received &&
          s1.chunking_layer_bytes_sent == s2.chunking_layer_bytes_sent &&
          s1.report_size_bytes == s2.report_size_bytes &&
-         s1.network_duration == s2.network_duration;
+         s1.network_duration == s2.network_duration &&
+         s1.operation_poll_count == s2.operation_poll_count &&
+         s1.operation_polling_duration == s2.operation_polling_duration &&
+         s1.chunking_layer_flow_control_increases ==
+             s2.chunking_layer_flow_control_increases &&
+         s1.chunking_layer_flow_control_decreases ==
+             s2.chunking_layer_flow_control_decreases;
 }
 
 struct ExampleStats {
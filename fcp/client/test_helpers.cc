@@ -17,7 +17,9 @@
 
 #include <fcntl.h>
 
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -79,6 +81,20 @@ absl::StatusOr<std::string> SimpleExampleIterator::Next() {
   return absl::OutOfRangeError("");
 }
 
+absl::StatusOr<std::string> RepeatedExampleIterator::Next() {
+  if (remaining_examples_ == 0) return absl::OutOfRangeError("");
+  if (remaining_examples_ > 0) --remaining_examples_;
+  return example_;
+}
+
+absl::Status RepeatedExampleIterator::NextInto(
+    const std::function<char*(size_t size)>& allocate) {
+  if (remaining_examples_ == 0) return absl::OutOfRangeError("");
+  if (remaining_examples_ > 0) --remaining_examples_;
+  std::memcpy(allocate(example_.size()), example_.data(), example_.size());
+  return absl::OkStatus();
+}
+
 std::string ExtractSingleString(const tensorflow::Example& example,
                                 const char key[]) {
   return example.features().feature().at(key).bytes_list().value().at(0);
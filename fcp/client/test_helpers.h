@@ -16,6 +16,8 @@
 #ifndef FCP_CLIENT_TEST_HELPERS_H_
 #define FCP_CLIENT_TEST_HELPERS_H_
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -497,6 +499,25 @@ class SimpleExampleIterator : public ExampleIterator {
   int index_ = 0;
 };
 
+// An iterator that returns the same synthetic example of `example_size` bytes
+// `num_examples` times, or forever if `num_examples` is negative. Copying the
+// example stands in for the app producing each example's bytes, which
+// `NextInto` does straight into the given buffer. Used by benchmarks.
+class RepeatedExampleIterator : public ExampleIterator {
+ public:
+  explicit RepeatedExampleIterator(int64_t example_size,
+                                   int64_t num_examples = -1)
+      : example_(example_size, 'e'), remaining_examples_(num_examples) {}
+  absl::StatusOr<std::string> Next() override;
+  absl::Status NextInto(
+      const std::function<char*(size_t size)>& allocate) override;
+  void Close() override {}
+
+ private:
+  const std::string example_;
+  int64_t remaining_examples_;
+};
+
 class MockFlags : public Flags {
  public:
   MOCK_METHOD(int64_t, condition_polling_period_millis, (), (const, override));
@@ -537,9 +558,38 @@ class MockFlags : public Flags {
   MOCK_METHOD(int32_t, waiting_period_sec_for_cancellation, (),
               (const, override));
   MOCK_METHOD(bool, client_decoded_http_resources, (), (const, override));
+  MOCK_METHOD(int32_t, max_concurrent_resource_fetches, (),
+              (const, override));
   MOCK_METHOD(bool, enable_cache_dir, (), (const, override));
   MOCK_METHOD(bool, enable_federated_select, (), (const, override));
   MOCK_METHOD(bool, enable_per_phase_network_stats, (), (const, override));
+  MOCK_METHOD(int64_t, operation_polling_initial_delay_millis, (),
+              (const, override));
+  MOCK_METHOD(int64_t, operation_polling_max_delay_millis, (),
+              (const, override));
+  MOCK_METHOD(int64_t, operation_polling_max_suggested_delay_millis, (),
+              (const, override));
+  MOCK_METHOD(float, operation_polling_delay_multiplier, (),
+              (const, override));
+  MOCK_METHOD(float, operation_polling_delay_jitter_fraction, (),
+              (const, override));
+  MOCK_METHOD(bool, enable_grpc_adaptive_flow_control, (),
+              (const, override));
+  MOCK_METHOD(int32_t, grpc_max_incoming_chunked_message_size_bytes, (),
+              (const, override));
+  MOCK_METHOD(int32_t, example_iterator_prefetch_count, (),
+              (const, override));
+  MOCK_METHOD(int64_t, example_iterator_prefetch_bytes, (),
+              (const, override));
+  MOCK_METHOD(int32_t, max_cached_tensorflow_sessions, (), (const, override));
+  MOCK_METHOD(int32_t, max_cached_tflite_interpreters, (), (const, override));
+  MOCK_METHOD(bool, load_tflite_models_from_files, (), (const, override));
+  MOCK_METHOD(int64_t, tflite_model_cache_size_bytes, (), (const, override));
+  MOCK_METHOD(int32_t, plan_intra_op_threads, (), (const, override));
+  MOCK_METHOD(int32_t, plan_inter_op_threads, (), (const, override));
+  MOCK_METHOD(bool, share_plan_inter_op_thread_pool, (), (const, override));
+  MOCK_METHOD(int32_t, tflite_num_threads, (), (const, override));
+  MOCK_METHOD(std::vector<int32_t>, plan_cpu_affinity, (), (const, override));
 };
 
 // Helper methods for extracting opstats fields from TF examples.
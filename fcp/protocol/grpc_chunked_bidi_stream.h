@@ -21,17 +21,25 @@
 
 #include <algorithm>
 #include <deque>
+#include <limits>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "absl/base/attributes.h"
 #include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/protos/federated_api.grpc.pb.h"
 #include "grpcpp/impl/codegen/call_op_set.h"
 #include "grpcpp/impl/codegen/sync_stream.h"
+#include "zlib.h"
 
 namespace fcp {
 namespace client {
@@ -52,6 +60,17 @@ class GrpcChunkedBidiStream {
     int32_t chunk_size_for_upload = -1;
     int32_t max_pending_chunks = -1;
     google::internal::federatedml::v2::CompressionLevel compression_level{};
+    // If true, the chunk size and the number of pending chunks are adapted to
+    // the measured ack round trip time and goodput, starting from (and never
+    // going below) the values above, and never exceeding the limits below (or,
+    // on the client, the limits advertised by the server).
+    bool enable_adaptive_flow_control = false;
+    int32_t adaptive_max_chunk_size_for_upload = -1;
+    int32_t adaptive_max_pending_chunks = -1;
+    // The maximum uncompressed size of an incoming chunked message. Transfers
+    // advertising a larger size are rejected before any of their data is
+    // buffered. A negative value means no limit.
+    int32_t max_incoming_message_size = -1;
   };
   GrpcChunkedBidiStream(
       grpc::internal::WriterInterface<Outgoing>* writer_interface,
@@ -60,24 +79,95 @@ class GrpcChunkedBidiStream {
       grpc::internal::WriterInterface<Outgoing>* writer_interface,
       grpc::internal::ReaderInterface<Incoming>* reader_interface,
       GrpcChunkedBidiStreamOptions options);
-  virtual ~GrpcChunkedBidiStream() = default;
+  virtual ~GrpcChunkedBidiStream();
 
   // GrpcChunkedBidiStream is neither copyable nor movable.
   GrpcChunkedBidiStream(const GrpcChunkedBidiStream&) = delete;
   GrpcChunkedBidiStream& operator=(const GrpcChunkedBidiStream&) = delete;
 
+  // Sends the message, chunking it if necessary. Blocks until all of its chunks
+  // have been handed to the transport, which (once `max_pending_chunks` chunks
+  // are awaiting their acks) means waiting for acks from the other end. Any
+  // messages received while waiting are returned by subsequent Receive calls.
   ABSL_MUST_USE_RESULT absl::Status Send(Outgoing* message);
   ABSL_MUST_USE_RESULT absl::Status Receive(Incoming* message);
   void Close();
   int64_t ChunkingLayerBytesSent();
   int64_t ChunkingLayerBytesReceived();
+  // The number of times adaptive flow control grew or shrank the chunk size or
+  // the number of pending chunks.
+  int64_t ChunkingLayerFlowControlIncreases();
+  int64_t ChunkingLayerFlowControlDecreases();
 
  private:
+  // A ZeroCopyOutputStream which hands out the unused space of the Data chunk
+  // currently being filled, and which sends each chunk as soon as it is full
+  // (once the flow control window allows it). This lets a message be
+  // serialized (and compressed) straight into its chunks, without ever holding
+  // more than a single chunk of the serialized message in memory.
+  class ChunkOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+   public:
+    explicit ChunkOutputStream(GrpcChunkedBidiStream* stream)
+        : stream_(stream) {}
+
+    bool Next(void** data, int* size) override;
+    void BackUp(int count) override;
+    int64_t ByteCount() const override { return byte_count_; }
+
+    // Sends the remaining partially filled chunk, if any. At least one
+    // (possibly empty) chunk is always sent.
+    ABSL_MUST_USE_RESULT absl::Status Finish();
+
+    int32_t chunk_count() const { return chunk_count_; }
+    const absl::Status& status() const { return status_; }
+
+   private:
+    ABSL_MUST_USE_RESULT absl::Status SendChunk();
+
+    GrpcChunkedBidiStream* stream_;
+    Outgoing chunk_;
+    int32_t chunk_count_ = 0;
+    // The size of the chunk currently being filled, which is fixed when the
+    // chunk is started (even if adaptive flow control changes the chunk size in
+    // the meantime).
+    int capacity_ = 0;
+    int used_ = 0;
+    int64_t byte_count_ = 0;
+    absl::Status status_;
+  };
+
+  // A ZeroCopyInputStream which reads the data of a received chunked message
+  // straight from the Cord holding it, and releases each part of the Cord as
+  // soon as it has been read, so that the data isn't held in memory twice
+  // while the message is parsed from it.
+  class ConsumingCordInputStream
+      : public google::protobuf::io::ZeroCopyInputStream {
+   public:
+    explicit ConsumingCordInputStream(absl::Cord* cord) : cord_(cord) {}
+
+    bool Next(const void** data, int* size) override;
+    void BackUp(int count) override;
+    bool Skip(int count) override;
+    int64_t ByteCount() const override { return byte_count_; }
+
+   private:
+    // Releases the data returned by the last `Next` call (except for any that
+    // was backed up).
+    void ReleaseReturned();
+
+    absl::Cord* cord_;
+    int returned_ = 0;
+    int64_t byte_count_ = 0;
+  };
+
   ABSL_MUST_USE_RESULT absl::Status TryDecorateCheckinRequest(
       Outgoing* message);
-  ABSL_MUST_USE_RESULT absl::Status ChunkMessage(const Outgoing& message);
-  ABSL_MUST_USE_RESULT absl::Status TrySendPending();
+  ABSL_MUST_USE_RESULT absl::Status SendChunked(const Outgoing& message);
+  ABSL_MUST_USE_RESULT absl::Status SendWhenWindowAllows(
+      const Outgoing& message);
   ABSL_MUST_USE_RESULT absl::Status TrySend(const Outgoing& message);
+  void OnChunkAcked();
+  void AdjustFlowControl(absl::Time now);
   ABSL_MUST_USE_RESULT absl::Status SendAck(int32_t chunk_index);
   ABSL_MUST_USE_RESULT absl::Status SendRaw(const Outgoing& message,
                                             bool disable_compression = false);
@@ -86,7 +176,16 @@ class GrpcChunkedBidiStream {
                                                        bool* message_assembled);
   ABSL_MUST_USE_RESULT absl::Status AssemblePending(Incoming* message,
                                                     bool* message_assembled);
+  ABSL_MUST_USE_RESULT absl::Status AppendPending(std::string chunk_bytes);
+  void FlushInflateBlock();
+  void ResetPending();
   ABSL_MUST_USE_RESULT absl::Status ReceiveRaw(Incoming* message);
+  ABSL_MUST_USE_RESULT absl::Status ReceiveAndDispatch(
+      Incoming* message, bool* message_assembled);
+
+  // The size of the blocks that compressed incoming messages are decompressed
+  // into.
+  static constexpr int64_t kInflateBlockSize = 64 * 1024;
 
   grpc::internal::WriterInterface<Outgoing>* writer_interface_;
   grpc::internal::ReaderInterface<Incoming>* reader_interface_;
@@ -95,8 +194,28 @@ class GrpcChunkedBidiStream {
     int32_t uncompressed_size = -1;
     google::internal::federatedml::v2::CompressionLevel compression_level{};
     int32_t blob_size_bytes = -1;
-    std::deque<std::string> deque;
-    std::string composite;
+    int32_t chunk_count = 0;
+    int32_t max_message_size = -1;
+    // The uncompressed blob, which is filled in as the chunks arrive. The
+    // buffers of uncompressed chunks are adopted by the Cord as they are, and
+    // compressed chunks are decompressed into blocks of `kInflateBlockSize`
+    // bytes, which are appended to the Cord once full. So the blob grows along
+    // with the data received (rather than being allocated upfront based on the
+    // `uncompressed_size` advertised by the other end), is never copied as it
+    // grows, and never grows past that size. The message is then parsed from
+    // the Cord, releasing it as it goes, so that receiving a message never
+    // holds more than its uncompressed size plus a chunk (or a block) in
+    // memory, on top of the parsed message itself.
+    absl::Cord uncompressed;
+    std::string inflate_block;
+    int64_t inflate_block_used = 0;
+    int64_t uncompressed_bytes_received = 0;
+    z_stream inflate_stream{};
+    bool inflating = false;
+    bool inflate_stream_ended = false;
+    // Messages which were received while waiting for the flow control window
+    // to open up during a Send, and which are yet to be returned by Receive.
+    std::deque<std::unique_ptr<Incoming>> received;
     int64_t total_chunking_layer_bytes_received = 0;
   } incoming_;
 
@@ -105,13 +224,28 @@ class GrpcChunkedBidiStream {
     int32_t max_pending_chunks = 0;
     int32_t pending_chunks = 0;
     google::internal::federatedml::v2::CompressionLevel compression_level{};
-    std::deque<std::unique_ptr<Outgoing>> deque;
     int64_t total_chunking_layer_bytes_sent = 0;
 
-    google::internal::federatedml::v2::ChunkedTransferMessage* Add() {
-      deque.push_back(std::make_unique<Outgoing>());
-      return deque.back()->mutable_chunked_transfer();
-    }
+    // Adaptive flow control state. The chunk size and number of pending chunks
+    // are adapted between the `min_*` values (the initially configured ones)
+    // and the `max_*` values.
+    bool adaptive_flow_control = false;
+    int32_t min_chunk_size_for_upload = 0;
+    int32_t max_chunk_size_for_upload = 0;
+    int32_t min_max_pending_chunks = 0;
+    int32_t max_max_pending_chunks = 0;
+    // The send time and size of each chunk that hasn't been acked yet.
+    std::deque<std::pair<absl::Time, int64_t>> unacked_chunks;
+    absl::Duration min_rtt = absl::InfiniteDuration();
+    absl::Duration smoothed_rtt = absl::ZeroDuration();
+    // The chunks acked since the last adjustment, which together form a
+    // measurement round.
+    absl::Time round_start;
+    int32_t round_acks = 0;
+    int64_t round_bytes = 0;
+    double last_round_goodput = 0;
+    int64_t flow_control_increases = 0;
+    int64_t flow_control_decreases = 0;
   } outgoing_;
 };
 
@@ -142,6 +276,20 @@ GrpcChunkedBidiStream<Outgoing, Incoming>::GrpcChunkedBidiStream(
   outgoing_.chunk_size_for_upload = options.chunk_size_for_upload;
   outgoing_.max_pending_chunks = options.max_pending_chunks;
   outgoing_.compression_level = options.compression_level;
+  outgoing_.adaptive_flow_control = options.enable_adaptive_flow_control;
+  outgoing_.min_chunk_size_for_upload = options.chunk_size_for_upload;
+  outgoing_.max_chunk_size_for_upload =
+      std::max(options.chunk_size_for_upload,
+               options.adaptive_max_chunk_size_for_upload);
+  outgoing_.min_max_pending_chunks = options.max_pending_chunks;
+  outgoing_.max_max_pending_chunks = std::max(
+      options.max_pending_chunks, options.adaptive_max_pending_chunks);
+  incoming_.max_message_size = options.max_incoming_message_size;
+}
+
+template <typename Outgoing, typename Incoming>
+GrpcChunkedBidiStream<Outgoing, Incoming>::~GrpcChunkedBidiStream() {
+  ResetPending();
 }
 
 template <typename Outgoing, typename Incoming>
@@ -166,33 +314,44 @@ absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::Receive(
     Incoming* message) {
   COMMON_USING_DIRECTIVES;
   Status status;
-  bool message_assembled = false;
-
-  do {
-    FCP_RETURN_IF_ERROR(status = ReceiveRaw(message));
-    switch (message->kind_case()) {
-      case Incoming::KindCase::kChunkedTransfer:
-        if (message->chunked_transfer().kind_case() ==
-            ChunkedTransferMessage::kAck) {
-          --outgoing_.pending_chunks;
-          FCP_RETURN_IF_ERROR(status = TrySendPending());
-        } else {
-          FCP_RETURN_IF_ERROR(
-              status = TryAssemblePending(message, &message_assembled));
-        }
-        break;
-      default:
-        if (incoming_.uncompressed_size != -1)
-          return absl::InvalidArgumentError("Chunk reassembly in progress.");
-        message_assembled = true;
-        break;
-    }
-  } while (!message_assembled);
+  if (!incoming_.received.empty()) {
+    *message = std::move(*incoming_.received.front());
+    incoming_.received.pop_front();
+  } else {
+    bool message_assembled = false;
+    do {
+      FCP_RETURN_IF_ERROR(status =
+                              ReceiveAndDispatch(message, &message_assembled));
+    } while (!message_assembled);
+  }
 
   FCP_RETURN_IF_ERROR(status = TrySnoopCheckinResponse(message));
   return status;
 }
 
+template <typename Outgoing, typename Incoming>
+absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::ReceiveAndDispatch(
+    Incoming* message, bool* message_assembled) {
+  COMMON_USING_DIRECTIVES;
+  *message_assembled = false;
+  FCP_RETURN_IF_ERROR(ReceiveRaw(message));
+  switch (message->kind_case()) {
+    case Incoming::KindCase::kChunkedTransfer:
+      if (message->chunked_transfer().kind_case() ==
+          ChunkedTransferMessage::kAck) {
+        --outgoing_.pending_chunks;
+        OnChunkAcked();
+        return absl::OkStatus();
+      }
+      return TryAssemblePending(message, message_assembled);
+    default:
+      if (incoming_.uncompressed_size != -1)
+        return absl::InvalidArgumentError("Chunk reassembly in progress.");
+      *message_assembled = true;
+      return absl::OkStatus();
+  }
+}
+
 template <>
 inline absl::Status
 GrpcChunkedBidiStream<google::internal::federatedml::v2::ClientStreamMessage,
@@ -217,6 +376,8 @@ GrpcChunkedBidiStream<google::internal::federatedml::v2::ClientStreamMessage,
   options->add_supported_compression_levels(
       CompressionLevel::ZLIB_BEST_COMPRESSION);
   options->add_supported_compression_levels(CompressionLevel::ZLIB_BEST_SPEED);
+  if (outgoing_.adaptive_flow_control)
+    options->set_supports_adaptive_flow_control(true);
   return absl::OkStatus();
 }
 
@@ -228,78 +389,231 @@ GrpcChunkedBidiStream<Outgoing, Incoming>::TryDecorateCheckinRequest(
 }
 
 template <typename Outgoing, typename Incoming>
-absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkMessage(
+bool GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkOutputStream::Next(
+    void** data, int* size) {
+  if (!status_.ok()) return false;
+  if (used_ > 0 && used_ == capacity_ && !(status_ = SendChunk()).ok())
+    return false;
+  if (used_ == 0) capacity_ = stream_->outgoing_.chunk_size_for_upload;
+  std::string* chunk_bytes =
+      chunk_.mutable_chunked_transfer()->mutable_data()->mutable_chunk_bytes();
+  chunk_bytes->resize(static_cast<size_t>(capacity_));
+  *data = &(*chunk_bytes)[used_];
+  *size = capacity_ - used_;
+  byte_count_ += *size;
+  used_ = capacity_;
+  return true;
+}
+
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkOutputStream::BackUp(
+    int count) {
+  used_ -= count;
+  byte_count_ -= count;
+}
+
+template <typename Outgoing, typename Incoming>
+absl::Status
+GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkOutputStream::Finish() {
+  FCP_RETURN_IF_ERROR(status_);
+  if (used_ > 0 || chunk_count_ == 0) status_ = SendChunk();
+  return status_;
+}
+
+template <typename Outgoing, typename Incoming>
+absl::Status
+GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkOutputStream::SendChunk() {
+  auto data = chunk_.mutable_chunked_transfer()->mutable_data();
+  data->mutable_chunk_bytes()->resize(static_cast<size_t>(used_));
+  data->set_chunk_index(chunk_count_);
+  FCP_RETURN_IF_ERROR(stream_->SendWhenWindowAllows(chunk_));
+  ++stream_->outgoing_.pending_chunks;
+  stream_->outgoing_.unacked_chunks.emplace_back(absl::Now(), used_);
+  ++chunk_count_;
+  used_ = 0;
+  return absl::OkStatus();
+}
+
+template <typename Outgoing, typename Incoming>
+bool GrpcChunkedBidiStream<Outgoing, Incoming>::ConsumingCordInputStream::Next(
+    const void** data, int* size) {
+  ReleaseReturned();
+  if (cord_->empty()) return false;
+  absl::string_view chunk = *cord_->chunk_begin();
+  returned_ = static_cast<int>(
+      std::min<size_t>(chunk.size(), std::numeric_limits<int>::max()));
+  *data = chunk.data();
+  *size = returned_;
+  byte_count_ += returned_;
+  return true;
+}
+
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::ConsumingCordInputStream::
+    BackUp(int count) {
+  returned_ -= count;
+  byte_count_ -= count;
+}
+
+template <typename Outgoing, typename Incoming>
+bool GrpcChunkedBidiStream<Outgoing, Incoming>::ConsumingCordInputStream::Skip(
+    int count) {
+  ReleaseReturned();
+  const size_t skipped = std::min<size_t>(count, cord_->size());
+  cord_->RemovePrefix(skipped);
+  byte_count_ += skipped;
+  return skipped == static_cast<size_t>(count);
+}
+
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::ConsumingCordInputStream::
+    ReleaseReturned() {
+  cord_->RemovePrefix(returned_);
+  returned_ = 0;
+}
+
+template <typename Outgoing, typename Incoming>
+absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::SendChunked(
     const Outgoing& message) {
   COMMON_USING_DIRECTIVES;
 
-  auto start = outgoing_.Add()->mutable_start();
+  // Messages are serialized (and compressed) straight into their chunks, so
+  // neither the serialized message nor its compressed blob is ever held in
+  // memory. The size of a compressed blob is therefore unknown when the Start
+  // message is sent, so compressed transfers leave its blob_size_bytes unset
+  // (which receivers must already handle, see ChunkedTransferMessage.Start),
+  // and the End message's chunk count marks where the blob ends.
+  Outgoing start_message;
+  auto start = start_message.mutable_chunked_transfer()->mutable_start();
   start->set_compression_level(outgoing_.compression_level);
+  auto uncompressed_size = static_cast<int32_t>(message.ByteSizeLong());
+  start->set_uncompressed_size(uncompressed_size);
+  GzipOutputStream::Options options;
+  options.format = GzipOutputStream::ZLIB;
+  switch (outgoing_.compression_level) {
+    case CompressionLevel::UNCOMPRESSED:
+      // Force one empty packet for empty messages.
+      start->set_blob_size_bytes(std::max(uncompressed_size, 1));
+      break;
+    case CompressionLevel::ZLIB_DEFAULT:
+      options.compression_level = Z_DEFAULT_COMPRESSION;
+      break;
+    case CompressionLevel::ZLIB_BEST_COMPRESSION:
+      options.compression_level = Z_BEST_COMPRESSION;
+      break;
+    case CompressionLevel::ZLIB_BEST_SPEED:
+      options.compression_level = Z_BEST_SPEED;
+      break;
+    default:
+      return absl::InternalError("Unsupported compression level.");
+  }
+  FCP_RETURN_IF_ERROR(SendWhenWindowAllows(start_message));
 
-  // TODO(team): Replace with a more efficient serialization mechanism.
-  std::string output;
+  ChunkOutputStream chunk_output_stream(this);
   if (outgoing_.compression_level == CompressionLevel::UNCOMPRESSED) {
-    if (!message.AppendToString(&output))
-      return absl::InternalError("Could not append to std::string.");
-  } else {
-    StringOutputStream string_output_stream(&output);
-    GzipOutputStream::Options options;
-    options.format = GzipOutputStream::ZLIB;
-    switch (outgoing_.compression_level) {
-      case CompressionLevel::ZLIB_DEFAULT:
-        options.compression_level = Z_DEFAULT_COMPRESSION;
-        break;
-      case CompressionLevel::ZLIB_BEST_COMPRESSION:
-        options.compression_level = Z_BEST_COMPRESSION;
-        break;
-      case CompressionLevel::ZLIB_BEST_SPEED:
-        options.compression_level = Z_BEST_SPEED;
-        break;
-      default:
-        Close();
-        return absl::InternalError("Unsupported compression level.");
+    if (!message.SerializeToZeroCopyStream(&chunk_output_stream)) {
+      FCP_RETURN_IF_ERROR(chunk_output_stream.status());
+      return absl::InternalError("Could not serialize message.");
     }
-    GzipOutputStream compressed_stream(&string_output_stream, options);
+  } else {
+    GzipOutputStream compressed_stream(&chunk_output_stream, options);
     if (!message.SerializeToZeroCopyStream(&compressed_stream) ||
-        !compressed_stream.Close())
+        !compressed_stream.Close()) {
+      FCP_RETURN_IF_ERROR(chunk_output_stream.status());
       return absl::InvalidArgumentError(
           absl::StrCat("Failed to serialize message: ",
                        compressed_stream.ZlibErrorMessage()));
+    }
   }
+  FCP_RETURN_IF_ERROR(chunk_output_stream.Finish());
 
-  auto blob_size_bytes = static_cast<int32_t>(output.size());
-  int32_t chunk_index = 0;
-  if (!blob_size_bytes) blob_size_bytes = 1;  // Force one empty packet.
-  for (size_t offset = 0; offset < blob_size_bytes;
-       offset += std::min(blob_size_bytes, outgoing_.chunk_size_for_upload),
-              ++chunk_index) {
-    auto data = outgoing_.Add()->mutable_data();
-    data->set_chunk_index(chunk_index);
-    data->set_chunk_bytes(output.substr(
-        offset, static_cast<size_t>(outgoing_.chunk_size_for_upload)));
-  }
+  Outgoing end_message;
+  end_message.mutable_chunked_transfer()->mutable_end()->set_chunk_count(
+      chunk_output_stream.chunk_count());
+  return SendWhenWindowAllows(end_message);
+}
 
-  start->set_uncompressed_size(static_cast<int32_t>(message.ByteSizeLong()));
-  start->set_blob_size_bytes(blob_size_bytes);
+template <typename Outgoing, typename Incoming>
+absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::SendWhenWindowAllows(
+    const Outgoing& message) {
+  // Process incoming messages until enough of the pending chunks have been
+  // acked. Any complete messages received in the meantime are kept around
+  // for subsequent Receive calls.
+  while (outgoing_.pending_chunks >= outgoing_.max_pending_chunks) {
+    auto incoming = std::make_unique<Incoming>();
+    bool message_assembled = false;
+    FCP_RETURN_IF_ERROR(
+        ReceiveAndDispatch(incoming.get(), &message_assembled));
+    if (message_assembled) incoming_.received.push_back(std::move(incoming));
+  }
+  return SendRaw(message, outgoing_.compression_level > 0);
+}
 
-  auto end = outgoing_.Add()->mutable_end();
-  end->set_chunk_count(chunk_index);
-  return absl::OkStatus();
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::OnChunkAcked() {
+  if (outgoing_.unacked_chunks.empty()) return;
+  const absl::Time now = absl::Now();
+  const auto [sent_time, size] = outgoing_.unacked_chunks.front();
+  outgoing_.unacked_chunks.pop_front();
+  const absl::Duration rtt = now - sent_time;
+  outgoing_.min_rtt = std::min(outgoing_.min_rtt, rtt);
+  outgoing_.smoothed_rtt = outgoing_.smoothed_rtt == absl::ZeroDuration()
+                               ? rtt
+                               : (7 * outgoing_.smoothed_rtt + rtt) / 8;
+  if (!outgoing_.adaptive_flow_control) return;
+  if (outgoing_.round_acks == 0) outgoing_.round_start = sent_time;
+  ++outgoing_.round_acks;
+  outgoing_.round_bytes += size;
+  // Only adjust once a full window's worth of chunks has been acked, so that
+  // each measurement reflects the current window.
+  if (outgoing_.round_acks >= outgoing_.max_pending_chunks)
+    AdjustFlowControl(now);
 }
 
 template <typename Outgoing, typename Incoming>
-absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::TrySendPending() {
-  COMMON_USING_DIRECTIVES;
-  auto status = absl::OkStatus();
-  while (!outgoing_.deque.empty() &&
-         outgoing_.pending_chunks < outgoing_.max_pending_chunks) {
-    auto& front = outgoing_.deque.front();
-    FCP_RETURN_IF_ERROR(status =
-                            SendRaw(*front, outgoing_.compression_level > 0));
-    if (front->chunked_transfer().kind_case() == ChunkedTransferMessage::kData)
-      ++outgoing_.pending_chunks;
-    outgoing_.deque.pop_front();
+void GrpcChunkedBidiStream<Outgoing, Incoming>::AdjustFlowControl(
+    absl::Time now) {
+  const double goodput =
+      static_cast<double>(outgoing_.round_bytes) /
+      std::max(absl::ToDoubleSeconds(now - outgoing_.round_start), 1e-6);
+  const int32_t chunk_size = outgoing_.chunk_size_for_upload;
+  const int32_t max_pending_chunks = outgoing_.max_pending_chunks;
+  // The small absolute margin keeps scheduling jitter on very low latency
+  // links from being mistaken for queueing.
+  if (outgoing_.smoothed_rtt >
+      2 * outgoing_.min_rtt + absl::Milliseconds(5)) {
+    // Acks take much longer than they did on an idle link, which means that
+    // data is queueing up somewhere: back off, shrinking the window before the
+    // chunk size.
+    if (max_pending_chunks > outgoing_.min_max_pending_chunks) {
+      outgoing_.max_pending_chunks =
+          std::max(outgoing_.min_max_pending_chunks, max_pending_chunks / 2);
+    } else {
+      outgoing_.chunk_size_for_upload =
+          std::max(outgoing_.min_chunk_size_for_upload, chunk_size / 2);
+    }
+  } else if (goodput > 1.1 * outgoing_.last_round_goodput) {
+    // The previous increase paid off (or this is the first measurement), so
+    // keep growing: first the window, then the chunk size.
+    if (max_pending_chunks < outgoing_.max_max_pending_chunks) {
+      outgoing_.max_pending_chunks =
+          std::min(outgoing_.max_max_pending_chunks, max_pending_chunks * 2);
+    } else {
+      outgoing_.chunk_size_for_upload = static_cast<int32_t>(
+          std::min<int64_t>(outgoing_.max_chunk_size_for_upload,
+                            int64_t{chunk_size} * 2));
+    }
   }
-  return status;
+  if (outgoing_.chunk_size_for_upload > chunk_size ||
+      outgoing_.max_pending_chunks > max_pending_chunks) {
+    ++outgoing_.flow_control_increases;
+  } else if (outgoing_.chunk_size_for_upload < chunk_size ||
+             outgoing_.max_pending_chunks < max_pending_chunks) {
+    ++outgoing_.flow_control_decreases;
+  }
+  outgoing_.last_round_goodput = goodput;
+  outgoing_.round_acks = 0;
+  outgoing_.round_bytes = 0;
 }
 
 template <typename Outgoing, typename Incoming>
@@ -309,11 +623,10 @@ absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::TrySend(
   if (outgoing_.chunk_size_for_upload <= 0 || outgoing_.max_pending_chunks <= 0)
     return SendRaw(message);  // No chunking.
   absl::Status status;
-  if (!(status = ChunkMessage(message)).ok()) {
+  if (!(status = SendChunked(message)).ok()) {
     Close();
-    return status;
   }
-  return TrySendPending();
+  return status;
 }
 
 template <typename Outgoing, typename Incoming>
@@ -375,6 +688,16 @@ GrpcChunkedBidiStream<google::internal::federatedml::v2::ClientStreamMessage,
     outgoing_.chunk_size_for_upload = options.chunk_size_for_upload();
     outgoing_.max_pending_chunks = options.max_pending_chunks();
     outgoing_.compression_level = options.compression_level();
+    // The advertised values are where adaptive flow control starts from, and
+    // the lower bounds it adapts within.
+    outgoing_.min_chunk_size_for_upload = options.chunk_size_for_upload();
+    outgoing_.max_chunk_size_for_upload =
+        std::max(options.chunk_size_for_upload(),
+                 options.adaptive_flow_control().max_chunk_size_for_upload());
+    outgoing_.min_max_pending_chunks = options.max_pending_chunks();
+    outgoing_.max_max_pending_chunks =
+        std::max(options.max_pending_chunks(),
+                 options.adaptive_flow_control().max_pending_chunks());
   }
   return absl::OkStatus();
 }
@@ -392,24 +715,42 @@ absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::TryAssemblePending(
     Incoming* message, bool* message_assembled) {
   COMMON_USING_DIRECTIVES;
   *message_assembled = false;
-  auto chunk = message->chunked_transfer();
+  const auto& chunk = message->chunked_transfer();
   switch (chunk.kind_case()) {
     case ChunkedTransferMessage::kStart:
-      if (!incoming_.deque.empty() || incoming_.uncompressed_size != -1)
+      if (incoming_.chunk_count != 0 || incoming_.uncompressed_size != -1)
         return absl::InternalError("Unexpected Start.");
+      if (chunk.start().uncompressed_size() < 0)
+        return absl::InvalidArgumentError(
+            absl::StrCat("Invalid uncompressed size: ",
+                         chunk.start().uncompressed_size()));
+      if (incoming_.max_message_size >= 0 &&
+          chunk.start().uncompressed_size() > incoming_.max_message_size)
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Uncompressed size ", chunk.start().uncompressed_size(),
+            " exceeds the maximum message size ", incoming_.max_message_size));
       incoming_.uncompressed_size = chunk.start().uncompressed_size();
       incoming_.compression_level = chunk.start().compression_level();
       incoming_.blob_size_bytes = chunk.start().blob_size_bytes();
+      if (incoming_.compression_level != CompressionLevel::UNCOMPRESSED) {
+        // Adding 32 to the window bits lets zlib detect both zlib and gzip
+        // headers, like GzipInputStream's AUTO format does.
+        if (inflateInit2(&incoming_.inflate_stream, 32 + MAX_WBITS) != Z_OK)
+          return absl::InternalError("Could not initialize inflate stream.");
+        incoming_.inflating = true;
+      }
       break;
     case ChunkedTransferMessage::kData:
-      if (chunk.data().chunk_index() != incoming_.deque.size())
+      if (incoming_.uncompressed_size == -1 ||
+          chunk.data().chunk_index() != incoming_.chunk_count)
         return absl::InternalError("Unexpected Data.");
-      incoming_.deque.emplace_back(chunk.data().chunk_bytes());
-      incoming_.composite.append(incoming_.deque.back());
-      return SendAck(static_cast<int32_t>(incoming_.deque.size() - 1));
+      FCP_RETURN_IF_ERROR(AppendPending(std::move(
+          *message->mutable_chunked_transfer()->mutable_data()
+               ->mutable_chunk_bytes())));
+      return SendAck(incoming_.chunk_count++);
     case ChunkedTransferMessage::kEnd:
-      if (incoming_.deque.empty() ||
-          chunk.end().chunk_count() != incoming_.deque.size())
+      if (incoming_.chunk_count == 0 ||
+          chunk.end().chunk_count() != incoming_.chunk_count)
         return absl::InternalError("Unexpected End.");
       return AssemblePending(message, message_assembled);
     case ChunkedTransferMessage::kAck:
@@ -423,29 +764,113 @@ absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::TryAssemblePending(
   return absl::OkStatus();
 }
 
+template <typename Outgoing, typename Incoming>
+absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::AppendPending(
+    std::string chunk_bytes) {
+  const int64_t capacity = incoming_.uncompressed_size;
+  if (!incoming_.inflating) {
+    if (incoming_.uncompressed_bytes_received +
+            static_cast<int64_t>(chunk_bytes.size()) >
+        capacity)
+      return absl::InternalError("Data exceeds the uncompressed size.");
+    incoming_.uncompressed_bytes_received += chunk_bytes.size();
+    incoming_.uncompressed.Append(std::move(chunk_bytes));
+    return absl::OkStatus();
+  }
+
+  if (incoming_.inflate_stream_ended) {
+    if (chunk_bytes.empty()) return absl::OkStatus();
+    return absl::InternalError("Unexpected data after compressed stream.");
+  }
+  z_stream& stream = incoming_.inflate_stream;
+  stream.next_in = reinterpret_cast<Bytef*>(chunk_bytes.data());
+  stream.avail_in = static_cast<uInt>(chunk_bytes.size());
+  while (true) {
+    // Start a new block once the previous one has been appended to the blob.
+    // Blocks never extend past the uncompressed size.
+    std::string& block = incoming_.inflate_block;
+    if (block.empty()) {
+      block.resize(static_cast<size_t>(
+          std::min(capacity - incoming_.uncompressed_bytes_received,
+                   kInflateBlockSize)));
+      incoming_.inflate_block_used = 0;
+    }
+    // `data()` is never null, which zlib requires even if there's no room.
+    stream.next_out =
+        reinterpret_cast<Bytef*>(block.data()) + incoming_.inflate_block_used;
+    stream.avail_out =
+        static_cast<uInt>(block.size() - incoming_.inflate_block_used);
+    const uInt avail_out_before = stream.avail_out;
+    int result = inflate(&stream, Z_NO_FLUSH);
+    const uInt inflated = avail_out_before - stream.avail_out;
+    incoming_.inflate_block_used += inflated;
+    incoming_.uncompressed_bytes_received += inflated;
+    if (!block.empty() && stream.avail_out == 0) FlushInflateBlock();
+    if (result == Z_STREAM_END) {
+      incoming_.inflate_stream_ended = true;
+      if (stream.avail_in > 0)
+        return absl::InternalError("Unexpected data after compressed stream.");
+      return absl::OkStatus();
+    } else if (result == Z_BUF_ERROR) {
+      // No progress was possible: either all of the chunk has been consumed,
+      // or the blob has reached its uncompressed size but there's more data.
+      if (stream.avail_in == 0) return absl::OkStatus();
+      return absl::InternalError("Data exceeds the uncompressed size.");
+    } else if (result != Z_OK) {
+      return absl::InternalError(
+          absl::StrCat("Could not decompress data: ",
+                       stream.msg != nullptr ? stream.msg : "unknown error"));
+    }
+    // Once all of the chunk has been consumed, zlib may still hold back output
+    // if it ran out of room, so only stop once it no longer did.
+    if (stream.avail_in == 0 && stream.avail_out > 0) return absl::OkStatus();
+  }
+}
+
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::FlushInflateBlock() {
+  std::string& block = incoming_.inflate_block;
+  block.resize(static_cast<size_t>(incoming_.inflate_block_used));
+  incoming_.uncompressed.Append(std::move(block));
+  block.clear();
+  incoming_.inflate_block_used = 0;
+}
+
 template <typename Outgoing, typename Incoming>
 absl::Status GrpcChunkedBidiStream<Outgoing, Incoming>::AssemblePending(
     Incoming* message, bool* message_assembled) {
-  COMMON_USING_DIRECTIVES;
-  // TODO(team): Replace with a more efficient deserialization mechanism.
-  if (incoming_.compression_level == CompressionLevel::UNCOMPRESSED) {
-    if (!message->ParseFromString(incoming_.composite))
-      return absl::InternalError(absl::StrCat("Could not parse from std::string. ",
-                                              incoming_.composite.size()));
-  } else {
-    ArrayInputStream string_input_stream(
-        incoming_.composite.c_str(),
-        static_cast<int>(incoming_.composite.size()));
-    GzipInputStream compressed_stream(&string_input_stream);
-    if (!message->ParseFromZeroCopyStream(&compressed_stream))
-      return absl::InternalError("Could not parse proto from input stream.");
-  }
+  if (incoming_.inflating && !incoming_.inflate_stream_ended)
+    return absl::InternalError("Incomplete compressed data.");
+  if (incoming_.uncompressed_bytes_received != incoming_.uncompressed_size)
+    return absl::InternalError(
+        absl::StrCat("Received ", incoming_.uncompressed_bytes_received,
+                     " bytes, but expected ", incoming_.uncompressed_size));
+  if (incoming_.inflate_block_used > 0) FlushInflateBlock();
+  ConsumingCordInputStream input_stream(&incoming_.uncompressed);
+  if (!message->ParseFromZeroCopyStream(&input_stream))
+    return absl::InternalError(
+        absl::StrCat("Could not parse proto from ",
+                     incoming_.uncompressed_size, " bytes."));
   *message_assembled = true;
+  ResetPending();
+  return absl::OkStatus();
+}
+
+template <typename Outgoing, typename Incoming>
+void GrpcChunkedBidiStream<Outgoing, Incoming>::ResetPending() {
+  if (incoming_.inflating) inflateEnd(&incoming_.inflate_stream);
+  incoming_.inflate_stream = z_stream{};
+  incoming_.inflating = false;
+  incoming_.inflate_stream_ended = false;
   incoming_.uncompressed_size = -1;
   incoming_.blob_size_bytes = -1;
-  incoming_.deque.clear();
-  incoming_.composite.clear();
-  return absl::OkStatus();
+  incoming_.chunk_count = 0;
+  incoming_.uncompressed_bytes_received = 0;
+  incoming_.uncompressed.Clear();
+  // Release the block, rather than keeping its allocation around until the
+  // next compressed message arrives.
+  std::string().swap(incoming_.inflate_block);
+  incoming_.inflate_block_used = 0;
 }
 
 template <typename Outgoing, typename Incoming>
@@ -478,6 +903,18 @@ int64_t GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkingLayerBytesSent() {
   return outgoing_.total_chunking_layer_bytes_sent;
 }
 
+template <typename Outgoing, typename Incoming>
+int64_t
+GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkingLayerFlowControlIncreases() {
+  return outgoing_.flow_control_increases;
+}
+
+template <typename Outgoing, typename Incoming>
+int64_t
+GrpcChunkedBidiStream<Outgoing, Incoming>::ChunkingLayerFlowControlDecreases() {
+  return outgoing_.flow_control_decreases;
+}
+
 }  // namespace client
 }  // namespace fcp
 
@@ -16,19 +16,32 @@
 
 #include "fcp/protocol/grpc_chunked_bidi_stream.h"
 
+#include <sys/resource.h>
+
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <random>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/algorithm/container.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "fcp/base/monitoring.h"
 #include "fcp/client/fake_server.h"
 #include "fcp/client/grpc_bidi_stream.h"
 #include "fcp/protos/federated_api.pb.h"
 #include "fcp/testing/testing.h"
+#include "grpcpp/impl/codegen/call_op_set.h"
+#include "grpcpp/impl/codegen/sync_stream.h"
 #include "grpcpp/security/server_credentials.h"
 #include "grpcpp/server.h"
 #include "grpcpp/server_builder.h"
@@ -43,6 +56,7 @@ using google::internal::federatedml::v2::CompressionLevel;
 using google::internal::federatedml::v2::ServerStreamMessage;
 using ::testing::Gt;
 using ::testing::Le;
+using ::testing::Lt;
 using ::testing::Not;
 
 std::string SimpleSelfVerifyingString(size_t n) {
@@ -324,6 +338,422 @@ INSTANTIATE_TEST_SUITE_P(
       return name;
     });
 
+// A fake transport standing in for a gRPC stream, which acks each Data chunk
+// written to it (without holding on to the chunk's data) after a simulated
+// round trip time, and which can additionally be primed with other messages to
+// deliver.
+class FakeAckingTransport
+    : public grpc::internal::WriterInterface<ClientStreamMessage>,
+      public grpc::internal::ReaderInterface<ServerStreamMessage> {
+ public:
+  explicit FakeAckingTransport(bool record_written_messages,
+                               absl::Duration rtt = absl::ZeroDuration())
+      : record_written_messages_(record_written_messages), rtt_(rtt) {}
+
+  bool Write(const ClientStreamMessage& msg,
+             grpc::WriteOptions options) override {
+    if (msg.chunked_transfer().has_data()) {
+      const int64_t chunk_size =
+          msg.chunked_transfer().data().chunk_bytes().size();
+      ++unacked_chunks_;
+      max_unacked_chunks_ = std::max(max_unacked_chunks_, unacked_chunks_);
+      max_chunk_size_ = std::max(max_chunk_size_, chunk_size);
+      chunk_bytes_written_ += chunk_size;
+      ServerStreamMessage ack;
+      ack.mutable_chunked_transfer()->mutable_ack()->set_chunk_index(
+          msg.chunked_transfer().data().chunk_index());
+      to_deliver_.emplace_back(absl::Now() + rtt_, ack);
+    }
+    if (record_written_messages_) written_messages_.push_back(msg);
+    return true;
+  }
+
+  bool NextMessageSize(uint32_t* sz) override {
+    if (to_deliver_.empty()) return false;
+    *sz = static_cast<uint32_t>(to_deliver_.front().second.ByteSizeLong());
+    return true;
+  }
+
+  bool Read(ServerStreamMessage* msg) override {
+    if (to_deliver_.empty()) return false;
+    absl::SleepFor(to_deliver_.front().first - absl::Now());
+    *msg = std::move(to_deliver_.front().second);
+    to_deliver_.pop_front();
+    if (msg->chunked_transfer().has_ack()) --unacked_chunks_;
+    return true;
+  }
+
+  void Deliver(ServerStreamMessage msg) {
+    to_deliver_.emplace_back(absl::Now(), msg);
+  }
+
+  int max_unacked_chunks() const { return max_unacked_chunks_; }
+  int64_t max_chunk_size() const { return max_chunk_size_; }
+  int64_t chunk_bytes_written() const { return chunk_bytes_written_; }
+  const std::vector<ClientStreamMessage>& written_messages() const {
+    return written_messages_;
+  }
+
+ private:
+  const bool record_written_messages_;
+  const absl::Duration rtt_;
+  // The messages to deliver, along with the time at which they arrive.
+  std::deque<std::pair<absl::Time, ServerStreamMessage>> to_deliver_;
+  std::vector<ClientStreamMessage> written_messages_;
+  int unacked_chunks_ = 0;
+  int max_unacked_chunks_ = 0;
+  int64_t max_chunk_size_ = 0;
+  int64_t chunk_bytes_written_ = 0;
+};
+
+// Replays previously written client messages to a server-side stream.
+class ReplayingReader
+    : public grpc::internal::ReaderInterface<ClientStreamMessage> {
+ public:
+  explicit ReplayingReader(const std::vector<ClientStreamMessage>& messages)
+      : messages_(messages.begin(), messages.end()) {}
+
+  bool NextMessageSize(uint32_t* sz) override {
+    if (messages_.empty()) return false;
+    *sz = static_cast<uint32_t>(messages_.front().ByteSizeLong());
+    return true;
+  }
+
+  bool Read(ClientStreamMessage* msg) override {
+    if (messages_.empty()) return false;
+    *msg = std::move(messages_.front());
+    messages_.pop_front();
+    return true;
+  }
+
+ private:
+  std::deque<ClientStreamMessage> messages_;
+};
+
+// Discards everything written to it.
+class DiscardingWriter
+    : public grpc::internal::WriterInterface<ServerStreamMessage> {
+ public:
+  bool Write(const ServerStreamMessage& msg,
+             grpc::WriteOptions options) override {
+    return true;
+  }
+};
+
+using ClientChunkedBidiStream =
+    GrpcChunkedBidiStream<ClientStreamMessage, ServerStreamMessage>;
+
+int64_t PeakRssBytes() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is reported in KiB on Linux.
+  return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+}
+
+class GrpcChunkedBidiStreamFakeTransportTest
+    : public ::testing::TestWithParam<CompressionLevel> {};
+
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest, RoundTrip) {
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/129,
+                                         /*max_pending_chunks=*/3, GetParam()});
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(100 * 1000));
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+  EXPECT_THAT(transport.max_unacked_chunks(), Le(3));
+
+  // The Start message must advertise the size of an uncompressed blob. The
+  // size of a compressed blob isn't known upfront, so it is left unset.
+  int64_t blob_size_bytes = -1;
+  int64_t chunk_bytes = 0;
+  for (const auto& message : transport.written_messages()) {
+    if (message.chunked_transfer().has_start()) {
+      blob_size_bytes = message.chunked_transfer().start().blob_size_bytes();
+    } else if (message.chunked_transfer().has_data()) {
+      chunk_bytes += message.chunked_transfer().data().chunk_bytes().size();
+    }
+  }
+  EXPECT_EQ(blob_size_bytes,
+            GetParam() == CompressionLevel::UNCOMPRESSED ? chunk_bytes : 0);
+
+  ReplayingReader reader(transport.written_messages());
+  DiscardingWriter writer;
+  GrpcChunkedBidiStream<ServerStreamMessage, ClientStreamMessage> server_stream(
+      &writer, &reader);
+  ClientStreamMessage received;
+  ASSERT_THAT(server_stream.Receive(&received), IsOk());
+  EXPECT_TRUE(
+      VerifyString(received.report_request().report().update_checkpoint()));
+  EXPECT_EQ(received.report_request().report().update_checkpoint().size(),
+            100 * 1000);
+}
+
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest, EmptyMessageRoundTrip) {
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/129,
+                                         /*max_pending_chunks=*/3, GetParam()});
+  ClientStreamMessage request;
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+
+  ReplayingReader reader(transport.written_messages());
+  DiscardingWriter writer;
+  GrpcChunkedBidiStream<ServerStreamMessage, ClientStreamMessage> server_stream(
+      &writer, &reader);
+  ClientStreamMessage received;
+  ASSERT_THAT(server_stream.Receive(&received), IsOk());
+  EXPECT_EQ(received.ByteSizeLong(), 0);
+}
+
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest,
+       MessagesReceivedDuringSendAreReturnedByReceive) {
+  FakeAckingTransport transport(/*record_written_messages=*/false);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/8,
+                                         /*max_pending_chunks=*/1, GetParam()});
+  // This message will be delivered before the ack for the first chunk, while
+  // the stream is waiting to send the next one.
+  ServerStreamMessage server_message;
+  server_message.mutable_checkin_request_ack()
+      ->mutable_retry_window_if_accepted()
+      ->set_retry_token("token");
+  transport.Deliver(server_message);
+
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(1000));
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+
+  ServerStreamMessage received;
+  ASSERT_THAT(client_stream.Receive(&received), IsOk());
+  EXPECT_EQ(received.checkin_request_ack()
+                .retry_window_if_accepted()
+                .retry_token(),
+            "token");
+}
+
+using ServerChunkedBidiStream =
+    GrpcChunkedBidiStream<ServerStreamMessage, ClientStreamMessage>;
+
+// Replays a recorded chunked transfer of a message to a server-side stream,
+// after overriding the uncompressed size advertised in its Start message.
+Status ReceiveWithAdvertisedSize(std::vector<ClientStreamMessage> transfer,
+                                 int32_t uncompressed_size_delta,
+                                 int32_t max_incoming_message_size = -1) {
+  for (auto& message : transfer) {
+    if (message.chunked_transfer().has_start()) {
+      auto start = message.mutable_chunked_transfer()->mutable_start();
+      start->set_uncompressed_size(start->uncompressed_size() +
+                                   uncompressed_size_delta);
+    }
+  }
+  ReplayingReader reader(transfer);
+  DiscardingWriter writer;
+  ServerChunkedBidiStream::GrpcChunkedBidiStreamOptions options;
+  options.max_incoming_message_size = max_incoming_message_size;
+  ServerChunkedBidiStream server_stream(&writer, &reader, options);
+  ClientStreamMessage received;
+  return server_stream.Receive(&received);
+}
+
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest,
+       ReceiveRejectsDataNotMatchingUncompressedSize) {
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/129,
+                                         /*max_pending_chunks=*/3, GetParam()});
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(10 * 1000));
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(), 0),
+              IsOk());
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(), -1),
+              IsCode(INTERNAL));
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(), 1),
+              IsCode(INTERNAL));
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(),
+                                        -request.ByteSizeLong() - 1),
+              IsCode(INVALID_ARGUMENT));
+}
+
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest,
+       ReceiveRejectsMessagesLargerThanMaxMessageSize) {
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/129,
+                                         /*max_pending_chunks=*/3, GetParam()});
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(10 * 1000));
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+  const auto message_size = static_cast<int32_t>(request.ByteSizeLong());
+
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(), 0,
+                                        message_size),
+              IsOk());
+  EXPECT_THAT(ReceiveWithAdvertisedSize(transport.written_messages(), 0,
+                                        message_size - 1),
+              IsCode(INVALID_ARGUMENT));
+}
+
+// The receive buffer must grow with the data actually received, rather than
+// being allocated upfront based on the size advertised by the other end.
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest,
+       ReceiveDoesNotAllocateAdvertisedSizeUpfront) {
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/129,
+                                         /*max_pending_chunks=*/3, GetParam()});
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(10 * 1000));
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+
+  constexpr int32_t kAdvertisedSize = 1024 * 1024 * 1024;
+  int64_t peak_rss_before = PeakRssBytes();
+  EXPECT_THAT(
+      ReceiveWithAdvertisedSize(transport.written_messages(),
+                                kAdvertisedSize - request.ByteSizeLong()),
+      IsCode(INTERNAL));
+  EXPECT_THAT(PeakRssBytes() - peak_rss_before, Le(kAdvertisedSize / 16));
+}
+
+// Returns a string of the given size which doesn't compress.
+std::string IncompressibleString(int64_t size) {
+  std::string result(size, '\0');
+  std::mt19937_64 random;
+  for (int64_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t value = random();
+    std::memcpy(&result[i], &value,
+                std::min<int64_t>(sizeof(value), size - i));
+  }
+  return result;
+}
+
+// Receiving a large message must not require holding additional copies of it
+// in memory either: the received data is adopted (or decompressed into blocks)
+// rather than copied into a growing buffer, and released as it is parsed. So
+// the memory needed on top of the received chunks is mostly taken up by the
+// parsed message.
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest,
+       LargeMessageReceiveMemoryIsBounded) {
+  constexpr int64_t kMessageSize = 32 * 1024 * 1024;
+  FakeAckingTransport transport(/*record_written_messages=*/true);
+  {
+    ClientChunkedBidiStream client_stream(
+        &transport, &transport,
+        {/*chunk_size_for_upload=*/64 * 1024, /*max_pending_chunks=*/2,
+         GetParam()});
+    ClientStreamMessage request;
+    *request.mutable_report_request()
+         ->mutable_report()
+         ->mutable_update_checkpoint() = IncompressibleString(kMessageSize);
+    ASSERT_THAT(client_stream.Send(&request), IsOk());
+  }
+  ReplayingReader reader(transport.written_messages());
+  DiscardingWriter writer;
+  GrpcChunkedBidiStream<ServerStreamMessage, ClientStreamMessage> server_stream(
+      &writer, &reader);
+
+  int64_t peak_rss_before = PeakRssBytes();
+  ClientStreamMessage received;
+  ASSERT_THAT(server_stream.Receive(&received), IsOk());
+  int64_t peak_rss_increase = PeakRssBytes() - peak_rss_before;
+
+  EXPECT_EQ(received.report_request().report().update_checkpoint().size(),
+            kMessageSize);
+  EXPECT_THAT(peak_rss_increase, Le(kMessageSize + kMessageSize / 4));
+}
+
+// Sending a large message must not require holding additional copies of it (in
+// serialized, compressed or chunked form) in memory: the chunks are produced
+// on demand, as the flow control window allows. The message doesn't compress,
+// so that buffering its compressed blob would be noticed as well.
+TEST_P(GrpcChunkedBidiStreamFakeTransportTest, LargeMessageMemoryIsBounded) {
+  constexpr int64_t kMessageSize = 256 * 1024 * 1024;
+  FakeAckingTransport transport(/*record_written_messages=*/false);
+  ClientChunkedBidiStream client_stream(&transport, &transport,
+                                        {/*chunk_size_for_upload=*/8192,
+                                         /*max_pending_chunks=*/2, GetParam()});
+  ClientStreamMessage request;
+  *request.mutable_report_request()
+       ->mutable_report()
+       ->mutable_update_checkpoint() = IncompressibleString(kMessageSize);
+
+  int64_t peak_rss_before = PeakRssBytes();
+  ASSERT_THAT(client_stream.Send(&request), IsOk());
+  int64_t peak_rss_increase = PeakRssBytes() - peak_rss_before;
+
+  EXPECT_THAT(transport.max_unacked_chunks(), Le(2));
+  EXPECT_THAT(transport.chunk_bytes_written(), Gt(0));
+  EXPECT_THAT(peak_rss_increase, Le(kMessageSize / 8));
+}
+
+// Sends a message of the given size over a link with the given round trip time,
+// and returns how long that took.
+absl::Duration TimeSendOverLink(
+    FakeAckingTransport& transport,
+    const ClientChunkedBidiStream::GrpcChunkedBidiStreamOptions& options,
+    int64_t message_size) {
+  ClientChunkedBidiStream client_stream(&transport, &transport, options);
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(message_size));
+  absl::Time start = absl::Now();
+  EXPECT_THAT(client_stream.Send(&request), IsOk());
+  return absl::Now() - start;
+}
+
+TEST(GrpcChunkedBidiStreamAdaptiveFlowControlTest,
+     AdaptsToLinkWithHighLatency) {
+  constexpr int64_t kMessageSize = 2 * 1024 * 1024;
+  constexpr absl::Duration kRtt = absl::Milliseconds(5);
+  ClientChunkedBidiStream::GrpcChunkedBidiStreamOptions options{
+      /*chunk_size_for_upload=*/8192, /*max_pending_chunks=*/2,
+      CompressionLevel::UNCOMPRESSED};
+
+  FakeAckingTransport fixed_transport(/*record_written_messages=*/false, kRtt);
+  absl::Duration fixed_duration =
+      TimeSendOverLink(fixed_transport, options, kMessageSize);
+  EXPECT_THAT(fixed_transport.max_unacked_chunks(), Le(2));
+  EXPECT_THAT(fixed_transport.max_chunk_size(), Le(8192));
+
+  options.enable_adaptive_flow_control = true;
+  options.adaptive_max_chunk_size_for_upload = 64 * 1024;
+  options.adaptive_max_pending_chunks = 16;
+  FakeAckingTransport adaptive_transport(/*record_written_messages=*/false,
+                                         kRtt);
+  ClientChunkedBidiStream adaptive_stream(&adaptive_transport,
+                                          &adaptive_transport, options);
+  ClientStreamMessage request;
+  request.mutable_report_request()->mutable_report()->set_update_checkpoint(
+      SimpleSelfVerifyingString(kMessageSize));
+  absl::Time start = absl::Now();
+  ASSERT_THAT(adaptive_stream.Send(&request), IsOk());
+  absl::Duration adaptive_duration = absl::Now() - start;
+
+  // Growing the window and the chunk size means far fewer round trips are
+  // needed, but never beyond the configured limits.
+  EXPECT_THAT(adaptive_duration, Lt(fixed_duration / 2));
+  EXPECT_THAT(adaptive_transport.max_unacked_chunks(), Le(16));
+  EXPECT_THAT(adaptive_transport.max_chunk_size(), Gt(8192));
+  EXPECT_THAT(adaptive_transport.max_chunk_size(), Le(64 * 1024));
+  EXPECT_THAT(adaptive_stream.ChunkingLayerFlowControlIncreases(), Gt(0));
+  EXPECT_EQ(adaptive_stream.ChunkingLayerFlowControlDecreases(), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    CompressionLevels, GrpcChunkedBidiStreamFakeTransportTest,
+    testing::Values(CompressionLevel::UNCOMPRESSED,
+                    CompressionLevel::ZLIB_BEST_SPEED),
+    [](const testing::TestParamInfo<CompressionLevel>& info) {
+      return CompressionLevel_Name(info.param);
+    });
+
 }  // namespace
 }  // namespace test
 }  // namespace client
@@ -17,12 +17,19 @@
 #ifndef FCP_TENSORFLOW_EXTERNAL_DATASET_H_
 #define FCP_TENSORFLOW_EXTERNAL_DATASET_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "fcp/base/batch.h"
 #include "fcp/base/bounds.h"
 #include "fcp/tensorflow/host_object.h"
 
@@ -44,6 +51,98 @@ class ExternalDatasetIterator {
    * Implementations must be thread-safe.
    */
   virtual absl::StatusOr<std::string> GetNext() = 0;
+
+  /**
+   * Returns up to max_count (which must be positive) elements at once. Stops
+   * once the elements returned so far add up to at least max_bytes, but always
+   * returns at least one element. If the end of the stream is reached after
+   * some elements were read, those are returned, and the next call returns
+   * OUT_OF_RANGE. Other errors are returned as by GetNext, dropping any
+   * elements read by the same call.
+   *
+   * The default implementation calls GetNext repeatedly. Implementations which
+   * can produce elements more cheaply in bulk (e.g. without taking a lock for
+   * each of them) should override it.
+   *
+   * Implementations must be thread-safe.
+   */
+  virtual absl::StatusOr<std::vector<std::string>> GetNextBatch(
+      int max_count, int64_t max_bytes) {
+    return ReadBatch([this]() { return GetNext(); }, max_count, max_bytes);
+  }
+
+  /**
+   * Like GetNext, but rather than returning the element, writes it to a buffer
+   * of the element's size obtained from allocate, so that the op can have it
+   * written directly into the output tensor. allocate must be called at most
+   * once, and only if OK is returned.
+   *
+   * The default implementation copies the element returned by GetNext.
+   * Implementations which obtain the element bytes from somewhere else should
+   * override it to write them to that buffer directly, which avoids copying
+   * each element.
+   *
+   * Implementations must be thread-safe.
+   */
+  virtual absl::Status GetNextInto(
+      const std::function<char*(size_t size)>& allocate) {
+    absl::StatusOr<std::string> element = GetNext();
+    if (!element.ok()) {
+      return element.status();
+    }
+    char* buffer = allocate(element->size());
+    if (!element->empty()) {
+      std::memcpy(buffer, element->data(), element->size());
+    }
+    return absl::OkStatus();
+  }
+
+  /**
+   * Like GetNextBatch, but rather than returning the elements, writes each of
+   * them to a buffer of its size obtained from allocate, in order, as
+   * GetNextInto does. allocate is called once per element, and the buffers it
+   * returns must remain valid until the call returns. If an error other than
+   * OUT_OF_RANGE is returned, the caller must drop any elements written by the
+   * same call.
+   *
+   * The default implementation copies the elements returned by GetNextBatch.
+   *
+   * Implementations must be thread-safe.
+   */
+  virtual absl::Status GetNextBatchInto(
+      int max_count, int64_t max_bytes,
+      const std::function<char*(size_t size)>& allocate) {
+    absl::StatusOr<std::vector<std::string>> batch =
+        GetNextBatch(max_count, max_bytes);
+    if (!batch.ok()) {
+      return batch.status();
+    }
+    WriteBatchInto(*batch, allocate);
+    return absl::OkStatus();
+  }
+
+  /**
+   * Skips the next count elements, so that an iterator restored from a
+   * checkpoint continues where the saved iterator left off. Returns OK if the
+   * end of the stream is reached before count elements were skipped (in which
+   * case GetNext then returns OUT_OF_RANGE). Other errors are returned as by
+   * GetNext.
+   *
+   * The default implementation calls GetNext count times. Implementations
+   * which can seek to a given position more cheaply should override it.
+   *
+   * Implementations must be thread-safe.
+   */
+  virtual absl::Status Skip(int64_t count) {
+    for (int64_t i = 0; i < count; ++i) {
+      absl::StatusOr<std::string> element = GetNext();
+      if (!element.ok()) {
+        if (element.status().code() == absl::StatusCode::kOutOfRange) break;
+        return element.status();
+      }
+    }
+    return absl::OkStatus();
+  }
 };
 
 namespace external_dataset_internal {
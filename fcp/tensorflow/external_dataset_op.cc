@@ -14,8 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/strings/str_format.h"
 #include "fcp/base/random_token.h"
@@ -39,12 +44,31 @@ namespace fcp {
  *   token: String scalar. It should encode a token obtained from
  *          ExternalDatasetProviderRegistry::Register.
  *
+ * Attributes:
+ *   batch_size: If positive, each element of the dataset is a 1-D string
+ *               tensor of up to this many examples, obtained from the stub with
+ *               a single ExternalDatasetIterator::GetNextBatchInto call,
+ *               rather than a single scalar string. This greatly reduces the
+ *               per-example overhead for datasets of many small examples.
+ *   max_batch_bytes: If positive (and batch_size is), batches are cut short
+ *                    once their examples add up to at least this many bytes.
+ *
+ * Iterators can be saved and restored (e.g. as part of a checkpoint), so that
+ * an interrupted computation can resume where it left off. The saved state is
+ * just the number of examples returned so far, and restoring it skips as many
+ * examples of the stub's new iterator (see ExternalDatasetIterator::Skip).
+ * Datasets can be serialized to a graph as well (see AsGraphDefInternal).
+ *
  * See TensorFlow's guide to making custom dataset ops:
  * https://www.tensorflow.org/guide/extend/formats
  */
 class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
  public:
-  using tensorflow::data::DatasetOpKernel::DatasetOpKernel;
+  explicit ExternalDatasetOp(tensorflow::OpKernelConstruction* ctx)
+      : DatasetOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("batch_size", &batch_size_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("max_batch_bytes", &max_batch_bytes_));
+  }
 
   void MakeDataset(tensorflow::OpKernelContext* ctx,
                    tensorflow::data::DatasetBase** output) override {
@@ -82,16 +106,27 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
       return;
     }
 
-    *output = new Dataset(ctx, std::move(maybe_dataset).value());
+    *output = new Dataset(ctx, std::move(token_str), std::move(selector_str),
+                          std::move(maybe_dataset).value(), batch_size_,
+                          max_batch_bytes_);
   }
 
  private:
   class Dataset : public tensorflow::data::DatasetBase {
    public:
-    Dataset(tensorflow::OpKernelContext* ctx,
-            std::unique_ptr<ExternalDataset> stub)
+    Dataset(tensorflow::OpKernelContext* ctx, tensorflow::tstring token,
+            tensorflow::tstring selector,
+            std::unique_ptr<ExternalDataset> stub, int64_t batch_size,
+            int64_t max_batch_bytes)
         : DatasetBase(tensorflow::data::DatasetContext(ctx)),
-          stub_(std::move(stub)) {}
+          token_(std::move(token)),
+          selector_(std::move(selector)),
+          stub_(std::move(stub)),
+          batch_size_(batch_size),
+          max_batch_bytes_(max_batch_bytes),
+          output_shapes_({batch_size > 0
+                              ? tensorflow::PartialTensorShape({-1})
+                              : tensorflow::PartialTensorShape()}) {}
 
     std::unique_ptr<tensorflow::data::IteratorBase> MakeIteratorInternal(
         const std::string& prefix) const override {
@@ -102,7 +137,8 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
           new Iterator(params, std::move(iter)));
     }
 
-    // Each iterator element is just a scalar std::string.
+    // Each iterator element is just a scalar std::string (or a vector of them,
+    // in batched mode).
 
     const tensorflow::DataTypeVector& output_dtypes() const override {
       static auto* const dtypes =
@@ -112,9 +148,7 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
 
     const std::vector<tensorflow::PartialTensorShape>& output_shapes()
         const override {
-      static std::vector<tensorflow::PartialTensorShape>* shapes =
-          new std::vector<tensorflow::PartialTensorShape>({{}});
-      return *shapes;
+      return output_shapes_;
     }
 
     std::string DebugString() const override {
@@ -137,11 +171,24 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
 #endif
 
    protected:
+    // The dataset is serialized as an ExternalDataset op with the same token,
+    // selector and attributes, so the serialized graph only remains valid for
+    // as long as the provider stays registered under that token.
     tensorflow::Status AsGraphDefInternal(
         tensorflow::data::SerializationContext* ctx, DatasetGraphDefBuilder* b,
         tensorflow::Node** output) const override {
-      return ::tensorflow::errors::Unimplemented(
-          DebugString(), " does not support serialization.");
+      tensorflow::Node* token = nullptr;
+      TF_RETURN_IF_ERROR(b->AddScalar(token_, &token));
+      tensorflow::Node* selector = nullptr;
+      TF_RETURN_IF_ERROR(b->AddScalar(selector_, &selector));
+      tensorflow::AttrValue batch_size;
+      b->BuildAttrValue(batch_size_, &batch_size);
+      tensorflow::AttrValue max_batch_bytes;
+      b->BuildAttrValue(max_batch_bytes_, &max_batch_bytes);
+      return b->AddDataset(this, {token, selector},
+                           {{"batch_size", batch_size},
+                            {"max_batch_bytes", max_batch_bytes}},
+                           output);
     }
 
    private:
@@ -155,29 +202,37 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
           tensorflow::data::IteratorContext* ctx,
           std::vector<tensorflow::Tensor>* out_tensors,
           bool* end_of_sequence) override {
-        StatusOr<std::string> maybe_element;
+        if (dataset()->batch_size_ > 0) {
+          return GetNextBatch(ctx, out_tensors, end_of_sequence);
+        }
+        // The {} at the end specifies a scalar tensor.
+        tensorflow::Tensor element_tensor(ctx->allocator({}),
+                                          tensorflow::DT_STRING, {});
+        tensorflow::tstring& element =
+            element_tensor.scalar<tensorflow::tstring>()();
+        // The stub writes the element straight into the tensor's string.
+        Status status;
         {
           absl::MutexLock _(&mu_);
-          maybe_element = stub_->GetNext();
+          status = stub_->GetNextInto([&element](size_t size) {
+            element.resize_uninitialized(size);
+            return element.mdata();
+          });
+          if (status.ok()) {
+            ++num_examples_;
+          }
         }
 
-        if (maybe_element.ok()) {
-          std::string element = std::move(maybe_element).value();
-
-          // The {} at the end specifies a scalar tensor.
-          tensorflow::Tensor element_tensor(ctx->allocator({}),
-                                            tensorflow::DT_STRING, {});
-          element_tensor.scalar<tensorflow::tstring>()() = element;
-
+        if (status.ok()) {
           *end_of_sequence = false;
           out_tensors->push_back(std::move(element_tensor));
           return tensorflow::Status::OK();
         } else {
           *end_of_sequence = true;
-          if (maybe_element.status().code() == StatusCode::kOutOfRange) {
+          if (status.code() == StatusCode::kOutOfRange) {
             return tensorflow::Status::OK();
           } else {
-            return ConvertToTensorFlowStatus(maybe_element.status());
+            return ConvertToTensorFlowStatus(status);
           }
         }
       }
@@ -190,31 +245,113 @@ class ExternalDatasetOp : public tensorflow::data::DatasetOpKernel {
           tensorflow::data::SerializationContext* ctx,
 #endif
           tensorflow::data::IteratorStateWriter* writer) override {
-        return ::tensorflow::errors::Unimplemented(
-            "Save / Restore of an ExternalDataset iterator is not supported");
+        absl::MutexLock _(&mu_);
+        return writer->WriteScalar(full_name(kNumExamples), num_examples_);
       }
       tensorflow::Status RestoreInternal(
           tensorflow::data::IteratorContext* ctx,
           tensorflow::data::IteratorStateReader* reader) override {
-        return ::tensorflow::errors::Unimplemented(
-            "Save / Restore of an ExternalDataset iterator is not supported");
+        int64_t num_examples;
+        TF_RETURN_IF_ERROR(
+            reader->ReadScalar(full_name(kNumExamples), &num_examples));
+        absl::MutexLock _(&mu_);
+        if (num_examples < num_examples_) {
+          return ::tensorflow::errors::FailedPrecondition(
+              "An ExternalDataset iterator can't be restored to an earlier "
+              "position");
+        }
+        // The stub iterates over the same examples again, so restoring the
+        // position just means skipping the examples consumed before it was
+        // saved.
+        Status status = stub_->Skip(num_examples - num_examples_);
+        if (!status.ok()) {
+          return ConvertToTensorFlowStatus(status);
+        }
+        num_examples_ = num_examples;
+        return tensorflow::Status::OK();
       }
 
      private:
+      // GetNextInternal, for datasets in batched mode.
+      tensorflow::Status GetNextBatch(
+          tensorflow::data::IteratorContext* ctx,
+          std::vector<tensorflow::Tensor>* out_tensors,
+          bool* end_of_sequence) {
+        // The stub writes each example straight into a tstring. A deque keeps
+        // the tstrings (and so their buffers) in place as more are added, and
+        // they are moved into the tensor once the batch size is known.
+        std::deque<tensorflow::tstring> batch;
+        Status status;
+        {
+          absl::MutexLock _(&mu_);
+          status = stub_->GetNextBatchInto(
+              static_cast<int>(std::min<int64_t>(
+                  dataset()->batch_size_, std::numeric_limits<int>::max())),
+              dataset()->max_batch_bytes_ > 0
+                  ? dataset()->max_batch_bytes_
+                  : std::numeric_limits<int64_t>::max(),
+              [&batch](size_t size) {
+                tensorflow::tstring& element = batch.emplace_back();
+                element.resize_uninitialized(size);
+                return element.mdata();
+              });
+          if (status.ok()) {
+            num_examples_ += batch.size();
+          }
+        }
+
+        if (!status.ok()) {
+          *end_of_sequence = true;
+          if (status.code() == StatusCode::kOutOfRange) {
+            return tensorflow::Status::OK();
+          } else {
+            return ConvertToTensorFlowStatus(status);
+          }
+        }
+
+        tensorflow::Tensor batch_tensor(
+            ctx->allocator({}), tensorflow::DT_STRING,
+            {static_cast<int64_t>(batch.size())});
+        auto elements = batch_tensor.vec<tensorflow::tstring>();
+        for (size_t i = 0; i < batch.size(); ++i) {
+          elements(i) = std::move(batch[i]);
+        }
+
+        *end_of_sequence = false;
+        out_tensors->push_back(std::move(batch_tensor));
+        return tensorflow::Status::OK();
+      }
+
+      static constexpr char kNumExamples[] = "num_examples";
+
       std::unique_ptr<ExternalDatasetIterator> stub_;
       absl::Mutex mu_;
+      // The number of examples returned so far, which is the iterator's
+      // position when it is saved.
+      int64_t num_examples_ ABSL_GUARDED_BY(mu_) = 0;
     };
 
     // Private members of Dataset
 
+    // The op's inputs, kept for serializing the dataset.
+    const tensorflow::tstring token_;
+    const tensorflow::tstring selector_;
     std::unique_ptr<ExternalDataset> stub_;
+    const int64_t batch_size_;
+    const int64_t max_batch_bytes_;
+    const std::vector<tensorflow::PartialTensorShape> output_shapes_;
   };
+
+  int64_t batch_size_;
+  int64_t max_batch_bytes_;
 };
 
 REGISTER_OP("ExternalDataset")
     .Input("token: string")
     .Input("selector: string")
     .Output("handle: variant")
+    .Attr("batch_size: int >= 0 = 0")
+    .Attr("max_batch_bytes: int >= 0 = 0")
     .SetIsStateful()
     .SetShapeFn(tensorflow::shape_inference::ScalarShape);
 
@@ -35,6 +35,7 @@
 
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/text_format.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "fcp/tensorflow/external_dataset.h"
@@ -44,6 +45,7 @@
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/protobuf/error_codes.pb.h"
 #include "tensorflow/core/public/session.h"
 
@@ -82,9 +84,8 @@ tensorflow::GraphDef LoadExampleGraph() {
   return graph;
 }
 
-std::unique_ptr<tensorflow::Session> PrepareExampleGraphSession() {
-  tensorflow::GraphDef graph = LoadExampleGraph();
-
+std::unique_ptr<tensorflow::Session> PrepareSession(
+    const tensorflow::GraphDef& graph) {
   std::unique_ptr<tensorflow::Session> session;
   {
     tensorflow::SessionOptions options;
@@ -100,6 +101,186 @@ std::unique_ptr<tensorflow::Session> PrepareExampleGraphSession() {
   return session;
 }
 
+std::unique_ptr<tensorflow::Session> PrepareExampleGraphSession() {
+  return PrepareSession(LoadExampleGraph());
+}
+
+// A graph which iterates over an ExternalDataset directly, with ops to save
+// and restore the iterator, and to serialize the dataset and iterate over the
+// dataset deserialized from that.
+constexpr char kIteratorGraph[] = R"pb(
+  node {
+    name: "token"
+    op: "Placeholder"
+    attr {
+      key: "dtype"
+      value { type: DT_STRING }
+    }
+  }
+  node {
+    name: "selector"
+    op: "Placeholder"
+    attr {
+      key: "dtype"
+      value { type: DT_STRING }
+    }
+  }
+  node {
+    name: "dataset"
+    op: "ExternalDataset"
+    input: "token"
+    input: "selector"
+    attr {
+      key: "batch_size"
+      value { i: 0 }
+    }
+    attr {
+      key: "max_batch_bytes"
+      value { i: 0 }
+    }
+  }
+  node {
+    name: "iterator"
+    op: "IteratorV2"
+    attr {
+      key: "shared_name"
+      value { s: "iterator" }
+    }
+    attr {
+      key: "container"
+      value { s: "" }
+    }
+    attr {
+      key: "output_types"
+      value { list { type: DT_STRING } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape {} } }
+    }
+  }
+  node {
+    name: "make_iterator"
+    op: "MakeIterator"
+    input: "dataset"
+    input: "iterator"
+  }
+  node {
+    name: "get_next"
+    op: "IteratorGetNext"
+    input: "iterator"
+    attr {
+      key: "output_types"
+      value { list { type: DT_STRING } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape {} } }
+    }
+  }
+  node {
+    name: "save_iterator"
+    op: "SerializeIterator"
+    input: "iterator"
+  }
+  node {
+    name: "saved_iterator"
+    op: "Placeholder"
+    attr {
+      key: "dtype"
+      value { type: DT_VARIANT }
+    }
+  }
+  node {
+    name: "restore_iterator"
+    op: "DeserializeIterator"
+    input: "iterator"
+    input: "saved_iterator"
+  }
+  node {
+    name: "dataset_graph"
+    op: "DatasetToGraphV2"
+    input: "dataset"
+  }
+  node {
+    name: "restored_dataset"
+    op: "DatasetFromGraph"
+    input: "dataset_graph"
+  }
+  node {
+    name: "restored_dataset_iterator"
+    op: "IteratorV2"
+    attr {
+      key: "shared_name"
+      value { s: "restored_dataset_iterator" }
+    }
+    attr {
+      key: "container"
+      value { s: "" }
+    }
+    attr {
+      key: "output_types"
+      value { list { type: DT_STRING } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape {} } }
+    }
+  }
+  node {
+    name: "make_restored_dataset_iterator"
+    op: "MakeIterator"
+    input: "restored_dataset"
+    input: "restored_dataset_iterator"
+  }
+  node {
+    name: "restored_dataset_get_next"
+    op: "IteratorGetNext"
+    input: "restored_dataset_iterator"
+    attr {
+      key: "output_types"
+      value { list { type: DT_STRING } }
+    }
+    attr {
+      key: "output_shapes"
+      value { list { shape {} } }
+    }
+  }
+)pb";
+
+std::unique_ptr<tensorflow::Session> PrepareIteratorGraphSession() {
+  tensorflow::GraphDef graph;
+  FCP_CHECK(google::protobuf::TextFormat::ParseFromString(kIteratorGraph,
+                                                          &graph));
+  return PrepareSession(graph);
+}
+
+// Runs the given target of the iterator graph, feeding it the dataset inputs.
+tensorflow::Status RunIteratorGraph(tensorflow::Session* session,
+                                    RandomToken dataset_token,
+                                    const std::string& target) {
+  std::string selector_str;
+  FCP_CHECK(TestSelector().SerializeToString(&selector_str));
+  return session->Run(
+      {{kTokenPlaceholderName, tensorflow::test::AsScalar<tensorflow::tstring>(
+                                   dataset_token.ToString())},
+       {kSelectorPlaceholderName,
+        tensorflow::test::AsScalar<tensorflow::tstring>(selector_str)}},
+      {}, {target}, nullptr);
+}
+
+// Returns the value of the example returned by the given IteratorGetNext op.
+int64_t GetNextExample(tensorflow::Session* session,
+                       const std::string& get_next) {
+  std::vector<tensorflow::Tensor> outputs;
+  TF_CHECK_OK(session->Run({}, {get_next + ":0"}, {}, &outputs));
+  tensorflow::Example example;
+  FCP_CHECK(example.ParseFromString(
+      std::string(outputs[0].scalar<tensorflow::tstring>()())));
+  return tensorflow::GetFeatureValues<tensorflow::int64>(kFeatureName, example)
+      .Get(0);
+}
+
 tensorflow::Example MakeExample(int64_t value) {
   tensorflow::Example example;
   tensorflow::AppendFeatureValues({value}, kFeatureName, &example);
@@ -274,6 +455,50 @@ TEST(ExternalDatasetOpTest, RunExampleGraph_SelectorFilter) {
   tensorflow::test::ExpectTensorEqual<tensorflow::int64>(output, expected);
 }
 
+TEST(ExternalDatasetOpTest, SaveAndRestoreIterator) {
+  auto stub = std::make_shared<TestDatasetProvider>(
+      std::vector<int64_t>{123, 456, 789});
+  auto stub_reg = ExternalDatasetProviderRegistry::Register(stub);
+  auto session = PrepareIteratorGraphSession();
+  TF_ASSERT_OK(
+      RunIteratorGraph(session.get(), stub_reg.token(), "make_iterator"));
+
+  EXPECT_THAT(GetNextExample(session.get(), "get_next"), Eq(123));
+  std::vector<tensorflow::Tensor> saved_iterator;
+  TF_ASSERT_OK(
+      session->Run({}, {"save_iterator:0"}, {}, &saved_iterator));
+  EXPECT_THAT(GetNextExample(session.get(), "get_next"), Eq(456));
+  EXPECT_THAT(GetNextExample(session.get(), "get_next"), Eq(789));
+
+  // Restoring the iterator continues right after the first example again.
+  TF_ASSERT_OK(session->Run({{"saved_iterator", saved_iterator[0]}}, {},
+                            {"restore_iterator"}, nullptr));
+  EXPECT_THAT(GetNextExample(session.get(), "get_next"), Eq(456));
+  EXPECT_THAT(GetNextExample(session.get(), "get_next"), Eq(789));
+  std::vector<tensorflow::Tensor> outputs;
+  EXPECT_THAT(session->Run({}, {"get_next:0"}, {}, &outputs).code(),
+              Eq(tensorflow::error::OUT_OF_RANGE));
+}
+
+TEST(ExternalDatasetOpTest, SerializeDataset) {
+  auto stub =
+      std::make_shared<TestDatasetProvider>(std::vector<int64_t>{123, 456});
+  auto stub_reg = ExternalDatasetProviderRegistry::Register(stub);
+  auto session = PrepareIteratorGraphSession();
+
+  // The serialized dataset reads from the same provider.
+  TF_ASSERT_OK(RunIteratorGraph(session.get(), stub_reg.token(),
+                                "make_restored_dataset_iterator"));
+  EXPECT_THAT(GetNextExample(session.get(), "restored_dataset_get_next"),
+              Eq(123));
+  EXPECT_THAT(GetNextExample(session.get(), "restored_dataset_get_next"),
+              Eq(456));
+  std::vector<tensorflow::Tensor> outputs;
+  EXPECT_THAT(
+      session->Run({}, {"restored_dataset_get_next:0"}, {}, &outputs).code(),
+      Eq(tensorflow::error::OUT_OF_RANGE));
+}
+
 TEST(ExternalDatasetOpTest, TokenNotFound) {
   TestSelector selector;
   auto session = PrepareExampleGraphSession();